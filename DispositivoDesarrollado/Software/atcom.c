@@ -7,30 +7,33 @@
 
 #include "atcom.h"
 #include "FreeRTOS.h"
+#include "task.h"
 #include "usart.h"
 #include "pids.h"
+#include "shareData.h"
 #include "printf.h"
+#include <string.h>
 
-// Tamao de las cabeceras de los comandos
+// Tamaño de las cabeceras de los comandos
 #define STN_COMMAND			4
 #define NB_COMMAND			3
 #define GNSS_COMMAND		5
 
-// Posicin de la carga de la tasa de transferencia
-#define BAUD_SLEEP_PAYLOAD	10
-
-// Timeout del envo de la UART
-#define TIMEOUT_UART		500
-
 // Umbrales tabla ASCII
 #define ASCII_NUMBER_THRESHOLD	48
 #define ASCII_LETTER_THRESHOLD	65
 
 // Instrucciones disponibles
-#define N_INSTRUCCIONES			48
+#define N_INSTRUCCIONES			56
 #define MAX_CHAR_INST			15
 
-// Comandos del mdulo NB-IoT
+// Hash perfecto de las instrucciones: FNV-1a con multiplicador CMD_HASH_SEED, plegado a
+// CMD_HASH_SIZE entradas. Si se modifica inst[] hay que regenerar cmdHash[] y la semilla
+#define CMD_HASH_BASIS			0x811C9DC5
+#define CMD_HASH_SEED			183671
+#define CMD_HASH_SIZE			128
+
+// Comandos del módulo NB-IoT
 #define CONFIG_CONNECTION	"AT+CEREG=2;+CSCON=1;+CFUN=1;+CGDCONT=0,\"IP\",\"\";+COPS=1,2,\"21401\";\r"
 #define CONFIG_NUM_B		66
 #define CHECK_CONNECTION	"AT+CGDCONT?\r"
@@ -38,18 +41,25 @@
 #define SOCKET_CREATION		"AT+NSOCR=DGRAM,17,16666,1\r"
 #define CREATION_NUM_B		26
 
-// Comandos del mdulo GNSS
-#define RESTART_COMMAND		"$PMTK103*30\r\n"
-#define START_COMMAND		"$PMTK324,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0*37\r\n"
-#define GALILEO_COMMAND		"$PMTK353,0,0,1,1,0*2B\r\n"
-#define GPS_COMMAND			"$PMTK353,1,0,1,1,0*2A\r\n"
-#define GLONASS_COMMAND		"$PMTK353,0,1,1,1,0*2A\r\n"
-#define MULTIPLE_COMMAND	"$PMTK353,1,1,0,0,0*2B\r\n"
-#define STATIC_COMMAND		"$PMTK386,1.4*38\r\n"
-#define RESTART_CMD_NUM_B	13
-#define START_CMD_NUM_B		55
-#define MULTIPLE_CMD_NUM_B	23
-#define STATIC_CMD_NUM_B	17
+// Cuerpos de los comandos del módulo GNSS (el checksum y el final de línea se generan al enviar)
+#define RESTART_COMMAND		"PMTK103"
+#define START_COMMAND		"PMTK324,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0"
+#define GALILEO_COMMAND		"PMTK353,0,0,1,1,0"
+#define GPS_COMMAND			"PMTK353,1,0,1,1,0"
+#define GLONASS_COMMAND		"PMTK353,0,1,1,1,0"
+#define MULTIPLE_COMMAND	"PMTK353,1,1,0,0,0"
+#define STATIC_COMMAND		"PMTK386,1.4"
+#define FIX_RATE_COMMAND	"PMTK220,"
+#define BAUD_RATE_COMMAND	"PMTK251,"
+
+// Límites del periodo entre posiciones del GNSS (ms)
+#define MIN_FIX_PERIOD		100
+#define MAX_FIX_PERIOD		10000
+
+// Peticiones OBD de un único PID ("SSPP\r") generadas en tiempo de compilación
+#define OBD_REQ_SIZE		6
+#define HEX_CHAR(n)			((n) < 0xA ? ASCII_NUMBER_THRESHOLD + (n) : (ASCII_LETTER_THRESHOLD-10) + (n))
+#define OBD_REQUEST(service, pid)	{'0', (service), HEX_CHAR((pid) >> 4), HEX_CHAR((pid) & 0x0F), '\r', '\0'}
 
 // Instrucciones disponibles a ejecutar
 static const uint8_t inst[N_INSTRUCCIONES][MAX_CHAR_INST] = {
@@ -60,8 +70,13 @@ static const uint8_t inst[N_INSTRUCCIONES][MAX_CHAR_INST] = {
 		{"header\r\0"},
 		{"sn\r\0"},
 		{"brate\r\0"},
+		{"brtimeout\r\0"},
 		{"sleep\r\0"},
 		{"getProt\r\0"},
+		{"stm\r\0"},
+		{"stma\r\0"},
+		{"filter\r\0"},
+		{"nofilter\r\0"},
 		{"default\r\0"},
 
 		// OBD data
@@ -85,7 +100,11 @@ static const uint8_t inst[N_INSTRUCCIONES][MAX_CHAR_INST] = {
 		{"pmSensor\r\0"},
 		{"noxSensorC\r\0"},
 		{"monitor\r\0"},
+		{"ecu\r\0"},
+		{"esn\r\0"},
+		{"erotan\r\0"},
 		{"vin\r\0"},
+		{"batch\r\0"},
 		{"obd\r\0"},
 
 		// NB instructions
@@ -101,6 +120,8 @@ static const uint8_t inst[N_INSTRUCCIONES][MAX_CHAR_INST] = {
 		{"multiple\r\0"},
 		{"static\r\0"},
 		{"start\r\0"},
+		{"rate\r\0"},
+		{"baud\r\0"},
 
 		// Test commands
 		{"test speed\r\0"},
@@ -113,7 +134,74 @@ static const uint8_t inst[N_INSTRUCCIONES][MAX_CHAR_INST] = {
 		{"error\r\0"}
 };
 
-// Comunicaciones con cada uno de los mdulos
+// Instrucción asociada a cada valor del hash (NO_CMD si no hay ninguna)
+static const uint8_t cmdHash[CMD_HASH_SIZE] = {
+		NO_CMD, STN_MONITOR, NO_CMD, NO_CMD,
+		NO_CMD, NO_CMD, STN_PIDS_1_4, NO_CMD,
+		NO_CMD, NO_CMD, NO_CMD, STN_GET_ENGINE_NUMBER,
+		NO_CMD, NO_CMD, NO_CMD, NO_CMD,
+		NO_CMD, NO_CMD, STN_SLEEP, NO_CMD,
+		NO_CMD, NO_CMD, NO_CMD, GNSS_MULTIPLE,
+		NO_CMD, NO_CMD, STN_SERIAL_NUMBER, STN_GET_NOx_SENSOR_CORRECTED,
+		STN_GET_MONITOR, NO_CMD, STN_PIDS_1_5, STN_MONITOR_ALL,
+		NO_CMD, GNSS_RESTART, NO_CMD, STN_GET_FUEL,
+		NO_CMD, STN_PIDS_1_1, NO_CMD, NO_CMD,
+		STN_GET_PROTOCOL, NO_CMD, NO_CMD, STN_BAUD_TIMEOUT,
+		STN_USER_OBD, NO_CMD, STN_GET_PM_SENSOR, STN_GET_AIR_TEMPERATURE,
+		NO_CMD, STN_CLEAR_FILTERS, STN_PIDS_1_6, NO_CMD,
+		NO_CMD, STN_PIDS_1_3, NO_CMD, NO_CMD,
+		NO_CMD, GNSS_GPS, GNSS_GALILEO, NO_CMD,
+		GNSS_FIX_RATE, STN_GET_DPF_2, NO_CMD, NO_CMD,
+		NO_CMD, STN_GET_NOx_SENSOR, GNSS_START, STN_PIDS_1_2,
+		NO_CMD, NO_CMD, NB_CONNECT, STN_GET_SPEED,
+		NO_CMD, NO_CMD, STN_LOW_POWER, NO_CMD,
+		NO_CMD, NO_CMD, NO_CMD, NO_CMD,
+		STN_GET_DPF_1, NO_CMD, NO_CMD, STN_GET_VIN,
+		STN_ECHO, GNSS_BAUD_RATE, STN_PIDS_9, NO_CMD,
+		GNSS_GLONASS, STN_REPEAT, NB_SOCKET_CREATION, NO_CMD,
+		NO_CMD, NO_CMD, NO_CMD, STN_GET_BATCH,
+		NO_CMD, NO_CMD, NO_CMD, STN_BAUD_SPEED,
+		NO_CMD, NO_CMD, STN_GET_RPM, NO_CMD,
+		STN_GET_PM_NTE, NO_CMD, STN_GET_NOx_NTE, NO_CMD,
+		STN_DEFAULT_FILTERS, STN_GET_EROTAN, NO_CMD, NO_CMD,
+		NO_CMD, NB_CHECK_CONNECTION, NO_CMD, STN_PASS_FILTER,
+		STN_GET_ECU_NAME, GNSS_STATIC, STN_GET_TIMESTART, NO_CMD,
+		NO_CMD, NO_CMD, NO_CMD, NO_CMD,
+		NO_CMD, NO_CMD, STN_HEADER, NO_CMD
+};
+
+// Peticiones OBD constantes, desde STN_PIDS_1_1 hasta STN_GET_VIN
+static const uint8_t obdRequest[STN_GET_VIN - STN_PIDS_1_1 + 1][OBD_REQ_SIZE] = {
+		OBD_REQUEST('1', FIRST_PIDS),
+		OBD_REQUEST('1', SECOND_PIDS),
+		OBD_REQUEST('1', THIRD_PIDS),
+		OBD_REQUEST('1', FOURTH_PIDS),
+		OBD_REQUEST('1', FIFTH_PIDS),
+		OBD_REQUEST('1', SIXTH_PIDS),
+		OBD_REQUEST('9', FIRST_PIDS),
+		OBD_REQUEST('1', ENGINE_RPM),
+		OBD_REQUEST('1', VEHICLE_SPEED),
+		OBD_REQUEST('1', TIME_SINCE_START),
+		OBD_REQUEST('1', AMBIENT_AIR_TEMP),
+		OBD_REQUEST('1', FUEL_TYPE),
+		OBD_REQUEST('1', DPF_1),
+		OBD_REQUEST('1', DPF_2),
+		OBD_REQUEST('1', NOX_NTE),
+		OBD_REQUEST('1', PM_NTE),
+		OBD_REQUEST('1', NOX_SENSOR),
+		OBD_REQUEST('1', PM_SENSOR),
+		OBD_REQUEST('1', NOX_SENSOR_CORRECTED),
+		OBD_REQUEST('9', MONITOR),
+		OBD_REQUEST('9', ECU_NAME),
+		OBD_REQUEST('9', ENGINE_NUMBER),
+		OBD_REQUEST('9', EROTAN),
+		OBD_REQUEST('9', VIN_NUMBER)
+};
+
+// PIDs que se piden con "stn batch" si no se indican otros
+static const uint8_t batchPIDs[] = {VEHICLE_SPEED, ENGINE_RPM, AMBIENT_AIR_TEMP, FUEL_TYPE};
+
+// Comunicaciones con cada uno de los módulos
 static atCom *stnPort, *gnssPort, *nbPort;
 
 // UARTs
@@ -124,34 +212,37 @@ UART_HandleTypeDef huart3;
 static uint8_t sendCMD(comando cmd, atCom *comPort);
 static uint8_t decodeCommand(comando cmd, atCom *port);
 static uint8_t decodeOBD(command cmd);
-static void importPID(uint8_t *request, uint8_t PID);
+static uint8_t encodeBatch(uint8_t *dst, const uint8_t *pids, uint8_t num);
+static uint8_t decodeHex(uint8_t *data);
+static uint8_t buildNMEA(uint8_t *dst, uint8_t size, const char *body, const char *param);
+
+static uint8_t parseCommand(uint8_t *mssg, command first, command last, comando *cmd);
 
-static uint8_t str_cmp(uint8_t *str1, const uint8_t *str2);
+static void atTxInit(atCom *port, UART_HandleTypeDef *huart, uint16_t *flags, uint16_t txDone);
+static uint8_t* atTxSlot(atCom *port);
+static uint8_t atTxPush(atCom *port);
+static uint8_t atTxStart(atCom *port);
+static void atTxDone(atCom *port, UART_HandleTypeDef *huart);
 
 /*
- * @brief	Inicializacin de la comunicacin con el STN
- * @param	Nada
+ * @brief	Inicialización de la comunicación con el STN
+ * @param	flags: flags donde se avisa con STN_TX_DONE del fin de cada envío
  * @retval	1 -> Todo correcto
  * 			0 -> No se ha podido reservar memoria
  */
-uint8_t initSTNCom(void)
+uint8_t initSTNCom(uint16_t *flags)
 {
 	if ((stnPort = (atCom*) pvPortMalloc(sizeof(atCom))) == NULL)
 		return 0;
 
-	if ((stnPort->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t))) == NULL) {
-		vPortFree(stnPort);
-		return 0;
-	}
-
-	stnPort->huart = &huart1;
+	atTxInit(stnPort, &huart1, flags, STN_TX_DONE);
 	stnPort->lastCom = NO_CMD;
 
 	return 1;
 }
 
 /*
- * @brief	Inicializacin de la comunicacin con el GNSS
+ * @brief	Inicialización de la comunicación con el GNSS
  * @param	Nada
  * @retval	1 -> Todo correcto
  * 			0 -> No se ha podido reservar memoria
@@ -161,13 +252,13 @@ uint8_t initGNSSCom(void)
 	if ((gnssPort = (atCom*) pvPortMalloc(sizeof(atCom))) == NULL)
 		return 0;
 
-	gnssPort->huart = &huart2;
+	atTxInit(gnssPort, &huart2, NULL, 0);
 
 	return 1;
 }
 
 /*
- * @brief	Inicializacin de la comunicacin con el mdulo de NB-IoT
+ * @brief	Inicialización de la comunicación con el módulo de NB-IoT
  * @param	Nada
  * @retval	1 -> Todo correcto
  * 			0 -> No se ha podido reservar memoria
@@ -177,184 +268,248 @@ uint8_t initNBCom(void)
 	if ((nbPort = (atCom*) pvPortMalloc(sizeof(atCom))) == NULL)
 		return 0;
 
-	nbPort->huart = &huart3;
+	atTxInit(nbPort, &huart3, NULL, 0);
 
-	nbPort->lastReq = NULL;
 	return 1;
 }
 
 /*
- * @brief	Envo de comando al mdulo STN
+ * @brief	Envío de comando al módulo STN
  * @param	mssg: puntero al mensaje que hay que enviar
  * @retval	1 -> Se ha enviado
- * 			0 -> Error en el envo
+ * 			0 -> Error en el envío
  */
 uint8_t STN_sendCMD(uint8_t *mssg)
 {
 	comando cmd;
-	uint8_t i, j, match;
-	uint32_t max;
-
-	// Comprobamos cul es el mensaje a enviar
-	for (cmd.type = 0; cmd.type < NB_CONNECT; cmd.type++) {
-		match = str_cmp(&mssg[STN_COMMAND], inst[cmd.type]);
-		if (match)
-			break;
-	}
+	uint8_t i, args, *buf;
+	uint8_t pids[OBD_MAX_PIDS];
 
-	if (cmd.type >= NB_CONNECT)
+	// Comprobamos cuál es el mensaje a enviar y recibimos sus parámetros
+	args = parseCommand(&mssg[STN_COMMAND], STN_REPEAT, STN_USER_OBD, &cmd);
+	if (cmd.type == NO_CMD)
 		return 0;
+	if (cmd.type == STN_ECHO || cmd.type == STN_HEADER)
+		cmd.params = (cmd.params != 0);
 
-	// Recibimos los parmteros del mensaje
-	cmd.params = 0;
-	if ((cmd.type == STN_ECHO && mssg[9] == '1') || (cmd.type == STN_HEADER && mssg[11] == '1')) {
-		cmd.params = 1;
-	} else if (cmd.type == STN_BAUD_SPEED || cmd.type == STN_SLEEP) {
-		max = 1;
-		for (i = BAUD_SLEEP_PAYLOAD; mssg[i] != '\0' && mssg[i] != '\r' ; i++) {
-			max = max * 10;
-		}
-		max = max/10;
-		for (j = BAUD_SLEEP_PAYLOAD; j < i; j++) {
-			cmd.params = cmd.params + (mssg[j] - ASCII_NUMBER_THRESHOLD)*max;
-			max = max / 10;
-		}
-	}
-
-	// Distinguimos entre si es mensaje de configuracin u OBD
+	// Distinguimos entre si es mensaje de configuración u OBD
 	stnPort->lastCom = cmd.type;
 
-	// Mensaje para el vehculo
+	// Mensaje para el vehículo
 	if (cmd.type > STN_DEFAULT_FILTERS) {
-		vPortFree(stnPort->lastReq);
-		if (cmd.type == STN_USER_OBD) {
-			i = 8;
-			while (mssg[i] != '\r'){
-				i++;
+		if (cmd.type == STN_GET_BATCH) {
+			// PIDs indicados en hexadecimal ("stn batch 0D0C46") o el grupo por defecto
+			args = args ? args + STN_COMMAND : 0;
+			for (i = 0; args && i < OBD_MAX_PIDS && mssg[args] != '\r' && mssg[args+1] != '\r'; i++, args += 2) {
+				pids[i] = decodeHex(&mssg[args]);
+			}
+			return i ? STN_sendBatch(pids, i) : STN_sendBatch(batchPIDs, sizeof(batchPIDs));
+		} else if (cmd.type == STN_USER_OBD) {
+			if (!args)
+				return 0;
+			if (!(buf = atTxSlot(stnPort)))
+				return 0;
+			args += STN_COMMAND;
+			for (i = 0; mssg[args+i] != '\r'; i++) {
+				if (mssg[args+i] == '\0' || i >= AT_TX_SIZE - 1)
+					return 0;
+				buf[i] = mssg[args+i];
 			}
-			stnPort->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(i-8+2));
-			sprintf_((char*) stnPort->lastReq, "%s\r", (char*) &(mssg[8]));
-			stnPort->sendNum = i-8+1;
+			buf[i++] = '\r';
+			stnPort->lastReq = buf;
+			stnPort->sendNum = i;
 		} else if (!(stnPort->sendNum = decodeOBD(cmd.type))) {
 			return 0;
 		}
 
-		if(HAL_UART_Transmit(stnPort->huart, stnPort->lastReq, stnPort->sendNum, TIMEOUT_UART) == HAL_ERROR) {
-			return 0;
-		}
-
-		return 1;
+		return atTxPush(stnPort);
 
-	// Mensaje de configuracin
+	// Mensaje de configuración
 	} else {
 		return sendCMD(cmd, stnPort);
 	}
 }
 
 /*
- * @brief	Envo de comando al mdulo GNSS
- * @param	mssg: puntero al mensaje que hay que enviar
+ * @brief	Envío de una petición de varios PIDs del servicio 01 en una única trama
+ * 			("010D0C46\r"). La respuesta incluye cada PID seguido de sus datos
+ * @param	pids: PIDs a solicitar
+ * 			num: número de PIDs (como máximo OBD_MAX_PIDS)
  * @retval	1 -> Se ha enviado
- * 			0 -> Error en el envo
+ * 			0 -> Error en el envío
  */
-uint8_t GNSS_sendCMD(uint8_t *mssg)
+uint8_t STN_sendBatch(const uint8_t *pids, uint8_t num)
 {
-	comando cmd;
-	uint8_t match;
+	uint8_t *buf;
 
-	// Comprobamos cul es el mensaje a enviar
-	for (cmd.type = GNSS_RESTART; cmd.type < NO_CMD; cmd.type++) {
-		match = str_cmp(&mssg[GNSS_COMMAND], inst[cmd.type]);
-		if (match)
-			break;
-	}
-
-	if (cmd.type >= NO_CMD)
+	if (!(buf = atTxSlot(stnPort)))
 		return 0;
+	if (!(stnPort->sendNum = encodeBatch(buf, pids, num)))
+		return 0;
+	stnPort->lastReq = buf;
+	stnPort->lastCom = STN_GET_BATCH;
 
-	// Segn el tipo, realizamos la distincin de los comandos
-	cmd.params = 0;
-	if (cmd.type == GNSS_RESTART) {
-
-			if(HAL_UART_Transmit_IT(gnssPort->huart, (uint8_t *) RESTART_COMMAND, RESTART_CMD_NUM_B) == HAL_ERROR) {
-				return 0;
-			}
-
-			return 1;
+	return atTxPush(stnPort);
+}
 
-	} else if (cmd.type == GNSS_GALILEO) {
+/*
+ * @brief	Envío de una de las peticiones OBD constantes
+ * @param	cmd: comando a enviar (STN_PIDS_1_1..STN_GET_VIN)
+ * @retval	1 -> Se ha enviado
+ * 			0 -> Error en el envío
+ */
+uint8_t STN_sendOBD(command cmd)
+{
+	if (!(stnPort->sendNum = decodeOBD(cmd)))
+		return 0;
+	stnPort->lastCom = cmd;
 
-		if(HAL_UART_Transmit_IT(gnssPort->huart, (uint8_t *) GALILEO_COMMAND, MULTIPLE_CMD_NUM_B) == HAL_ERROR) {
-			return 0;
-		}
+	return atTxPush(stnPort);
+}
 
-		return 1;
+/*
+ * @brief	Cambia la tasa de la UART del STN sin detener la recepción por DMA: sólo se
+ * 			reprograma el divisor con la UART deshabilitada
+ * @param	baud: nueva tasa (bits/s)
+ * @retval	1 -> Cambiada
+ * 			0 -> Tasa no alcanzable con el reloj de la UART
+ */
+uint8_t STN_setBaud(uint32_t baud)
+{
+	uint32_t pclk = HAL_RCC_GetPCLK2Freq();
 
-	} else if (cmd.type == GNSS_GPS) {
+	// Sobremuestreo x16: el divisor debe ser al menos 16
+	if (baud == 0 || pclk / baud < 16)
+		return 0;
 
-		if(HAL_UART_Transmit_IT(gnssPort->huart, (uint8_t *) GPS_COMMAND, MULTIPLE_CMD_NUM_B) == HAL_ERROR) {
-			return 0;
-		}
+	__HAL_UART_DISABLE(stnPort->huart);
+	stnPort->huart->Instance->BRR = (pclk + baud/2) / baud;
+	stnPort->huart->Init.BaudRate = baud;
+	__HAL_UART_ENABLE(stnPort->huart);
 
-		return 1;
+	return 1;
+}
 
-	} else if (cmd.type == GNSS_GLONASS) {
+/*
+ * @brief	Tasa actual de la UART del STN
+ * @param	Nada
+ * @retval	Tasa (bits/s)
+ */
+uint32_t STN_getBaud(void)
+{
+	return stnPort->huart->Init.BaudRate;
+}
 
-		if(HAL_UART_Transmit_IT(gnssPort->huart, (uint8_t *) GLONASS_COMMAND, MULTIPLE_CMD_NUM_B) == HAL_ERROR) {
-			return 0;
-		}
+/*
+ * @brief	Descarta los envíos pendientes al STN, abortando el que esté en curso
+ * @param	Nada
+ * @retval	Nada
+ */
+void STN_flushTX(void)
+{
+	taskENTER_CRITICAL();
+	HAL_UART_AbortTransmit(stnPort->huart);
+	stnPort->txBusy = 0;
+	stnPort->txTail = stnPort->txHead;
+	taskEXIT_CRITICAL();
+}
 
-		return 1;
+/*
+ * @brief	Envío de comando al módulo GNSS
+ * @param	mssg: puntero al mensaje que hay que enviar
+ * @retval	1 -> Se ha enviado
+ * 			0 -> Error en el envío
+ */
+uint8_t GNSS_sendCMD(uint8_t *mssg)
+{
+	comando cmd;
+	uint8_t len, *buf;
+	const char *body;
+	char param[8];
 
-	} else if (cmd.type == GNSS_MULTIPLE) {
+	// Comprobamos cuál es el mensaje a enviar
+	parseCommand(&mssg[GNSS_COMMAND], GNSS_RESTART, GNSS_BAUD_RATE, &cmd);
+	if (cmd.type == NO_CMD)
+		return 0;
 
-		if(HAL_UART_Transmit_IT(gnssPort->huart, (uint8_t *) MULTIPLE_COMMAND, MULTIPLE_CMD_NUM_B) == HAL_ERROR) {
-			return 0;
-		}
+	// Hueco de la cola donde se genera la sentencia
+	if (!(buf = atTxSlot(gnssPort)))
+		return 0;
 
-		return 1;
+	// Según el tipo, elegimos el cuerpo de la sentencia y su parámetro
+	param[0] = '\0';
+	switch (cmd.type) {
+	case GNSS_RESTART:
+		body = RESTART_COMMAND;
+		break;
+	case GNSS_GALILEO:
+		body = GALILEO_COMMAND;
+		break;
+	case GNSS_GPS:
+		body = GPS_COMMAND;
+		break;
+	case GNSS_GLONASS:
+		body = GLONASS_COMMAND;
+		break;
+	case GNSS_MULTIPLE:
+		body = MULTIPLE_COMMAND;
+		break;
+	case GNSS_STATIC:
+		body = STATIC_COMMAND;
+		break;
+	case GNSS_START:
+		body = START_COMMAND;
+		break;
 
-	} else if (cmd.type == GNSS_STATIC) {
+	// Periodo entre posiciones en ms, hasta 10 Hz
+	case GNSS_FIX_RATE:
+		if (cmd.params < MIN_FIX_PERIOD)
+			cmd.params = MIN_FIX_PERIOD;
+		else if (cmd.params > MAX_FIX_PERIOD)
+			cmd.params = MAX_FIX_PERIOD;
+		body = FIX_RATE_COMMAND;
+		sprintf_(param, "%u", (unsigned int) cmd.params);
+		break;
 
-		if(HAL_UART_Transmit_IT(gnssPort->huart, (uint8_t *) STATIC_COMMAND, STATIC_CMD_NUM_B) == HAL_ERROR) {
+	// Tasa de la UART del módulo (0 -> por defecto). Tras el envío hay que
+	// reconfigurar la UART2 a la nueva tasa
+	case GNSS_BAUD_RATE:
+		if (cmd.params != 0 && cmd.params != 4800 && cmd.params != 9600 && cmd.params != 14400
+				&& cmd.params != 19200 && cmd.params != 38400 && cmd.params != 57600 && cmd.params != 115200)
 			return 0;
-		}
-
-		return 1;
+		body = BAUD_RATE_COMMAND;
+		sprintf_(param, "%u", (unsigned int) cmd.params);
+		break;
 
-	} else if (cmd.type == GNSS_START) {
+	default:
+		return 0;
+	}
 
-		if(HAL_UART_Transmit_IT(gnssPort->huart, (uint8_t *) START_COMMAND, START_CMD_NUM_B) == HAL_ERROR) {
-			return 0;
-		}
+	if (!(len = buildNMEA(buf, AT_TX_SIZE, body, param)))
+		return 0;
+	gnssPort->lastReq = buf;
+	gnssPort->lastCom = cmd.type;
+	gnssPort->sendNum = len;
 
-		return 1;
-	}
-	return 0;
+	return atTxPush(gnssPort);
 }
 
 /*
- * @brief	Envo de comando al mdulo NB-IoT
+ * @brief	Envío de comando al módulo NB-IoT
  * @param	mssg: puntero al mensaje que hay que enviar
  * @retval	1 -> Se ha enviado
- * 			0 -> Error en el envo
+ * 			0 -> Error en el envío
  */
 uint8_t NB_sendCMD(uint8_t *mssg)
 {
 	comando cmd;
-	uint8_t match;
-
-	// Comprobamos cul es el mensaje a enviar
-	for (cmd.type = NB_CONNECT; cmd.type < GNSS_MULTIPLE; cmd.type++) {
-		match = str_cmp(&mssg[NB_COMMAND], inst[cmd.type]);
-		if (match)
-			break;
-	}
 
-	if (cmd.type >= GNSS_RESTART)
+	// Comprobamos cuál es el mensaje a enviar
+	parseCommand(&mssg[NB_COMMAND], NB_CONNECT, NB_SOCKET_CREATION, &cmd);
+	if (cmd.type == NO_CMD)
 		return 0;
 
-	// Segn el tipo, realizamos la distincin de los comandos a transmitir
+	// Según el tipo, realizamos la distinción de los comandos a transmitir
 	cmd.params = 0;
 	if (cmd.type == NB_CONNECT) {
 
@@ -385,304 +540,372 @@ uint8_t NB_sendCMD(uint8_t *mssg)
 }
 
 /*
- * @brief	Devuelve la informacin del ltimo comando enviado por el mdulo STN en
- * 			formato de comando y su equivalencia en orden para el mdulo
+ * @brief	Devuelve la información del último comando enviado por el módulo STN en
+ * 			formato de comando y su equivalencia en orden para el módulo
  * @param	sent: puntero donde se indica el tipo de comando enviado
- * @retval	Puntero a la orden enviada al mdulo
+ * @retval	Puntero a la orden enviada al módulo
  */
-uint8_t* STN_getLastCommand(command *sent)
+const uint8_t* STN_getLastCommand(command *sent)
 {
 	*sent = stnPort->lastCom;
 	return stnPort->lastReq;
 }
 
 /*
- * @brief	Envo de un comando de configuracin a cualquiera de los mdulos
+ * @brief	Envío de un comando de configuración a cualquiera de los módulos
  * @param	cmd: comando a enviar
- * 			comPort: puntero al puerto de comunicaciones por el que se mandar el mensaje
+ * 			comPort: puntero al puerto de comunicaciones por el que se mandará el mensaje
  * @retval	1 -> Todo correcto
  * 			0 -> No se ha podido transmitir el mensaje
  */
 static uint8_t sendCMD(comando cmd, atCom *comPort)
 {
-	vPortFree(comPort->lastReq);
 	if (!(comPort->sendNum = decodeCommand(cmd, comPort))) {
 		return 0;
 	}
 
-	if(HAL_UART_Transmit(comPort->huart, comPort->lastReq, comPort->sendNum, TIMEOUT_UART) == HAL_ERROR) {
-		return 0;
-	}
-
-	return 1;
+	return atTxPush(comPort);
 }
 
 /*
- * @brief	Decodificacin del comando en los bytes asociados para el envo
+ * @brief	Decodificación del comando en los bytes asociados para el envío. Las órdenes
+ * 			constantes se envían desde flash; las que llevan parámetro se generan en el
+ * 			buffer del puerto
  * @param	cmd: comando a enviar
- * 			port: puntero al puerto de comunicaciones por el que se mandar el mensaje
- * @retval	nmero de bytes a transmitir
+ * 			port: puntero al puerto de comunicaciones por el que se mandará el mensaje
+ * @retval	número de bytes a transmitir
  */
 static uint8_t decodeCommand(comando cmd, atCom *port)
 {
-	uint8_t i, tipo, numOrden, sendNum;
-	uint32_t j, value = 0;
-	tipo = 1;
+	const char *req;
+	uint8_t *buf;
+	int len;
+
+	// Hueco de la cola para las órdenes que se generan
+	if (!(buf = atTxSlot(port)))
+		return 0;
+
 	switch(cmd.type) {
 
-	// Comandos STN
+	// Comandos STN constantes
 	case STN_REPEAT:
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*2)) == NULL)
-			return 0;
-		port->lastReq[0] = '\r';
-		port->lastReq[1] = '\0';
-		sendNum = 2;
-		return sendNum;
-
+		req = "\r";
+		break;
 	case STN_LOW_POWER:
-		numOrden = 2;
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + STN_STRUCT))) == NULL) {
-			return 0;
-		}
-		sprintf_((char*) port->lastReq, "%s\r", STN_LOW_POWER_CMD);
+		req = STN_LOW_POWER_CMD "\r";
 		break;
-
-	case STN_BAUD_SPEED:
-		tipo = 0;
-		value = cmd.params;
-		for (i = 0, j = 1000000; i < 7; i++, j = j/10) {
-			if (value / j != 0)
-				break;
-		}
-		numOrden = 3+(7-i);
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + STN_STRUCT))) == NULL) {
-			return 0;
-		}
-		sprintf_((char*) port->lastReq, "%s%u\r", STN_BAUD_SPEED_CMD, (unsigned int) cmd.params);
+	case STN_SERIAL_NUMBER:
+		req = STN_SERIAL_NUMBER_CMD "\r";
 		break;
-
-	case STN_ECHO:
-		numOrden = 3;
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + STN_STRUCT))) == NULL) {
-			return 0;
-		}
-		sprintf_((char*) port->lastReq, "%s%u\r", STN_ECHO_CMD, (unsigned int) cmd.params);
+	case STN_GET_PROTOCOL:
+		req = STN_GET_PROTOCOL_CMD "\r";
 		break;
-
-	case STN_HEADER:
-		numOrden = 3;
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + STN_STRUCT))) == NULL) {
-			return 0;
-		}
-		sprintf_((char*) port->lastReq, "%s%u\r", STN_HEADER_CMD, (unsigned int) cmd.params);
+	case STN_DEFAULT_FILTERS:
+		req = STN_DEFAULT_FILTERS_CMD "\r";
 		break;
-
-	case STN_SERIAL_NUMBER:
-		tipo = 0;
-		numOrden = 2;
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + STN_STRUCT))) == NULL) {
-			return 0;
-		}
-		sprintf_((char*) port->lastReq, "%s\r", STN_SERIAL_NUMBER_CMD);
+	case STN_MONITOR:
+		req = STN_MONITOR_CMD "\r";
 		break;
-
-	case STN_SLEEP:
-		value = cmd.params;
-		tipo = 0;
-		for (i = 0, j = 100; i < 3; i++, j = j/10) {
-			if (value / j != 0)
-				break;
-		}
-		numOrden = 6+(3-i);
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + STN_STRUCT))) == NULL) {
-			return 0;
-		}
-		sprintf_((char*) port->lastReq, "%s%u\r", STN_SLEEP_CMD, (unsigned int) cmd.params);
+	case STN_MONITOR_ALL:
+		req = STN_MONITOR_ALL_CMD "\r";
 		break;
-
-	case STN_GET_PROTOCOL:
-		numOrden = 2;
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + STN_STRUCT))) == NULL) {
-			return 0;
-		}
-		sprintf_((char*) port->lastReq, "%s\r", STN_GET_PROTOCOL_CMD);
+	case STN_CLEAR_FILTERS:
+		req = STN_CLEAR_FILTERS_CMD "\r";
 		break;
 
-	case STN_DEFAULT_FILTERS:
-		numOrden = 3;
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + STN_STRUCT))) == NULL) {
-			return 0;
-		}
-		sprintf_((char*) port->lastReq, "%s\r", STN_DEFAULT_FILTERS_CMD);
-		break;
+	// Comandos STN con parámetro
+	case STN_BAUD_SPEED:
+		len = sprintf_((char*) buf, "%s%u\r", STN_BAUD_SPEED_CMD, (unsigned int) cmd.params);
+		port->lastReq = buf;
+		return len;
+	case STN_BAUD_TIMEOUT:
+		len = sprintf_((char*) buf, "%s%u\r", STN_BAUD_TIMEOUT_CMD, (unsigned int) cmd.params);
+		port->lastReq = buf;
+		return len;
+	// Filtro de paso de un identificador de 11 bits
+	case STN_PASS_FILTER:
+		len = sprintf_((char*) buf, "%s%03X,7FF\r", STN_PASS_FILTER_CMD, (unsigned int) (cmd.params & 0x7FF));
+		port->lastReq = buf;
+		return len;
+	case STN_ECHO:
+		len = sprintf_((char*) buf, "%s%u\r", STN_ECHO_CMD, (unsigned int) cmd.params);
+		port->lastReq = buf;
+		return len;
+	case STN_HEADER:
+		len = sprintf_((char*) buf, "%s%u\r", STN_HEADER_CMD, (unsigned int) cmd.params);
+		port->lastReq = buf;
+		return len;
+	case STN_SLEEP:
+		len = sprintf_((char*) buf, "%s%u\r", STN_SLEEP_CMD, (unsigned int) cmd.params);
+		port->lastReq = buf;
+		return len;
 
 	default:
 		return 0;
 	}
 
-	// Gestion de comandos AT y ST
-	if (tipo < 2) {
-		sendNum = numOrden + 3;
-		return sendNum;
-
-	// Gestion de comandos NMEA de ML865C1
-	} else {
-		if ((port->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*(numOrden + 8))) == NULL) {
-			return 0;
-		}
-		port->lastReq[0] = '$';
-		port->lastReq[1] = 'P';
-		if (tipo == 2) {
-			port->lastReq[2] = 'M';
-			port->lastReq[3] = 'T';
-			port->lastReq[4] = 'K';
-		} else {
-			port->lastReq[2] = 'T';
-			port->lastReq[3] = 'W';
-			port->lastReq[4] = 'S';
-		}
-		port->lastReq[numOrden+5] = '\r';
-		port->lastReq[numOrden+6] = '\n';
-		port->lastReq[numOrden+7] = '\0';
-		sendNum = numOrden + 8;
-
-		return sendNum-1;
-	}
+	port->lastReq = (const uint8_t*) req;
+	return strlen(req);
 }
 
 /*
- * @brief	Decodificacin de los PIDs de OBD II
+ * @brief	Decodificación de los PIDs de OBD II. La petición se envía directamente desde flash
  * @param	cmd: comando a transmitir
- * @retval	Nmero de bytes a transmitir
+ * @retval	Número de bytes a transmitir
  */
 static uint8_t decodeOBD(command cmd)
 {
-	uint8_t *request;
-	if ((stnPort->lastReq = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*8)) == NULL)
+	if (cmd < STN_PIDS_1_1 || cmd > STN_GET_VIN)
 		return 0;
-	request = stnPort->lastReq;
-	request[0] = '0';
-	request[1] = '1';
-	request[4] = '\r';
-	request[5] = '\0';
 
-	switch(cmd) {
-
-	// PIDs de parmetros soportados
-	case STN_PIDS_1_1:
-		importPID(&(request[2]), FIRST_PIDS);
-		break;
-	case STN_PIDS_1_2:
-		importPID(&(request[2]), SECOND_PIDS);
-		break;
-	case STN_PIDS_1_3:
-		importPID(&(request[2]), THIRD_PIDS);
-		break;
-	case STN_PIDS_1_4:
-		importPID(&(request[2]), FOURTH_PIDS);
-		break;
-	case STN_PIDS_1_5:
-		importPID(&(request[2]), FIFTH_PIDS);
-		break;
-	case STN_PIDS_1_6:
-		importPID(&(request[2]), SIXTH_PIDS);
-		break;
-	case STN_PIDS_9:
-		request[1] = '9';
-		importPID(&(request[2]), FIRST_PIDS);
-		break;
+	stnPort->lastReq = obdRequest[cmd - STN_PIDS_1_1];
+	return OBD_REQ_SIZE - 1;
+}
 
-	// PIDS del modo de datos del vehculo
-	case STN_GET_RPM:
-		importPID(&(request[2]), ENGINE_RPM);
-		break;
-	case STN_GET_SPEED:
-		importPID(&(request[2]), VEHICLE_SPEED);
-		break;
-	case STN_GET_TIMESTART:
-		importPID(&(request[2]), TIME_SINCE_START);
-		break;
-	case STN_GET_AIR_TEMPERATURE:
-		importPID(&(request[2]), AMBIENT_AIR_TEMP);
-		break;
-	case STN_GET_FUEL:
-		importPID(&(request[2]), FUEL_TYPE);
-		break;
-	case STN_GET_DPF_1:
-		importPID(&(request[2]), DPF_1);
-		break;
-	case STN_GET_DPF_2:
-		importPID(&(request[2]), DPF_2);
-		break;
-	case STN_GET_NOx_NTE:
-		importPID(&(request[2]), NOX_NTE);
-		break;
-	case STN_GET_PM_NTE:
-		importPID(&(request[2]), PM_NTE);
-		break;
-	case STN_GET_NOx_SENSOR:
-		importPID(&(request[2]), NOX_SENSOR);
-		break;
-	case STN_GET_PM_SENSOR:
-		importPID(&(request[2]), PM_SENSOR);
-		break;
-	case STN_GET_NOx_SENSOR_CORRECTED:
-		importPID(&(request[2]), NOX_SENSOR_CORRECTED);
-		break;
+/*
+ * @brief	Genera una petición del servicio 01 con varios PIDs
+ * @param	dst: buffer destino (al menos 2*OBD_MAX_PIDS + 4 bytes)
+ * 			pids: PIDs a solicitar
+ * 			num: número de PIDs
+ * @retval	Número de bytes a transmitir
+ * 			0 -> Número de PIDs no válido
+ */
+static uint8_t encodeBatch(uint8_t *dst, const uint8_t *pids, uint8_t num)
+{
+	uint8_t i;
 
-	// PIDs del modo de informacin del vehculo
-	case STN_GET_MONITOR:
-		request[1] = '9';
-		importPID(&(request[2]), MONITOR);
-		break;
-	case STN_GET_VIN:
-		request[1] = '9';
-		importPID(&(request[2]), VIN_NUMBER);
-		break;
-	default:
+	if (num == 0 || num > OBD_MAX_PIDS)
 		return 0;
+
+	dst[0] = '0';
+	dst[1] = '1';
+	for (i = 0; i < num; i++) {
+		dst[2*i+2] = HEX_CHAR(pids[i] >> 4);
+		dst[2*i+3] = HEX_CHAR(pids[i] & 0x0F);
+	}
+	dst[2*i+2] = '\r';
+	dst[2*i+3] = '\0';
+	return 2*i+3;
+}
+
+/*
+ * @brief	Pasa a número un byte escrito con dos caracteres hexadecimales
+ * @param	data: caracteres a convertir
+ * @retval	Valor del byte
+ */
+static uint8_t decodeHex(uint8_t *data)
+{
+	return HEX_BYTE(data);
+}
+
+/*
+ * @brief	Genera una sentencia NMEA: '$', cuerpo, parámetro, '*', checksum y \r\n.
+ * 			El checksum es la XOR de los caracteres entre '$' y '*'
+ * @param	dst: buffer destino
+ * 			size: tamaño del buffer destino
+ * 			body: cuerpo de la sentencia sin '$' ni checksum
+ * 			param: parámetro añadido tras el cuerpo ("" si no tiene)
+ * @retval	Número de bytes a transmitir
+ * 			0 -> La sentencia no cabe en el buffer
+ */
+static uint8_t buildNMEA(uint8_t *dst, uint8_t size, const char *body, const char *param)
+{
+	static const uint8_t hex[16] = "0123456789ABCDEF";
+	uint8_t i, checksum;
+
+	checksum = 0;
+	i = 1;
+	dst[0] = '$';
+	for (; *body != '\0'; body++, i++) {
+		if (i + 6 > size)
+			return 0;
+		dst[i] = *body;
+		checksum ^= *body;
+	}
+	for (; *param != '\0'; param++, i++) {
+		if (i + 6 > size)
+			return 0;
+		dst[i] = *param;
+		checksum ^= *param;
 	}
 
-	return 5;
+	dst[i++] = '*';
+	dst[i++] = hex[checksum >> 4];
+	dst[i++] = hex[checksum & 0x0F];
+	dst[i++] = '\r';
+	dst[i++] = '\n';
+	dst[i] = '\0';
+	return i;
 }
 
 /*
- * @brief	Reinicia el STN
- * @param	this: mquina de estados de la accin
+ * @brief	Fin de una transmisión por UART (interrupción). Libera la petición enviada,
+ * 			avisa a la máquina de estados y lanza la siguiente de la cola
+ * @param	huart: UART que ha terminado de transmitir
  * @retval	Nada
  */
-static void importPID(uint8_t *request, uint8_t PID)
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
-	// Pasamos a ASCII el primer nmero
-	if ((PID >> 4) >= 0xA) {
-		request[0] = (ASCII_LETTER_THRESHOLD-10) + (PID >> 4);
-	} else {
-		request[0] = ASCII_NUMBER_THRESHOLD + (PID >> 4);
+	atTxDone(stnPort, huart);
+	atTxDone(gnssPort, huart);
+	atTxDone(nbPort, huart);
+}
+
+/*
+ * @brief	Inicializa el puerto y su cola de transmisión
+ * @param	port: puerto a inicializar
+ * 			huart: UART asociada
+ * 			flags: flags donde se avisa del fin de cada envío (NULL si no se avisa)
+ * 			txDone: flag a activar al terminar cada envío
+ * @retval	Nada
+ */
+static void atTxInit(atCom *port, UART_HandleTypeDef *huart, uint16_t *flags, uint16_t txDone)
+{
+	port->huart = huart;
+	port->lastReq = NULL;
+	port->sendNum = 0;
+	port->txHead = 0;
+	port->txTail = 0;
+	port->txBusy = 0;
+	port->flags = flags;
+	port->txDone = txDone;
+}
+
+/*
+ * @brief	Devuelve el buffer del siguiente hueco de la cola de transmisión
+ * @param	port: puerto de comunicaciones
+ * @retval	Buffer donde generar la petición
+ * 			NULL -> La cola está llena
+ */
+static uint8_t* atTxSlot(atCom *port)
+{
+	if ((port->txHead + 1) % AT_TX_QUEUE == port->txTail)
+		return NULL;
+	return port->txBuf[port->txHead];
+}
+
+/*
+ * @brief	Encola la última petición del puerto (lastReq, sendNum) y la transmite si
+ * 			la UART está libre. No bloquea
+ * @param	port: puerto de comunicaciones
+ * @retval	1 -> Petición encolada
+ * 			0 -> Cola llena o error al comenzar la transmisión
+ */
+static uint8_t atTxPush(atCom *port)
+{
+	uint8_t next, dev;
+
+	taskENTER_CRITICAL();
+	next = (port->txHead + 1) % AT_TX_QUEUE;
+	if (next == port->txTail) {
+		taskEXIT_CRITICAL();
+		return 0;
 	}
+	port->txData[port->txHead] = port->lastReq;
+	port->txLen[port->txHead] = port->sendNum;
+	port->txHead = next;
+	dev = atTxStart(port);
+	taskEXIT_CRITICAL();
 
-	// Pasamos a ASCII el segundo nmero
-	if ((PID % 0x10) >= 0xA) {
-		request[1] = (ASCII_LETTER_THRESHOLD-10) + (PID % 0x10);
-	} else {
-		request[1] = ASCII_NUMBER_THRESHOLD + (PID % 0x10);
+	return dev;
+}
+
+/*
+ * @brief	Comienza la transmisión de la primera petición de la cola si no hay otra en
+ * 			curso. Usa DMA si la UART tiene canal asociado y si no, interrupciones.
+ * 			Se llama con las interrupciones deshabilitadas o desde la interrupción
+ * @param	port: puerto de comunicaciones
+ * @retval	1 -> Todo correcto
+ * 			0 -> No se ha podido comenzar la transmisión, se descarta la petición
+ */
+static uint8_t atTxStart(atCom *port)
+{
+	HAL_StatusTypeDef res;
+
+	// Transmisión terminada por un error, sin pasar por el callback
+	if (port->txBusy && port->huart->gState == HAL_UART_STATE_READY) {
+		port->txBusy = 0;
+		port->txTail = (port->txTail + 1) % AT_TX_QUEUE;
+	}
+
+	if (port->txBusy || port->txTail == port->txHead)
+		return 1;
+
+	if (port->huart->hdmatx != NULL)
+		res = HAL_UART_Transmit_DMA(port->huart, (uint8_t*) port->txData[port->txTail], port->txLen[port->txTail]);
+	else
+		res = HAL_UART_Transmit_IT(port->huart, (uint8_t*) port->txData[port->txTail], port->txLen[port->txTail]);
+
+	if (res != HAL_OK) {
+		port->txTail = (port->txTail + 1) % AT_TX_QUEUE;
+		return 0;
 	}
+
+	port->txBusy = 1;
+	return 1;
 }
 
 /*
- * @brief	Comparacin de dos strings para ver si el primero es contenido en el segundo
- * @param	str1: string a comparar 1
- * 			str2: string a comparar 2
- * @retval	1 -> Contenido
- * 			0 -> No contenido
+ * @brief	Gestiona el fin de transmisión en un puerto
+ * @param	port: puerto de comunicaciones (NULL si no se ha inicializado)
+ * 			huart: UART que ha terminado de transmitir
+ * @retval	Nada
  */
-static uint8_t str_cmp(uint8_t *str1, const uint8_t *str2)
+static void atTxDone(atCom *port, UART_HandleTypeDef *huart)
 {
-	uint8_t i;
-	for (i = 0; i < 20; i++) { // El 20 es arbitrario, aumentar si hay instrucciones con ms de esos caracteres
-		if (str2[i] == '\r' && (str1[i] == '\r' || str1[i] == ' '))
-			return 1;
-		else if (str1[i] != str2[i])
+	// Envíos que no son de la cola (p.ej. datos al NB-IoT desde usb_fsm)
+	if (port == NULL || port->huart != huart || !port->txBusy)
+		return;
+
+	port->txBusy = 0;
+	port->txTail = (port->txTail + 1) % AT_TX_QUEUE;
+	if (port->flags != NULL)
+		*(port->flags) |= port->txDone;
+	atTxStart(port);
+}
+
+/*
+ * @brief	Identifica la instrucción de un mensaje mediante el hash perfecto de su primera
+ * 			palabra (terminada en espacio o \r) y decodifica el parámetro decimal que le sigue
+ * @param	mssg: comienzo de la instrucción, tras la cabecera del módulo
+ * 			first: primera instrucción aceptada
+ * 			last: última instrucción aceptada
+ * 			cmd: instrucción encontrada (NO_CMD si no hay ninguna) y su parámetro
+ * @retval	Posición del parámetro en mssg
+ * 			0 -> La instrucción no tiene parámetro
+ */
+static uint8_t parseCommand(uint8_t *mssg, command first, command last, comando *cmd)
+{
+	uint32_t hash = CMD_HASH_BASIS, params = 0;
+	uint8_t len, i, c, type;
+
+	// Se trabaja con copias locales: cmd puede solaparse con mssg y obligaría a releerlo
+	cmd->type = NO_CMD;
+	cmd->params = 0;
+
+	// Hash de la palabra
+	for (len = 0; (c = mssg[len]) != '\r' && c != ' '; len++) {
+		if (c == '\0' || len >= MAX_CHAR_INST - 2)
 			return 0;
+		hash = (hash ^ c) * CMD_HASH_SEED;
 	}
-	return 1;
+
+	// Sólo hay una candidata, que se comprueba entera
+	type = cmdHash[(hash ^ (hash >> 16)) & (CMD_HASH_SIZE - 1)];
+	if (type < first || type > last || inst[type][len] != '\r')
+		return 0;
+	for (i = 0; i < len; i++) {
+		if (mssg[i] != inst[type][i])
+			return 0;
+	}
+	cmd->type = type;
+
+	if (c != ' ')
+		return 0;
+
+	for (i = len + 1; (c = mssg[i] - ASCII_NUMBER_THRESHOLD) <= 9; i++) {
+		params = params*10 + c;
+	}
+	cmd->params = params;
+	return len + 1;
 }
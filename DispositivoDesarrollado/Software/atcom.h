@@ -14,8 +14,10 @@
 typedef enum command {
 	// Comandos STN
 	STN_REPEAT, STN_LOW_POWER, STN_ECHO, STN_HEADER,
-	STN_SERIAL_NUMBER, STN_BAUD_SPEED,
-	STN_SLEEP, STN_GET_PROTOCOL, STN_DEFAULT_FILTERS,
+	STN_SERIAL_NUMBER, STN_BAUD_SPEED, STN_BAUD_TIMEOUT,
+	STN_SLEEP, STN_GET_PROTOCOL,
+	STN_MONITOR, STN_MONITOR_ALL, STN_PASS_FILTER, STN_CLEAR_FILTERS,
+	STN_DEFAULT_FILTERS,
 
 	// Asociados a OBD
 	STN_PIDS_1_1, STN_PIDS_1_2, STN_PIDS_1_3,
@@ -28,7 +30,8 @@ typedef enum command {
 	STN_GET_NOx_NTE, STN_GET_PM_NTE,
 	STN_GET_NOx_SENSOR, STN_GET_PM_SENSOR,
 	STN_GET_NOx_SENSOR_CORRECTED, STN_GET_MONITOR,
-	STN_GET_VIN, STN_USER_OBD,
+	STN_GET_ECU_NAME, STN_GET_ENGINE_NUMBER, STN_GET_EROTAN,
+	STN_GET_VIN, STN_GET_BATCH, STN_USER_OBD,
 
 	// Comandos NB-IoT
 	NB_CONNECT, NB_CHECK_CONNECTION,
@@ -37,43 +40,68 @@ typedef enum command {
 	// Comandos GNSS
 	GNSS_RESTART, GNSS_GALILEO, GNSS_GPS, GNSS_GLONASS,
 	GNSS_MULTIPLE, GNSS_STATIC, GNSS_START,
+	GNSS_FIX_RATE, GNSS_BAUD_RATE,
 
 	// Ninguno de ellos
 	NO_CMD,
 
 } command;
 
-// Defincin del puerto de comunicaciones con un mdulo
+// Máximo de PIDs en una misma petición del servicio 01 (ISO 15765-4)
+#define OBD_MAX_PIDS	6
+
+// Tamaño del buffer de peticiones y de la cola de transmisión de cada puerto
+#define AT_TX_SIZE		64
+#define AT_TX_QUEUE		4
+
+// Definción del puerto de comunicaciones con un módulo
 typedef struct atCom {
 	UART_HandleTypeDef *huart;
-	uint8_t *lastReq;
+	const uint8_t *lastReq;		// Última petición, en txBuf o constante en flash
 	command lastCom;
 	uint8_t sendNum;
+	uint8_t txBuf[AT_TX_QUEUE][AT_TX_SIZE];	// Peticiones generadas en tiempo de ejecución, una por hueco de la cola
+
+	// Cola de transmisión no bloqueante (DMA o interrupción)
+	const uint8_t *txData[AT_TX_QUEUE];
+	uint8_t txLen[AT_TX_QUEUE];
+	volatile uint8_t txHead, txTail, txBusy;
+	uint16_t *flags;			// Flags donde se avisa del fin de cada transmisión
+	uint16_t txDone;
 } atCom;
 
-// Defincin de un comando a enviar
+// Definción de un comando a enviar
 typedef struct comando {
 	command type;
 	uint32_t params;
 } comando;
 
-uint8_t initSTNCom(void);
+uint8_t initSTNCom(uint16_t *flags);
 uint8_t initGNSSCom(void);
 uint8_t initNBCom(void);
 uint8_t STN_sendCMD(uint8_t *mssg);
+uint8_t STN_sendBatch(const uint8_t *pids, uint8_t num);
+uint8_t STN_sendOBD(command cmd);
+uint8_t STN_setBaud(uint32_t baud);
+uint32_t STN_getBaud(void);
+void STN_flushTX(void);
 uint8_t GNSS_sendCMD(uint8_t *mssg);
 uint8_t NB_sendCMD(uint8_t *mssg);
-uint8_t* STN_getLastCommand(command *sent);
+const uint8_t* STN_getLastCommand(command *sent);
 
 // STN Commands to UART
-#define STN_STRUCT					4
 #define STN_LOW_POWER_CMD			"ATLP"
 #define STN_ECHO_CMD				"ATE "
 #define STN_HEADER_CMD				"ATH "
 #define STN_SERIAL_NUMBER_CMD		"STSN"
 #define STN_BAUD_SPEED_CMD			"STBR "
+#define STN_BAUD_TIMEOUT_CMD		"STBRT "
 #define STN_SLEEP_CMD				"STSLEEP "
 #define STN_GET_PROTOCOL_CMD		"ATDP"
+#define STN_MONITOR_CMD				"STM"
+#define STN_MONITOR_ALL_CMD			"STMA"
+#define STN_PASS_FILTER_CMD			"STFAP "
+#define STN_CLEAR_FILTERS_CMD		"STFCP"
 #define STN_DEFAULT_FILTERS_CMD		"ATCRA"
 
 #endif /* ATCOM_H_ */
@@ -10,177 +10,515 @@
 // Conversion de horas a milisegundos
 #define HOUR_TO_MS		(60*60*1000)
 
-//Velocidad mnima para la estimacin
+//Velocidad mínima para la estimación
 #define MIN_SPEED		5
 
-#if !TEST
-#define NUM_VAL_CALC	1
-#endif
+// Velocidad máxima de validez de las curvas de COPERT para turismos: por encima se mantiene
+// el factor de esa velocidad (fuera del rango, el denominador de algunas curvas se anula y
+// cambia de signo)
+#define MAX_SPEED		130
+
+// Fila de la tabla de factores para una velocidad: por encima de la última se mantiene el
+// factor de la última
+#define EF_INDEX(speed)	(((speed) < 0) ? 0 : ((speed) > EF_TABLE_SIZE-1) ? EF_TABLE_SIZE-1 : (uint16_t) (speed))
+
+// Entrada del registro: los parámetros siguen el orden de la ecuación de COPERT
+#define COPERT_ENTRY(fuel, euro, segment, type, alpha, beta, gamma, delta, epsilon, zeta, eta, reductionFactor) \
+	{COPERT_KEY(fuel, euro, segment, type), (alpha), (beta), (gamma), (delta), (epsilon)/(eta), (zeta)/(eta), (1-(reductionFactor))/(eta)}
+
+// Registro de coeficientes COPERT. Debe mantenerse ordenado por clave
+// (combustible, normativa, segmento y sustancia) para la búsqueda binaria.
+// Sólo contiene curvas de COPERT: una clase sin entradas propias no se estima (no se sustituye
+// por otro combustible ni por los límites de homologación)
+static const copertEntry copertTable[] = {
+	// EURO 3 Gasolina Mediano
+	COPERT_ENTRY(GAS, EURO_3, SEGMENT_MEDIUM, CO_EMISSION,	7.2205718251378E-14, 6.75329473854208, 42.3272490063793, 3.22666412372708E-07, -0.146573191649441, 20.9003372463063, 0.590294093899604, 0),
+	COPERT_ENTRY(GAS, EURO_3, SEGMENT_MEDIUM, NOX_EMISSION,	0.0000183250132932115, -0.00418135831647819, 0.260842824674338, 6.56212692898217E-12, 0.000111409345755782, -0.0342366251422349, 2.80628074931392, 0),
+	COPERT_ENTRY(GAS, EURO_3, SEGMENT_MEDIUM, PM_EMISSION,	0, 0, 0.00128, 0, 0, 0, 1, 0),
 
+	// EURO 6 hasta 2016 Diesel Pequeño
+	COPERT_ENTRY(DSL, EURO_6_2016, SEGMENT_SMALL, CO_EMISSION,	0.0000330569078938345, -0.00572783242876238, 0.282346191800297, 0.943071291929658, 0.000354315235068144, -0.0705430852781633, 4.61140523347493, 0),
+	COPERT_ENTRY(DSL, EURO_6_2016, SEGMENT_SMALL, NOX_EMISSION,	0.0000667136, -0.011381467, 0.945951727, 1.923608149, -0.0000515046, 0.004264272, 1, 0.176306450219664),
+	COPERT_ENTRY(DSL, EURO_6_2016, SEGMENT_SMALL, PM_EMISSION,	0.000467299306307736, 0.0664094975805683, -0.325010592710707, 0.960762635129021, 1.13723865568225, 0.54617955489948, 0.289633151649954, 0),
+};
+
+#define COPERT_TABLE_SIZE	(sizeof(copertTable)/sizeof(copertEntry))
+
+// Tabla de factores de emisión del coche (3 KB). Se guarda aparte y no dentro de car para que
+// la reserva de car en el heap de FreeRTOS siga siendo pequeña: sólo hay un coche por dispositivo
+static efRow efTable[EF_TABLE_SIZE];
+
+static const copertEntry* searchKey(uint32_t key);
 static float calculateEF(uint8_t speed, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float reductionFactor);
+static void setParamsEmission(car* this, emissionType type, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float eta, float reductionFactor);
+static void buildEFTable(emissionParams *param, emissionType type);
+static void accumulateEmission(const emissionParams *param, emissionType type, int32_t sum, uint16_t count, float time, emissionAcc *emission);
+static void accumulateEmissions(const emissionParams *param, int32_t sum, uint16_t count, float time, emissionAcc *emission);
+#if !COPERT_FIXED_POINT
+static float lookupEF(const emissionParams *param, emissionType type, float speed);
+#endif
 
 /*
- * @brief	Establece los parmetros que se aplicarn a la frmula en funcin de la tecnologa del motor
+ * @brief	Asocia al coche su tabla de factores de emisión y reinicia las emisiones. Hasta que
+ * 			se llame a setParams la tabla está a 0 y no se estiman emisiones
  * @param	this: coche de las emisiones
- * 			normaEURO: normativa a la que est adherida el motor
+ * @retval	Nada
  */
-void setParams(car* this, uint8_t normaEURO)
+void initParams(car* this)
+{
+	this->params.ef = efTable;
+	resetEmissions(this);
+}
+
+/*
+ * @brief	Establece los parámetros que se aplicarán a la fórmula en función de la tecnología del motor
+ * @param	this: coche de las emisiones
+ * 			normaEURO: configuración predefinida del motor
+ * @retval	1 -> Parámetros establecidos
+ * 			0 -> Configuración desconocida
+ */
+uint8_t setParams(car* this, uint8_t normaEURO)
 {
 	switch (normaEURO) {
 	case EURO3_GAS:
-		setParamsCO(this, EURO3_ALPHA_CO_TEST, EURO3_BETA_CO_TEST, EURO3_GAMMA_CO_TEST, EURO3_DELTA_CO_TEST, EURO3_EPSILON_CO_TEST, EURO3_ZETA_CO_TEST, EURO3_ETA_CO_TEST, EURO3_RF_CO_TEST);
-		setParamsNOx(this, EURO3_ALPHA_NOX_TEST, EURO3_BETA_NOX_TEST, EURO3_GAMMA_NOX_TEST, EURO3_DELTA_NOX_TEST, EURO3_EPSILON_NOX_TEST, EURO3_ZETA_NOX_TEST, EURO3_ETA_NOX_TEST, EURO3_RF_NOX_TEST);
-		setParamsPM(this, EURO3_ALPHA_PM_TEST, EURO3_BETA_PM_TEST, EURO3_GAMMA_PM_TEST, EURO3_DELTA_PM_TEST, EURO3_EPSILON_PM_TEST, EURO3_ZETA_PM_TEST, EURO3_ETA_PM_TEST, EURO3_RF_PM_TEST);
-		break;
+		return setParamsTable(this, GAS, EURO_3, SEGMENT_MEDIUM);
 
 	case EURO6_DIESEL_2016:
-		setParamsCO(this, EURO6_ALPHA_CO_TEST, EURO6_BETA_CO_TEST, EURO6_GAMMA_CO_TEST, EURO6_DELTA_CO_TEST, EURO6_EPSILON_CO_TEST, EURO6_ZETA_CO_TEST, EURO6_ETA_CO_TEST, EURO6_RF_CO_TEST);
-		setParamsNOx(this, EURO6_ALPHA_NOX_TEST, EURO6_BETA_NOX_TEST, EURO6_GAMMA_NOX_TEST, EURO6_DELTA_NOX_TEST, EURO6_EPSILON_NOX_TEST, EURO6_ZETA_NOX_TEST, EURO6_ETA_NOX_TEST, EURO6_RF_NOX_TEST);
-		setParamsPM(this, EURO6_ALPHA_PM_TEST, EURO6_BETA_PM_TEST, EURO6_GAMMA_PM_TEST, EURO6_DELTA_PM_TEST, EURO6_EPSILON_PM_TEST, EURO6_ZETA_PM_TEST, EURO6_ETA_PM_TEST, EURO6_RF_PM_TEST);
-		break;
+		return setParamsTable(this, DSL, EURO_6_2016, SEGMENT_SMALL);
+	}
+	return 0;
+}
+
+/*
+ * @brief	Establece los parámetros de todas las sustancias contaminantes a partir del registro
+ * @param	this: coche de las emisiones
+ * 			fuel: combustible del vehículo
+ * 			euro: normativa a la que está adherida el motor
+ * 			segment: segmento de cilindrada del motor
+ * @retval	1 -> Parámetros establecidos
+ * 			0 -> Falta alguna sustancia en el registro, no se modifica nada
+ */
+uint8_t setParamsTable(car* this, fuelType fuel, uint8_t euro, engineSegment segment)
+{
+	return copertParams(&(this->params), fuel, euro, segment);
+}
+
+/*
+ * @brief	Establece en un bloque de parámetros los de todas las sustancias contaminantes a
+ * 			partir del registro y precalcula su tabla. Permite calcular varios vehículos a la
+ * 			vez, cada uno con su propia tabla (p.ej. en el reprocesado de trazas en el PC)
+ * @param	param: parámetros a establecer, con la tabla ya asociada (param->ef)
+ * 			fuel: combustible del vehículo
+ * 			euro: normativa a la que está adherida el motor
+ * 			segment: segmento de cilindrada del motor
+ * @retval	1 -> Parámetros establecidos
+ * 			0 -> Falta alguna sustancia en el registro, no se modifica nada
+ */
+uint8_t copertParams(emissionParams *param, fuelType fuel, uint8_t euro, engineSegment segment)
+{
+	const copertEntry *entry[NUM_EMISSIONS];
+	uint8_t i;
+
+	for (i = 0; i < NUM_EMISSIONS; i++) {
+		if ((entry[i] = copertLookup(fuel, euro, segment, i)) == NULL)
+			return 0;
+	}
+
+	for (i = 0; i < NUM_EMISSIONS; i++) {
+		param->a[i] = entry[i]->a;
+		param->b[i] = entry[i]->b;
+		param->c[i] = entry[i]->c;
+		param->d[i] = entry[i]->d;
+		param->e[i] = entry[i]->e;
+		param->f[i] = entry[i]->f;
+		param->reductionFactor[i] = entry[i]->reductionFactor;
+		buildEFTable(param, i);
+	}
+	return 1;
+}
+
+/*
+ * @brief	Busca los coeficientes en el registro COPERT: los del combustible y segmento
+ * 			indicados o, si no existen, los del combustible para cualquier segmento
+ * @param	fuel: combustible del vehículo
+ * 			euro: normativa a la que está adherida el motor
+ * 			segment: segmento de cilindrada del motor
+ * 			type: sustancia contaminante
+ * @retval	Puntero a la entrada del registro o NULL si no existe
+ */
+const copertEntry* copertLookup(fuelType fuel, uint8_t euro, engineSegment segment, emissionType type)
+{
+	const copertEntry *entry;
+
+	if ((entry = searchKey(COPERT_KEY(fuel, euro, segment, type))) != NULL)
+		return entry;
+	return searchKey(COPERT_KEY(fuel, euro, SEGMENT_ANY, type));
+}
+
+/*
+ * @brief	Búsqueda binaria de una clave en el registro COPERT
+ * @param	key: clave (ver COPERT_KEY)
+ * @retval	Puntero a la entrada del registro o NULL si no existe
+ */
+static const copertEntry* searchKey(uint32_t key)
+{
+	uint16_t low, high, mid;
+
+	low = 0;
+	high = COPERT_TABLE_SIZE;
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (copertTable[mid].key == key)
+			return &(copertTable[mid]);
+		else if (copertTable[mid].key < key)
+			low = mid + 1;
+		else
+			high = mid;
 	}
+	return NULL;
 }
 
 /*
- * @brief	Establece los parmetros de las emisiones de CO
+ * @brief	Establece los parámetros de las emisiones de CO
  * @param	this: coche de las emisiones
- * 			alpha: parmetro alpha
- * 			beta: parmetro beta
- * 			gamma: parmetro gamma
- * 			delta: parmetro delta
- * 			epsilon: parmetro epsilon
- * 			zita: parmetro zita
- * 			eta: parmetro eta
- * 			reductionFactor: parmetro reductionFactor
+ * 			alpha: parámetro alpha
+ * 			beta: parámetro beta
+ * 			gamma: parámetro gamma
+ * 			delta: parámetro delta
+ * 			epsilon: parámetro epsilon
+ * 			zita: parámetro zita
+ * 			eta: parámetro eta
+ * 			reductionFactor: parámetro reductionFactor
  */
 void setParamsCO(car* this, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float eta, float reductionFactor) {
-	this->coParams.a = alpha;
-	this->coParams.b = beta;
-	this->coParams.c = gamma;
-	this->coParams.d = delta;
-	this->coParams.e = epsilon/eta;
-	this->coParams.f = zita/eta;
-	this->coParams.reductionFactor = (1-reductionFactor)/eta;
+	setParamsEmission(this, CO_EMISSION, alpha, beta, gamma, delta, epsilon, zita, eta, reductionFactor);
 }
 
 /*
  * @brief	Calcula las emisiones de CO en el periodo de tiempo indicado
  * @param	this: coche de las emisiones
- * 			time: tiempo de evaluacin
+ * 			time: tiempo de evaluación
  * @retval	Emisiones de CO estimadas
  */
 float calcCO(car* this, float time) {
-	float av_speed;
-	float ef;
-	uint8_t i;
-	emissionParams param = this->coParams;
-	av_speed = 0;
-	for (i = 0; i < NUM_VAL_CALC; i++) {
-		av_speed += this->speed[i];
-	}
-	av_speed = av_speed / NUM_VAL_CALC;
-	ef = calculateEF(av_speed, param.a, param.b, param.c, param.d, param.e, param.f, param.reductionFactor);
-	this->co += ef*av_speed*time/HOUR_TO_MS;
-	return this->co;
+	accumulateEmission(&(this->params), CO_EMISSION, this->speed.sum, this->speed.count, time, &(this->emission[CO_EMISSION]));
+	return emissionValue(this, CO_EMISSION);
 }
 
 /*
- * @brief	Establece los parmetros de las emisiones de NOx
+ * @brief	Establece los parámetros de las emisiones de NOx
  * @param	this: coche de las emisiones
- * 			alpha: parmetro alpha
- * 			beta: parmetro beta
- * 			gamma: parmetro gamma
- * 			delta: parmetro delta
- * 			epsilon: parmetro epsilon
- * 			zita: parmetro zita
- * 			eta: parmetro eta
- * 			reductionFactor: parmetro reductionFactor
+ * 			alpha: parámetro alpha
+ * 			beta: parámetro beta
+ * 			gamma: parámetro gamma
+ * 			delta: parámetro delta
+ * 			epsilon: parámetro epsilon
+ * 			zita: parámetro zita
+ * 			eta: parámetro eta
+ * 			reductionFactor: parámetro reductionFactor
  */
 void setParamsNOx(car* this, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float eta, float reductionFactor) {
-	this->noxParams.a = alpha;
-	this->noxParams.b = beta;
-	this->noxParams.c = gamma;
-	this->noxParams.d = delta;
-	this->noxParams.e = epsilon/eta;
-	this->noxParams.f = zita/eta;
-	this->noxParams.reductionFactor = (1-reductionFactor)/eta;
+	setParamsEmission(this, NOX_EMISSION, alpha, beta, gamma, delta, epsilon, zita, eta, reductionFactor);
 }
 
 /*
  * @brief	Calcula las emisiones de NOx en el periodo de tiempo indicado
  * @param	this: coche de las emisiones
- * 			time: tiempo de evaluacin
+ * 			time: tiempo de evaluación
  * @retval	Emisiones de NOx estimadas
  */
 float calcNOx(car* this, float time) {
-	float av_speed;
-	uint8_t i;
-	emissionParams param = this->noxParams;
-	av_speed = 0;
-	for (i = 0; i < NUM_VAL_CALC; i++) {
-		av_speed += this->speed[i];
-	}
-	av_speed = av_speed / NUM_VAL_CALC;
-	this->nox += calculateEF(av_speed, param.a, param.b, param.c, param.d, param.e, param.f, param.reductionFactor)*av_speed*time/HOUR_TO_MS;
-	return this->nox;
+	accumulateEmission(&(this->params), NOX_EMISSION, this->speed.sum, this->speed.count, time, &(this->emission[NOX_EMISSION]));
+	return emissionValue(this, NOX_EMISSION);
 }
 
 /*
- * @brief	Establece los parmetros de las emisiones de PM
+ * @brief	Establece los parámetros de las emisiones de PM
  * @param	this: coche de las emisiones
- * 			alpha: parmetro alpha
- * 			beta: parmetro beta
- * 			gamma: parmetro gamma
- * 			delta: parmetro delta
- * 			epsilon: parmetro epsilon
- * 			zita: parmetro zita
- * 			eta: parmetro eta
- * 			reductionFactor: parmetro reductionFactor
+ * 			alpha: parámetro alpha
+ * 			beta: parámetro beta
+ * 			gamma: parámetro gamma
+ * 			delta: parámetro delta
+ * 			epsilon: parámetro epsilon
+ * 			zita: parámetro zita
+ * 			eta: parámetro eta
+ * 			reductionFactor: parámetro reductionFactor
  */
 void setParamsPM(car* this, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float eta, float reductionFactor) {
-	this->pmParams.a = alpha;
-	this->pmParams.b = beta;
-	this->pmParams.c = gamma;
-	this->pmParams.d = delta;
-	this->pmParams.e = epsilon/eta;
-	this->pmParams.f = zita/eta;
-	this->pmParams.reductionFactor = (1-reductionFactor)/eta;
+	setParamsEmission(this, PM_EMISSION, alpha, beta, gamma, delta, epsilon, zita, eta, reductionFactor);
 }
 
 /*
  * @brief	Calcula las emisiones de PM en el periodo de tiempo indicado
  * @param	this: coche de las emisiones
- * 			time: tiempo de evaluacin
+ * 			time: tiempo de evaluación
  * @retval	Emisiones de PM estimadas
  */
 float calcPM(car* this, float time) {
-	float av_speed;
+	accumulateEmission(&(this->params), PM_EMISSION, this->speed.sum, this->speed.count, time, &(this->emission[PM_EMISSION]));
+	return emissionValue(this, PM_EMISSION);
+}
+
+/*
+ * @brief	Calcula en una sola pasada las emisiones de todas las sustancias contaminantes
+ * 			en el periodo de tiempo indicado
+ * @param	this: coche de las emisiones
+ * 			time: tiempo de evaluación
+ */
+void calcEmissions(car* this, float time) {
+	accumulateEmissions(&(this->params), this->speed.sum, this->speed.count, time, this->emission);
+}
+
+/*
+ * @brief	Valor de las emisiones acumuladas de una sustancia contaminante
+ * @param	this: coche de las emisiones
+ * 			type: sustancia contaminante
+ * @retval	Emisiones acumuladas
+ */
+float emissionValue(car* this, emissionType type) {
+#if COPERT_FIXED_POINT
+	return (float) this->emission[type] / this->params.scale[type] / HOUR_TO_MS;
+#else
+	return this->emission[type];
+#endif
+}
+
+/*
+ * @brief	Reinicia las emisiones acumuladas de todas las sustancias contaminantes
+ * @param	this: coche de las emisiones
+ */
+void resetEmissions(car* this) {
 	uint8_t i;
-	emissionParams param = this->pmParams;
-	av_speed = 0;
-	for (i = 0; i < NUM_VAL_CALC; i++) {
-		av_speed += this->speed[i];
+	for (i = 0; i < NUM_EMISSIONS; i++) {
+		this->emission[i] = 0;
+	}
+}
+
+/*
+ * @brief	Reprocesa una traza de velocidades grabada aplicando muestra a muestra las mismas
+ * 			operaciones que calcEmissions, de modo que el resultado coincide con el del dispositivo
+ * @param	param: parámetros de las sustancias contaminantes
+ * 			speed: velocidades de la traza, una por periodo de muestreo
+ * 			samples: número de muestras de la traza
+ * 			window: longitud de la ventana de promediado
+ * 			time: periodo de muestreo
+ * 			emission: acumuladores de las emisiones (NUM_EMISSIONS valores, no se reinician)
+ */
+void calcEmissionsTrace(const emissionParams *param, const uint8_t *speed, uint32_t samples, uint16_t window, float time, emissionAcc *emission)
+{
+	int32_t sum;
+	uint32_t i;
+	uint16_t count;
+
+	if (window == 0)
+		return;
+
+	sum = 0;
+	count = 0;
+	for (i = 0; i < samples; i++) {
+		sum += speed[i];
+		if (count < window)
+			count++;
+		else
+			sum -= speed[i - window];
+		accumulateEmissions(param, sum, count, time, emission);
 	}
-	av_speed = av_speed / NUM_VAL_CALC;
-	this->pm += calculateEF(av_speed, param.a, param.b, param.c, param.d, param.e, param.f, param.reductionFactor)*av_speed*time/HOUR_TO_MS;
-	return this->pm;
-}
-
-/*
- * @brief	Frmula de factor de emisin proporcionada por COPERT
- * @param	speed: velocidad media del vehculo
- * 			alpha: parmetro alpha
- * 			beta: parmetro beta
- * 			gamma: parmetro gamma
- * 			delta: parmetro delta
- * 			epsilon: parmetro epsilon
- * 			zita: parmetro zita
- * 			eta: parmetro eta
- * 			reductionFactor: parmetro reductionFactor
+}
+
+/*
+ * @brief	Fórmula de factor de emisión proporcionada por COPERT, limitada a su rango de
+ * 			validez y a factores no negativos
+ * @param	speed: velocidad media del vehículo
+ * 			alpha: parámetro alpha
+ * 			beta: parámetro beta
+ * 			gamma: parámetro gamma
+ * 			delta: parámetro delta
+ * 			epsilon: parámetro epsilon
+ * 			zita: parámetro zita
+ * 			eta: parámetro eta
+ * 			reductionFactor: parámetro reductionFactor
  * @retval	Factor de emision estimado de la sustancia contaminante
  */
 static float calculateEF(uint8_t speed, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float reductionFactor) {
+	float ef;
 	if (speed < MIN_SPEED)
 		return 0;
-	return (alpha*speed*speed+beta*speed+gamma+delta/speed)/(epsilon*speed*speed+zita*speed+1)*reductionFactor;
+	if (speed > MAX_SPEED)
+		speed = MAX_SPEED;
+	ef = (alpha*speed*speed+beta*speed+gamma+delta/speed)/(epsilon*speed*speed+zita*speed+1)*reductionFactor;
+	return (ef > 0)? ef : 0;
+}
+
+/*
+ * @brief	Establece los parámetros de una sustancia contaminante y precalcula su tabla
+ * @param	this: coche de las emisiones
+ * 			type: sustancia contaminante
+ * 			alpha: parámetro alpha
+ * 			beta: parámetro beta
+ * 			gamma: parámetro gamma
+ * 			delta: parámetro delta
+ * 			epsilon: parámetro epsilon
+ * 			zita: parámetro zita
+ * 			eta: parámetro eta
+ * 			reductionFactor: parámetro reductionFactor
+ */
+static void setParamsEmission(car* this, emissionType type, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float eta, float reductionFactor)
+{
+	this->params.a[type] = alpha;
+	this->params.b[type] = beta;
+	this->params.c[type] = gamma;
+	this->params.d[type] = delta;
+	this->params.e[type] = epsilon/eta;
+	this->params.f[type] = zita/eta;
+	this->params.reductionFactor[type] = (1-reductionFactor)/eta;
+	buildEFTable(&(this->params), type);
+}
+
+/*
+ * @brief	Precalcula el factor de emisión para cada velocidad entera, de forma que
+ * 			el cálculo periódico se reduce a una lectura de la tabla. En coma fija, cada
+ * 			sustancia usa su propio factor de escala para aprovechar EF_FIXED_BITS bits
+ * @param	param: parámetros de las sustancias contaminantes
+ * 			type: sustancia contaminante a tabular
+ */
+static void buildEFTable(emissionParams *param, emissionType type)
+{
+	uint16_t speed;
+#if COPERT_FIXED_POINT
+	float ef, max, scale;
+
+	max = 0;
+	for (speed = 0; speed < EF_TABLE_SIZE; speed++) {
+		ef = calculateEF(speed, param->a[type], param->b[type], param->c[type], param->d[type], param->e[type], param->f[type], param->reductionFactor[type]);
+		if (ef > max)
+			max = ef;
+		else if (-ef > max)
+			max = -ef;
+	}
+
+	// Mayor potencia de 2 con la que el factor máximo cabe en EF_FIXED_BITS bits. Basta una
+	// escala por sustancia y no un exponente por coeficiente: la fórmula sólo se evalúa aquí,
+	// en float, y el cálculo periódico sólo usa el factor ya tabulado. El redondeo a la escala
+	// queda por debajo de 2^-(EF_FIXED_BITS-1) del mayor factor de la sustancia, menos que el
+	// error de la propia evaluación en float (Herramientas/test_copert.c), y al ser potencia de
+	// 2 la escala es exacta en float y en emissionValue
+	scale = 1;
+	if (max > 0) {
+		while (max*scale < (1UL << (EF_FIXED_BITS-1)))
+			scale *= 2;
+		while (max*scale >= (1UL << EF_FIXED_BITS))
+			scale /= 2;
+	}
+	param->scale[type] = scale;
+
+	for (speed = 0; speed < EF_TABLE_SIZE; speed++) {
+		ef = calculateEF(speed, param->a[type], param->b[type], param->c[type], param->d[type], param->e[type], param->f[type], param->reductionFactor[type]);
+		param->ef[speed][type] = (ef >= 0)? (int32_t) (ef*scale + 0.5f) : -(int32_t) (-ef*scale + 0.5f);
+	}
+#else
+	for (speed = 0; speed < EF_TABLE_SIZE; speed++) {
+		param->ef[speed][type] = calculateEF(speed, param->a[type], param->b[type], param->c[type], param->d[type], param->e[type], param->f[type], param->reductionFactor[type]);
+	}
+#endif
+}
+
+/*
+ * @brief	Acumula las emisiones de una sustancia contaminante
+ * @param	param: parámetros de las sustancias contaminantes
+ * 			type: sustancia contaminante
+ * 			sum: suma de las velocidades de la ventana
+ * 			count: número de velocidades de la ventana
+ * 			time: tiempo de evaluación
+ * 			emission: acumulador de la sustancia
+ */
+static void accumulateEmission(const emissionParams *param, emissionType type, int32_t sum, uint16_t count, float time, emissionAcc *emission)
+{
+#if COPERT_FIXED_POINT
+	if (count == 0)
+		return;
+	*emission += (int64_t) param->ef[EF_INDEX(sum / count)][type] * sum * (int64_t) time / count;
+#else
+	float av_speed;
+	if (count == 0)
+		return;
+	av_speed = (float) sum / count;
+	*emission += lookupEF(param, type, av_speed)*av_speed*time/HOUR_TO_MS;
+#endif
+}
+
+/*
+ * @brief	Acumula las emisiones de todas las sustancias contaminantes para la velocidad media
+ * 			de la ventana
+ * @param	param: parámetros de las sustancias contaminantes
+ * 			sum: suma de las velocidades de la ventana
+ * 			count: número de velocidades de la ventana
+ * 			time: tiempo de evaluación
+ * 			emission: acumuladores de las emisiones
+ */
+static void accumulateEmissions(const emissionParams *param, int32_t sum, uint16_t count, float time, emissionAcc *emission)
+{
+	uint8_t i;
+#if COPERT_FIXED_POINT
+	const int32_t *ef;
+	int64_t weight;
+
+	if (count == 0)
+		return;
+	ef = param->ef[EF_INDEX(sum / count)];
+	weight = (int64_t) sum * (int64_t) time;
+	for (i = 0; i < NUM_EMISSIONS; i++) {
+		emission[i] += ef[i] * weight / count;
+	}
+#else
+	float av_speed, distance;
+	const float *ef;
+	uint8_t index;
+#if EF_INTERPOLATION
+	const float *efNext;
+	float frac;
+#endif
+
+	if (count == 0)
+		return;
+	av_speed = (float) sum / count;
+	distance = av_speed*time/HOUR_TO_MS;
+	index = EF_INDEX(av_speed);
+	ef = param->ef[index];
+#if EF_INTERPOLATION
+	if (index < MIN_SPEED)
+		return;
+	efNext = (index < EF_TABLE_SIZE-1)? param->ef[index+1] : ef;
+	frac = av_speed - index;
+	for (i = 0; i < NUM_EMISSIONS; i++) {
+		emission[i] += (ef[i] + (efNext[i] - ef[i])*frac)*distance;
+	}
+#else
+	for (i = 0; i < NUM_EMISSIONS; i++) {
+		emission[i] += ef[i]*distance;
+	}
+#endif
+#endif
+}
+
+#if !COPERT_FIXED_POINT
+/*
+ * @brief	Obtiene el factor de emisión de la tabla precalculada
+ * @param	param: parámetros de las sustancias contaminantes
+ * 			type: sustancia contaminante
+ * 			speed: velocidad media del vehículo
+ * @retval	Factor de emision estimado de la sustancia contaminante
+ */
+static float lookupEF(const emissionParams *param, emissionType type, float speed)
+{
+	uint8_t index = EF_INDEX(speed);
+#if EF_INTERPOLATION
+	if (index < MIN_SPEED)
+		return 0;
+	if (index >= EF_TABLE_SIZE-1)
+		return param->ef[EF_TABLE_SIZE-1][type];
+	return param->ef[index][type] + (param->ef[index+1][type] - param->ef[index][type])*(speed - index);
+#else
+	return param->ef[index][type];
+#endif
 }
+#endif
@@ -10,7 +10,15 @@
 
 #include "shareData.h"
 
-void setParams(car* this, uint8_t normaEURO);
+// Interpolación lineal entre entradas de la tabla para velocidades medias no enteras
+#define EF_INTERPOLATION	0
+
+#if EF_INTERPOLATION && COPERT_FIXED_POINT
+#error "EF_INTERPOLATION solo está disponible en coma flotante"
+#endif
+
+void initParams(car* this);
+uint8_t setParams(car* this, uint8_t normaEURO);
 
 void setParamsCO(car* this, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float eta, float reductionFactor);
 float calcCO(car* this, float time);
@@ -18,65 +26,53 @@ void setParamsNOx(car* this, float alpha, float beta, float gamma, float delta,
 float calcNOx(car* this, float time);
 void setParamsPM(car* this, float alpha, float beta, float gamma, float delta, float epsilon, float zita, float eta, float reductionFactor);
 float calcPM(car* this, float time);
+void calcEmissions(car* this, float time);
+void calcEmissionsTrace(const emissionParams *param, const uint8_t *speed, uint32_t samples, uint16_t window, float time, emissionAcc *emission);
+float emissionValue(car* this, emissionType type);
+void resetEmissions(car* this);
 
-// EURO 3 Gasolina Mediano Params
-#define EURO3_GAS					0x30
-
-#define EURO3_ALPHA_CO_TEST			7.2205718251378E-14
-#define EURO3_BETA_CO_TEST			6.75329473854208
-#define EURO3_GAMMA_CO_TEST			42.3272490063793
-#define EURO3_DELTA_CO_TEST			3.22666412372708E-07
-#define EURO3_EPSILON_CO_TEST		-0.146573191649441
-#define EURO3_ZETA_CO_TEST			20.9003372463063
-#define EURO3_ETA_CO_TEST			0.590294093899604
-#define EURO3_RF_CO_TEST			0
-
-#define EURO3_ALPHA_NOX_TEST		0.0000183250132932115
-#define EURO3_BETA_NOX_TEST			-0.00418135831647819
-#define EURO3_GAMMA_NOX_TEST		0.260842824674338
-#define EURO3_DELTA_NOX_TEST		6.56212692898217E-12
-#define EURO3_EPSILON_NOX_TEST		0.000111409345755782
-#define EURO3_ZETA_NOX_TEST			-0.0342366251422349
-#define EURO3_ETA_NOX_TEST			2.80628074931392
-#define EURO3_RF_NOX_TEST			0
+// Normativas EURO: la cifra alta indica la norma y la baja la etapa
+#define PRE_EURO					0x00
+#define EURO_1						0x10
+#define EURO_2						0x20
+#define EURO_3						0x30
+#define EURO_4						0x40
+#define EURO_5						0x50
+#define EURO_6_2016					0x61	// Euro 6 a/b/c hasta 2016
+#define EURO_6_2017					0x62	// Euro 6 a/b/c desde 2017
+#define EURO_6D_TEMP				0x63
+#define EURO_6D						0x64
 
-#define EURO3_ALPHA_PM_TEST			0
-#define EURO3_BETA_PM_TEST			0
-#define EURO3_GAMMA_PM_TEST			0.00128
-#define EURO3_DELTA_PM_TEST			0
-#define EURO3_EPSILON_PM_TEST		0
-#define EURO3_ZETA_PM_TEST			0
-#define EURO3_ETA_PM_TEST			1
-#define EURO3_RF_PM_TEST			0
+// Configuraciones predefinidas para setParams
+#define EURO3_GAS					0x30	// EURO 3 Gasolina Mediano
+#define EURO6_DIESEL_2016			0x61	// EURO 6 hasta 2016 Diesel Pequeño
 
-// EURO 6 hasta 2016 Diesel Pequeo Params
-#define EURO6_DIESEL_2016			0x61
+// Segmentos de cilindrada del motor
+typedef enum _engineSegment {
+	SEGMENT_MINI,
+	SEGMENT_SMALL,
+	SEGMENT_MEDIUM,
+	SEGMENT_LARGE,
+	SEGMENT_ANY = 0xFF,		// Entrada válida para cualquier segmento
+} engineSegment;
 
-#define EURO6_ALPHA_CO_TEST			0.0000330569078938345
-#define EURO6_BETA_CO_TEST			-0.00572783242876238
-#define EURO6_GAMMA_CO_TEST			0.282346191800297
-#define EURO6_DELTA_CO_TEST			0.943071291929658
-#define EURO6_EPSILON_CO_TEST		0.000354315235068144
-#define EURO6_ZETA_CO_TEST			-0.0705430852781633
-#define EURO6_ETA_CO_TEST			4.61140523347493
-#define EURO6_RF_CO_TEST			0
+// Entrada del registro de coeficientes COPERT, con las divisiones entre eta ya aplicadas
+typedef struct _copertEntry {
+	uint32_t key;
+	float a;	// alpha
+	float b;	// beta
+	float c;	// gamma
+	float d;	// delta
+	float e;	// epsilon/eta
+	float f;	// zeta/eta
+	float reductionFactor;		// (1-reductionFactor)/eta
+} copertEntry;
 
-#define EURO6_ALPHA_NOX_TEST		0.0000667136
-#define EURO6_BETA_NOX_TEST			-0.011381467
-#define EURO6_GAMMA_NOX_TEST		0.945951727
-#define EURO6_DELTA_NOX_TEST		1.923608149
-#define EURO6_EPSILON_NOX_TEST		-0.0000515046
-#define EURO6_ZETA_NOX_TEST			0.004264272
-#define EURO6_ETA_NOX_TEST			1
-#define EURO6_RF_NOX_TEST			0.176306450219664
+// Clave de búsqueda en el registro: combustible, normativa, segmento y sustancia
+#define COPERT_KEY(fuel, euro, segment, type)	((((uint32_t) (fuel)) << 24) | (((uint32_t) (euro)) << 16) | (((uint32_t) (segment)) << 8) | ((uint32_t) (type)))
 
-#define EURO6_ALPHA_PM_TEST			0.000467299306307736
-#define EURO6_BETA_PM_TEST			0.0664094975805683
-#define EURO6_GAMMA_PM_TEST			-0.325010592710707
-#define EURO6_DELTA_PM_TEST			0.960762635129021
-#define EURO6_EPSILON_PM_TEST		1.13723865568225
-#define EURO6_ZETA_PM_TEST			0.54617955489948
-#define EURO6_ETA_PM_TEST			0.289633151649954
-#define EURO6_RF_PM_TEST			0
+const copertEntry* copertLookup(fuelType fuel, uint8_t euro, engineSegment segment, emissionType type);
+uint8_t setParamsTable(car* this, fuelType fuel, uint8_t euro, engineSegment segment);
+uint8_t copertParams(emissionParams *param, fuelType fuel, uint8_t euro, engineSegment segment);
 
 #endif /* COPERT_H_ */
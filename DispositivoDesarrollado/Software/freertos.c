@@ -84,12 +84,11 @@ void MX_FREERTOS_Init(void); /* (MISRA C 2004 rule 8.1) */
 void MX_FREERTOS_Init(void) {
   /* USER CODE BEGIN Init */
 
-	uint8_t i;
-	uint16_t *flags;			// Debemos tener una variable compartida entre las mquinas USB y del micro
+	uint16_t *flags;			// Debemos tener una variable compartida entre las máquinas USB y del micro
 	pilePointers_t *serial;
 	car *coche;
 
-	// Inicializacin de los flags
+	// Inicialización de los flags
 	if ((flags = (uint16_t*) pvPortMalloc(sizeof(uint16_t))) == NULL) {
 		enciendeLED(AZUL);
 		enciendeLED(VERDE);
@@ -97,14 +96,14 @@ void MX_FREERTOS_Init(void) {
 	}
 	*flags = 0;
 
-	// Inicializacin de los datos compartidos
+	// Inicialización de los datos compartidos
 	if (!shareData_init(flags)){
 		enciendeLED(AZUL);
 		enciendeLED(VERDE);
 		while(1) {}
 	}
 
-	// Inicializacin de los datos recibidos por las comunicaciones
+	// Inicialización de los datos recibidos por las comunicaciones
 	if ((serial = (pilePointers_t*) pvPortMalloc(sizeof(pilePointers_t))) == NULL) {
 		enciendeLED(AZUL);
 		enciendeLED(VERDE);
@@ -121,7 +120,7 @@ void MX_FREERTOS_Init(void) {
 		while (1) {}
 	}
 
-	// Inicializacin de los datos del coche
+	// Inicialización de los datos del coche
 	if ((coche = (car*) pvPortMalloc(sizeof(car))) == NULL) {
 		enciendeLED(AZUL);
 		enciendeLED(VERDE);
@@ -133,27 +132,15 @@ void MX_FREERTOS_Init(void) {
 	coche->setupState = NUM_SETUP;
 	coche->lastLat = 0;
 	coche->lastLong = 0;
+	initParams(coche);
 
-#if TEST
-	coche->times = 0;
-	for (i = 0; i < NUM_VAL_CALC; i++) {
-#if SPEED_TEST
-		coche->speed[i] = 0;
-#else
-		coche->speed[0] = 0;
-#endif
-#if RPM_TEST
-		coche->rpm[i] = 0;
-#else
-		coche->rpm[0] = 0;
-#endif
-#if AIR_TEST
-		coche->air[i] = 0;
-#else
-		coche->air[0] = 0;
-#endif
+	// Inicialización de las ventanas de muestras del coche
+	if (!window_init(&(coche->speed), SPEED_WINDOW) || !window_init(&(coche->rpm), RPM_WINDOW)
+			|| !window_init(&(coche->air), AIR_WINDOW)) {
+		enciendeLED(AZUL);
+		enciendeLED(VERDE);
+		while (1) {}
 	}
-#endif
 
 	MX_USB_DEVICE_Init();
   /* USER CODE END Init */
@@ -207,7 +194,7 @@ void StartUsbTask(void const * argument)
 	uint32_t clk1, clk2;
 	pilePointers_t *serial = (pilePointers_t*) argument;
 
-	// Si no se puede crear la mquina, paramos hebra
+	// Si no se puede crear la máquina, paramos hebra
 	if ((usb = init_usb(serial)) == NULL) {
 		enciendeLED(VERDE);
 		while(1){}
@@ -239,7 +226,7 @@ void StartMicroTask(void const * argument)
 	uint32_t clk1, clk2;
 	car *coche = (car*) argument;
 
-	// Si no se puede crear la mquina, paramos hebra
+	// Si no se puede crear la máquina, paramos hebra
 	if ((micro = init_micro(coche)) == NULL) {
 		enciendeLED(AZUL);
 		while(1){}
@@ -267,51 +254,13 @@ void StartAliveTask(void const * argument)
 {
 	/* USER CODE BEGIN startAliveTask */
 	uint32_t clk1, clk2;
-	uint8_t mssgLen, mssgPos, cont = 0;
-	uint8_t *mssg;
-	uint16_t *flags = (uint16_t*) argument;
+	uint8_t cont = 0;
 	clk1 = osKernelSysTick();
 	/* Infinite loop */
 	for(;;)
 	{
 		(cont == 5)? enciendeLED(VERDE) : apagaLED(VERDE);
 		cont = (cont+1)%6;
-#if TEST
-		// Envo del mensaje de test de forma peridica
-		if ((*flags) & TEST_MSSG) {
-			mssgPos = 10;
-
-			// Reservamos memoria en funcin de los datos que vayamos a pedir en el test
-			mssgLen = 11
-	#if SPEED_TEST
-					+2
-	#endif
-	#if RPM_TEST
-					+2
-	#endif
-					;
-
-			mssg = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*mssgLen);
-
-			// Creamos el mensaje con los datos a pedir en el test
-			mssg[0] = 's'; mssg[1] = 't'; mssg[2] = 'n'; mssg[3] = ' '; mssg[4] = 'o'; mssg[5] = 'b'; mssg[6] = 'd'; mssg[7] = ' '; mssg[8] = '0'; mssg[9] = '1';
-	#if SPEED_TEST
-			mssg[mssgPos] = '0'; mssg[mssgPos+1] = 'd';
-			mssgPos += 2;
-	#endif
-	#if RPM_TEST
-			mssg[mssgPos] = '0'; mssg[mssgPos+1] = 'c';
-			mssgPos += 2;
-	#endif
-			mssg[mssgPos] = '\r';
-
-			lockRX();
-			putRX(mssg, mssgLen);
-			unlockRX();
-			*flags = *flags | B_NOT_READ;
-			vPortFree(mssg);
-		}
-#endif
 		clk2 = osKernelSysTick();
 		osDelay(SEND_PERIOD/NUM_VAL_CALC - (clk2 - clk1));
 		clk1 += SEND_PERIOD/NUM_VAL_CALC;
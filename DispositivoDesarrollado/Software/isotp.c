@@ -0,0 +1,131 @@
+/*
+ * isotp.c
+ *
+ *  Reensamblado de respuestas ISO 15765-2 (ISO-TP) a partir de las líneas del STN
+ *      Author: miguelvp
+ */
+
+#include "isotp.h"
+#include "shareData.h"
+
+// Formato de las líneas con cabeceras (ATH1) y CAN de 11 bits: "7E8 10 14 49 02 01 ..."
+#define ISOTP_ID_CHARS		3
+#define ISOTP_PCI			4		// Tipo de trama y longitud o secuencia
+#define ISOTP_SF_DATA		7		// Datos de una trama única
+#define ISOTP_FF_LENGTH		7		// Segundo byte de longitud de la primera trama
+#define ISOTP_FF_DATA		10		// Datos de la primera trama
+#define ISOTP_CF_DATA		7		// Datos de una trama consecutiva
+#define ISOTP_NEXT			3		// Distancia entre bytes ("XX ")
+
+// Tipos de trama (nibble alto del PCI)
+#define ISOTP_SINGLE		0x0
+#define ISOTP_FIRST			0x1
+#define ISOTP_CONSECUTIVE	0x2
+
+static uint8_t copyData(isotp_t *tp, const uint8_t *line, uint8_t len, uint8_t pos);
+
+/*
+ * @brief	Prepara el reensamblado de un mensaje en el buffer indicado
+ * @param	tp: estado del reensamblado
+ * 			buf: destino de los datos del mensaje
+ * 			size: tamaño de buf
+ * @retval	Nada
+ */
+void isotp_init(isotp_t *tp, uint8_t *buf, uint16_t size)
+{
+	tp->buf = buf;
+	tp->size = size;
+	tp->len = 0;
+	tp->received = 0;
+	tp->active = 0;
+}
+
+/*
+ * @brief	Procesa una línea recibida del STN. Las tramas de otras ECU distintas a la que
+ * 			envió la primera trama se ignoran
+ * @param	tp: estado del reensamblado
+ * 			line: línea recibida
+ * 			len: caracteres de la línea
+ * @retval	Resultado del procesado (ver isotpResult)
+ */
+isotpResult isotp_line(isotp_t *tp, const uint8_t *line, uint8_t len)
+{
+	uint8_t i, pci;
+	uint16_t id = 0;
+
+	// Identificador y PCI
+	if (len < ISOTP_SF_DATA + 2 || line[ISOTP_ID_CHARS] != ' ')
+		return ISOTP_IGNORED;
+	for (i = 0; i < ISOTP_ID_CHARS; i++) {
+		if (hexValue[line[i]] == HEX_INVALID)
+			return ISOTP_IGNORED;
+		id = (id << 4) | hexValue[line[i]];
+	}
+	if (hexValue[line[ISOTP_PCI]] == HEX_INVALID || hexValue[line[ISOTP_PCI+1]] == HEX_INVALID)
+		return ISOTP_IGNORED;
+	pci = HEX_BYTE(&line[ISOTP_PCI]);
+
+	// Con un mensaje multitrama en curso sólo se atiende a su ECU
+	if (tp->active && id != tp->id)
+		return ISOTP_IGNORED;
+
+	switch (pci >> 4) {
+	case ISOTP_SINGLE:
+		if (!(pci & 0x0F) || (pci & 0x0F) > tp->size)
+			return ISOTP_ERROR;
+		tp->id = id;
+		tp->len = pci & 0x0F;
+		tp->received = 0;
+		tp->active = 0;
+		return copyData(tp, line, len, ISOTP_SF_DATA) ? ISOTP_COMPLETE : ISOTP_ERROR;
+
+	case ISOTP_FIRST:
+		if (len < ISOTP_FF_DATA + 2)
+			return ISOTP_IGNORED;
+		tp->id = id;
+		tp->len = ((pci & 0x0F) << 8) | HEX_BYTE(&line[ISOTP_FF_LENGTH]);
+		tp->received = 0;
+		tp->seq = 1;
+		if (tp->len > tp->size) {
+			tp->active = 0;
+			return ISOTP_ERROR;
+		}
+		tp->active = 1;
+		copyData(tp, line, len, ISOTP_FF_DATA);
+		return ISOTP_MORE;
+
+	case ISOTP_CONSECUTIVE:
+		if (!tp->active)
+			return ISOTP_IGNORED;
+		if ((pci & 0x0F) != tp->seq) {
+			tp->active = 0;
+			return ISOTP_ERROR;
+		}
+		tp->seq = (tp->seq + 1) & 0x0F;
+		if (copyData(tp, line, len, ISOTP_CF_DATA)) {
+			tp->active = 0;
+			return ISOTP_COMPLETE;
+		}
+		return ISOTP_MORE;
+
+	default:
+		return ISOTP_IGNORED;
+	}
+}
+
+/*
+ * @brief	Escribe en el buffer los bytes de datos de la trama, sin pasar del mensaje
+ * @param	tp: estado del reensamblado
+ * 			line: línea recibida
+ * 			len: caracteres de la línea
+ * 			pos: posición del primer byte de datos
+ * @retval	1 -> Mensaje completo
+ * 			0 -> Faltan datos
+ */
+static uint8_t copyData(isotp_t *tp, const uint8_t *line, uint8_t len, uint8_t pos)
+{
+	for (; pos + 1 < len && tp->received < tp->len; pos += ISOTP_NEXT) {
+		tp->buf[tp->received++] = HEX_BYTE(&line[pos]);
+	}
+	return tp->received == tp->len;
+}
@@ -0,0 +1,38 @@
+/*
+ * isotp.h
+ *
+ *  Reensamblado de respuestas ISO 15765-2 (ISO-TP) a partir de las líneas del STN
+ *      Author: miguelvp
+ */
+
+#ifndef ISOTP_H_
+#define ISOTP_H_
+
+#include <stdint.h>
+
+// Longitud máxima de un mensaje ISO-TP (12 bits de la primera trama)
+#define ISOTP_MAX_LENGTH	4095
+
+// Resultado de procesar una línea
+typedef enum isotpResult {
+	ISOTP_MORE,			// Faltan tramas consecutivas
+	ISOTP_COMPLETE,		// Mensaje completo en el buffer
+	ISOTP_IGNORED,		// Línea que no pertenece al mensaje (otra ECU, texto del STN...)
+	ISOTP_ERROR			// Secuencia incorrecta o mensaje mayor que el buffer: se descarta
+} isotpResult;
+
+// Estado del reensamblado. Los datos se escriben directamente en el buffer del llamante
+typedef struct isotp_t {
+	uint8_t		*buf;
+	uint16_t	size;		// Tamaño de buf
+	uint16_t	len;		// Longitud anunciada del mensaje
+	uint16_t	received;	// Bytes ya escritos en buf
+	uint16_t	id;			// Identificador de la ECU que responde
+	uint8_t		seq;		// Siguiente número de secuencia esperado
+	uint8_t		active;		// Mensaje multitrama en curso
+} isotp_t;
+
+void isotp_init(isotp_t *tp, uint8_t *buf, uint16_t size);
+isotpResult isotp_line(isotp_t *tp, const uint8_t *line, uint8_t len);
+
+#endif /* ISOTP_H_ */
@@ -11,6 +11,9 @@
 #include "main.h"
 #include "pids.h"
 #include "copert.h"
+#include "scheduler.h"
+#include "monitor.h"
+#include "isotp.h"
 #include <string.h>
 #include "printf.h"
 
@@ -23,10 +26,13 @@
 #define TIMER_GNSS			3	//segundos
 #define TIMER_NB			60	//segundos
 
+// Ventana del STN (STBRT) para recibir el retorno de carro a la nueva tasa
+#define STN_BAUD_WINDOW		250	//milisegundos
+
 // Conversion de segundos a milisegundos
 #define SEC_TO_MILL			1000
 
-// Funciones de comprobacin
+// Funciones de comprobación
 static uint8_t alwaysRead (fsm_t *this);
 static uint8_t setupState (fsm_t *this);
 static uint8_t respondSTN (fsm_t *this);
@@ -40,13 +46,22 @@ static uint8_t stnMssg (fsm_t *this);
 static uint8_t gnssMssg (fsm_t *this);
 static uint8_t nbMssg (fsm_t *this);
 static uint8_t timeout (fsm_t *this);
-
-// Funciones de transicin
+static uint8_t pidsDue (fsm_t *this);
+static uint8_t batchExpired (fsm_t *this);
+static uint8_t nextRequest (fsm_t *this);
+static uint8_t monitorMssg (fsm_t *this);
+static uint8_t monitorOn (fsm_t *this);
+static uint8_t monitorData (fsm_t *this);
+
+// Funciones de transición
 static void read (fsm_t *this);
 static void sendSTN (fsm_t *this);
 static void sendGNSS (fsm_t *this);
 static void setupGNSS (fsm_t *this);
 static void sendNB (fsm_t *this);
+static void sendScheduled (fsm_t *this);
+static void flushBatch (fsm_t *this);
+static void sendNext (fsm_t *this);
 static void translateOBD (fsm_t *this);
 static void back (fsm_t *this);
 static void resetSTN (fsm_t *this);
@@ -58,13 +73,32 @@ static void successConnection (fsm_t *this);
 static void checkConexion (fsm_t *this);
 static void clearNewSTN (fsm_t *this);
 static void clearSetupSTN (fsm_t *this);
+static void baudFallback (fsm_t *this);
+static void startMonitor (fsm_t *this);
+static void setupMonitor (fsm_t *this);
+static void storeMonitor (fsm_t *this);
+static void stopMonitor (fsm_t *this);
+static void endMonitor (fsm_t *this);
 static void clearNewNB (fsm_t *this);
 static void clearSetupNB (fsm_t *this);
 static void clearAll (fsm_t *this);
 
 // Funciones auxiliares
 static uint32_t decodeNumber (uint8_t *data, uint8_t len);
+static uint32_t decodeField (uint8_t *data, uint8_t *pos, uint8_t base);
+static uint8_t setupCOPERT (car *coche, uint8_t *data);
+static uint8_t setupWindows (car *coche, uint8_t *data);
 static void setPosition (car *coche);
+static uint8_t decodeBatch (car *coche, uint8_t *data, uint8_t len);
+static void storePID (car *coche, uint8_t pid, uint32_t value);
+static void decodeService9 (car *coche, const uint8_t *msg, uint16_t len);
+static uint8_t negotiateBaud (fsm_t *this);
+static void fillQueue (void);
+static void popQueue (void);
+static uint8_t readLineSTN (fsm_t *this, uint8_t *line, uint8_t size);
+#if TEST
+static void updateEmissions (car *coche);
+#endif
 
 // Mensajes de debug
 #if DEBUG
@@ -83,7 +117,75 @@ static const uint8_t mssg[9][22] = {
 };
 #endif
 
-// Estados de la mquina
+// Decodificación de cada PID
+static const pidDecoder_t pidDecoders[PID_DECODERS_SIZE] = PID_DECODERS;
+
+// Estado del recorrido de una respuesta de varios PIDs, que puede ocupar varias tramas
+static struct {
+	uint16_t remaining;		// Bytes de la respuesta aún por llegar
+	uint8_t service;		// Se ha leído ya el byte de servicio
+	uint8_t pid;			// PID en curso
+	uint8_t left;			// Bytes de datos del PID en curso aún por leer (0 -> toca un PID)
+	uint32_t value;
+} batch;
+
+// Cola de peticiones OBD preparadas: la cabeza es la que está en el STN y su respuesta es
+// la que se recibe, por lo que las respuestas se asocian en orden a las peticiones
+#define OBD_QUEUE_SIZE		4
+
+typedef struct obdRequest_t {
+	command cmd;
+	uint8_t num;					// PIDs de una petición STN_GET_BATCH
+	uint8_t pids[OBD_MAX_PIDS];
+} obdRequest_t;
+
+static struct {
+	obdRequest_t req[OBD_QUEUE_SIZE];
+	uint8_t head;
+	uint8_t count;
+	uint8_t inFlight;				// La cabeza se ha enviado y espera el prompt
+} obdQueue;
+
+// Mensajes que obligan a volver a IDLE en lugar de encadenar la siguiente petición
+#define PENDING_MSSG		(B_NOT_READ | STN_MSSG | GNSS_MSSG | NB_MSSG | MONITOR_MSSG)
+
+// Respuestas del servicio 09, reensambladas directamente en service9 (VIN, CALID, ECU...)
+#define SERVICE9_SIZE		128
+static uint8_t service9[SERVICE9_SIZE];
+static isotp_t service9Tp;
+
+// Tasas a negociar con el STN, de mayor a menor. Si ninguna funciona se mantiene la inicial
+static const uint32_t stnBauds[] = {2000000, 1000000, 500000, 230400, 115200};
+#define NUM_STN_BAUDS		(sizeof(stnBauds)/sizeof(stnBauds[0]))
+
+// Pasos de la negociación de la tasa de la UART1 con el STN (STBR)
+typedef enum baudStep {
+	BAUD_WINDOW,		// Envío de la ventana de confirmación (STBRT)
+	BAUD_REQUEST,		// Envío de STBR con la tasa candidata
+	BAUD_SWITCH,		// Esperando el OK a la tasa anterior
+	BAUD_VERIFY,		// Esperando el identificador del STN a la nueva tasa
+	BAUD_CONFIRM,		// Enviado el retorno de carro, esperando el prompt a la nueva tasa
+	BAUD_DONE
+} baudStep;
+
+static struct {
+	baudStep step;
+	uint8_t index;			// Tasa candidata en stnBauds
+	uint32_t oldBaud;		// Tasa a la que volver si falla la verificación
+} baud;
+
+// Identificadores CAN que se dejan pasar en modo monitor
+#define MONITOR_MAX_IDS		8
+
+// Configuración del modo monitor: filtros de paso de la tabla de señales y STM, o STMA
+static struct {
+	uint8_t all;			// Sin filtros (STMA)
+	uint8_t step;			// Filtros ya enviados
+	uint8_t num;
+	uint16_t ids[MONITOR_MAX_IDS];
+} monitorCfg;
+
+// Estados de la máquina
 static enum uCstates {
 	PREV,
 	SETUP_STN,
@@ -95,6 +197,8 @@ static enum uCstates {
 	COM_STN,
 	COM_GNSS,
 	COM_NB,
+	MON_SETUP,
+	MON_STREAM,
 };
 
 // Tabla de transiciones
@@ -103,6 +207,7 @@ static fsm_trans_t uC_tt[] = {
 	{SETUP_STN,		setupState,		SETUP_GNSS,		setupGNSS},
 	{SETUP_STN,		respondSTN,		SETUP_STN,		clearSetupSTN},
 	{SETUP_STN,		newDataSTN,		SETUP_STN,		setupSTN},
+	{SETUP_STN,		timeout,		SETUP_STN,		baudFallback},
 	{SETUP_GNSS,	setupState,		SETUP_NB,		setupNB},
 	{SETUP_GNSS,	timeout,		SETUP_GNSS,		setupGNSS},
 	{SETUP_NB,		respondNB,		SETUP_NB,		clearSetupNB},
@@ -117,19 +222,31 @@ static fsm_trans_t uC_tt[] = {
 	{IDLE,			stnMssg,		COM_STN,		sendSTN},
 	{IDLE,			gnssMssg,		COM_GNSS,		sendGNSS},
 	{IDLE,			nbMssg,			COM_NB, 		sendNB},
+	{IDLE,			monitorMssg,	MON_SETUP,		startMonitor},
+	{IDLE,			pidsDue,		COM_STN,		sendScheduled},
+	{IDLE,			batchExpired,	IDLE,			flushBatch},
 	{COM_STN, 		respondSTN, 	COM_STN, 		translateOBD},
+	{COM_STN, 		nextRequest, 	COM_STN, 		sendNext},
 	{COM_STN, 		newDataSTN, 	IDLE, 			back},
 	{COM_STN,		timeout,		IDLE,			resetSTN},
 	{COM_GNSS,		timeout,		IDLE,			NULL},
 	{COM_NB,		respondSTN, 	IDLE, 			translateNB},
 	{COM_NB,		timeout,		IDLE,			resetNB},
+	{MON_SETUP,		newDataSTN,		MON_SETUP,		setupMonitor},
+	{MON_SETUP,		monitorOn,		MON_STREAM,		NULL},
+	{MON_SETUP,		timeout,		IDLE,			resetSTN},
+	{MON_STREAM,	dataRead,		MON_STREAM,		read},
+	{MON_STREAM,	monitorData,	MON_STREAM,		storeMonitor},
+	{MON_STREAM,	monitorMssg,	MON_STREAM,		stopMonitor},
+	{MON_STREAM,	newDataSTN,		IDLE,			endMonitor},
+	{MON_STREAM,	timeout,		IDLE,			endMonitor},
 	{-1, NULL, -1, NULL},
 };
 
 /*
- * @brief 	Inicializacin de la mquina de estados
- * @param 	flags: puntero a la variable compartida de la sealizacin por flags
- * @retval 	Mquina de estados
+ * @brief 	Inicialización de la máquina de estados
+ * @param 	flags: puntero a la variable compartida de la señalización por flags
+ * @retval 	Máquina de estados
  */
 fsm_t* init_micro(car *coche)
 {
@@ -137,7 +254,9 @@ fsm_t* init_micro(car *coche)
 	fsm = fsm_new(uC_tt, coche);
 
 #if USE_STN
-	initSTNCom();
+	initSTNCom(coche->communication->flags);
+	scheduler_init(osKernelSysTick());
+	isotp_init(&service9Tp, service9, SERVICE9_SIZE);
 	HAL_GPIO_WritePin(STN_RST_GPIO_Port, STN_RST_Pin, 0);
 #endif
 
@@ -153,8 +272,8 @@ fsm_t* init_micro(car *coche)
 }
 
 /*
- * @brief	Siempre ejecuta al prximo estado
- * @param	this: mquina de estados a evaluar
+ * @brief	Siempre ejecuta al próximo estado
+ * @param	this: máquina de estados a evaluar
  * @retval	1 -> Siempre ejecuta
  */
 static uint8_t alwaysRead (fsm_t *this)
@@ -163,10 +282,10 @@ static uint8_t alwaysRead (fsm_t *this)
 }
 
 /*
- * @brief	Comprueba si ha terminado de completarse la configuracin
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> La configuracin ha terminado
- * 			 0 -> La configuracin no ha terminado
+ * @brief	Comprueba si ha terminado de completarse la configuración
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> La configuración ha terminado
+ * 			 0 -> La configuración no ha terminado
  */
 static uint8_t setupState (fsm_t *this)
 {
@@ -174,10 +293,10 @@ static uint8_t setupState (fsm_t *this)
 }
 
 /*
- * @brief	Comprueba si el mdulo de STN ha respondido
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> El mdulo STN tiene una nueva respuesta
- * 			 0 -> El mdulo se mantiene
+ * @brief	Comprueba si el módulo de STN ha respondido
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> El módulo STN tiene una nueva respuesta
+ * 			 0 -> El módulo se mantiene
  */
 static uint8_t respondSTN (fsm_t *this)
 {
@@ -186,10 +305,10 @@ static uint8_t respondSTN (fsm_t *this)
 
 
 /*
- * @brief	Comprueba si el mdulo de STN solicita nuevos datos
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> El mdulo STN espera nuevos datos
- * 			 0 -> El mdulo se mantiene commo estaba
+ * @brief	Comprueba si el módulo de STN solicita nuevos datos
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> El módulo STN espera nuevos datos
+ * 			 0 -> El módulo se mantiene commo estaba
  */
 static uint8_t newDataSTN (fsm_t *this)
 {
@@ -197,10 +316,10 @@ static uint8_t newDataSTN (fsm_t *this)
 }
 
 /*
- * @brief	Comprueba si el mdulo de NB-IoT ha respondido
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> El mdulo NB-IoT tiene una nueva respuesta
- * 			 0 -> El mdulo se mantiene
+ * @brief	Comprueba si el módulo de NB-IoT ha respondido
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> El módulo NB-IoT tiene una nueva respuesta
+ * 			 0 -> El módulo se mantiene
  */
 static uint8_t respondNB (fsm_t *this)
 {
@@ -208,10 +327,10 @@ static uint8_t respondNB (fsm_t *this)
 }
 
 /*
- * @brief	Comprueba si el mdulo de NB-IoT solicita nuevos datos
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> El mdulo NB-IoT espera nuevos datos
- * 			 0 -> El mdulo se mantiene commo estaba
+ * @brief	Comprueba si el módulo de NB-IoT solicita nuevos datos
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> El módulo NB-IoT espera nuevos datos
+ * 			 0 -> El módulo se mantiene commo estaba
  */
 static uint8_t newDataNB (fsm_t *this)
 {
@@ -219,10 +338,10 @@ static uint8_t newDataNB (fsm_t *this)
 }
 
 /*
- * @brief	Comprueba si el mdulo NB-IoT se ha configurado correctamente con el socket creado
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> La configuracin ha sido un xito
- * 			 0 -> La configuracin est indeterminada
+ * @brief	Comprueba si el módulo NB-IoT se ha configurado correctamente con el socket creado
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> La configuración ha sido un éxito
+ * 			 0 -> La configuración está indeterminada
  */
 static uint8_t setupFinished (fsm_t *this)
 {
@@ -230,10 +349,10 @@ static uint8_t setupFinished (fsm_t *this)
 }
 
 /*
- * @brief	Comprueba si el mdulo NB-IoT se ha configurado correctamente con el socket creado
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> La configuracin ha fracasado
- * 			 0 -> La configuracin est indeterminada
+ * @brief	Comprueba si el módulo NB-IoT se ha configurado correctamente con el socket creado
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> La configuración ha fracasado
+ * 			 0 -> La configuración está indeterminada
  */
 static uint8_t tryAgain (fsm_t *this)
 {
@@ -241,8 +360,8 @@ static uint8_t tryAgain (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay datos recibidos no ledos
- * @param	this: mquina de estados a evaluar
+ * @brief	Comprobación de si hay datos recibidos no leídos
+ * @param	this: máquina de estados a evaluar
  * @retval	!0 -> Hay datos para leer
  * 			 0 -> No hay datos para leer
  */
@@ -252,10 +371,10 @@ static uint8_t dataRead (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay un mensaje para el STN
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> Hay datos para transmitir al mdulo
- * 			 0 -> No hay datos para transmitir al mdulo
+ * @brief	Comprobación de si hay un mensaje para el STN
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Hay datos para transmitir al módulo
+ * 			 0 -> No hay datos para transmitir al módulo
  */
 static uint8_t stnMssg (fsm_t *this)
 {
@@ -263,10 +382,10 @@ static uint8_t stnMssg (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay un mensaje para el GNSS
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> Hay datos para transmitir al mdulo
- * 			 0 -> No hay datos para transmitir al mdulo
+ * @brief	Comprobación de si hay un mensaje para el GNSS
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Hay datos para transmitir al módulo
+ * 			 0 -> No hay datos para transmitir al módulo
  */
 static uint8_t gnssMssg (fsm_t *this)
 {
@@ -274,10 +393,10 @@ static uint8_t gnssMssg (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay un mensaje para el NB-IoT
- * @param	this: mquina de estados a evaluar
- * @retval	!0 -> Hay datos para transmitir al mdulo
- * 			 0 -> No hay datos para transmitir al mdulo
+ * @brief	Comprobación de si hay un mensaje para el NB-IoT
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Hay datos para transmitir al módulo
+ * 			 0 -> No hay datos para transmitir al módulo
  */
 static uint8_t nbMssg (fsm_t *this)
 {
@@ -285,8 +404,8 @@ static uint8_t nbMssg (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si ha saltado el timeout
- * @param	this: mquina de estados a evaluar
+ * @brief	Comprobación de si ha saltado el timeout
+ * @param	this: máquina de estados a evaluar
  * @retval	!0 -> Ha saltado el timeout
  * 			 0 -> No ha saltado el timeout
  */
@@ -296,24 +415,94 @@ static uint8_t timeout (fsm_t *this)
 }
 
 /*
- * @brief	Lee los datos recibidos que hay en el buffer de recepcin
- * @param	this: mquina de estados de la accin
+ * @brief	Comprueba si durante la adquisición (activada con "test") toca pedir algún PID
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Hay PIDs que pedir al STN
+ * 			 0 -> No hay que pedir nada
+ */
+static uint8_t pidsDue (fsm_t *this)
+{
+	return (*(((car*)(this->data))->communication->flags) & TEST_MSSG)
+			&& (obdQueue.count || scheduler_due(osKernelSysTick()));
+}
+
+/*
+ * @brief	Comprueba si el lote de telemetría abierto ha superado su retraso máximo sin que
+ * 			una nueva ventana lo cierre (vehículo parado o sin respuesta del STN)
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Hay que enviar el lote
+ * 			 0 -> No hay lote pendiente o aún puede esperar
+ */
+static uint8_t batchExpired (fsm_t *this)
+{
+	return expiredMssg();
+}
+
+/*
+ * @brief	Comprueba si, recibido el prompt, se puede enviar ya la siguiente petición sin
+ * 			pasar por IDLE (no hay mensajes del usuario pendientes)
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Se encadena la siguiente petición
+ * 			 0 -> Se vuelve a IDLE
+ */
+static uint8_t nextRequest (fsm_t *this)
+{
+	uint16_t flags = *(((car*)(this->data))->communication->flags);
+	return (flags & NEW_DATA_STN) && !(flags & PENDING_MSSG) && pidsDue(this);
+}
+
+/*
+ * @brief	Comprueba si se ha pedido entrar o salir del modo monitor ("mon")
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Cambio de modo pedido
+ * 			 0 -> Nada
+ */
+static uint8_t monitorMssg (fsm_t *this)
+{
+	return (*(((car*)(this->data))->communication->flags) & MONITOR_MSSG) != 0;
+}
+
+/*
+ * @brief	Comprueba si el STN ya está en modo monitor
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> En modo monitor
+ * 			 0 -> Aún configurándose
+ */
+static uint8_t monitorOn (fsm_t *this)
+{
+	return monitor_active();
+}
+
+/*
+ * @brief	Comprueba si hay señales decodificadas del modo monitor sin guardar
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Hay valores nuevos
+ * 			 0 -> Ninguno
+ */
+static uint8_t monitorData (fsm_t *this)
+{
+	return monitor_pending();
+}
+
+/*
+ * @brief	Lee los datos recibidos que hay en el buffer de recepción
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void read (fsm_t *this)
 {
-	uint8_t resp[32];
-	uint16_t tipo;
+	uint8_t resp[32], i, num;
+	uint16_t tipo, len;
+	const pidSchedule_t *sched;
+	txStats_t usbStats, nbStats;
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
 
 	// Comprobamos los mensajes recibidos
-	lockRX();
 	if (lenFirstMssgRX() == notReadRX())
 		*flags = *flags & ~B_NOT_READ;
 	tipo = typeNextMssgRX();
-	unlockRX();
 
-	// Modificamos los flags segn el tipo de comando
+	// Modificamos los flags según el tipo de comando
 	lockTX();
 	switch (tipo) {
 
@@ -346,9 +535,12 @@ static void read (fsm_t *this)
 		sprintf_((char*) resp, "%s\r", mssg[6]);
 		putTX(resp, strlen((char*) resp));
 #endif
-		if (*flags & TEST_MSSG)
+		if (*flags & TEST_MSSG) {
+			// Fin de la adquisición: no se deja el lote de telemetría a medias (lockTX ya
+			// está tomado)
 			*flags = *flags & ~TEST_MSSG;
-		else
+			flushMssg();
+		} else
 			*flags = *flags | TEST_MSSG;
 		jumpMssgRX();
 		break;
@@ -358,22 +550,73 @@ static void read (fsm_t *this)
 		jumpMssgRX();
 		sprintf_((char*) resp, "%s,%3u,%4u,%3d\r",
 				((car*)(this->data))->vin,
-				((car*)(this->data))->speed,
-				((car*)(this->data))->rpm,
-				((car*)(this->data))->air);
+				window_last(&(((car*)(this->data))->speed)),
+				window_last(&(((car*)(this->data))->rpm)),
+				window_last(&(((car*)(this->data))->air)));
+
+		putTX(resp, strlen((char*) resp));
+
+		// Tasa objetivo y conseguida (centésimas de Hz) y periodos perdidos de cada PID
+		sched = scheduler_table(&num);
+		for (i = 0; i < num; i++) {
+			sprintf_((char*) resp, "%02X,%u,%u,%u\r", sched[i].pid,
+					(unsigned int) (100000 / sched[i].period),
+					(unsigned int) scheduler_rate(i, osKernelSysTick()),
+					(unsigned int) sched[i].missed);
+			putTX(resp, strlen((char*) resp));
+		}
 
+		// Ocupación máxima y descartes de las pilas de transmisión
+		statsTX(&usbStats, &nbStats);
+		sprintf_((char*) resp, "USB,%u,%u,%lu\r", usbStats.used, usbStats.highWater,
+				(unsigned long) usbStats.failures);
+		putTX(resp, strlen((char*) resp));
+		sprintf_((char*) resp, "NB,%u,%u,%lu\r", nbStats.used, nbStats.highWater,
+				(unsigned long) nbStats.failures);
 		putTX(resp, strlen((char*) resp));
 		*flags = *flags | TX_DATA;
 		break;
 
-	// Establecemos los parmetros de COPERT segn la norma Euro
+	// Entrada o salida del modo monitor. "mon all" monitoriza sin filtros (STMA)
+	case MONITOR_MSSG:
+		len = lenFirstMssgRX();
+		if (len > sizeof(resp)) {
+			jumpMssgRX();
+			break;
+		}
+		getRX(resp, len);
+		monitorCfg.all = (len > 6 && !memcmp(&resp[4], "all", 3));
+		*flags = *flags | MONITOR_MSSG;
+		break;
+
+	// Establecemos los parámetros de COPERT según la norma Euro
 	case SETUP_MSSG:
-		getRX(resp, 7);
-		if (resp[4] == '3')
-			tipo = EURO3_GAS;
-		else if (resp[4] == '6')
-			tipo = EURO6_DIESEL_2016;
-		setParams((car*)(this->data), (uint8_t) tipo);
+		len = lenFirstMssgRX();
+		if (len > sizeof(resp)) {
+			jumpMssgRX();
+			break;
+		}
+		getRX(resp, len);
+		if (!setupCOPERT((car*)(this->data), resp)) {
+			sprintf_((char*) resp, "Norma EURO no encontrada\r");
+			putTX(resp, strlen((char*) resp));
+			*flags = *flags | TX_DATA;
+		}
+		break;
+
+	// Longitud de las ventanas de muestras de velocidad, rpm y temperatura del aire
+	case WINDOW_MSSG:
+		len = lenFirstMssgRX();
+		if (len > sizeof(resp)) {
+			jumpMssgRX();
+			break;
+		}
+		getRX(resp, len);
+		if (!setupWindows((car*)(this->data), resp)) {
+			sprintf_((char*) resp, "Ventana no valida\r");
+			putTX(resp, strlen((char*) resp));
+			*flags = *flags | TX_DATA;
+		}
 		break;
 
 	default:
@@ -391,8 +634,8 @@ static void read (fsm_t *this)
 }
 
 /*
- * @brief	Enva datos al STN que haya en el buffer de recepcin
- * @param	this: mquina de estados de la accin
+ * @brief	Envía datos al STN que haya en el buffer de recepción
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void sendSTN (fsm_t *this)
@@ -400,14 +643,12 @@ static void sendSTN (fsm_t *this)
 	uint16_t len;
 	uint8_t *mens;
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
-	*flags = *flags & ~STN_MSSG;
+	*flags = *flags & ~(STN_MSSG | STN_TX_DONE);
 
-	// Recogemos el mensaje y lo transmitimos como comando al mdulo STN
-	lockRX();
+	// Recogemos el mensaje y lo transmitimos como comando al módulo STN
 	len = lenFirstMssgRX();
 	mens = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*len);
 	getRX(mens, len);
-	unlockRX();
 
 	STN_sendCMD(mens);
 	vPortFree(mens);
@@ -418,8 +659,8 @@ static void sendSTN (fsm_t *this)
 }
 
 /*
- * @brief	Enva datos al GNSS que haya en el buffer de recepcin
- * @param	this: mquina de estados de la accin
+ * @brief	Envía datos al GNSS que haya en el buffer de recepción
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void sendGNSS (fsm_t *this)
@@ -429,12 +670,10 @@ static void sendGNSS (fsm_t *this)
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
 	*flags = *flags & ~GNSS_MSSG;
 
-	// Recogemos el mensaje y lo transmitimos como comando al mdulo GNSS
-	lockRX();
+	// Recogemos el mensaje y lo transmitimos como comando al módulo GNSS
 	len = lenFirstMssgRX();
 	mens = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*len);
 	getRX(mens, len);
-	unlockRX();
 
 	GNSS_sendCMD(mens);
 	vPortFree(mens);
@@ -444,8 +683,8 @@ static void sendGNSS (fsm_t *this)
 }
 
 /*
- * @brief	Enva datos al NB-IoT que haya en el buffer de recepcin
- * @param	this: mquina de estados de la accin
+ * @brief	Envía datos al NB-IoT que haya en el buffer de recepción
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void sendNB (fsm_t *this)
@@ -455,12 +694,10 @@ static void sendNB (fsm_t *this)
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
 	*flags = *flags & ~NB_MSSG;
 
-	// Recogemos el mensaje y lo transmitimos como comando al mdulo NB-IoT
-	lockRX();
+	// Recogemos el mensaje y lo transmitimos como comando al módulo NB-IoT
 	len = lenFirstMssgRX();
 	mens = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*len);
 	getRX(mens, len);
-	unlockRX();
 
 	NB_sendCMD(mens);
 	vPortFree(mens);
@@ -470,142 +707,172 @@ static void sendNB (fsm_t *this)
 }
 
 /*
- * @brief	Traduce el mensaje que se recibe por parte del mdulo STN
- * @param	this: mquina de estados de la accin
+ * @brief	Envía por NB-IoT el lote de telemetría abierto
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void flushBatch (fsm_t *this)
+{
+	lockTX();
+	flushMssg();
+	unlockTX();
+}
+
+/*
+ * @brief	Envía al STN la primera petición de la cola, rellenándola antes con las peticiones
+ * 			del descubrimiento de PIDs o con los PIDs planificados a los que les toca
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void sendScheduled (fsm_t *this)
+{
+	obdRequest_t *req;
+	uint16_t *flags = (((car*)(this->data))->communication->flags);
+	*flags = *flags & ~STN_TX_DONE;
+
+	fillQueue();
+	if (!obdQueue.count)
+		return;
+
+	req = &obdQueue.req[obdQueue.head];
+	if (req->cmd == STN_GET_BATCH)
+		STN_sendBatch(req->pids, req->num);
+	else
+		STN_sendOBD(req->cmd);
+	obdQueue.inFlight = 1;
+
+	if (!launchTimer(TIMER_STN*SEC_TO_MILL)){
+		while(1){}
+	}
+}
+
+/*
+ * @brief	Recibido el prompt, se da por respondida la cabeza de la cola y se envía la
+ * 			siguiente petición en el mismo ciclo
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void sendNext (fsm_t *this)
+{
+	back(this);
+	sendScheduled(this);
+}
+
+/*
+ * @brief	Añade a la cola las peticiones pendientes. Las del descubrimiento dependen de la
+ * 			respuesta anterior, así que se añaden de una en una; los PIDs planificados se
+ * 			reparten en peticiones de OBD_MAX_PIDS mientras quepan
+ * @param	Nada
+ * @retval	Nada
+ */
+static void fillQueue (void)
+{
+	obdRequest_t *req;
+	command cmd;
+	uint32_t now = osKernelSysTick();
+
+	if ((cmd = scheduler_discovery()) != NO_CMD) {
+		if (!obdQueue.count) {
+			obdQueue.req[obdQueue.head].cmd = cmd;
+			obdQueue.count = 1;
+		}
+		return;
+	}
+
+	while (obdQueue.count < OBD_QUEUE_SIZE && scheduler_due(now)) {
+		req = &obdQueue.req[(obdQueue.head + obdQueue.count) % OBD_QUEUE_SIZE];
+		if (!(req->num = scheduler_next(now, req->pids, OBD_MAX_PIDS)))
+			break;
+		req->cmd = STN_GET_BATCH;
+		obdQueue.count++;
+	}
+}
+
+/*
+ * @brief	Saca de la cola la petición enviada, respondida o sin respuesta
+ * @param	Nada
+ * @retval	Nada
+ */
+static void popQueue (void)
+{
+	if (!obdQueue.inFlight)
+		return;
+	obdQueue.inFlight = 0;
+	obdQueue.head = (obdQueue.head + 1) % OBD_QUEUE_SIZE;
+	obdQueue.count--;
+}
+
+/*
+ * @brief	Traduce el mensaje que se recibe por parte del módulo STN
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void translateOBD (fsm_t *this)
 {
 	command lastCom;
-	uint8_t i, j, nLin;
+	uint8_t i, j;
 	uint8_t data[30], dev[20];
-	uint16_t head, pos;
+	uint16_t pos;
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
 	*flags = *flags & ~RESPOND_STN;
-	STN_getLastCommand(&lastCom);
-	i = 0;
+	if (obdQueue.inFlight)
+		lastCom = obdQueue.req[obdQueue.head].cmd;
+	else
+		STN_getLastCommand(&lastCom);
 
 	// Recogemos los datos almacenados en el buffer asociado a la UART1
 	osMutexWait(((car*)this->data)->communication->pileLock, 0);
-	pos = ((car*)this->data)->communication->pileUART1->tail;
-	head = ((car*)this->data)->communication->pileUART1->head;
-	do {
-		data[i] = ((car*)this->data)->communication->pileUART1->buffer[pos];
-		i++;
-		pos = (pos + 1) % ((car*)this->data)->communication->pileUART1->size;
-	} while (pos != head);
-	((car*)this->data)->communication->pileUART1->tail = pos;
+	i = circular_buf_read(((car*)this->data)->communication->pileUART1, data, sizeof(data) - 1);
 	osMutexRelease(((car*)this->data)->communication->pileLock);
 
-	// Segn el tipo de comando que mandamos, decodificamos de una forma u otra
+	// Según el tipo de comando que mandamos, decodificamos de una forma u otra
 	switch (lastCom) {
 
-	// Numero de bastidor: Transformacin al abecedario
+	// Servicio 09: las respuestas de varias tramas se reensamblan antes de interpretarse
+	case STN_PIDS_9:
+	case STN_GET_MONITOR:
+	case STN_GET_ECU_NAME:
+	case STN_GET_ENGINE_NUMBER:
+	case STN_GET_EROTAN:
 	case STN_GET_VIN:
-		if (data[0] == '7' && data[1] == 'E') {
-		switch (data[5]) {
-		// Lnea 1
-		case '0':
-			for (i = VIN_INIT_NUMBER; i < VIN_MAX_NUMBER; i += NEXT_NUMBER) {
-				((car*)(this->data))->vin
-						[(i-VIN_INIT_NUMBER)/NEXT_NUMBER] = 0;
-				if (data[i] >= ASCII_LETTER_THRESHOLD) {
-					((car*)(this->data))->vin
-							[(i-VIN_INIT_NUMBER)/NEXT_NUMBER] += (((data[i]-ASCII_LETTER_THRESHOLD)+10) << 4);	// Valores en hexadecimal A-F
-				} else if (data[i] >= ASCII_NUMBER_THRESHOLD) {
-					((car*)(this->data))->vin
-							[(i-VIN_INIT_NUMBER)/NEXT_NUMBER] += ((data[i]-ASCII_NUMBER_THRESHOLD) << 4);	// Valores en hexadecimal 0-9
-				}
-				if (data[i+1] >= ASCII_LETTER_THRESHOLD) {
-					((car*)(this->data))->vin
-							[(i-VIN_INIT_NUMBER)/NEXT_NUMBER] += ((data[i+1]-ASCII_LETTER_THRESHOLD)+10);	// Valores en hexadecimal A-F
-				} else if (data[i+1] >= ASCII_NUMBER_THRESHOLD) {
-					((car*)(this->data))->vin
-							[(i-VIN_INIT_NUMBER)/NEXT_NUMBER] += (data[i+1]-ASCII_NUMBER_THRESHOLD);	// Valores en hexadecimal 0-9
-				}
-			}
-
-			break;
-		// Lneas 2 y 3
-		case '1':
-		case '2':
-			nLin = data[5] - ASCII_NUMBER_THRESHOLD;
-			for (i = VIN_NEXT_LINE; i < VIN_MAX_NUMBER; i += NEXT_NUMBER) {
-				((car*)(this->data))->vin
-						[(i-VIN_NEXT_LINE)/NEXT_NUMBER + (VIN_MAX_NUMBER-VIN_INIT_NUMBER)/NEXT_NUMBER + ((VIN_MAX_NUMBER-VIN_NEXT_LINE)/NEXT_NUMBER*(nLin-1))] = 0;
-				if (data[i] >= ASCII_LETTER_THRESHOLD) {
-					((car*)(this->data))->vin
-							[(i-VIN_NEXT_LINE)/NEXT_NUMBER + (VIN_MAX_NUMBER-VIN_INIT_NUMBER)/NEXT_NUMBER + ((VIN_MAX_NUMBER-VIN_NEXT_LINE)/NEXT_NUMBER*(nLin-1))] += (((data[i]-ASCII_LETTER_THRESHOLD)+10) << 4);	// Valores en hexadecimal A-F
-				} else if (data[i] >= ASCII_NUMBER_THRESHOLD) {
-					((car*)(this->data))->vin
-							[(i-VIN_NEXT_LINE)/NEXT_NUMBER + (VIN_MAX_NUMBER-VIN_INIT_NUMBER)/NEXT_NUMBER + ((VIN_MAX_NUMBER-VIN_NEXT_LINE)/NEXT_NUMBER*(nLin-1))] += ((data[i]-ASCII_NUMBER_THRESHOLD) << 4);	// Valores en hexadecimal 0-9
-				}
-				if (data[i+1] >= ASCII_LETTER_THRESHOLD) {
-					((car*)(this->data))->vin
-							[(i-VIN_NEXT_LINE)/NEXT_NUMBER + (VIN_MAX_NUMBER-VIN_INIT_NUMBER)/NEXT_NUMBER + ((VIN_MAX_NUMBER-VIN_NEXT_LINE)/NEXT_NUMBER*(nLin-1))] += ((data[i+1]-ASCII_LETTER_THRESHOLD)+10);	// Valores en hexadecimal A-F
-				} else if (data[i+1] >= ASCII_NUMBER_THRESHOLD) {
-					((car*)(this->data))->vin
-							[(i-VIN_NEXT_LINE)/NEXT_NUMBER + (VIN_MAX_NUMBER-VIN_INIT_NUMBER)/NEXT_NUMBER + ((VIN_MAX_NUMBER-VIN_NEXT_LINE)/NEXT_NUMBER*(nLin-1))] += (data[i+1]-ASCII_NUMBER_THRESHOLD);	// Valores en hexadecimal 0-9
-				}
-			}
-#if DEBUG || TEST
-			if (nLin == 2) {
-				((car*)(this->data))->vin[VIN_LENGTH] = '\0';
-				sprintf_((char*) data, "%s\r", ((car*)(this->data))->vin);
-				putTX(data, strlen((char*) data));
-				*flags = *flags | TX_DATA;
-			}
-#endif
-			break;
-		}
-		}
+		if (isotp_line(&service9Tp, data, i) == ISOTP_COMPLETE)
+			decodeService9((car*)(this->data), service9, service9Tp.received);
 		break;
 
-	// Revoluciones por minuto: Pasar a nmero y aplicar correccin
-	case STN_GET_RPM:
-		if (data[0] == '7' && data[1] == 'E') {
-		((car*)(this->data))->rpm[0] = 0;
-		((car*)(this->data))->rpm[0] = decodeNumber(&(data[PAYLOAD]), data[NUM_BYTES] - ASCII_NUMBER_THRESHOLD - LEN_HEADER_OBD);
-		((car*)(this->data))->rpm[0] /= CORRECCION_RPM;
-#if DEBUG || TEST
-		sprintf_((char*) dev, "%d\r", ((car*)(this->data))->rpm[0]);
-		putTX(dev, strlen((char*) dev));
-		*flags = *flags | TX_DATA;
-#endif
-		}
+	// PIDs soportados: bitmap de 32 PIDs por respuesta
+	case STN_PIDS_1_1:
+	case STN_PIDS_1_2:
+	case STN_PIDS_1_3:
+	case STN_PIDS_1_4:
+	case STN_PIDS_1_5:
+	case STN_PIDS_1_6:
+		if (data[0] == '7' && data[1] == 'E' && i > PAYLOAD + 3*NEXT_NUMBER + 1)
+			scheduler_supported(lastCom, decodeNumber(&(data[PAYLOAD]), 4));
 		break;
 
-	// Velocidad: Pasar a nmero
+	// Respuestas del servicio 01, de uno o varios PIDs: se recorren PID a PID y cada uno
+	// se decodifica según su línea de pidDecoders
+	case STN_GET_RPM:
 	case STN_GET_SPEED:
-		if (data[0] == '7' && data[1] == 'E') {
-		((car*)(this->data))->speed[0] = 0;
-		((car*)(this->data))->speed[0] = decodeNumber(&(data[PAYLOAD]), data[NUM_BYTES] - ASCII_NUMBER_THRESHOLD - LEN_HEADER_OBD);	// Nunca es mayor a 8 (al menos en la velocidad)
-
-#if DEBUG || TEST
-		setPosition((car*)(this->data));
-		sprintf_((char*) dev, "%d\r", ((car*)(this->data))->speed[0]);
-		putTX(dev, strlen((char*) dev));
-		*flags = *flags | TX_DATA;
-#endif
-		}
-		break;
-
-	// Tipo de combustible: TODO con la tabla de conversiones dado por los PIDs
-	case STN_GET_FUEL:
-		((car*)(this->data))->fuel = NONE;
-		((car*)(this->data))->fuel = decodeNumber(&(data[PAYLOAD]), data[NUM_BYTES] - ASCII_NUMBER_THRESHOLD - LEN_HEADER_OBD);
-		break;
-
-	// Temperatura del aire ambiente: Pasar a nmero y aplicar correccin
+	case STN_GET_TIMESTART:
 	case STN_GET_AIR_TEMPERATURE:
-		if (data[0] == '7' && data[1] == 'E') {
-		((car*)(this->data))->air[0] = 0;
-		((car*)(this->data))->air[0] = decodeNumber(&(data[PAYLOAD]), data[NUM_BYTES] - ASCII_NUMBER_THRESHOLD - LEN_HEADER_OBD);
-		((car*)(this->data))->air[0] += CORRECCION_AIR;
+	case STN_GET_FUEL:
+	case STN_GET_DPF_1:
+	case STN_GET_DPF_2:
+	case STN_GET_NOx_NTE:
+	case STN_GET_PM_NTE:
+	case STN_GET_NOx_SENSOR:
+	case STN_GET_PM_SENSOR:
+	case STN_GET_NOx_SENSOR_CORRECTED:
+	case STN_GET_BATCH:
+		if (data[0] == '7' && data[1] == 'E' && decodeBatch((car*)(this->data), data, i)) {
 #if DEBUG || TEST
-		sprintf_((char*) dev, "%3d\r", ((car*)(this->data))->air[0]);
-		putTX(dev, strlen((char*) dev));
-		*flags = *flags | TX_DATA;
+			sprintf_((char*) dev, "%3u,%4u,%3d\r",
+					window_last(&(((car*)(this->data))->speed)),
+					window_last(&(((car*)(this->data))->rpm)),
+					window_last(&(((car*)(this->data))->air)));
+			putTX(dev, strlen((char*) dev));
+			*flags = *flags | TX_DATA;
 #endif
 		}
 		break;
@@ -616,33 +883,25 @@ static void translateOBD (fsm_t *this)
 		if (*flags & TEST_MSSG) {
 #if TEST
 			i = 0;
-			j = ((car*)(this->data))->times;
+			j = 0;
 			pos = PAYLOAD;
 #if SPEED_TEST
-			((car*)(this->data))->speed[j] = 0;
-			((car*)(this->data))->speed[j] = decodeNumber(&(data[pos]), 1);
-			calcCO(((car*)(this->data)), SEND_PERIOD/NUM_VAL_CALC);
-			calcNOx(((car*)(this->data)), SEND_PERIOD/NUM_VAL_CALC);
-			calcPM(((car*)(this->data)), SEND_PERIOD/NUM_VAL_CALC);
+			j = window_put(&(((car*)(this->data))->speed), decodeNumber(&(data[pos]), 1));
+			calcEmissions(((car*)(this->data)), SEND_PERIOD/NUM_VAL_CALC);
 			pos += 6;		// "0D XX "
 #endif
 #if RPM_TEST
-			((car*)(this->data))->rpm[j] = 0;
-			((car*)(this->data))->rpm[j] = decodeNumber(&(data[pos]), 2);
-			((car*)(this->data))->rpm[j] /= CORRECCION_RPM;
+			j |= window_put(&(((car*)(this->data))->rpm), decodeNumber(&(data[pos]), 2) / CORRECCION_RPM);
 			pos += 9;
 #endif
-			if (j == NUM_VAL_CALC-1) {
+			// Se envían los datos cada vez que se completa la ventana de muestras
+			if (j) {
 				setPosition((car*)(this->data));
 				lockTX();
 				sendMssg(((car*)(this->data)));
 				unlockTX();
-				((car*)(this->data))->times = 0;
-				((car*)(this->data))->co = 0;
-				((car*)(this->data))->nox = 0;
-				((car*)(this->data))->pm = 0;
-			} else
-				((car*)(this->data))->times++;
+				resetEmissions((car*)(this->data));
+			}
 #endif
 			} else {
 				data[i] = '\0';
@@ -666,14 +925,19 @@ static void translateOBD (fsm_t *this)
 
 
 /*
- * @brief	Retorno de la solicitud de un nuevo comando por parte del mdulo STN
- * @param	this: mquina de estados de la accin
+ * @brief	Retorno de la solicitud de un nuevo comando por parte del módulo STN
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void back (fsm_t *this)
 {
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
 	*flags = *flags & ~NEW_DATA_STN;
+	// Con el prompt la petición ha terminado: si era del descubrimiento y su respuesta no
+	// se ha podido decodificar (NO DATA), la fase se da por no soportada
+	if (obdQueue.inFlight)
+		scheduler_unanswered(obdQueue.req[obdQueue.head].cmd);
+	popQueue();
 	stopTimer();
 	*flags = *flags & ~TIMEOUT;
 	osMutexWait(((car*)this->data)->communication->pileLock, 0);
@@ -683,7 +947,7 @@ static void back (fsm_t *this)
 
 /*
  * @brief	Reinicia el STN
- * @param	this: mquina de estados de la accin
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void resetSTN (fsm_t *this)
@@ -693,6 +957,15 @@ static void resetSTN (fsm_t *this)
 #endif
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
 	*flags = *flags & ~TIMEOUT;
+
+	// La petición no llegó a salir por la UART: se descarta la cola de envío
+	if (!(*flags & STN_TX_DONE))
+		STN_flushTX();
+	// El STN se reinicia: se descartan también las peticiones aún no enviadas, cuyos PIDs
+	// quedan como perdidos
+	obdQueue.count = 0;
+	obdQueue.inFlight = 0;
+	scheduler_timeout();
 #if DEBUG
 	sprintf_((char*) resp, "%s\r", mssg[1]);
 	putTX(resp, strlen((char*) resp));
@@ -701,8 +974,106 @@ static void resetSTN (fsm_t *this)
 }
 
 /*
- * @brief	Traduce el mensaje que se recibe por parte del NB-IoT (Hecho en otro puntos del cdigo en estos momentos).
- * @param	this: mquina de estados de la accin
+ * @brief	Comienza la configuración del modo monitor borrando los filtros de paso del STN
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void startMonitor (fsm_t *this)
+{
+	uint8_t mssg[16];
+	uint16_t *flags = (((car*)(this->data))->communication->flags);
+	*flags = *flags & ~(MONITOR_MSSG | STN_TX_DONE);
+
+	monitorCfg.step = 0;
+	monitorCfg.num = monitorCfg.all ? 0 : monitor_filters(monitorCfg.ids, MONITOR_MAX_IDS);
+	sprintf_((char*) mssg, "stn nofilter\r");
+	STN_sendCMD(mssg);
+	if (!launchTimer(TIMER_STN*SEC_TO_MILL)){
+		while(1){}
+	}
+}
+
+/*
+ * @brief	Con cada prompt se añade un filtro de paso por identificador de la tabla de
+ * 			señales y, al final, se entra en modo monitor
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void setupMonitor (fsm_t *this)
+{
+	uint8_t mssg[20];
+	uint16_t *flags = (((car*)(this->data))->communication->flags);
+	*flags = *flags & ~(NEW_DATA_STN | RESPOND_STN);
+	osMutexWait(((car*)this->data)->communication->pileLock, 0);
+	((car*)this->data)->communication->pileUART1->tail = ((car*)this->data)->communication->pileUART1->head;
+	osMutexRelease(((car*)this->data)->communication->pileLock);
+
+	if (monitorCfg.step < monitorCfg.num) {
+		sprintf_((char*) mssg, "stn filter %u\r", monitorCfg.ids[monitorCfg.step++]);
+		STN_sendCMD(mssg);
+		return;
+	}
+
+	// A partir de aquí el STN no envía prompt hasta que se le interrumpe
+	stopTimer();
+	*flags = *flags & ~TIMEOUT;
+	sprintf_((char*) mssg, monitorCfg.all ? "stn stma\r" : "stn stm\r");
+	monitor_start();
+	STN_sendCMD(mssg);
+}
+
+/*
+ * @brief	Guarda las señales decodificadas en modo monitor como si fueran PIDs recibidos
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void storeMonitor (fsm_t *this)
+{
+	uint8_t pid;
+	uint32_t value;
+
+	while (monitor_take(&pid, &value)) {
+		storePID((car*)(this->data), pid, value);
+	}
+}
+
+/*
+ * @brief	Sale del modo monitor: cualquier carácter recibido interrumpe al STN, que
+ * 			responde con el prompt
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void stopMonitor (fsm_t *this)
+{
+	uint8_t mssg[6];
+	uint16_t *flags = (((car*)(this->data))->communication->flags);
+	*flags = *flags & ~MONITOR_MSSG;
+
+	sprintf_((char*) mssg, "stn \r");
+	STN_sendCMD(mssg);
+	if (!launchTimer(TIMER_STN*SEC_TO_MILL)){
+		while(1){}
+	}
+}
+
+/*
+ * @brief	El STN ha salido del modo monitor (interrumpido o con el buffer lleno): se
+ * 			vuelve a la adquisición por peticiones
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void endMonitor (fsm_t *this)
+{
+	uint16_t *flags = (((car*)(this->data))->communication->flags);
+	*flags = *flags & ~RESPOND_STN;
+	monitor_stop();
+	storeMonitor(this);
+	back(this);
+}
+
+/*
+ * @brief	Traduce el mensaje que se recibe por parte del NB-IoT (Hecho en otro puntos del código en estos momentos).
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void translateNB (fsm_t *this)
@@ -711,8 +1082,8 @@ static void translateNB (fsm_t *this)
 }
 
 /*
- * @brief	Reinicia el NB (Hecho en otro puntos del cdigo en estos momentos).
- * @param	this: mquina de estados de la accin
+ * @brief	Reinicia el NB (Hecho en otro puntos del código en estos momentos).
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void resetNB (fsm_t *this)
@@ -721,8 +1092,8 @@ static void resetNB (fsm_t *this)
 }
 
 /*
- * @brief	Realiza la configuracin del mdulo STN
- * @param	this: mquina de estados de la accin
+ * @brief	Realiza la configuración del módulo STN
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void setupSTN (fsm_t *this)
@@ -744,13 +1115,112 @@ static void setupSTN (fsm_t *this)
 		sprintf_((char*) mssg, "stn header 1\r");
 		STN_sendCMD(mssg);
 		enciendeLED(AZUL);
+		baud.step = BAUD_WINDOW;
+	} else if (state == 1 && !negotiateBaud(this)) {
+		return;
 	}
 	(((car*)(this->data))->setupState)--;
 }
 
 /*
- * @brief	Realiza la configuracin del mdulo GNSS
- * @param	this: mquina de estados de la accin
+ * @brief	Avanza la negociación de la tasa de la UART1 con el STN cada vez que llega
+ * 			el prompt. Se prueba cada tasa de stnBauds hasta que una se verifica
+ * @param	this: máquina de estados de la acción
+ * @retval	1 -> Negociación terminada
+ * 			0 -> En curso
+ */
+static uint8_t negotiateBaud (fsm_t *this)
+{
+	uint8_t mssg[24];
+
+	switch (baud.step) {
+	case BAUD_WINDOW:
+		sprintf_((char*) mssg, "stn brtimeout %u\r", STN_BAUD_WINDOW);
+		STN_sendCMD(mssg);
+		baud.index = 0;
+		baud.step = BAUD_REQUEST;
+		return 0;
+
+	// Prompt sin OK: el STN no acepta la tasa o falló la verificación
+	case BAUD_SWITCH:
+	case BAUD_VERIFY:
+		stopTimer();
+		baud.index++;
+		baud.step = BAUD_REQUEST;
+		/* no break */
+	case BAUD_REQUEST:
+		// Se descartan las tasas que la UART1 no puede generar
+		baud.oldBaud = STN_getBaud();
+		while (baud.index < NUM_STN_BAUDS && (stnBauds[baud.index] <= baud.oldBaud
+				|| HAL_RCC_GetPCLK2Freq() / stnBauds[baud.index] < 16))
+			baud.index++;
+		if (baud.index == NUM_STN_BAUDS) {
+			baud.step = BAUD_DONE;
+			return 1;
+		}
+		sprintf_((char*) mssg, "stn brate %u\r", (unsigned int) stnBauds[baud.index]);
+		STN_sendCMD(mssg);
+		baud.step = BAUD_SWITCH;
+		launchTimer(TIMER_STN*SEC_TO_MILL);
+		return 0;
+
+	// Prompt a la nueva tasa: negociación correcta
+	case BAUD_CONFIRM:
+		stopTimer();
+		baud.step = BAUD_DONE;
+		return 1;
+
+	default:
+		return 1;
+	}
+}
+
+/*
+ * @brief	Sin respuesta durante la negociación: se vuelve a la tasa anterior y se pide el
+ * 			prompt para continuar con la siguiente tasa. La espera tras el OK cubre la
+ * 			ventana del STN, que para entonces ya ha vuelto a la tasa anterior
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void baudFallback (fsm_t *this)
+{
+	uint8_t mssg[6];
+	uint16_t *flags = (((car*)(this->data))->communication->flags);
+	*flags = *flags & ~TIMEOUT;
+	stopTimer();
+
+	if (baud.step != BAUD_SWITCH && baud.step != BAUD_VERIFY && baud.step != BAUD_CONFIRM)
+		return;
+
+	STN_setBaud(baud.oldBaud);
+	baud.step = BAUD_SWITCH;
+	sprintf_((char*) mssg, "stn \r");
+	STN_sendCMD(mssg);
+	launchTimer(TIMER_STN*SEC_TO_MILL);
+}
+
+/*
+ * @brief	Lee una línea recibida del STN y la descarta del buffer de la UART1
+ * @param	this: máquina de estados de la acción
+ * 			line: destino de la línea, terminada en '\0' (se trunca a size-1 caracteres)
+ * 			size: tamaño de line
+ * @retval	Número de caracteres copiados
+ */
+static uint8_t readLineSTN (fsm_t *this, uint8_t *line, uint8_t size)
+{
+	uint8_t i;
+
+	osMutexWait(((car*)this->data)->communication->pileLock, 0);
+	i = circular_buf_read(((car*)this->data)->communication->pileUART1, line, size - 1);
+	osMutexRelease(((car*)this->data)->communication->pileLock);
+	line[i] = '\0';
+
+	return i;
+}
+
+/*
+ * @brief	Realiza la configuración del módulo GNSS
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void setupGNSS (fsm_t *this)
@@ -783,8 +1253,8 @@ static void setupGNSS (fsm_t *this)
 }
 
 /*
- * @brief	Realiza la configuracin del mdulo NB-IoT
- * @param	this: mquina de estados de la accin
+ * @brief	Realiza la configuración del módulo NB-IoT
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void setupNB (fsm_t *this)
@@ -801,22 +1271,42 @@ static void setupNB (fsm_t *this)
 }
 
 /*
- * @brief	Continua el almacenamiento en el buffer asociado al UART1 que corresponde al mdulo STN
- * @param	this: mquina de estados de la accin
+ * @brief	Continua el almacenamiento en el buffer asociado al UART1 que corresponde al módulo STN
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void clearSetupSTN (fsm_t *this)
 {
+	uint8_t line[24];
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
 	*flags = *flags & ~RESPOND_STN;
+
+	// Durante la negociación de la tasa se interpretan las líneas recibidas
+	if (baud.step == BAUD_SWITCH || baud.step == BAUD_VERIFY) {
+		readLineSTN(this, line, sizeof(line));
+		if (baud.step == BAUD_SWITCH && strstr((char*) line, "OK")) {
+			// El STN cambia de tasa tras el OK: se le sigue y se espera su identificador
+			STN_setBaud(stnBauds[baud.index]);
+			baud.step = BAUD_VERIFY;
+			stopTimer();
+			launchTimer(2*STN_BAUD_WINDOW);
+		} else if (baud.step == BAUD_VERIFY && (strstr((char*) line, "STN") || strstr((char*) line, "ELM"))) {
+			// Identificador legible a la nueva tasa: se confirma con un retorno de carro
+			sprintf_((char*) line, "stn \r");
+			STN_sendCMD(line);
+			baud.step = BAUD_CONFIRM;
+		}
+		return;
+	}
+
 	osMutexWait(((car*)this->data)->communication->pileLock, 0);
 	((car*)this->data)->communication->pileUART1->tail = ((((car*)this->data)->communication->pileUART1->tail+1) % ((car*)this->data)->communication->pileUART1->size);
 	osMutexRelease(((car*)this->data)->communication->pileLock);
 }
 
 /*
- * @brief	Continua el almacenamiento en el buffer asociado al UART3 que corresponde al mdulo NB-IoT
- * @param	this: mquina de estados de la accin
+ * @brief	Continua el almacenamiento en el buffer asociado al UART3 que corresponde al módulo NB-IoT
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void clearSetupNB (fsm_t *this)
@@ -830,26 +1320,21 @@ static void clearSetupNB (fsm_t *this)
 
 /*
  * @brief	Comprueba si se ha creado correctamente el socket con el servidor
- * @param	this: mquina de estados de la accin
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void successConnection (fsm_t *this)
 {
-	uint8_t i, data;
-	uint16_t head, pos;
+	uint8_t data;
+	buf_span_t span;
 	uint16_t *flags = (((car*)(this->data))->communication->flags);
-	i = 0;
 	data = '\"';
+
+	// Sólo interesa el carácter 19 de la respuesta: se lee en el sitio y se descarta el resto
 	osMutexWait(((car*)this->data)->communication->pileLock, 0);
-	pos = ((car*)this->data)->communication->pileUART3->tail;
-	head = ((car*)this->data)->communication->pileUART3->head;
-	do {
-		if (i == 19)
-			data = ((car*)this->data)->communication->pileUART3->buffer[pos];
-		i++;
-		pos = (pos + 1) % ((car*)this->data)->communication->pileUART3->size;
-	} while (pos != head);
-	((car*)this->data)->communication->pileUART3->tail = pos;
+	circular_buf_span(((car*)this->data)->communication->pileUART3, &span);
+	span_copy(&span, 19, &data, 1);
+	((car*)this->data)->communication->pileUART3->tail = ((car*)this->data)->communication->pileUART3->head;
 	osMutexRelease(((car*)this->data)->communication->pileLock);
 	if(data != '\"') {
 		apagaLED(AZUL);
@@ -861,8 +1346,8 @@ static void successConnection (fsm_t *this)
 }
 
 /*
- * @brief	Comprueba si se ha realizado correctamente la conexin a la celda
- * @param	this: mquina de estados de la accin
+ * @brief	Comprueba si se ha realizado correctamente la conexión a la celda
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void checkConexion (fsm_t *this)
@@ -878,8 +1363,8 @@ static void checkConexion (fsm_t *this)
 }
 
 /*
- * @brief	Limpia el buffer de recepcin del mdulo STN
- * @param	this: mquina de estados de la accin
+ * @brief	Limpia el buffer de recepción del módulo STN
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void clearNewSTN (fsm_t *this)
@@ -902,8 +1387,8 @@ static void clearNewSTN (fsm_t *this)
 }
 
 /*
- * @brief	Limpia el buffer de recepcin del mdulo NB-IoT
- * @param	this: mquina de estados de la accin
+ * @brief	Limpia el buffer de recepción del módulo NB-IoT
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void clearNewNB (fsm_t *this)
@@ -918,8 +1403,8 @@ static void clearNewNB (fsm_t *this)
 }
 
 /*
- * @brief	Limpia los buffer de recepcin de los mdulos STN y NB-IoT
- * @param	this: mquina de estados de la accin
+ * @brief	Limpia los buffer de recepción de los módulos STN y NB-IoT
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void clearAll (fsm_t *this)
@@ -966,38 +1451,304 @@ void apagaLED(leds color)
 }
 
 /*
- * @brief	Pasa el string a los valores numricos con formato de byte [NUM_1_ASCII][NUM_2_ASCII][Espacio]
+ * @brief	Pasa el string a los valores numéricos con formato de byte [NUM_1_ASCII][NUM_2_ASCII][Espacio]
  * @param	data: string a convertir
- * 			bytes: nmero de bytes contenidos en el string
- * @retval	Nmero equivalente al string pasado
+ * 			bytes: número de bytes contenidos en el string
+ * @retval	Número equivalente al string pasado
  */
 static uint32_t decodeNumber(uint8_t *data, uint8_t bytes)
 {
 	uint32_t dev = 0;
-	uint8_t i = 0;
-
-	for (i = 0; i < bytes*NEXT_NUMBER; i += NEXT_NUMBER) {
-		if (data[i] >= ASCII_LETTER_THRESHOLD) {
-			dev = dev << 4;
-			dev = dev + ((data[i] - ASCII_LETTER_THRESHOLD)+10);
-		} else if (data[i] >= ASCII_NUMBER_THRESHOLD) {
-			dev = dev << 4;
-			dev = dev + (data[i] - ASCII_NUMBER_THRESHOLD);
-		}
-		if (data[i+1] >= ASCII_LETTER_THRESHOLD) {
-			dev = dev << 4;
-			dev = dev + ((data[i+1] - ASCII_LETTER_THRESHOLD)+10);
-		} else if (data[i+1] >= ASCII_NUMBER_THRESHOLD) {
-			dev = dev << 4;
-			dev = dev + (data[i+1] - ASCII_NUMBER_THRESHOLD);
+
+	for (; bytes; bytes--, data += NEXT_NUMBER) {
+		dev = (dev << 8) | HEX_BYTE(data);
+	}
+
+	return dev;
+}
+
+/*
+ * @brief	Recorre una trama de la respuesta a una petición de varios PIDs. Admite trama
+ * 			única y tramas ISO-TP primera/consecutivas, guardando el estado entre ellas
+ * @param	coche: datos del vehículo donde se guardan los valores
+ * 			data: línea recibida del STN ("7E8 06 41 0D 32 0C 0B B8")
+ * 			len: número de caracteres de la línea
+ * @retval	1 -> Se ha completado la respuesta
+ * 			0 -> Faltan tramas o la respuesta no es válida
+ */
+static uint8_t decodeBatch(car *coche, uint8_t *data, uint8_t len)
+{
+	uint8_t pos, byte;
+
+	// Cabecera de la trama según su tipo
+	switch (data[PCI_TYPE]) {
+	case '0':
+		batch.remaining = decodeNumber(&data[PCI_TYPE], 1);
+		batch.service = 0;
+		batch.left = 0;
+		pos = PCI_TYPE + NEXT_NUMBER;
+		break;
+	case '1':
+		batch.remaining = (decodeNumber(&data[PCI_TYPE], 1) & 0x0F) << 8 | decodeNumber(&data[PCI_TYPE + NEXT_NUMBER], 1);
+		batch.service = 0;
+		batch.left = 0;
+		pos = FIRST_FRAME_PAYLOAD;
+		break;
+	case '2':
+		if (!batch.remaining)
+			return 0;
+		pos = CONSECUTIVE_FRAME_PAYLOAD;
+		break;
+	default:
+		return 0;
+	}
+
+	for (; batch.remaining && pos + 1 < len; pos += NEXT_NUMBER) {
+		byte = decodeNumber(&data[pos], 1);
+		batch.remaining--;
+
+		// Servicio, PID o dato del PID en curso
+		if (!batch.service) {
+			if (byte != SERVICE_01_RESPONSE) {
+				batch.remaining = 0;
+				return 0;
+			}
+			batch.service = 1;
+		} else if (!batch.left) {
+			batch.pid = byte;
+			batch.value = 0;
+			// Con una longitud desconocida no se puede seguir recorriendo la respuesta
+			if (batch.pid >= PID_DECODERS_SIZE || !(batch.left = pidDecoders[batch.pid].bytes)) {
+				batch.remaining = 0;
+				return 0;
+			}
+		} else {
+			batch.value = (batch.value << 8) | byte;
+			if (!--batch.left)
+				storePID(coche, batch.pid, batch.value);
 		}
 	}
 
+	return !batch.remaining;
+}
+
+/*
+ * @brief	Aplica la decodificación del PID y guarda el valor en su campo de los datos del
+ * 			vehículo
+ * @param	coche: datos del vehículo
+ * 			pid: PID del servicio 01
+ * 			value: datos del PID sin corregir
+ * @retval	Nada
+ */
+static void storePID(car *coche, uint8_t pid, uint32_t value)
+{
+	const pidDecoder_t *dec;
+	int32_t dev;
+
+	scheduler_received(pid);
+	if (pid >= PID_DECODERS_SIZE || (dec = &pidDecoders[pid])->field == FIELD_NONE)
+		return;
+
+	// Extensión de signo de los datos en complemento a 2
+	dev = (dec->sign && dec->bytes < 4) ? (int32_t) (value << (32 - 8*dec->bytes)) >> (32 - 8*dec->bytes) : (int32_t) value;
+	dev = dev * dec->mult / dec->div + dec->offset;
+
+	switch (dec->field) {
+	case FIELD_SPEED:
+		// Una velocidad fuera de la tabla de factores de emisión sólo puede ser una trama mal
+		// interpretada (p. ej. "mon all" con la escala de otro fabricante): se descarta
+		if (dev < 0 || dev > EF_TABLE_SIZE-1)
+			break;
+		window_put(&(coche->speed), dev);
+#if TEST
+		updateEmissions(coche);
+#endif
+		break;
+	case FIELD_RPM:
+		window_put(&(coche->rpm), dev);
+		break;
+	case FIELD_AIR:
+		window_put(&(coche->air), dev);
+		break;
+	case FIELD_FUEL:
+		coche->fuel = dev;
+		break;
+	}
+}
+
+/*
+ * @brief	Interpreta una respuesta completa del servicio 09: [0x49][PID][datos]
+ * @param	coche: datos del vehículo
+ * 			msg: respuesta reensamblada
+ * 			len: bytes de la respuesta
+ * @retval	Nada
+ */
+static void decodeService9(car *coche, const uint8_t *msg, uint16_t len)
+{
+#if DEBUG || TEST
+	uint8_t text[48];
+	uint16_t i, n;
+#endif
+
+	if (len < 2 || msg[0] != SERVICE_09_RESPONSE)
+		return;
+
+	switch (msg[1]) {
+	// PIDs soportados del servicio 09
+	case FIRST_PIDS:
+		if (len >= 6)
+			scheduler_supported(STN_PIDS_9, (uint32_t) msg[2] << 24 | (uint32_t) msg[3] << 16 | msg[4] << 8 | msg[5]);
+		return;
+
+	// Número de bastidor: los últimos VIN_LENGTH caracteres
+	case VIN_NUMBER:
+		if (len < 2 + VIN_LENGTH)
+			return;
+		memcpy(coche->vin, &msg[len - VIN_LENGTH], VIN_LENGTH);
+		coche->vin[VIN_LENGTH] = '\0';
+		scheduler_vin(coche->vin);
+		break;
+
+	default:
+		break;
+	}
+
+#if DEBUG || TEST
+	// Se muestra el PID con sus datos: en texto los identificadores y en hexadecimal el resto
+	n = sprintf_((char*) text, "%02X:", msg[1]);
+	for (i = 3; i < len && n < sizeof(text) - 3; i++) {
+		if (msg[1] == MONITOR)
+			n += sprintf_((char*) &text[n], "%02X", msg[i]);
+		else if (msg[i] >= ' ' && msg[i] <= '~')
+			text[n++] = msg[i];
+	}
+	text[n++] = '\r';
+	text[n] = '\0';
+	putTX(text, n);
+	*(coche->communication->flags) |= TX_DATA;
+#endif
+}
+
+#if TEST
+/*
+ * @brief	Integra las emisiones con cada nueva muestra de velocidad, usando el tiempo real
+ * 			transcurrido desde la anterior, y envía los datos cada SEND_PERIOD
+ * @param	coche: datos del vehículo
+ * @retval	Nada
+ */
+static void updateEmissions(car *coche)
+{
+	static uint32_t lastSample, lastSend;
+	static uint8_t started = 0;
+	uint32_t now = osKernelSysTick();
+
+	if (!started) {
+		lastSample = now;
+		lastSend = now;
+		started = 1;
+		return;
+	}
+
+	calcEmissions(coche, now - lastSample);
+	lastSample = now;
+
+	if (now - lastSend >= SEND_PERIOD) {
+		setPosition(coche);
+		lockTX();
+		sendMssg(coche);
+		unlockTX();
+		resetEmissions(coche);
+		lastSend = now;
+	}
+}
+#endif
+
+/*
+ * @brief	Pasa a número un campo de texto terminado en espacio o \r, avanzando la posición
+ * 			hasta el comienzo del siguiente campo
+ * @param	data: string a convertir
+ * 			pos: posición del comienzo del campo, se actualiza al siguiente
+ * 			base: base numérica del campo (10 o 16)
+ * @retval	Número equivalente al campo
+ */
+static uint32_t decodeField(uint8_t *data, uint8_t *pos, uint8_t base)
+{
+	uint32_t dev = 0;
+	uint8_t c;
+
+	for (c = data[*pos]; c != ' ' && c != '\r' && c != '\0'; c = data[++(*pos)]) {
+		if (c >= 'a')
+			dev = dev*base + (c - 'a' + 10);
+		else if (c >= ASCII_LETTER_THRESHOLD)
+			dev = dev*base + (c - ASCII_LETTER_THRESHOLD + 10);
+		else
+			dev = dev*base + (c - ASCII_NUMBER_THRESHOLD);
+	}
+	if (c == ' ')
+		(*pos)++;
 	return dev;
 }
 
 /*
- * @brief	Determina y almacena las posiciones recogidas por geolocalizacin
+ * @brief	Configura los parámetros de COPERT según la orden recibida:
+ * 			"euro3" o "euro6" -> configuraciones predefinidas
+ * 			"euro<norma> <combustible> <segmento>" -> entrada del registro, con combustible y
+ * 			segmento según fuelType y engineSegment. La norma es la cifra de la normativa (3 ->
+ * 			EURO_3, 6 -> EURO_6_2016) o, con dos cifras, el código en hexadecimal (p.ej. 63)
+ * @param	coche: coche a configurar
+ * 			data: orden recibida
+ * @retval	1 -> Parámetros establecidos
+ * 			0 -> Configuración no encontrada
+ */
+static uint8_t setupCOPERT(car *coche, uint8_t *data)
+{
+	uint8_t pos, euro, fuel, segment;
+
+	pos = 4;
+	euro = decodeField(data, &pos, 16);
+	// Una sola cifra seguida de más campos: número de la normativa
+	if (pos == 6 && data[pos-1] == ' ')
+		euro = (euro == 6)? EURO_6_2016 : euro << 4;
+	// Una sola cifra sin más campos: configuración predefinida
+	if (pos == 5) {
+		if (euro == 3)
+			return setParams(coche, EURO3_GAS);
+		else if (euro == 6)
+			return setParams(coche, EURO6_DIESEL_2016);
+		return 0;
+	}
+	fuel = decodeField(data, &pos, 10);
+	segment = decodeField(data, &pos, 10);
+	return setParamsTable(coche, fuel, euro, segment);
+}
+
+/*
+ * @brief	Cambia la longitud de las ventanas de muestras según la orden recibida:
+ * 			"win <velocidad> <rpm> <aire>", en número de muestras. Las muestras anteriores se
+ * 			descartan
+ * @param	coche: coche a configurar
+ * 			data: orden recibida
+ * @retval	1 -> Ventanas cambiadas
+ * 			0 -> Longitud nula o mayor de 16 bits, o falta de memoria (las ventanas ya
+ * 				 cambiadas conservan su nueva longitud)
+ */
+static uint8_t setupWindows(car *coche, uint8_t *data)
+{
+	uint32_t speed, rpm, air;
+	uint8_t pos;
+
+	pos = 4;
+	speed = decodeField(data, &pos, 10);
+	rpm = decodeField(data, &pos, 10);
+	air = decodeField(data, &pos, 10);
+	if (speed == 0 || rpm == 0 || air == 0 || speed > UINT16_MAX || rpm > UINT16_MAX || air > UINT16_MAX)
+		return 0;
+	return window_resize(&(coche->speed), speed) && window_resize(&(coche->rpm), rpm)
+			&& window_resize(&(coche->air), air);
+}
+
+/*
+ * @brief	Determina y almacena las posiciones recogidas por geolocalización
  * @param	car: coche a posicionar
  * @retval	Nada
  */
@@ -0,0 +1,248 @@
+/*
+ * monitor.c
+ *
+ *  Monitorización pasiva del bus CAN (STM/STMA) y decodificación de las señales difundidas
+ *      Author: miguelvp
+ */
+
+#include "monitor.h"
+#include "pids.h"
+#include "shareData.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+// Señales difundidas por el vehículo de pruebas. Los identificadores y escalas dependen del
+// fabricante: esta tabla es la de Toyota (0x0B4 velocidad en 0.01 km/h, 0x2C4 rpm)
+static const canSignal_t signals[] = {
+		// id		byte	bytes	mult	div		PID
+		{0x0B4,		5,		2,		1,		100,	VEHICLE_SPEED},
+		{0x2C4,		0,		2,		4,		1,		ENGINE_RPM},		// El PID 0C va en 1/4 rpm
+};
+
+#define NUM_SIGNALS		(sizeof(signals)/sizeof(signals[0]))
+
+// Trama en curso de la línea recibida: "0B4 00 00 00 00 8D 05 DC A1\r"
+static struct {
+	uint32_t id;
+	uint8_t data[CAN_MAX_DATA];
+	uint8_t len;			// Bytes de datos leídos
+	uint8_t field;			// 0 -> identificador, n -> byte de datos n-1
+	uint8_t digits;			// Dígitos del campo en curso
+	uint8_t valid;			// La línea es, por ahora, una trama bien formada
+	uint32_t acc;			// Valor del campo en curso
+} frame;
+
+// Último valor de cada señal y señales aún no recogidas (escritas por la tarea USB,
+// recogidas por la tarea del micro)
+static volatile uint32_t values[NUM_SIGNALS];
+static volatile uint32_t fresh;
+static volatile uint32_t frames;
+static volatile uint8_t active;
+
+static void resetFrame(void);
+static void closeField(void);
+static void decodeFrame(void);
+
+/*
+ * @brief	Comienza la decodificación del flujo del STN en modo monitor
+ * @param	Nada
+ * @retval	Nada
+ */
+void monitor_start(void)
+{
+	resetFrame();
+	fresh = 0;
+	frames = 0;
+	active = 1;
+}
+
+/*
+ * @brief	Termina el modo monitor: la UART1 vuelve a tratarse como petición/respuesta
+ * @param	Nada
+ * @retval	Nada
+ */
+void monitor_stop(void)
+{
+	active = 0;
+}
+
+/*
+ * @brief	Indica si el STN está en modo monitor
+ * @param	Nada
+ * @retval	1 -> Modo monitor
+ * 			0 -> Petición/respuesta
+ */
+uint8_t monitor_active(void)
+{
+	return active;
+}
+
+/*
+ * @brief	Decodifica el flujo de tramas del buffer circular de la UART1 según llega, sin
+ * 			copiar las líneas. Las líneas que no son tramas (BUFFER FULL, ...) se descartan
+ * @param	ring: buffer circular
+ * 			size: tamaño del buffer
+ * 			pos: posición del primer carácter sin leer, se actualiza
+ * 			end: posición de escritura de la DMA
+ * @retval	1 -> Se ha recibido el prompt: el STN ha salido del modo monitor
+ * 			0 -> Sigue en modo monitor
+ */
+uint8_t monitor_parse(const uint8_t *ring, uint16_t size, uint16_t *pos, uint16_t end)
+{
+	uint16_t i = *pos;
+	uint8_t c, nibble;
+
+	while (i != end) {
+		c = ring[i];
+		if (++i == size)
+			i = 0;
+
+		if (c == '>') {
+			resetFrame();
+			*pos = i;
+			return 1;
+		} else if (c == '\r' || c == '\n') {
+			closeField();
+			if (frame.valid && frame.field > 1)
+				decodeFrame();
+			resetFrame();
+		} else if (c == ' ') {
+			closeField();
+		} else if (frame.valid) {
+			nibble = hexValue[c];
+			if (nibble == HEX_INVALID || frame.digits == 8) {
+				frame.valid = 0;
+			} else {
+				frame.acc = (frame.acc << 4) | nibble;
+				frame.digits++;
+			}
+		}
+	}
+
+	*pos = i;
+	return 0;
+}
+
+/*
+ * @brief	Indica si hay valores decodificados sin recoger
+ * @param	Nada
+ * @retval	1 -> Hay valores nuevos
+ * 			0 -> Ninguno
+ */
+uint8_t monitor_pending(void)
+{
+	return fresh != 0;
+}
+
+/*
+ * @brief	Recoge el siguiente valor decodificado
+ * @param	pid: PID equivalente de la señal
+ * 			value: valor en las unidades del PID
+ * @retval	1 -> Valor recogido
+ * 			0 -> No hay valores nuevos
+ */
+uint8_t monitor_take(uint8_t *pid, uint32_t *value)
+{
+	uint8_t i;
+
+	taskENTER_CRITICAL();
+	for (i = 0; i < NUM_SIGNALS && !(fresh & (1UL << i)); i++);
+	if (i < NUM_SIGNALS) {
+		fresh &= ~(1UL << i);
+		*pid = signals[i].pid;
+		*value = values[i];
+	}
+	taskEXIT_CRITICAL();
+
+	return i < NUM_SIGNALS;
+}
+
+/*
+ * @brief	Identificadores distintos de la tabla de señales, para los filtros del STN
+ * @param	ids: identificadores
+ * 			max: máximo de identificadores
+ * @retval	Número de identificadores
+ */
+uint8_t monitor_filters(uint16_t *ids, uint8_t max)
+{
+	uint8_t i, j, n = 0;
+
+	for (i = 0; i < NUM_SIGNALS && n < max; i++) {
+		for (j = 0; j < n && ids[j] != signals[i].id; j++);
+		if (j == n)
+			ids[n++] = signals[i].id;
+	}
+	return n;
+}
+
+/*
+ * @brief	Tramas decodificadas desde el comienzo del modo monitor
+ * @param	Nada
+ * @retval	Número de tramas
+ */
+uint32_t monitor_frames(void)
+{
+	return frames;
+}
+
+/*
+ * @brief	Prepara la lectura de una nueva línea
+ * @param	Nada
+ * @retval	Nada
+ */
+static void resetFrame(void)
+{
+	frame.len = 0;
+	frame.field = 0;
+	frame.digits = 0;
+	frame.valid = 1;
+	frame.acc = 0;
+}
+
+/*
+ * @brief	Cierra el campo en curso: identificador o byte de datos
+ * @param	Nada
+ * @retval	Nada
+ */
+static void closeField(void)
+{
+	if (!frame.digits)
+		return;
+
+	if (frame.field == 0) {
+		frame.id = frame.acc;
+	} else if (frame.digits != 2 || frame.len == CAN_MAX_DATA) {
+		frame.valid = 0;
+	} else {
+		frame.data[frame.len++] = frame.acc;
+	}
+	frame.field++;
+	frame.digits = 0;
+	frame.acc = 0;
+}
+
+/*
+ * @brief	Extrae de la trama completa las señales de la tabla
+ * @param	Nada
+ * @retval	Nada
+ */
+static void decodeFrame(void)
+{
+	uint8_t i, j;
+	uint32_t value;
+
+	frames++;
+	for (i = 0; i < NUM_SIGNALS; i++) {
+		if (signals[i].id != frame.id || signals[i].start + signals[i].len > frame.len)
+			continue;
+		value = 0;
+		for (j = 0; j < signals[i].len; j++) {
+			value = (value << 8) | frame.data[signals[i].start + j];
+		}
+
+		taskENTER_CRITICAL();
+		values[i] = value * signals[i].mult / signals[i].div;
+		fresh |= 1UL << i;
+		taskEXIT_CRITICAL();
+	}
+}
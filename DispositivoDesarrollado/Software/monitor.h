@@ -0,0 +1,35 @@
+/*
+ * monitor.h
+ *
+ *  Monitorización pasiva del bus CAN (STM/STMA) y decodificación de las señales difundidas
+ *      Author: miguelvp
+ */
+
+#ifndef MONITOR_H_
+#define MONITOR_H_
+
+#include <stdint.h>
+
+// Máximo de bytes de datos de una trama CAN
+#define CAN_MAX_DATA		8
+
+// Señal difundida en el bus, traducida a las unidades del PID equivalente del servicio 01
+typedef struct canSignal_t {
+	uint16_t	id;			// Identificador CAN (11 bits)
+	uint8_t		start;		// Primer byte de la señal en la trama
+	uint8_t		len;		// Bytes de la señal (big endian), hasta 4
+	uint16_t	mult;		// Valor del PID = señal * mult / div
+	uint16_t	div;
+	uint8_t		pid;		// PID equivalente del servicio 01
+} canSignal_t;
+
+void monitor_start(void);
+void monitor_stop(void);
+uint8_t monitor_active(void);
+uint8_t monitor_parse(const uint8_t *ring, uint16_t size, uint16_t *pos, uint16_t end);
+uint8_t monitor_pending(void);
+uint8_t monitor_take(uint8_t *pid, uint32_t *value);
+uint8_t monitor_filters(uint16_t *ids, uint8_t max);
+uint32_t monitor_frames(void);
+
+#endif /* MONITOR_H_ */
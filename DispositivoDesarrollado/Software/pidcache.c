@@ -0,0 +1,178 @@
+/*
+ * pidcache.c
+ *
+ *  Caché en flash de los PIDs soportados por cada vehículo (VIN)
+ *      Author: miguelvp
+ */
+
+#include "pidcache.h"
+#include "stm32l4xx_hal.h"
+#include <string.h>
+
+// Marca de entrada válida (las entradas libres están borradas a 0xFF)
+#define PID_CACHE_TAG		0x50494443
+#define PID_CACHE_FREE		0xFFFFFFFF
+
+// Entrada de la caché, múltiplo de 8 bytes para escribirse por dobles palabras
+typedef struct pidCacheEntry_t {
+	uint32_t	tag;
+	uint8_t		vin[VIN_LENGTH];
+	uint8_t		reserved[3];
+	uint32_t	service1[PID_RANGES];
+	uint32_t	service9;
+	uint32_t	reserved2;
+} pidCacheEntry_t;
+
+#define PID_CACHE_ENTRIES	(FLASH_PAGE_SIZE / sizeof(pidCacheEntry_t))
+
+// Página de flash reservada para la caché. Ocupa exactamente una página alineada, por lo que
+// se puede borrar sin afectar al resto del programa. Las entradas se añaden una tras otra y
+// sólo se borra la página cuando se llena o falla una escritura
+static const uint64_t cachePage[FLASH_PAGE_SIZE / sizeof(uint64_t)] __attribute__((aligned(FLASH_PAGE_SIZE))) = {
+		[0 ... FLASH_PAGE_SIZE / sizeof(uint64_t) - 1] = 0xFFFFFFFFFFFFFFFF
+};
+
+// Acceso a las entradas (volatile: el contenido cambia al programar la flash)
+#define CACHE_ENTRY(i)		(&((const volatile pidCacheEntry_t*) cachePage)[i])
+
+static uint8_t entryFree(uint8_t index);
+static uint8_t writeEntry(uint8_t index, const pidCacheEntry_t *entry);
+static uint8_t erasePage(void);
+
+/*
+ * @brief	Busca la última entrada guardada para un VIN
+ * @param	vin: número de bastidor (VIN_LENGTH caracteres)
+ * 			service1: bitmaps de PIDs soportados del servicio 01, uno por rango
+ * 			service9: bitmap de PIDs soportados del servicio 09
+ * @retval	1 -> Encontrado
+ * 			0 -> El vehículo no está en la caché
+ */
+uint8_t pidcache_load(const uint8_t *vin, uint32_t *service1, uint32_t *service9)
+{
+	uint8_t i, j, found = 0;
+
+	for (i = 0; i < PID_CACHE_ENTRIES && !entryFree(i); i++) {
+		if (CACHE_ENTRY(i)->tag != PID_CACHE_TAG || memcmp((const void*) CACHE_ENTRY(i)->vin, vin, VIN_LENGTH))
+			continue;
+		for (j = 0; j < PID_RANGES; j++) {
+			service1[j] = CACHE_ENTRY(i)->service1[j];
+		}
+		*service9 = CACHE_ENTRY(i)->service9;
+		found = 1;
+	}
+
+	return found;
+}
+
+/*
+ * @brief	Guarda los PIDs soportados por un vehículo en la siguiente entrada libre. Si la
+ * 			página está llena o la escritura falla, se borra y se empieza de nuevo
+ * @param	vin: número de bastidor (VIN_LENGTH caracteres)
+ * 			service1: bitmaps de PIDs soportados del servicio 01, uno por rango
+ * 			service9: bitmap de PIDs soportados del servicio 09
+ * @retval	1 -> Guardado
+ * 			0 -> Error al escribir la flash
+ */
+uint8_t pidcache_store(const uint8_t *vin, const uint32_t *service1, uint32_t service9)
+{
+	pidCacheEntry_t entry;
+	uint8_t i;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.tag = PID_CACHE_TAG;
+	memcpy(entry.vin, vin, VIN_LENGTH);
+	memcpy(entry.service1, service1, sizeof(entry.service1));
+	entry.service9 = service9;
+
+	for (i = 0; i < PID_CACHE_ENTRIES && !entryFree(i); i++);
+	if (i == PID_CACHE_ENTRIES) {
+		if (!erasePage())
+			return 0;
+		i = 0;
+	}
+
+	if (writeEntry(i, &entry))
+		return 1;
+
+	// La entrada ha quedado a medias: se borra la página y se reintenta una vez
+	return erasePage() && writeEntry(0, &entry);
+}
+
+/*
+ * @brief	Indica si una entrada está libre, es decir, borrada por completo. Una escritura
+ * 			interrumpida deja la marca borrada pero otras dobles palabras programadas, que ya
+ * 			no se pueden volver a escribir
+ * @param	index: posición de la entrada
+ * @retval	1 -> Libre
+ * 			0 -> Ocupada o escrita a medias
+ */
+static uint8_t entryFree(uint8_t index)
+{
+	const volatile uint32_t *word = (const volatile uint32_t*) CACHE_ENTRY(index);
+	uint8_t i;
+
+	for (i = 0; i < sizeof(pidCacheEntry_t) / sizeof(uint32_t); i++) {
+		if (word[i] != PID_CACHE_FREE)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * @brief	Escribe una entrada en la flash. La doble palabra con la marca se escribe la
+ * 			última, para que una escritura interrumpida no deje una entrada válida a medias
+ * @param	index: posición de la entrada
+ * 			entry: entrada a escribir
+ * @retval	1 -> Todo correcto
+ * 			0 -> Error al programar la flash
+ */
+static uint8_t writeEntry(uint8_t index, const pidCacheEntry_t *entry)
+{
+	uint64_t data[sizeof(pidCacheEntry_t) / sizeof(uint64_t)];
+	uint32_t addr = (uint32_t) (uintptr_t) CACHE_ENTRY(index);
+	uint8_t i, dev = 1;
+
+	memcpy(data, entry, sizeof(data));
+
+	HAL_FLASH_Unlock();
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+	for (i = 1; i < sizeof(data) / sizeof(uint64_t) && dev; i++) {
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr + i*sizeof(uint64_t), data[i]) != HAL_OK)
+			dev = 0;
+	}
+	if (dev && HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr, data[0]) != HAL_OK)
+		dev = 0;
+	HAL_FLASH_Lock();
+
+	return dev;
+}
+
+/*
+ * @brief	Borra la página de la caché
+ * @param	Nada
+ * @retval	1 -> Todo correcto
+ * 			0 -> Error al borrar
+ */
+static uint8_t erasePage(void)
+{
+	FLASH_EraseInitTypeDef erase;
+	uint32_t offset = (uint32_t) (uintptr_t) cachePage - FLASH_BASE;
+	uint32_t pageError;
+	HAL_StatusTypeDef res;
+
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+#ifdef FLASH_BANK_2
+	erase.Banks = (offset < FLASH_BANK_SIZE) ? FLASH_BANK_1 : FLASH_BANK_2;
+#else
+	erase.Banks = FLASH_BANK_1;
+#endif
+	erase.Page = (offset % FLASH_BANK_SIZE) / FLASH_PAGE_SIZE;
+	erase.NbPages = 1;
+
+	HAL_FLASH_Unlock();
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+	res = HAL_FLASHEx_Erase(&erase, &pageError);
+	HAL_FLASH_Lock();
+
+	return res == HAL_OK;
+}
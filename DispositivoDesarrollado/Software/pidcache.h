@@ -0,0 +1,20 @@
+/*
+ * pidcache.h
+ *
+ *  Caché en flash de los PIDs soportados por cada vehículo (VIN)
+ *      Author: miguelvp
+ */
+
+#ifndef PIDCACHE_H_
+#define PIDCACHE_H_
+
+#include <stdint.h>
+#include "shareData.h"
+
+// Rangos de 32 PIDs del servicio 01 (0100, 0120, ..., 01A0)
+#define PID_RANGES		6
+
+uint8_t pidcache_load(const uint8_t *vin, uint32_t *service1, uint32_t *service9);
+uint8_t pidcache_store(const uint8_t *vin, const uint32_t *service1, uint32_t service9);
+
+#endif /* PIDCACHE_H_ */
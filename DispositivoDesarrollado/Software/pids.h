@@ -8,6 +8,8 @@
 #ifndef PIDS_H_
 #define PIDS_H_
 
+#include <stdint.h>
+
 // Request available PIDs from any service
 #define FIRST_PIDS					0x00
 #define SECOND_PIDS					0x20
@@ -59,6 +61,50 @@
 
 #define NOX_SENSOR_CORRECTED		0xA1
 
+// Campo de los datos del vehículo donde se guarda cada PID decodificado
+typedef enum pidField {
+	FIELD_NONE,
+	FIELD_SPEED,
+	FIELD_RPM,
+	FIELD_AIR,
+	FIELD_FUEL,
+} pidField;
+
+// Decodificación de un PID de los servicios 01 y 02: valor = datos * mult / div + offset
+typedef struct pidDecoder_t {
+	uint8_t		bytes;		// Bytes de datos (0 -> desconocido)
+	uint8_t		sign;		// Datos en complemento a 2
+	uint8_t		field;		// pidField destino
+	uint8_t		div;
+	int16_t		mult;
+	int16_t		offset;
+} pidDecoder_t;
+
+#define PID_DECODER(nbytes, mult, div, offset, sign, field)	{(nbytes), (sign), (field), (div), (mult), (offset)}
+#define PID_LENGTH(nbytes)		PID_DECODER(nbytes, 1, 1, 0, 0, FIELD_NONE)
+
+// Tabla de decodificación indexada por PID. Añadir un PID es añadir su línea
+#define PID_DECODERS_SIZE			0xC0
+#define PID_DECODERS { \
+	[FIRST_PIDS] = PID_LENGTH(4), [SECOND_PIDS] = PID_LENGTH(4), [THIRD_PIDS] = PID_LENGTH(4), \
+	[FOURTH_PIDS] = PID_LENGTH(4), [FIFTH_PIDS] = PID_LENGTH(4), [SIXTH_PIDS] = PID_LENGTH(4), \
+	[STATUS_DTC] = PID_LENGTH(4), [FREEZE_DTC] = PID_LENGTH(2), [FUEL_SYSTEM] = PID_LENGTH(2), \
+	[ENGINE_LOAD] = PID_LENGTH(1), [ENGINE_COOLANT_TEMP] = PID_LENGTH(1), \
+	[ENGINE_RPM] =			PID_DECODER(2, 1, CORRECCION_RPM, 0, 0, FIELD_RPM), \
+	[VEHICLE_SPEED] =		PID_DECODER(1, 1, 1, 0, 0, FIELD_SPEED), \
+	[AMBIENT_AIR_TEMP] =	PID_DECODER(1, 1, 1, CORRECCION_AIR, 0, FIELD_AIR), \
+	[FUEL_TYPE] =			PID_DECODER(1, 1, 1, 0, 0, FIELD_FUEL), \
+	[INTAKE_AIR_TEMP] = PID_LENGTH(1), [MAF_RATE] = PID_LENGTH(2), \
+	[THROTTLE_POS] = PID_LENGTH(1), [POWER_TAKE_OFF] = PID_LENGTH(1), [TIME_SINCE_START] = PID_LENGTH(2), \
+	[DISTANCE_MALFUNCTION] = PID_LENGTH(2), [EGR] = PID_LENGTH(1), [EGR_ERROR] = PID_LENGTH(1), \
+	[HYBRID_BATTERY_CHARGE] = PID_LENGTH(1), [ENGINE_FUEL_RATE] = PID_LENGTH(2), \
+	[ACTUAL_TORQUE] = PID_LENGTH(1), [ENGINE_PERCENT_TORQUE] = PID_LENGTH(5), \
+	[EXHAUST_PRESSURE] = PID_LENGTH(5), [EXHAUST_GAS_TEMP_1] = PID_LENGTH(9), [EXHAUST_GAS_TEMP_2] = PID_LENGTH(9), \
+	[DPF_1] = PID_LENGTH(7), [DPF_2] = PID_LENGTH(7), [DPF_TEMP] = PID_LENGTH(9), \
+	[NOX_NTE] = PID_LENGTH(1), [PM_NTE] = PID_LENGTH(1), [ENGINE_RUNTIME] = PID_LENGTH(13), \
+	[NOX_SENSOR] = PID_LENGTH(9), [PM_SENSOR] = PID_LENGTH(5), [SCR] = PID_LENGTH(13), \
+	[ENGINE_EXHAUST_FLOW_RATE] = PID_LENGTH(2), [NOX_SENSOR_CORRECTED] = PID_LENGTH(9) \
+}
 
 // Service 09
 #define MC_VIN						0x01
@@ -75,10 +121,13 @@
 #define NUM_BYTES					5
 #define PAYLOAD						13
 
+// Posición de los datos en tramas ISO-TP ("7E8 10 0A 41 ..." y "7E8 21 ...")
+#define PCI_TYPE					4
+#define FIRST_FRAME_PAYLOAD			10
+#define CONSECUTIVE_FRAME_PAYLOAD	7
+#define SERVICE_01_RESPONSE			0x41
+#define SERVICE_09_RESPONSE			0x49
 
-#define VIN_INIT_NUMBER				19
-#define VIN_NEXT_LINE				7
-#define VIN_MAX_NUMBER				28
 
 // Correciones
 #define CORRECCION_RPM		4
@@ -0,0 +1,315 @@
+/*
+ * scheduler.c
+ *
+ *  Planificador de la adquisición de PIDs del servicio 01
+ *      Author: miguelvp
+ */
+
+#include "scheduler.h"
+#include "pidcache.h"
+#include "pids.h"
+#include <string.h>
+
+// PIDs planificados: las señales rápidas se piden más a menudo para integrar bien las emisiones.
+// Sólo se piden los PIDs que tienen campo en los datos del vehículo (PID_DECODERS de pids.h)
+static pidSchedule_t table[] = {
+		// PID					prioridad	periodo (ms)
+		{VEHICLE_SPEED,			0,			100},
+		{ENGINE_RPM,			0,			100},
+		{AMBIENT_AIR_TEMP,		1,			10000},
+		{FUEL_TYPE,				2,			60000}
+};
+
+#define NUM_SCHEDULED	(sizeof(table)/sizeof(table[0]))
+
+// Fases del descubrimiento de los PIDs soportados antes de la adquisición
+typedef enum discoveryState {
+	DISCOVER_VIN,			// Petición del VIN para buscarlo en la caché
+	DISCOVER_PIDS,			// Peticiones 0100, 0120... mientras se indique el siguiente rango
+	DISCOVER_PIDS_9,		// Petición 0900
+	DISCOVER_DONE
+} discoveryState;
+
+static discoveryState discovery;
+static uint8_t range;
+static uint8_t vinKnown;
+static uint8_t carVin[VIN_LENGTH];
+
+// PIDs soportados: servicio 01 por rangos de 32 (bit 31 -> PID base+1) y servicio 09
+static uint32_t service1[PID_RANGES];
+static uint32_t service9;
+
+static void endDiscovery(void);
+
+/*
+ * @brief	Inicializa la tabla de planificación: todos los PIDs se piden en el primer envío
+ * @param	now: instante actual (ms)
+ * @retval	Nada
+ */
+void scheduler_init(uint32_t now)
+{
+	uint8_t i;
+
+	discovery = DISCOVER_VIN;
+	range = 0;
+	vinKnown = 0;
+	memset(service1, 0, sizeof(service1));
+	service9 = 0;
+
+	for (i = 0; i < NUM_SCHEDULED; i++) {
+		table[i].next = now;
+		table[i].pending = 0;
+		table[i].since = now;
+		table[i].received = 0;
+		table[i].missed = 0;
+	}
+}
+
+/*
+ * @brief	Siguiente petición del descubrimiento de PIDs soportados
+ * @param	Nada
+ * @retval	Comando a enviar al STN
+ * 			NO_CMD -> El descubrimiento ha terminado
+ */
+command scheduler_discovery(void)
+{
+	switch (discovery) {
+	case DISCOVER_VIN:
+		return STN_GET_VIN;
+	case DISCOVER_PIDS:
+		return STN_PIDS_1_1 + range;
+	case DISCOVER_PIDS_9:
+		return STN_PIDS_9;
+	default:
+		return NO_CMD;
+	}
+}
+
+/*
+ * @brief	Recibido el VIN, se buscan en la caché sus PIDs soportados para no tener que
+ * 			volver a descubrirlos
+ * @param	vin: número de bastidor (VIN_LENGTH caracteres)
+ * @retval	Nada
+ */
+void scheduler_vin(const uint8_t *vin)
+{
+	if (discovery != DISCOVER_VIN)
+		return;
+
+	memcpy(carVin, vin, VIN_LENGTH);
+	vinKnown = 1;
+	if (pidcache_load(carVin, service1, &service9))
+		discovery = DISCOVER_DONE;
+	else
+		discovery = DISCOVER_PIDS;
+}
+
+/*
+ * @brief	Guarda la respuesta a una petición de PIDs soportados y avanza el descubrimiento
+ * @param	cmd: comando respondido (STN_PIDS_1_1..STN_PIDS_1_6 o STN_PIDS_9)
+ * 			bitmap: PIDs soportados del rango (bit 31 -> PID base+1, bit 0 -> PID base+0x20)
+ * @retval	Nada
+ */
+void scheduler_supported(command cmd, uint32_t bitmap)
+{
+	if (discovery == DISCOVER_PIDS && cmd == STN_PIDS_1_1 + range) {
+		service1[range] = bitmap;
+		// El último PID del rango indica si se soporta el siguiente
+		if ((bitmap & 0x01) && range + 1 < PID_RANGES)
+			range++;
+		else
+			discovery = DISCOVER_PIDS_9;
+	} else if (discovery == DISCOVER_PIDS_9 && cmd == STN_PIDS_9) {
+		service9 = bitmap;
+		endDiscovery();
+	}
+}
+
+/*
+ * @brief	La petición del descubrimiento en curso ha terminado sin una respuesta válida
+ * 			(NO DATA o sin respuesta): la fase se da por no soportada y se pasa a la siguiente
+ * @param	cmd: comando terminado
+ * @retval	Nada
+ */
+void scheduler_unanswered(command cmd)
+{
+	if (discovery == DISCOVER_DONE || cmd != scheduler_discovery())
+		return;
+
+	switch (discovery) {
+	case DISCOVER_VIN:
+		// Sin VIN no se puede buscar ni guardar el vehículo en la caché
+		vinKnown = 0;
+		memset(carVin, 0, sizeof(carVin));
+		discovery = DISCOVER_PIDS;
+		break;
+	case DISCOVER_PIDS:
+	case DISCOVER_PIDS_9:
+		scheduler_supported(cmd, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * @brief	Indica si el vehículo soporta un PID del servicio 01. Mientras no se conozcan
+ * 			los PIDs soportados se suponen todos
+ * @param	pid: PID del servicio 01
+ * @retval	1 -> Soportado
+ * 			0 -> No soportado
+ */
+uint8_t scheduler_isSupported(uint8_t pid)
+{
+	if (discovery != DISCOVER_DONE || !service1[0])
+		return 1;
+	if (pid == 0 || pid > 32*PID_RANGES)
+		return 0;
+	pid--;
+	return (service1[pid / 32] >> (31 - pid % 32)) & 0x01;
+}
+
+/*
+ * @brief	Termina el descubrimiento y guarda en la caché los PIDs del vehículo
+ * @param	Nada
+ * @retval	Nada
+ */
+static void endDiscovery(void)
+{
+	discovery = DISCOVER_DONE;
+	if (vinKnown && service1[0])
+		pidcache_store(carVin, service1, service9);
+}
+
+/*
+ * @brief	Indica si hay algún PID al que le toque ser pedido
+ * @param	now: instante actual (ms)
+ * @retval	1 -> Hay PIDs pendientes de pedir
+ * 			0 -> Ninguno
+ */
+uint8_t scheduler_due(uint32_t now)
+{
+	uint8_t i;
+
+	if (discovery != DISCOVER_DONE)
+		return 1;
+
+	for (i = 0; i < NUM_SCHEDULED; i++) {
+		if ((int32_t) (now - table[i].next) >= 0 && scheduler_isSupported(table[i].pid))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Selecciona los PIDs a pedir en la siguiente petición: primero por prioridad y,
+ * 			a igual prioridad, el que más retraso lleve. Programa su siguiente envío
+ * @param	now: instante actual (ms)
+ * 			pids: PIDs seleccionados
+ * 			max: máximo de PIDs a seleccionar
+ * @retval	Número de PIDs seleccionados
+ */
+uint8_t scheduler_next(uint32_t now, uint8_t *pids, uint8_t max)
+{
+	uint8_t i, n, best;
+	uint8_t chosen[NUM_SCHEDULED] = {0};
+	uint32_t lag;
+
+	for (n = 0; n < max; n++) {
+		best = NUM_SCHEDULED;
+		for (i = 0; i < NUM_SCHEDULED; i++) {
+			if (chosen[i] || (int32_t) (now - table[i].next) < 0 || !scheduler_isSupported(table[i].pid))
+				continue;
+			if (best == NUM_SCHEDULED || table[i].priority < table[best].priority
+					|| (table[i].priority == table[best].priority
+							&& (int32_t) (table[best].next - table[i].next) > 0))
+				best = i;
+		}
+		if (best == NUM_SCHEDULED)
+			break;
+
+		chosen[best] = 1;
+		pids[n] = table[best].pid;
+
+		// La anterior petición no obtuvo respuesta
+		if (table[best].pending)
+			table[best].missed++;
+		table[best].pending = 1;
+
+		// Si se ha retrasado más de un periodo, se pierden esos periodos y se recoloca
+		lag = now - table[best].next;
+		if (lag >= table[best].period) {
+			table[best].missed += lag / table[best].period;
+			table[best].next = now + table[best].period;
+		} else {
+			table[best].next += table[best].period;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * @brief	Registra la respuesta a un PID planificado
+ * @param	pid: PID recibido
+ * @retval	Nada
+ */
+void scheduler_received(uint8_t pid)
+{
+	uint8_t i;
+	for (i = 0; i < NUM_SCHEDULED; i++) {
+		if (table[i].pid == pid && table[i].pending) {
+			table[i].pending = 0;
+			table[i].received++;
+			return;
+		}
+	}
+}
+
+/*
+ * @brief	La última petición no ha obtenido respuesta: se cuentan como perdidos sus PIDs
+ * @param	Nada
+ * @retval	Nada
+ */
+void scheduler_timeout(void)
+{
+	uint8_t i;
+
+	// Sin respuesta durante el descubrimiento: se pasa a la siguiente fase con lo conocido
+	if (discovery != DISCOVER_DONE) {
+		scheduler_unanswered(scheduler_discovery());
+		return;
+	}
+
+	for (i = 0; i < NUM_SCHEDULED; i++) {
+		if (table[i].pending) {
+			table[i].pending = 0;
+			table[i].missed++;
+		}
+	}
+}
+
+/*
+ * @brief	Tasa conseguida por un PID desde el comienzo de la medida
+ * @param	index: posición del PID en la tabla
+ * 			now: instante actual (ms)
+ * @retval	Tasa en centésimas de Hz
+ */
+uint16_t scheduler_rate(uint8_t index, uint32_t now)
+{
+	uint32_t elapsed;
+	if (index >= NUM_SCHEDULED || !(elapsed = now - table[index].since))
+		return 0;
+	return (uint64_t) table[index].received * 100000 / elapsed;
+}
+
+/*
+ * @brief	Devuelve la tabla de planificación para consultar sus estadísticas
+ * @param	num: número de PIDs de la tabla
+ * @retval	Tabla de planificación
+ */
+const pidSchedule_t* scheduler_table(uint8_t *num)
+{
+	*num = NUM_SCHEDULED;
+	return table;
+}
@@ -0,0 +1,41 @@
+/*
+ * scheduler.h
+ *
+ *  Planificador de la adquisición de PIDs del servicio 01
+ *      Author: miguelvp
+ */
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stdint.h>
+#include "atcom.h"
+
+// Entrada de la tabla de planificación de un PID
+typedef struct pidSchedule_t {
+	uint8_t		pid;
+	uint8_t		priority;		// 0 -> más prioritario
+	uint16_t	period;			// Periodo objetivo (ms)
+	uint32_t	next;			// Instante del próximo envío (ms)
+	uint8_t		pending;		// Pedido y sin respuesta
+
+	// Estadísticas
+	uint32_t	since;			// Comienzo de la medida (ms)
+	uint32_t	received;		// Respuestas recibidas desde since
+	uint32_t	missed;			// Periodos perdidos (sin pedir a tiempo o sin respuesta)
+} pidSchedule_t;
+
+void scheduler_init(uint32_t now);
+command scheduler_discovery(void);
+void scheduler_vin(const uint8_t *vin);
+void scheduler_supported(command cmd, uint32_t bitmap);
+void scheduler_unanswered(command cmd);
+uint8_t scheduler_isSupported(uint8_t pid);
+uint8_t scheduler_due(uint32_t now);
+uint8_t scheduler_next(uint32_t now, uint8_t *pids, uint8_t max);
+void scheduler_received(uint8_t pid);
+void scheduler_timeout(void);
+uint16_t scheduler_rate(uint8_t index, uint32_t now);
+const pidSchedule_t* scheduler_table(uint8_t *num);
+
+#endif /* SCHEDULER_H_ */
@@ -8,21 +8,23 @@
  */
 
 #include "shareData.h"
+#include "telemetry.h"
 #include "lptim.h"
 #include "stm32l4xx_hal_lptim.h"
-#include "printf.h"
 #include <string.h>
 
-// Tamaos de las pilas de los buffer de recepcin y transmisin a mdulo
-#define RX_SIZE		48
+// Tamaños de las pilas de los buffer de recepción y transmisión a módulo (potencias de 2)
+#define RX_SIZE		64
 #define TX_SIZE		32
 
-// Tamaos de pila de los mensajes a enviar por USB y NB-IoT
+// Tamaños de pila de los mensajes a enviar por USB y NB-IoT
 #define TX_USB_NUM_MSSG		10
 #define TX_NB_NUM_MSSG		10
 
-// Tiempos mximos de espera para los Mutex
-#define RX_TIMEOUT	2000	// ms
+// Bloques que puede ocupar como mucho un mensaje: los de la pila más grande
+#define TX_MAX_BLOCKS		((TX_USB_NUM_MSSG > TX_NB_NUM_MSSG) ? TX_USB_NUM_MSSG : TX_NB_NUM_MSSG)
+
+// Tiempo máximo de espera para el Mutex
 #define TX_TIMEOUT	1000	// ms
 
 #if SPEED_TEST
@@ -48,77 +50,112 @@
 // Copia de los flags para el timer
 static uint16_t *flags_cpy;
 
-// Buffers y mutex de datos de recepcin y transmisin por USB
-static circular_buf_t *usbReceive;
-static circular_buf_t *usbSend;
+// Buffers y mutex de datos de recepción y transmisión por USB
+static spsc_buf_t *usbReceive;
+static spsc_buf_t *usbSend;
 static osMailQId txUSB, txNB;
-static osMutexId sendPileMutex, receivePileMutex;
+static osMutexId sendPileMutex;
+static txStats_t usbStats, nbStats;
+
+// Cabeceras de los mensajes recibidos por USB. Hash perfecto: primera letra % MSSG_HASH_SIZE
+#define MSSG_HASH_SIZE		11
+typedef struct mssgHeader_t {
+	uint8_t text[5];
+	uint16_t type;
+} mssgHeader_t;
+static const mssgHeader_t mssgHeader[MSSG_HASH_SIZE] = {
+		['n' % MSSG_HASH_SIZE] = {"nb", NB_MSSG},
+		['d' % MSSG_HASH_SIZE] = {"data", TX_DATA},
+		['e' % MSSG_HASH_SIZE] = {"euro", SETUP_MSSG},
+		['g' % MSSG_HASH_SIZE] = {"gnss", GNSS_MSSG},
+		['s' % MSSG_HASH_SIZE] = {"stn", STN_MSSG},
+		['t' % MSSG_HASH_SIZE] = {"test", TEST_MSSG},
+		['m' % MSSG_HASH_SIZE] = {"mon", MONITOR_MSSG},
+		['w' % MSSG_HASH_SIZE] = {"win", WINDOW_MSSG}
+};
+
+// Valor de cada carácter hexadecimal (mayúsculas y minúsculas)
+const uint8_t hexValue[256] = {
+		[0 ... 255] = HEX_INVALID,
+		['0'] = 0x0, ['1'] = 0x1, ['2'] = 0x2, ['3'] = 0x3, ['4'] = 0x4,
+		['5'] = 0x5, ['6'] = 0x6, ['7'] = 0x7, ['8'] = 0x8, ['9'] = 0x9,
+		['A'] = 0xA, ['B'] = 0xB, ['C'] = 0xC, ['D'] = 0xD, ['E'] = 0xE, ['F'] = 0xF,
+		['a'] = 0xA, ['b'] = 0xB, ['c'] = 0xC, ['d'] = 0xD, ['e'] = 0xE, ['f'] = 0xF
+};
+
+// Índice de los mensajes completos del buffer de recepción. Lo rellena putRX al escribir el
+// terminador y lo vacía el consumidor, igual que el buffer: un productor y un consumidor
+#define MSSG_INDEX_SIZE		8	// Potencia de 2
+typedef struct mssgIndex_t {
+	uint16_t offset;	// Posición del primer byte en usbReceive (sin aplicar mask)
+	uint16_t len;		// Longitud con el '\0'
+	uint16_t type;		// Tipo de mensaje según la cabecera (0 -> desconocido)
+} mssgIndex_t;
+static mssgIndex_t mssgIndex[MSSG_INDEX_SIZE];
+static volatile uint8_t indexHead, indexTail;
+static uint16_t mssgStart;	// Comienzo del mensaje que se está recibiendo (productor)
 
 // Almacenamiento de coordenadas
 static uint8_t lastLat[13];
 static uint8_t lastLong[13];
 
-// Codificacin de mensajes en texto plano a hexadecimal
-static void string2hex (uint8_t *src, uint8_t *dst);
+// Mensaje de telemetría en preparación: fuera de la pila de la tarea del micro, que es la
+// única que lo usa (siempre con lockTX)
+static uint8_t telemetryMssg[TELEMETRY_NB_SIZE];
 
 // Funciones de los buffer
-static void circular_buf_free(circular_buf_t *cbuf);
 static uint8_t circular_buf_reset(circular_buf_t *cbuf);
-static uint8_t circular_buf_put(circular_buf_t *cbuf, uint8_t data);
-static uint8_t circular_buf_get(circular_buf_t *cbuf, uint8_t *data);
-static uint8_t circular_buf_empty(circular_buf_t cbuf);
-static uint8_t circular_buf_full(circular_buf_t cbuf);
+static void spsc_buf_free(spsc_buf_t *sbuf);
+
+// Pilas de transmisión
+static uint8_t putBlocks(osMailQId queue, txStats_t *stats, uint8_t *data, uint16_t len);
+static uint8_t getBlock(osMailQId queue, txBlock_t **block);
+static void freeBlock(osMailQId queue, txStats_t *stats, txBlock_t *block);
+
+// Índice de mensajes recibidos
+static uint16_t mssgType(uint16_t offset, uint16_t len);
+static void releaseIndexRX(void);
 
 /*
  * @brief	Inicializa los valores y reserva en memoria de los punteros
- * @param	flags: direccin de la variable compartida por micro y USB
+ * @param	flags: dirección de la variable compartida por micro y USB
  * 				   para tener copia como variable global
  * @retval	1 -> Se ha reservado correctamente
- * 			0 -> Ha habido algn error en las reservas de memoria
+ * 			0 -> Ha habido algún error en las reservas de memoria
  */
 uint8_t shareData_init(uint16_t *flags)
 {
 	flags_cpy = flags;
 
-	if (circular_buf_init(&usbReceive, RX_SIZE) == 0) {
+	if (spsc_buf_init(&usbReceive, RX_SIZE) == 0) {
 		return 0;
 	}
 
-	if (circular_buf_init(&usbSend, TX_SIZE) == 0) {
-		circular_buf_free(usbReceive);
+	if (spsc_buf_init(&usbSend, TX_SIZE) == 0) {
+		spsc_buf_free(usbReceive);
 		return 0;
 	}
 
 	osMutexDef(sendPile);
 	if ((sendPileMutex = osMutexCreate(osMutex(sendPile))) == NULL) {
-		circular_buf_free(usbReceive);
-		circular_buf_free(usbSend);
+		spsc_buf_free(usbReceive);
+		spsc_buf_free(usbSend);
 		return 0;
 	}
 
-	osMutexDef(sendReceive);
-	if ((receivePileMutex = osMutexCreate(osMutex(sendReceive))) == NULL) {
-		circular_buf_free(usbReceive);
-		circular_buf_free(usbSend);
-		osMutexDelete(sendPileMutex);
-		return 0;
-	}
-
-	osMailQDef(mssgPileTX, TX_USB_NUM_MSSG, uint8_t*);
+	osMailQDef(mssgPileTX, TX_USB_NUM_MSSG, txBlock_t);
 	if ((txUSB = osMailCreate(osMailQ(mssgPileTX), NULL)) == NULL) {
-		circular_buf_free(usbReceive);
-		circular_buf_free(usbSend);
+		spsc_buf_free(usbReceive);
+		spsc_buf_free(usbSend);
 		osMutexDelete(sendPileMutex);
-		osMutexDelete(receivePileMutex);
 		return 0;
 	}
 
-	osMailQDef(nbPileTX, TX_NB_NUM_MSSG, uint8_t*);
+	osMailQDef(nbPileTX, TX_NB_NUM_MSSG, txBlock_t);
 	if ((txNB = osMailCreate(osMailQ(nbPileTX), NULL)) == NULL) {
-		circular_buf_free(usbReceive);
-		circular_buf_free(usbSend);
+		spsc_buf_free(usbReceive);
+		spsc_buf_free(usbSend);
 		osMutexDelete(sendPileMutex);
-		osMutexDelete(receivePileMutex);
 		return 0;
 	}
 
@@ -127,242 +164,169 @@ uint8_t shareData_init(uint16_t *flags)
 }
 
 /*
- * @brief	Reserva el mutex asociado al buffer de recepcin
- * @retval	1 -> Se ha cumplido la reserva del mutex
- * 			0 -> Ha ido mal la reserva por salto de timeout o
- * 				 cualquier otro motivo
- */
-uint8_t lockRX(void)
-{
-	osStatus devol;
-	devol = osMutexWait(receivePileMutex, pdMS_TO_TICKS(RX_TIMEOUT));
-	return devol == osOK;
-}
-
-/*
- * @brief	Libera el mutex asociado al buffer de recepcin
- * @retval	1 -> Se ha cumplido la liberacin del mutex
- * 			0 -> Ha ido mal la liberacin por cualquier motivo
- */
-uint8_t unlockRX(void)
-{
-	osStatus devol;
-	devol = osMutexRelease(receivePileMutex);
-	return devol == osOK;
-}
-
-/*
- * @brief	Indica la cantidad de datos que hay en el buffer de recepcin
- * 			que todava no se han leido
- * @retval	Nmero de datos sin leer
+ * @brief	Indica la cantidad de datos que hay en el buffer de recepción
+ * 			que todavía no se han leido
+ * @retval	Número de datos sin leer
  */
 uint16_t notReadRX(void)
 {
-	if (usbReceive->head >= usbReceive->tail)
-		return usbReceive->head-(usbReceive->tail);
-	else
-		return (usbReceive->size)-((usbReceive->tail)-usbReceive->head);
+	return __atomic_load_n(&usbReceive->head, __ATOMIC_ACQUIRE) - usbReceive->tail;
 }
 
 /*
  * @brief	Indica la longitud del primer mensaje que hay en el buffer
- * 			de recepcin. Esto es hasta que se encuentre un \0
+ * 			de recepción, \0 incluido
  * @retval	Longitud del primer mensaje
+ * 			0 -> No hay ningún mensaje completo
  */
 uint16_t lenFirstMssgRX(void)
 {
-	uint16_t devol, initTail;
-	uint8_t lastByte;
-
-	initTail = usbReceive->tail;
-	devol = 0;
-	do {
-		if (!circular_buf_get(usbReceive, &lastByte)) {
-			devol = 0;
-		} else {
-			devol++;
-		}
-	} while (lastByte != '\0' && devol != 0);
-
-	usbReceive->tail = initTail;
-	return devol;
+	if (__atomic_load_n(&indexHead, __ATOMIC_ACQUIRE) == indexTail)
+		return 0;
+	return mssgIndex[indexTail & (MSSG_INDEX_SIZE - 1)].len;
 }
 
 /*
  * @brief	Indica el tipo del siguiente mensaje que hay en el buffer
- * 			de recepcin.
+ * 			de recepción. Los mensajes de tipo desconocido se descartan
  * @retval	Tipo de mensaje STN_MSSG, GNSS_MSSG o NB_MSSG
  * 			0 -> No coincide con ninguno de los tipos de mensaje
  */
 uint16_t typeNextMssgRX(void)
 {
-	uint8_t lastByte, initTail;
 	uint16_t type;
-	type = 0;
-	lastByte = '\0';
-	initTail = usbReceive->tail;
-
-	circular_buf_get(usbReceive, &lastByte);
-	if (lastByte == 's')
-		type = STN_MSSG;
-	else if (lastByte == 'g')
-		type = GNSS_MSSG;
-	else if (lastByte == 'n')
-		type = NB_MSSG;
-	else if (lastByte == 't')
-		type = TEST_MSSG;
-	else if (lastByte == 'd')
-		type = TX_DATA;
-	else if (lastByte == 'e')
-		type = SETUP_MSSG;
-	else
-		type = 0;
-
-	circular_buf_get(usbReceive, &lastByte);
-	switch (type) {
-	case STN_MSSG:
-		if (lastByte != 't')
-			type = 0;
-		break;
-	case GNSS_MSSG:
-		if (lastByte != 'n')
-			type = 0;
-		break;
-	case NB_MSSG:
-		if (lastByte != 'b')
-			type = 0;
-		break;
-	case TEST_MSSG:
-		if (lastByte != 'e')
-			type = 0;
-		break;
-	case TX_DATA:
-		if (lastByte != 'a')
-			type = 0;
-		break;
-	case SETUP_MSSG:
-		if (lastByte != 'u')
-			type = 0;
-		break;
-	}
-
-	circular_buf_get(usbReceive, &lastByte);
-	switch (type) {
-	case STN_MSSG:
-		if (lastByte != 'n')
-			type = 0;
-		break;
-	case GNSS_MSSG:
-		if (lastByte != 's')
-			type = 0;
-		break;
-	case TEST_MSSG:
-		if (lastByte != 's')
-			type = 0;
-		break;
-	case TX_DATA:
-		if (lastByte != 't')
-			type = 0;
-		break;
-	case SETUP_MSSG:
-		if (lastByte != 'r')
-			type = 0;
-		break;
-	}
-
-	circular_buf_get(usbReceive, &lastByte);
-	switch (type) {
-	case GNSS_MSSG:
-		if (lastByte != 's')
-			type = 0;
-		break;
-	case TEST_MSSG:
-		if (lastByte != 't')
-			type = 0;
-		break;
-	case TX_DATA:
-		if (lastByte != 'a')
-			type = 0;
-		break;
-	case SETUP_MSSG:
-		if (lastByte != 'o')
-			type = 0;
-		break;
-	}
 
-	usbReceive->tail = initTail;
+	if (__atomic_load_n(&indexHead, __ATOMIC_ACQUIRE) == indexTail)
+		return 0;
+	type = mssgIndex[indexTail & (MSSG_INDEX_SIZE - 1)].type;
 	if (!type)
 		jumpMssgRX();
 	return type;
 }
 
 /*
- * @brief	Aade datos al buffer de recepcin
+ * @brief	Añade datos al buffer de recepción. Sólo se llama desde el callback del USB.
+ * 			Si los datos cierran un mensaje se añade al índice con su tipo
  * @param	data: puntero a los datos a guardar
  * 			len: cantidad de datos del puntero a guardar
- * @retval	1 -> datos aadidos correctamente
- * 			0 -> datos no aadidos
+ * @retval	1 -> datos añadidos correctamente
+ * 			0 -> datos no añadidos (no caben enteros o el índice está lleno)
  */
 uint8_t putRX(uint8_t *data, uint16_t len)
 {
-	uint16_t i, hInit;
-	hInit = usbReceive->head;
-	for (i = 0; i < len; i++) {
-		if (!circular_buf_put(usbReceive, data[i])) {
-			usbReceive->head = hInit;
-			return 0;
-		}
-	}
-	if (data[len-1] == '\r'){
-		if (!circular_buf_put(usbReceive, '\0')) {
-			usbReceive->head = hInit;
-			return 0;
-		}
+	uint16_t need, head;
+	uint8_t slot;
+	const uint8_t end = '\0';
+	buf_span_t span;
+
+	if (!len)
+		return 1;
+	need = len + (data[len-1] == '\r');
+	if (spsc_buf_writeSpan(usbReceive, &span) < need)
+		return 0;
+	slot = indexHead;
+	if (need > len && (uint8_t) (slot - __atomic_load_n(&indexTail, __ATOMIC_ACQUIRE)) == MSSG_INDEX_SIZE)
+		return 0;
+
+	span_fill(&span, 0, data, len);
+	head = usbReceive->head + need;
+	if (need > len) {
+		span_fill(&span, len, &end, 1);
+		mssgIndex[slot & (MSSG_INDEX_SIZE - 1)].offset = mssgStart;
+		mssgIndex[slot & (MSSG_INDEX_SIZE - 1)].len = head - mssgStart;
+		mssgIndex[slot & (MSSG_INDEX_SIZE - 1)].type = mssgType(mssgStart, head - mssgStart);
+		mssgStart = head;
 	}
+
+	// Los datos quedan escritos antes de que el consumidor vea el nuevo head y el índice
+	__atomic_store_n(&usbReceive->head, head, __ATOMIC_RELEASE);
+	if (need > len)
+		__atomic_store_n(&indexHead, (uint8_t) (slot + 1), __ATOMIC_RELEASE);
 	return 1;
 }
 
 /*
- * @brief	Toma un cierto nmero de datos del buffer de recepcin
- * @param	data: puntero al lugar donde se almacenarn los datos del buffer
- * @param	len: nmero de datos a recoger
- * @retval	1 -> datos extrados correctamente
- * 			0 -> datos no extrados
+ * @brief	Toma un cierto número de datos del buffer de recepción
+ * @param	data: puntero al lugar donde se almacenarán los datos del buffer
+ * @param	len: número de datos a recoger
+ * @retval	1 -> datos extraídos correctamente
+ * 			0 -> datos no extraídos
  */
 uint8_t getRX(uint8_t *data, uint16_t len)
 {
-	uint16_t i, tInit;
-	tInit = usbReceive->tail;
-	for (i = 0; i < len; i++) {
-		if (!circular_buf_get(usbReceive, &data[i])) {
-			usbReceive->tail = tInit;
-			return 0;
-		}
-	}
+	buf_span_t span;
+
+	if (spsc_buf_readSpan(usbReceive, &span) < len)
+		return 0;
+	span_copy(&span, 0, data, len);
+
+	// Los datos quedan leídos antes de que el productor pueda sobrescribirlos
+	__atomic_store_n(&usbReceive->tail, (uint16_t) (usbReceive->tail + len), __ATOMIC_RELEASE);
+	releaseIndexRX();
 	return 1;
 }
 
 /*
- * @brief	Salta el mensaje en el buffer de recepcin al siguiente
+ * @brief	Salta el mensaje en el buffer de recepción al siguiente
  * @retval	1 -> salto correcto
- * 			0 -> fallo en el salto
+ * 			0 -> fallo en el salto (no hay ningún mensaje completo)
  */
 uint8_t jumpMssgRX(void)
 {
-	uint8_t i, data;
-	i = 0;
-	do {
-		circular_buf_get(usbReceive, &data);
-		if (i == 255) {
-			return 0;
-		}
-		i++;
-	} while (data != '\0');
+	uint16_t len;
+	if (!(len = lenFirstMssgRX()))
+		return 0;
+	__atomic_store_n(&usbReceive->tail, (uint16_t) (usbReceive->tail + len), __ATOMIC_RELEASE);
+	releaseIndexRX();
 	return 1;
 }
 
 /*
- * @brief	Reserva el mutex asociado al buffer de transmisin
+ * @brief	Saca del índice los mensajes que ya se han leído por completo
+ * @param	Nada
+ * @retval	Nada
+ */
+static void releaseIndexRX(void)
+{
+	uint8_t slot = indexTail;
+	const mssgIndex_t *mssg;
+
+	while (slot != __atomic_load_n(&indexHead, __ATOMIC_ACQUIRE)) {
+		mssg = &mssgIndex[slot & (MSSG_INDEX_SIZE - 1)];
+		if ((int16_t) (usbReceive->tail - (uint16_t) (mssg->offset + mssg->len)) < 0)
+			break;
+		slot++;
+	}
+	__atomic_store_n(&indexTail, slot, __ATOMIC_RELEASE);
+}
+
+/*
+ * @brief	Tipo de un mensaje recién recibido según su cabecera. Lo usa el productor, que
+ * 			lee datos que el consumidor todavía no puede liberar
+ * @param	offset: posición del mensaje en usbReceive
+ * @param	len: longitud del mensaje
+ * @retval	Tipo de mensaje
+ * 			0 -> No coincide con ninguna cabecera
+ */
+static uint16_t mssgType(uint16_t offset, uint16_t len)
+{
+	const uint8_t *buffer = usbReceive->buffer;
+	const uint16_t mask = usbReceive->mask;
+	const mssgHeader_t *header;
+	uint8_t i;
+
+	// La primera letra indexa directamente la única cabecera posible, que se compara sobre
+	// el propio buffer (una entrada vacía de la tabla no coincide con nada: tipo 0)
+	header = &mssgHeader[buffer[offset & mask] % MSSG_HASH_SIZE];
+	for (i = 0; i < sizeof(header->text) && header->text[i] != '\0'; i++) {
+		if (i >= len || buffer[(uint16_t) (offset + i) & mask] != header->text[i])
+			return 0;
+	}
+	return header->type;
+}
+
+/*
+ * @brief	Reserva el mutex asociado al buffer de transmisión
  * @retval	1 -> Se ha cumplido la reserva del mutex
  * 			0 -> Ha ido mal la reserva por salto de timeout o
  * 				 cualquier otro motivo
@@ -375,9 +339,9 @@ uint8_t lockTX(void)
 }
 
 /*
- * @brief	Libera el mutex asociado al buffer de transmisin
- * @retval	1 -> Se ha cumplido la liberacin del mutex
- * 			0 -> Ha ido mal la liberacin por cualquier motivo
+ * @brief	Libera el mutex asociado al buffer de transmisión
+ * @retval	1 -> Se ha cumplido la liberación del mutex
+ * 			0 -> Ha ido mal la liberación por cualquier motivo
  */
 uint8_t unlockTX(void)
 {
@@ -387,9 +351,9 @@ uint8_t unlockTX(void)
 }
 
 /*
- * @brief	Indica la cantidad de datos que hay en el buffer de transmisin
- * 			que todava no se han enviado (Sin uso)
- * @retval	Nmero de datos sin leer
+ * @brief	Indica la cantidad de datos que hay en el buffer de transmisión
+ * 			que todavía no se han enviado (Sin uso)
+ * @retval	Número de datos sin leer
  */
 uint16_t notSendTX(void)
 {
@@ -397,77 +361,161 @@ uint16_t notSendTX(void)
 }
 
 /*
- * @brief	Aade datos al buffer de transmisin por USB
+ * @brief	Añade datos al buffer de transmisión por USB
  * @param	data: puntero a los datos a guardar
- * 			len: cantidad de datos del puntero a guardar
- * @retval	1 -> datos aadidos correctamente
- * 			0 -> datos no aadidos
+ * 			len: cantidad de datos del puntero a guardar (hasta el primer \0)
+ * @retval	1 -> datos añadidos correctamente
+ * 			0 -> datos no añadidos
  */
 uint8_t putTX(uint8_t *data, uint16_t len)
 {
-	uint8_t *mssg, j;
-	uint16_t memPos;
-	for (j = 0; j <= (len-1)/32; j++) {
-		memPos = ((len-32*j)>=32)?33:(len-32*j)+1;
-		if ((mssg = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*memPos)) == NULL)
-			return 0;
-		strcpy((char*) mssg, (char*) &(data[32*j]));
-		mssg[memPos - 1] = '\0';
-		osMailPut(txUSB, mssg);
-	}
-	return 1;
+	return putBlocks(txUSB, &usbStats, data, len);
 }
 
 /*
- * @brief	Aade datos al buffer de transmisin por NB-IoT
+ * @brief	Añade datos al buffer de transmisión por NB-IoT
  * @param	data: puntero a los datos a guardar
- * 			len: cantidad de datos del puntero a guardar
- * @retval	1 -> datos aadidos correctamente
- * 			0 -> datos no aadidos
+ * 			len: cantidad de datos del puntero a guardar (hasta el primer \0)
+ * @retval	1 -> datos añadidos correctamente
+ * 			0 -> datos no añadidos
  */
 uint8_t putNB(uint8_t *data, uint16_t len)
 {
-	uint8_t *mssg;
-	if ((mssg = (uint8_t*) pvPortMalloc(sizeof(uint8_t)*len)) == NULL)
+	return putBlocks(txNB, &nbStats, data, len);
+}
+
+/*
+ * @brief	Toma el siguiente bloque del buffer de transmisión de USB. El bloque sigue
+ * 			reservado hasta que se libera con freeTX, una vez transmitido
+ * @param	block: bloque a transmitir
+ * @retval	1 -> Hay un bloque
+ * 			0 -> El buffer está vacío
+ */
+uint8_t getTX(txBlock_t **block)
+{
+	return getBlock(txUSB, block);
+}
+
+/*
+ * @brief	Devuelve al pool de USB un bloque ya transmitido
+ * @param	block: bloque transmitido
+ * @retval	Nada
+ */
+void freeTX(txBlock_t *block)
+{
+	freeBlock(txUSB, &usbStats, block);
+}
+
+/*
+ * @brief	Toma el siguiente bloque del buffer de transmisión de NB-IoT. El bloque sigue
+ * 			reservado hasta que se libera con freeNB, una vez transmitido
+ * @param	block: bloque a transmitir
+ * @retval	1 -> Hay un bloque
+ * 			0 -> El buffer está vacío
+ */
+uint8_t getNB(txBlock_t **block)
+{
+	return getBlock(txNB, block);
+}
+
+/*
+ * @brief	Devuelve al pool de NB-IoT un bloque ya transmitido
+ * @param	block: bloque transmitido
+ * @retval	Nada
+ */
+void freeNB(txBlock_t *block)
+{
+	freeBlock(txNB, &nbStats, block);
+}
+
+/*
+ * @brief	Ocupación de las pilas de transmisión
+ * @param	usb: estadísticas de la pila de USB
+ * 			nb: estadísticas de la pila de NB-IoT
+ * @retval	Nada
+ */
+void statsTX(txStats_t *usb, txStats_t *nb)
+{
+	*usb = usbStats;
+	*nb = nbStats;
+}
+
+/*
+ * @brief	Reparte un mensaje en bloques del pool de la pila y los encola. Se reservan todos
+ * 			los bloques antes de encolar ninguno, para no transmitir nunca un mensaje cortado
+ * @param	queue: pila de transmisión
+ * 			stats: estadísticas de la pila
+ * 			data: mensaje
+ * 			len: longitud del mensaje (hasta el primer \0)
+ * @retval	1 -> mensaje encolado
+ * 			0 -> no quedan bloques para todo el mensaje (no se encola nada)
+ */
+static uint8_t putBlocks(osMailQId queue, txStats_t *stats, uint8_t *data, uint16_t len)
+{
+	txBlock_t *blocks[TX_MAX_BLOCKS];
+	uint16_t pos, used;
+	uint8_t num, i;
+
+	len = strnlen((char*) data, len);
+	if (len > TX_MAX_BLOCKS*TX_BLOCK_SIZE) {
+		__atomic_fetch_add(&stats->failures, 1, __ATOMIC_RELAXED);
 		return 0;
-	strcpy((char*) mssg, (char*) data);
-	osMailAlloc(txNB, 0);
-	osMailPut(txNB, mssg);
+	}
+	num = (len + TX_BLOCK_SIZE - 1) / TX_BLOCK_SIZE;
+
+	for (i = 0; i < num; i++) {
+		if ((blocks[i] = (txBlock_t*) osMailAlloc(queue, 0)) == NULL) {
+			// Se devuelven los bloques ya reservados
+			while (i)
+				osMailFree(queue, blocks[--i]);
+			__atomic_fetch_add(&stats->failures, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+	used = __atomic_add_fetch(&stats->used, num, __ATOMIC_RELAXED);
+	if (used > stats->highWater)
+		stats->highWater = used;
+
+	for (i = 0, pos = 0; i < num; i++, pos += TX_BLOCK_SIZE) {
+		blocks[i]->len = (len - pos > TX_BLOCK_SIZE) ? TX_BLOCK_SIZE : len - pos;
+		memcpy(blocks[i]->data, &data[pos], blocks[i]->len);
+		osMailPut(queue, blocks[i]);
+	}
 	return 1;
 }
 
 /*
- * @brief	Toma un puntero de los mensajes del buffer de transmisin de USB
- * @param	data: puntero al lugar donde se almacenarn los datos del buffer
- * @param	len: nmero de datos a recoger (Sin uso)
- * @retval	Estado de la extraccin del buffer
+ * @brief	Toma el siguiente bloque de una pila de transmisión
+ * @param	queue: pila de transmisión
+ * 			block: bloque a transmitir
+ * @retval	1 -> Hay un bloque
+ * 			0 -> La pila está vacía
  */
-uint8_t getTX(uint8_t **data, uint16_t len)
+static uint8_t getBlock(osMailQId queue, txBlock_t **block)
 {
 	osEvent evt;
-	evt = osMailGet(txUSB, 0);
-	*data = evt.value.p;
-	osMailFree(txUSB, evt.value.p);
-	return evt.status;
+	evt = osMailGet(queue, 0);
+	if (evt.status != osEventMail)
+		return 0;
+	*block = (txBlock_t*) evt.value.p;
+	return 1;
 }
 
 /*
- * @brief	Toma un puntero de los mensajes del buffer de transmisin de NB-IoT
- * @param	data: puntero al lugar donde se almacenarn los datos del buffer
- * @param	len: nmero de datos a recoger
- * @retval	Estado de la extraccin del buffer
+ * @brief	Devuelve un bloque a su pool
+ * @param	queue: pila de transmisión
+ * 			stats: estadísticas de la pila
+ * 			block: bloque transmitido
+ * @retval	Nada
  */
-uint8_t getNB(uint8_t **data, uint16_t len)
+static void freeBlock(osMailQId queue, txStats_t *stats, txBlock_t *block)
 {
-	osEvent evt;
-	evt = osMailGet(txNB, 0);
-	*data = evt.value.p;
-	osMailFree(txNB, evt.value.p);
-	return evt.status;
+	if (osMailFree(queue, block) == osOK)
+		__atomic_fetch_sub(&stats->used, 1, __ATOMIC_RELAXED);
 }
 
 /*
- * @brief	Lanza un temporizador LP con el periodo indicado con interrupcin
+ * @brief	Lanza un temporizador LP con el periodo indicado con interrupción
  * @param	period: periodo por el cual salta el timeout
  * @retval	1 -> HAL_Status OK
  * 			0 -> HAL_Status not OK
@@ -515,106 +563,73 @@ void getLongitud(uint8_t *newLong)
 }
 
 /*
- * @brief	Envo de mensajes con los datos del vehculo a los buffer de USB y NB-IoT
+ * @brief	Envío de mensajes con los datos del vehículo a los buffer de USB y NB-IoT
  * @param	coche: coche caracterizado
- * @retval	1 -> siempre vlido
+ * @retval	1 -> mensajes encolados
+ * 			0 -> no han cabido en las pilas de transmisión
  */
 uint8_t sendMssg (car* coche)
 {
-	uint8_t mssg[60], str2hex[30];
-	float av_speed, av_rpm;
-	uint8_t i, len;
-	// Medimos la longitud del mensaje a enviar
-	len = 0;
-	sprintf_((char*) mssg, "{\"id\":111012345678,\"vin\":\"VF1BG0A0524085422\"");
-	len += strlen((char*) mssg);
-	sprintf_((char*) mssg, ",\"lat\":%1.7E,\"long\":%1.8E", coche->lastLat, coche->lastLong);
-	len += strlen((char*) mssg);
-	sprintf_((char*) mssg, ",\"co\":%1.6E,\"nox\":%1.6E",coche->co,coche->nox);
-	len += strlen((char*) mssg);
-	sprintf_((char*) mssg, ",\"pm\":%1.6E}\r",coche->pm);
-	len += strlen((char*) mssg) - 1;
-	sprintf_((char*) mssg, "AT+NSOST=0,35.226.227.97,8888,%d,",len);
-	putNB(mssg, strlen((char*) mssg));
-	sprintf_((char*) str2hex, "{\"id\":111012345678,");
-	string2hex(str2hex, mssg);
-	putNB(mssg, strlen((char*) mssg));
-#if TEST
-	av_speed = 0;
-	av_rpm = 0;
-	for (i = 0; i < NUM_VAL_CALC; i++) {
-#if SPEED_TEST
-		av_speed += coche->speed[i];
-#endif
-#if RPM_TEST
-		av_rpm += coche->rpm[i];
-#endif
-	}
-#if SPEED_TEST
-	av_speed = av_speed / NUM_VAL_CALC;
+	uint8_t *cmd;
+	uint16_t len;
+	uint8_t devol;
+
+	// Envío por NB: el comando se serializa de una pasada y se encola en bloques. Con
+	// TELEMETRY_BATCH sólo se envía cuando se cierra el lote de ventanas
+#if TELEMETRY_BATCH
+	cmd = telemetry_batchPush(coche, osKernelSysTick(), telemetryMssg, sizeof(telemetryMssg), &len);
+#else
+	cmd = telemetry_nbCommand(coche, osKernelSysTick(), telemetryMssg, sizeof(telemetryMssg), &len);
 #endif
-#if RPM_TEST
-	av_rpm = av_rpm / NUM_VAL_CALC;
+	devol = (cmd == NULL) || putNB(cmd, len);
+
+#if TEST
+	// Envío por USB
+	if ((len = telemetry_usb(coche, telemetryMssg, sizeof(telemetryMssg))) != 0)
+		devol &= putTX(telemetryMssg, len);
 #endif
+	return devol;
+}
 
-	sprintf_((char*) str2hex, "\"vin\":\"VF1BG0A0524085422\",");
-	string2hex(str2hex, mssg);
-	putNB(mssg, strlen((char*) mssg));
-	sprintf_((char*) str2hex, "\"lat\":%1.7E,", coche->lastLat);
-	string2hex(str2hex, mssg);
-	putNB(mssg, strlen((char*) mssg));
-	sprintf_((char*) str2hex, "\"long\":%1.8E,", coche->lastLong);
-	string2hex(str2hex, mssg);
-	putNB(mssg, strlen((char*) mssg));
-
-	// Envo por USB
-	sprintf_((char*) mssg, "{\"speed\":[%3d,%3d,%3d,%3d,%3d,%3d,%3d,%3d,%3d,%3d],",
-			coche->speed[0],
-			coche->speed[1],
-			coche->speed[2],
-			coche->speed[3],
-			coche->speed[4],
-			coche->speed[5],
-			coche->speed[6],
-			coche->speed[7],
-			coche->speed[8],
-			coche->speed[9]);
-	putTX(mssg, strlen((char*) mssg));
-	sprintf_((char*) mssg, "\"lat\":%1.7E,", coche->lastLat);
-	putTX(mssg, strlen((char*) mssg));
-	sprintf_((char*) mssg, "\"long\":%1.8E,", coche->lastLong);
-	putTX(mssg, strlen((char*) mssg));
-	sprintf_((char*) mssg, "\"co\":%E,",coche->co);
-	putTX(mssg, strlen((char*) mssg));
-	sprintf_((char*) mssg, "\"nox\":%E,",coche->nox);
-	putTX(mssg, strlen((char*) mssg));
-	sprintf_((char*) mssg, "\"pm\":%E}\r",coche->pm);
-	putTX(mssg, strlen((char*) mssg));
-
-	// Envo por NB
-	sprintf_((char*) str2hex, "\"co\":%1.6E,",coche->co);
-	string2hex(str2hex, mssg);
-	putNB(mssg, strlen((char*) mssg));
-	sprintf_((char*) str2hex, "\"nox\":%1.6E,",coche->nox);
-	string2hex(str2hex, mssg);
-	putNB(mssg, strlen((char*) mssg));
-	sprintf_((char*) str2hex, "\"pm\":%1.6E}",coche->pm);
-	string2hex(str2hex, mssg);
-	len = strlen((char*) mssg);
-	mssg[len] = '\r';
-	mssg[len+1] = '\0';
-	putNB(mssg, strlen((char*) mssg));
-	return 1;
+/*
+ * @brief	Comprueba si el lote de telemetría abierto debe enviarse ya por haber superado
+ * 			TELEMETRY_BATCH_LATENCY sin que llegue una ventana que lo cierre
+ * @retval	1 -> Hay que llamar a flushMssg
+ * 			0 -> No hay lote pendiente o aún puede esperar
+ */
+uint8_t expiredMssg (void)
+{
+#if TELEMETRY_BATCH
+	return telemetry_batchExpired(osKernelSysTick());
 #else
 	return 0;
 #endif
 }
 
+/*
+ * @brief	Envía por NB-IoT el lote de telemetría abierto, tenga las ventanas que tenga. Se
+ * 			llama al parar la adquisición y cuando vence TELEMETRY_BATCH_LATENCY
+ * @retval	1 -> Lote encolado o nada que enviar
+ * 			0 -> No ha cabido en la pila de transmisión
+ */
+uint8_t flushMssg (void)
+{
+#if TELEMETRY_BATCH
+	uint8_t *cmd;
+	uint16_t len;
+
+	cmd = telemetry_batchFlush(telemetryMssg, sizeof(telemetryMssg), &len);
+	return (cmd == NULL) || putNB(cmd, len);
+#else
+	return 1;
+#endif
+}
+
 /*
  * @brief	Inicializa el buffer circular
  * @param	cbuf: buffer circular
- * @param	size: tamao del buffer inicializado
- * @retval	1 -> Reserva de memoria con xito
+ * @param	size: tamaño del buffer inicializado
+ * @retval	1 -> Reserva de memoria con éxito
  * 			0 -> Error al reservar memoria
  */
 uint8_t circular_buf_init(circular_buf_t **cbuf, uint16_t size)
@@ -628,126 +643,290 @@ uint8_t circular_buf_init(circular_buf_t **cbuf, uint16_t size)
 }
 
 /*
- * @brief	Libera el buffer circular
- * @param	cbuf: buffer circular
- * @retval	Nada
+ * @brief	Inicializa el buffer circular de un productor y un consumidor
+ * @param	sbuf: buffer circular
+ * @param	size: tamaño del buffer, potencia de 2
+ * @retval	1 -> Reserva de memoria con éxito
+ * 			0 -> Error al reservar memoria o tamaño no válido
  */
-static void circular_buf_free(circular_buf_t *cbuf)
+uint8_t spsc_buf_init(spsc_buf_t **sbuf, uint16_t size)
 {
-	vPortFree(cbuf);
+	if (!size || (size & (size - 1)))
+		return 0;
+	if ((*sbuf = (spsc_buf_t*) pvPortMalloc(sizeof(spsc_buf_t))) == NULL)
+		return 0;
+	if (((*sbuf)->buffer = (uint8_t*) pvPortMalloc(size*sizeof(uint8_t))) == NULL) {
+		vPortFree(*sbuf);
+		return 0;
+	}
+	(*sbuf)->mask = size - 1;
+	(*sbuf)->head = 0;
+	(*sbuf)->tail = 0;
+	return 1;
 }
 
 /*
- * @brief	Reinicia el buffer circular
+ * @brief	Regiones con los datos sin leer de un buffer circular, de tail a head
  * @param	cbuf: buffer circular
- * @retval	1 -> Reinicio con xito
- * 			0 -> Error al reiniciar el buffer
+ * @param	span: regiones de los datos
+ * @retval	Número de datos sin leer
  */
-static uint8_t circular_buf_reset(circular_buf_t *cbuf)
+uint16_t circular_buf_span(circular_buf_t *cbuf, buf_span_t *span)
+{
+	uint16_t head = cbuf->head, tail = cbuf->tail;
+
+	span->data[0] = &cbuf->buffer[tail];
+	span->data[1] = cbuf->buffer;
+	if (head >= tail) {
+		span->len[0] = head - tail;
+		span->len[1] = 0;
+	} else {
+		span->len[0] = cbuf->size - tail;
+		span->len[1] = head;
+	}
+	return span->len[0] + span->len[1];
+}
+
+/*
+ * @brief	Copia los datos sin leer de un buffer circular y los da por leídos. Los que no
+ * 			caben en el destino se descartan
+ * @param	cbuf: buffer circular
+ * @param	dst: destino de los datos
+ * @param	max: tamaño del destino
+ * @retval	Número de datos copiados
+ */
+uint16_t circular_buf_read(circular_buf_t *cbuf, uint8_t *dst, uint16_t max)
 {
-    int r = 0;
+	buf_span_t span;
+	uint16_t len;
 
-    if(cbuf)
-    {
-        cbuf->head = 0;
-        cbuf->tail = 0;
-        cbuf->full = 0;
-        r = 1;
-    }
+	circular_buf_span(cbuf, &span);
+	len = span_copy(&span, 0, dst, max);
+	cbuf->tail = cbuf->head;
+	return len;
+}
 
-    return r;
+/*
+ * @brief	Regiones con los datos sin leer de un buffer de un productor y un consumidor.
+ * 			Sólo la usa el consumidor
+ * @param	sbuf: buffer circular
+ * @param	span: regiones de los datos
+ * @retval	Número de datos sin leer
+ */
+uint16_t spsc_buf_readSpan(spsc_buf_t *sbuf, buf_span_t *span)
+{
+	uint16_t tail = sbuf->tail;
+	uint16_t avail = __atomic_load_n(&sbuf->head, __ATOMIC_ACQUIRE) - tail;
+	uint16_t pos = tail & sbuf->mask;
+
+	span->data[0] = &sbuf->buffer[pos];
+	span->data[1] = sbuf->buffer;
+	span->len[0] = (avail < sbuf->mask + 1 - pos) ? avail : sbuf->mask + 1 - pos;
+	span->len[1] = avail - span->len[0];
+	return avail;
 }
 
 /*
- * @brief	Comprobacin de si el buffer circular est vaco
- * @param	cbuf: buffer circular
- * @retval	1 -> El buffer est vaco
- * 			0 -> El buffer no est vaco
+ * @brief	Regiones libres de un buffer de un productor y un consumidor, a partir de head.
+ * 			Sólo la usa el productor
+ * @param	sbuf: buffer circular
+ * @param	span: regiones libres
+ * @retval	Número de datos que caben
  */
-static uint8_t circular_buf_empty(circular_buf_t cbuf)
+uint16_t spsc_buf_writeSpan(spsc_buf_t *sbuf, buf_span_t *span)
 {
-    return (cbuf.head == cbuf.tail) && !cbuf.full;
+	uint16_t head = sbuf->head;
+	uint16_t space = sbuf->mask + 1 - (uint16_t) (head - __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE));
+	uint16_t pos = head & sbuf->mask;
+
+	span->data[0] = &sbuf->buffer[pos];
+	span->data[1] = sbuf->buffer;
+	span->len[0] = (space < sbuf->mask + 1 - pos) ? space : sbuf->mask + 1 - pos;
+	span->len[1] = space - span->len[0];
+	return space;
 }
 
 /*
- * @brief	Comprobacin de si el buffer circular est lleno
- * @param	cbuf: buffer circular
- * @retval	1 -> El buffer est lleno
- * 			0 -> El buffer no est lleno
+ * @brief	Copia datos de unas regiones de un buffer circular a un destino contiguo
+ * @param	span: regiones del buffer
+ * @param	offset: primer dato a copiar
+ * @param	dst: destino
+ * @param	len: máximo de datos a copiar
+ * @retval	Número de datos copiados
  */
-static uint8_t circular_buf_full(circular_buf_t cbuf)
+uint16_t span_copy(const buf_span_t *span, uint16_t offset, uint8_t *dst, uint16_t len)
 {
-    return cbuf.full;
+	uint16_t first = 0, n;
+
+	if (offset < span->len[0]) {
+		first = (len < span->len[0] - offset) ? len : span->len[0] - offset;
+		memcpy(dst, span->data[0] + offset, first);
+		offset = 0;
+	} else {
+		offset -= span->len[0];
+	}
+	if (offset >= span->len[1])
+		return first;
+	n = (len - first < span->len[1] - offset) ? len - first : span->len[1] - offset;
+	memcpy(dst + first, span->data[1] + offset, n);
+	return first + n;
 }
 
 /*
- * @brief	Aade datos al buffer circular
- * @param	cbuf: buffer circular
- * @param	data: datos a aadir
- * @retval	1 -> Datos aadidos correctamente
- * 			0 -> Error al aadir los datos
+ * @brief	Copia datos contiguos en unas regiones de un buffer circular
+ * @param	span: regiones del buffer
+ * @param	offset: posición del primer dato a escribir
+ * @param	src: origen
+ * @param	len: máximo de datos a copiar
+ * @retval	Número de datos copiados
  */
-static uint8_t circular_buf_put(circular_buf_t *cbuf, uint8_t data)
+uint16_t span_fill(const buf_span_t *span, uint16_t offset, const uint8_t *src, uint16_t len)
 {
-    int r = 0;
+	uint16_t first = 0, n;
 
-    if(cbuf)
-    {
-        cbuf->buffer[cbuf->head] = data;
-        cbuf->head = (cbuf->head + 1) % cbuf->size;
+	if (offset < span->len[0]) {
+		first = (len < span->len[0] - offset) ? len : span->len[0] - offset;
+		memcpy(span->data[0] + offset, src, first);
+		offset = 0;
+	} else {
+		offset -= span->len[0];
+	}
+	if (offset >= span->len[1])
+		return first;
+	n = (len - first < span->len[1] - offset) ? len - first : span->len[1] - offset;
+	memcpy(span->data[1] + offset, src + first, n);
+	return first + n;
+}
 
-        if(cbuf->head == cbuf->tail)
-        {
-            cbuf->tail = (cbuf->tail + 1) % cbuf->size;
-            cbuf->full = 1;
-        }
+/*
+ * @brief	Inicializa la ventana de muestras
+ * @param	win: ventana de muestras
+ * @param	size: número de muestras que se promedian
+ * @retval	1 -> Reserva de memoria con éxito
+ * 			0 -> Error al reservar memoria
+ */
+uint8_t window_init(sample_window_t *win, uint16_t size)
+{
+	if (size == 0)
+		return 0;
+	if ((win->samples = (int16_t*) pvPortMalloc(size*sizeof(int16_t))) == NULL)
+		return 0;
+	win->size = size;
+	win->head = 0;
+	win->count = 0;
+	win->sum = 0;
+	return 1;
+}
 
-        r = 1;
-    }
+/*
+ * @brief	Cambia la longitud de la ventana de muestras, descartando las muestras anteriores
+ * @param	win: ventana de muestras ya inicializada
+ * @param	size: nuevo número de muestras que se promedian
+ * @retval	1 -> Reserva de memoria con éxito
+ * 			0 -> Error al reservar memoria (se mantiene la ventana anterior)
+ */
+uint8_t window_resize(sample_window_t *win, uint16_t size)
+{
+	int16_t *old = win->samples;
+	uint16_t oldSize = win->size;
+	if (!window_init(win, size)) {
+		win->samples = old;
+		win->size = oldSize;
+		return 0;
+	}
+	vPortFree(old);
+	return 1;
+}
 
-    return r;
+/*
+ * @brief	Añade una muestra a la ventana, sustituyendo a la más antigua si está llena
+ * @param	win: ventana de muestras
+ * @param	sample: muestra a añadir
+ * @retval	1 -> Se ha completado una vuelta de la ventana
+ * 			0 -> La ventana todavía no ha dado la vuelta
+ */
+uint8_t window_put(sample_window_t *win, int16_t sample)
+{
+	if (win->count == win->size)
+		win->sum -= win->samples[win->head];
+	else
+		win->count++;
+	win->samples[win->head] = sample;
+	win->sum += sample;
+	win->head++;
+	if (win->head == win->size) {
+		win->head = 0;
+		return 1;
+	}
+	return 0;
 }
 
 /*
- * @brief	Conversin del string pasado a su codificacin en hexadecimal
- * @param	src: string a codificar
- * 			dst: puntero al destino
+ * @brief	Devuelve una muestra de la ventana por orden de llegada
+ * @param	win: ventana de muestras
+ * @param	pos: posición de la muestra, siendo 0 la más antigua
+ * @retval	Valor de la muestra
  */
-static void string2hex (uint8_t *src, uint8_t *dst)
+int16_t window_get(sample_window_t *win, uint16_t pos)
 {
-	uint8_t i, j;
+	uint16_t index;
+	index = (win->count == win->size)? win->head + pos : pos;
+	if (index >= win->size)
+		index -= win->size;
+	return win->samples[index];
+}
 
-	i = 0;
-	j = 0;
+/*
+ * @brief	Devuelve la última muestra añadida a la ventana
+ * @param	win: ventana de muestras
+ * @retval	Valor de la muestra (0 si la ventana está vacía)
+ */
+int16_t window_last(sample_window_t *win)
+{
+	if (win->count == 0)
+		return 0;
+	return win->samples[(win->head == 0)? win->size - 1 : win->head - 1];
+}
 
-	while(src[i] != '\0')
-	{
-		sprintf((char*)(dst+j),"%02X", src[i]);
-		i += 1;
-		j += 2;
-	}
+/*
+ * @brief	Indica el número de muestras almacenadas en la ventana
+ * @param	win: ventana de muestras
+ * @retval	Número de muestras
+ */
+uint16_t window_count(sample_window_t *win)
+{
+	return win->count;
+}
 
-	dst[j++] = '\0';
+/*
+ * @brief	Libera el buffer circular de un productor y un consumidor
+ * @param	sbuf: buffer circular
+ * @retval	Nada
+ */
+static void spsc_buf_free(spsc_buf_t *sbuf)
+{
+	vPortFree(sbuf->buffer);
+	vPortFree(sbuf);
 }
 
 /*
- * @brief	Extrae datos del buffer circular
+ * @brief	Reinicia el buffer circular
  * @param	cbuf: buffer circular
- * @param	data: puntero a los datos extrados
- * @retval	1 -> Datos extrados correctamente
- * 			0 -> Error al extraer los datos
+ * @retval	1 -> Reinicio con éxito
+ * 			0 -> Error al reiniciar el buffer
  */
-static uint8_t circular_buf_get(circular_buf_t * cbuf, uint8_t * data)
+static uint8_t circular_buf_reset(circular_buf_t *cbuf)
 {
     int r = 0;
 
-    if(cbuf && data && !circular_buf_empty(*cbuf))
+    if(cbuf)
     {
-        *data = cbuf->buffer[cbuf->tail];
-        cbuf->tail = (cbuf->tail + 1) % cbuf->size;
-
+        cbuf->head = 0;
+        cbuf->tail = 0;
+        cbuf->full = 0;
         r = 1;
     }
 
     return r;
 }
+
@@ -29,11 +29,20 @@
 #define RESPOND_NB		0x0400
 #define NEW_DATA_NB		0x0800
 
+#define STN_TX_DONE		0x1000
+#define MONITOR_MSSG	0x2000
+#define WINDOW_MSSG		0x4000
+
 #define VIN_LENGTH	17
 
 #define ASCII_NUMBER_THRESHOLD	48
 #define ASCII_LETTER_THRESHOLD	65
 
+// Valor de cada carácter hexadecimal, sin saltos (HEX_INVALID si no lo es)
+#define HEX_INVALID		0x10
+extern const uint8_t hexValue[256];
+#define HEX_BYTE(p)		((uint8_t) (((hexValue[(p)[0]] & 0x0F) << 4) | (hexValue[(p)[1]] & 0x0F)))
+
 #define DEBUG			0
 #define TEST			1
 #if TEST
@@ -55,6 +64,28 @@
 #define NUM_VAL_CALC	10
 #endif
 
+// Carga de los datagramas NB-IoT: registro binario empaquetado (1) o JSON en texto (0)
+#define TELEMETRY_BINARY	1
+// Agrupación de varias ventanas en un único datagrama NB-IoT (requiere TELEMETRY_BINARY)
+#define TELEMETRY_BATCH		1
+
+// Longitud inicial de las ventanas de muestras (modificable con la orden "win")
+#if TEST && SPEED_TEST
+#define SPEED_WINDOW	NUM_VAL_CALC
+#else
+#define SPEED_WINDOW	1
+#endif
+#if TEST && RPM_TEST
+#define RPM_WINDOW		NUM_VAL_CALC
+#else
+#define RPM_WINDOW		1
+#endif
+#if TEST && AIR_TEST
+#define AIR_WINDOW		NUM_VAL_CALC
+#else
+#define AIR_WINDOW		1
+#endif
+
 
 // Buffer circular
 typedef struct circular_buf {
@@ -65,6 +96,47 @@ typedef struct circular_buf {
     uint16_t full;
 } circular_buf_t;
 
+// Buffer circular de un único productor y un único consumidor, sin bloqueos. El tamaño es
+// potencia de 2: head y tail avanzan libremente y se indexan con mask. Sólo el productor
+// escribe head y sólo el consumidor escribe tail, por lo que se puede llenar desde una ISR
+typedef struct spsc_buf {
+	uint8_t *buffer;
+	volatile uint16_t head;
+	volatile uint16_t tail;
+	uint16_t mask; //size of the buffer - 1
+} spsc_buf_t;
+
+// Datos de un buffer circular como, a lo sumo, dos regiones contiguas: la segunda, si la
+// hay, es la que empieza al principio del buffer tras dar la vuelta
+typedef struct buf_span {
+	uint8_t *data[2];
+	uint16_t len[2];
+} buf_span_t;
+
+// Ventana deslizante de muestras con suma acumulada
+typedef struct sample_window {
+	int16_t *samples;
+	int32_t sum;
+	uint16_t head;
+	uint16_t count;
+	uint16_t size; //of the window
+} sample_window_t;
+
+// Bloque de las pilas de mensajes a transmitir por USB y NB-IoT. Los bloques salen de un
+// pool de tamaño fijo de cada pila (osMail) y se devuelven a él tras la transmisión
+#define TX_BLOCK_SIZE	64
+typedef struct tx_block {
+	uint16_t len;
+	uint8_t data[TX_BLOCK_SIZE];
+} txBlock_t;
+
+// Ocupación de una pila de transmisión
+typedef struct tx_stats {
+	uint16_t used;			// Bloques reservados
+	uint16_t highWater;		// Máximo de bloques reservados a la vez
+	uint32_t failures;		// Mensajes descartados por falta de bloques
+} txStats_t;
+
 typedef struct _pilePointers {
 	uint16_t		*flags;
 	osMutexId		pileLock;
@@ -86,43 +158,59 @@ typedef enum _fuelType {
 	BI_DSL
 } fuelType;
 
+// Sustancias contaminantes estimadas
+typedef enum _emissionType {
+	CO_EMISSION,
+	NOX_EMISSION,
+	PM_EMISSION,
+	NUM_EMISSIONS
+} emissionType;
+
+// Número de entradas de la tabla de factores de emisión (una por km/h)
+#define EF_TABLE_SIZE	256
+
+// Evaluación de COPERT en coma fija: factores de emisión enteros escalados por sustancia
+// y acumuladores de 64 bits en unidades de 1/(scale*HOUR_TO_MS). Se puede fijar al compilar
+// (-DCOPERT_FIXED_POINT=1) para probar los dos modos con el mismo código
+#ifndef COPERT_FIXED_POINT
+#define COPERT_FIXED_POINT	0
+#endif
+#define EF_FIXED_BITS		24
+
+#if COPERT_FIXED_POINT
+typedef int64_t emissionAcc;
+typedef int32_t efRow[NUM_EMISSIONS];
+#else
+typedef float emissionAcc;
+typedef float efRow[NUM_EMISSIONS];
+#endif
+
 // COPERT equation (alpha*V^2+beta*V+gamma+delta/V)/(epsilon/eta*V^2+zita/eta*V+1)*(1-reductionFactor)/eta
+// Cada parámetro agrupa los valores de todas las sustancias contaminantes (indexado por emissionType)
 typedef struct _emissionParams {
-	float a;	// alpha
-	float b;	// beta
-	float c;	// gamma
-	float d;	// delta
-	float e;	// epsilon/eta
-	float f;	// zeta/eta
-	float reductionFactor;		// (1-reductionFactor)/eta
+	float a[NUM_EMISSIONS];	// alpha
+	float b[NUM_EMISSIONS];	// beta
+	float c[NUM_EMISSIONS];	// gamma
+	float d[NUM_EMISSIONS];	// delta
+	float e[NUM_EMISSIONS];	// epsilon/eta
+	float f[NUM_EMISSIONS];	// zeta/eta
+	float reductionFactor[NUM_EMISSIONS];	// (1-reductionFactor)/eta
+	efRow *ef;	// Factor de emisión precalculado para cada velocidad (EF_TABLE_SIZE filas, fuera de car)
+#if COPERT_FIXED_POINT
+	float scale[NUM_EMISSIONS];		// Factor de escala (potencia de 2) de cada sustancia
+#endif
 } emissionParams;
 
 typedef struct _car {
 	uint8_t			vin[VIN_LENGTH+1];
-#if RPM_TEST
-	uint16_t		rpm[NUM_VAL_CALC];
-#else
-	uint16_t		rpm[1];
-#endif
-#if SPEED_TEST
-	uint8_t			speed[NUM_VAL_CALC];
-#else
-	uint8_t			speed[1];
-#endif
-#if AIR_TEST
-	int16_t			air[NUM_VAL_CAL];
-#else
-	int16_t			air[1];
-#endif
+	sample_window_t	rpm;
+	sample_window_t	speed;
+	sample_window_t	air;
 	fuelType		fuel;
 	uint8_t			timestart;
 
-	emissionParams	coParams;
-	float			co;
-	emissionParams	noxParams;
-	float			nox;
-	emissionParams	pmParams;
-	float			pm;
+	emissionParams	params;
+	emissionAcc		emission[NUM_EMISSIONS];
 
 	float			lastLat;
 	float			lastLong;
@@ -130,19 +218,30 @@ typedef struct _car {
 	pilePointers_t	*communication;
 	uint8_t			setupState;
 
-#if TEST
-	uint8_t			times;
-#endif
-
 } car;
 
-// Inicializacin de datos
+// Inicialización de datos
 uint8_t shareData_init(uint16_t *flags);
 uint8_t circular_buf_init(circular_buf_t **cbuf, uint16_t size);
+uint8_t spsc_buf_init(spsc_buf_t **sbuf, uint16_t size);
+
+// Acceso por bloques a los buffer circulares
+uint16_t circular_buf_span(circular_buf_t *cbuf, buf_span_t *span);
+uint16_t circular_buf_read(circular_buf_t *cbuf, uint8_t *dst, uint16_t max);
+uint16_t spsc_buf_readSpan(spsc_buf_t *sbuf, buf_span_t *span);
+uint16_t spsc_buf_writeSpan(spsc_buf_t *sbuf, buf_span_t *span);
+uint16_t span_copy(const buf_span_t *span, uint16_t offset, uint8_t *dst, uint16_t len);
+uint16_t span_fill(const buf_span_t *span, uint16_t offset, const uint8_t *src, uint16_t len);
+uint8_t window_init(sample_window_t *win, uint16_t size);
+uint8_t window_resize(sample_window_t *win, uint16_t size);
+
+// Tratamiento de las ventanas de muestras
+uint8_t window_put(sample_window_t *win, int16_t sample);
+int16_t window_get(sample_window_t *win, uint16_t pos);
+int16_t window_last(sample_window_t *win);
+uint16_t window_count(sample_window_t *win);
 
-// Tratamiento del buffer de recepcin
-uint8_t lockRX(void);
-uint8_t unlockRX(void);
+// Tratamiento del buffer de recepción. Productor: callback USB; consumidor: tarea del micro
 uint16_t notReadRX(void);
 uint16_t lenFirstMssgRX(void);
 uint16_t typeNextMssgRX(void);
@@ -150,19 +249,24 @@ uint8_t putRX(uint8_t *data, uint16_t len);
 uint8_t getRX(uint8_t *data, uint16_t len);
 uint8_t jumpMssgRX(void);
 
-// Tratamiento del buffer de transmisin
+// Tratamiento del buffer de transmisión
 uint8_t lockTX(void);
 uint8_t unlockTX(void);
 uint16_t notSendTX(void);
 uint8_t putTX(uint8_t *data, uint16_t len);
-uint8_t getTX(uint8_t **data, uint16_t len);
+uint8_t getTX(txBlock_t **block);
+void freeTX(txBlock_t *block);
 uint8_t putNB(uint8_t *data, uint16_t len);
-uint8_t getNB(uint8_t **data, uint16_t len);
+uint8_t getNB(txBlock_t **block);
+void freeNB(txBlock_t *block);
+void statsTX(txStats_t *usb, txStats_t *nb);
 
-// Envo de datos
+// Envío de datos
 uint8_t sendMssg(car* coche);
+uint8_t expiredMssg(void);
+uint8_t flushMssg(void);
 
-// Gestino de localizacin
+// Gestino de localización
 void setLatitud(uint8_t *newLat);
 void getLatitud(uint8_t *newLat);
 void setLongitud(uint8_t *newLong);
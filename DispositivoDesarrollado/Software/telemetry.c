@@ -0,0 +1,601 @@
+/*
+ * telemetry.c
+ *
+ *  Serialización de los mensajes de telemetría enviados por NB-IoT y USB
+ *      Author: miguelvp
+ */
+
+#include "telemetry.h"
+#include "copert.h"
+#include <string.h>
+
+// Hueco reservado delante de la carga para la cabecera: socket, longitud (3 cifras) y ','
+#define HEADER_RESERVED		(sizeof(TELEMETRY_SOCKET) - 1 + 4)
+
+// Identificadores fijos del dispositivo y del vehículo de pruebas
+#define TELEMETRY_ID		"{\"id\":111012345678,\"vin\":\"VF1BG0A0524085422\""
+
+// Cifras hexadecimales de cada nibble
+static const uint8_t hexDigit[16] = "0123456789ABCDEF";
+
+// Potencias de 10 para normalizar la mantisa (10^(2^i)) y para escalar los decimales
+static const double pow10Bin[] = {1e1, 1e2, 1e4, 1e8, 1e16, 1e32};
+static const uint32_t pow10Int[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+		100000000, 1000000000};
+
+#define NUM_POW10_BIN	(sizeof(pow10Bin)/sizeof(pow10Bin[0]))
+
+// Ventana de medida con los valores ya escalados a los enteros del registro binario
+typedef struct telemetrySample_t {
+	uint32_t time;
+	int32_t lat;
+	int32_t lon;
+	uint32_t emission[NUM_EMISSIONS];
+} telemetrySample_t;
+
+#define SAMPLE_SIZE			24		// Bytes de una ventana completa
+#define BATCH_HEADER_SIZE	10		// Versión, id, índice VIN y número de ventanas
+
+#if TELEMETRY_BATCH
+// Ventanas pendientes de enviar y longitud de la carga que ocupan
+static struct {
+	telemetrySample_t sample[TELEMETRY_BATCH_MAX];
+	uint8_t count;
+	uint16_t bytes;
+} batch;
+#endif
+
+#if !TELEMETRY_BINARY
+static uint16_t putJSON(car *coche, uint8_t *dst);
+#endif
+static uint8_t* frameCommand(uint8_t *buf, uint16_t payload, uint16_t *len);
+static void takeSample(car *coche, uint32_t timestamp, telemetrySample_t *sample);
+static uint8_t* putSample(uint8_t *dst, const telemetrySample_t *sample);
+#if TELEMETRY_BATCH
+static uint8_t* buildBatch(uint8_t *buf, uint16_t *len);
+static uint8_t deltaSize(const telemetrySample_t *sample, const telemetrySample_t *first);
+static uint8_t* putDelta(uint8_t *dst, const telemetrySample_t *sample, const telemetrySample_t *first);
+static uint8_t varintSize(uint32_t value);
+static uint8_t* putVarint(uint8_t *dst, uint32_t value);
+static uint32_t zigzag(uint32_t delta);
+#endif
+static uint8_t* putBE(uint8_t *dst, uint64_t value, uint8_t bytes);
+static uint32_t scaleUnsigned(float value, float scale);
+static int32_t scaleSigned(float value, float scale);
+static uint8_t* putText(uint8_t *dst, const char *text);
+
+/*
+ * @brief	Prepara el comando AT+NSOST con los datos del vehículo. La carga se escribe una
+ * 			única vez tras un hueco para la cabecera, se codifica en hexadecimal en el sitio y
+ * 			la cabecera se completa después con la longitud ya conocida
+ * @param	coche: coche caracterizado
+ * 			timestamp: instante de la medida (ms)
+ * 			buf: buffer de trabajo (al menos TELEMETRY_NB_SIZE)
+ * 			size: tamaño de buf
+ * 			len: longitud del comando
+ * @retval	Comienzo del comando dentro de buf
+ * 			NULL -> El buffer no es suficiente
+ */
+uint8_t* telemetry_nbCommand(car *coche, uint32_t timestamp, uint8_t *buf, uint16_t size, uint16_t *len)
+{
+	uint16_t payload;
+
+	if (size < TELEMETRY_NB_SIZE)
+		return NULL;
+
+#if TELEMETRY_BINARY
+	payload = telemetry_record(coche, timestamp, buf + HEADER_RESERVED);
+#else
+	payload = putJSON(coche, buf + HEADER_RESERVED);
+#endif
+	return frameCommand(buf, payload, len);
+}
+
+/*
+ * @brief	Escribe el registro binario de una ventana de medida
+ * @param	coche: coche caracterizado
+ * 			timestamp: instante de la medida (ms)
+ * 			dst: destino (TELEMETRY_RECORD_SIZE bytes)
+ * @retval	Longitud del registro
+ */
+uint8_t telemetry_record(car *coche, uint32_t timestamp, uint8_t *dst)
+{
+	uint8_t *pos = dst;
+	telemetrySample_t sample;
+
+	takeSample(coche, timestamp, &sample);
+	*pos++ = TELEMETRY_VERSION;
+	pos = putBE(pos, TELEMETRY_DEVICE_ID, 6);
+	pos = putBE(pos, TELEMETRY_VIN_INDEX, 2);
+	pos = putSample(pos, &sample);
+
+	return pos - dst;
+}
+
+#if TELEMETRY_BATCH
+/*
+ * @brief	Añade una ventana al lote en curso y, si el lote está completo, prepara el
+ * 			comando AT+NSOST que lo envía. El lote se cierra al llegar a TELEMETRY_BATCH_MAX
+ * 			ventanas, cuando la siguiente ventana no cabe en TELEMETRY_BATCH_BYTES o cuando
+ * 			la primera ventana lleva TELEMETRY_BATCH_LATENCY esperando
+ * @param	coche: coche caracterizado
+ * 			timestamp: instante de la medida (ms)
+ * 			buf: buffer de trabajo (al menos TELEMETRY_NB_SIZE)
+ * 			size: tamaño de buf
+ * 			len: longitud del comando
+ * @retval	Comienzo del comando dentro de buf
+ * 			NULL -> El lote sigue abierto (o el buffer no es suficiente)
+ */
+uint8_t* telemetry_batchPush(car *coche, uint32_t timestamp, uint8_t *buf, uint16_t size, uint16_t *len)
+{
+	telemetrySample_t sample;
+	uint8_t *cmd = NULL;
+
+	if (size < TELEMETRY_NB_SIZE)
+		return NULL;
+	takeSample(coche, timestamp, &sample);
+
+	// La ventana no cabe en el presupuesto: se envía antes el lote en curso
+	if (batch.count && batch.bytes + deltaSize(&sample, &batch.sample[0]) > TELEMETRY_BATCH_BYTES)
+		cmd = buildBatch(buf, len);
+
+	if (batch.count)
+		batch.bytes += deltaSize(&sample, &batch.sample[0]);
+	else
+		batch.bytes = BATCH_HEADER_SIZE + SAMPLE_SIZE;
+	batch.sample[batch.count++] = sample;
+
+	if (cmd == NULL && (batch.count == TELEMETRY_BATCH_MAX
+			|| sample.time - batch.sample[0].time >= TELEMETRY_BATCH_LATENCY))
+		cmd = buildBatch(buf, len);
+	return cmd;
+}
+
+/*
+ * @brief	Comprueba si la primera ventana del lote en curso lleva ya TELEMETRY_BATCH_LATENCY
+ * 			esperando. Sin ventanas nuevas el lote no se cierra en telemetry_batchPush
+ * @param	now: instante actual (ms)
+ * @retval	1 -> Hay que enviar el lote
+ * 			0 -> El lote está vacío o aún puede esperar
+ */
+uint8_t telemetry_batchExpired(uint32_t now)
+{
+	return batch.count && now - batch.sample[0].time >= TELEMETRY_BATCH_LATENCY;
+}
+
+/*
+ * @brief	Cierra el lote en curso, tenga las ventanas que tenga, y prepara su comando
+ * @param	buf: buffer de trabajo (al menos TELEMETRY_NB_SIZE)
+ * 			size: tamaño de buf
+ * 			len: longitud del comando
+ * @retval	Comienzo del comando dentro de buf
+ * 			NULL -> No hay ventanas pendientes (o el buffer no es suficiente)
+ */
+uint8_t* telemetry_batchFlush(uint8_t *buf, uint16_t size, uint16_t *len)
+{
+	if (size < TELEMETRY_NB_SIZE || !batch.count)
+		return NULL;
+	return buildBatch(buf, len);
+}
+#endif
+
+/*
+ * @brief	Escribe el mensaje de datos del vehículo que se envía por USB en modo test
+ * @param	coche: coche caracterizado
+ * 			buf: destino del mensaje
+ * 			size: tamaño de buf
+ * @retval	Longitud del mensaje
+ * 			0 -> El buffer no es suficiente
+ */
+uint16_t telemetry_usb(car *coche, uint8_t *buf, uint16_t size)
+{
+	uint8_t *pos = buf;
+	uint16_t i, count;
+
+	// Muestras de velocidad (4 caracteres cada una) y campos fijos (~100 caracteres)
+	count = window_count(&(coche->speed));
+	if (size < 4*count + 112)
+		return 0;
+
+	pos = putText(pos, "{\"speed\":[");
+	for (i = 0; i < count; i++) {
+		if (i)
+			*pos++ = ',';
+		pos += telemetry_int(window_get(&(coche->speed), i), 3, pos);
+	}
+	pos = putText(pos, "],\"lat\":");
+	pos += telemetry_exp(coche->lastLat, 7, pos);
+	pos = putText(pos, ",\"long\":");
+	pos += telemetry_exp(coche->lastLong, 8, pos);
+	pos = putText(pos, ",\"co\":");
+	pos += telemetry_exp(emissionValue(coche, CO_EMISSION), 6, pos);
+	pos = putText(pos, ",\"nox\":");
+	pos += telemetry_exp(emissionValue(coche, NOX_EMISSION), 6, pos);
+	pos = putText(pos, ",\"pm\":");
+	pos += telemetry_exp(emissionValue(coche, PM_EMISSION), 6, pos);
+	pos = putText(pos, "}\r");
+
+	return pos - buf;
+}
+
+/*
+ * @brief	Escribe un número en notación científica, como "%1.<decimals>E" de printf.
+ * 			La mantisa se normaliza con potencias de 10 binarias y se redondea a entero
+ * @param	value: número a escribir
+ * 			decimals: decimales de la mantisa (hasta 8)
+ * 			dst: destino (sin terminar en '\0'), al menos decimals + 8 caracteres
+ * @retval	Número de caracteres escritos
+ */
+uint8_t telemetry_exp(float value, uint8_t decimals, uint8_t *dst)
+{
+	uint8_t *pos = dst;
+	double mant = value;
+	int16_t exp = 0;
+	uint32_t digits;
+	int8_t i;
+
+	if (mant < 0) {
+		*pos++ = '-';
+		mant = -mant;
+	}
+	if (mant != mant)
+		return putText(pos, "nan") - dst;
+	if (mant > 3.5e38)
+		return putText(pos, "inf") - dst;
+
+	// Mantisa en [1, 10)
+	if (mant != 0) {
+		for (i = NUM_POW10_BIN - 1; i >= 0; i--) {
+			if (mant >= pow10Bin[i]) {
+				mant /= pow10Bin[i];
+				exp += 1 << i;
+			}
+		}
+		for (i = NUM_POW10_BIN - 1; i >= 0; i--) {
+			if (mant * pow10Bin[i] < 10) {
+				mant *= pow10Bin[i];
+				exp -= 1 << i;
+			}
+		}
+	}
+
+	// Cifras significativas; el redondeo puede llevar la mantisa a 10
+	digits = (uint32_t) (mant * pow10Int[decimals] + 0.5);
+	if (digits >= pow10Int[decimals + 1]) {
+		digits /= 10;
+		exp++;
+	}
+
+	*pos++ = hexDigit[digits / pow10Int[decimals]];
+	if (decimals) {
+		*pos++ = '.';
+		for (i = decimals - 1; i >= 0; i--) {
+			*pos++ = hexDigit[(digits / pow10Int[i]) % 10];
+		}
+	}
+
+	*pos++ = 'E';
+	if (exp < 0) {
+		*pos++ = '-';
+		exp = -exp;
+	} else {
+		*pos++ = '+';
+	}
+	pos += telemetry_int(exp, 2, pos);
+	if (pos[-2] == ' ')
+		pos[-2] = '0';
+
+	return pos - dst;
+}
+
+/*
+ * @brief	Escribe un entero en decimal alineado a la derecha, como "%<width>d" de printf
+ * @param	value: número a escribir
+ * 			width: ancho mínimo, rellenado con espacios
+ * 			dst: destino (sin terminar en '\0')
+ * @retval	Número de caracteres escritos
+ */
+uint8_t telemetry_int(int32_t value, uint8_t width, uint8_t *dst)
+{
+	uint8_t digits[11];
+	uint8_t n = 0, len;
+	uint32_t abs = (value < 0) ? -(uint32_t) value : (uint32_t) value;
+
+	do {
+		digits[n++] = '0' + abs % 10;
+		abs /= 10;
+	} while (abs);
+	if (value < 0)
+		digits[n++] = '-';
+
+	for (len = 0; len + n < width; len++) {
+		dst[len] = ' ';
+	}
+	while (n) {
+		dst[len++] = digits[--n];
+	}
+	return len;
+}
+
+/*
+ * @brief	Codifica en hexadecimal, en el sitio, los datos del buffer. Se recorre desde el
+ * 			final para no pisar datos sin codificar
+ * @param	buf: datos, con hueco para el doble de su longitud
+ * 			len: longitud de los datos
+ * @retval	Nada
+ */
+void telemetry_hex(uint8_t *buf, uint16_t len)
+{
+	uint8_t byte;
+
+	while (len--) {
+		byte = buf[len];
+		buf[2*len] = hexDigit[byte >> 4];
+		buf[2*len + 1] = hexDigit[byte & 0x0F];
+	}
+}
+
+#if !TELEMETRY_BINARY
+/*
+ * @brief	Escribe la carga en JSON
+ * @param	coche: coche caracterizado
+ * 			dst: destino (sin terminar en '\0')
+ * @retval	Longitud de la carga
+ */
+static uint16_t putJSON(car *coche, uint8_t *dst)
+{
+	uint8_t *pos = dst;
+
+	pos = putText(pos, TELEMETRY_ID ",\"lat\":");
+	pos += telemetry_exp(coche->lastLat, 7, pos);
+	pos = putText(pos, ",\"long\":");
+	pos += telemetry_exp(coche->lastLong, 8, pos);
+	pos = putText(pos, ",\"co\":");
+	pos += telemetry_exp(emissionValue(coche, CO_EMISSION), 6, pos);
+	pos = putText(pos, ",\"nox\":");
+	pos += telemetry_exp(emissionValue(coche, NOX_EMISSION), 6, pos);
+	pos = putText(pos, ",\"pm\":");
+	pos += telemetry_exp(emissionValue(coche, PM_EMISSION), 6, pos);
+	pos = putText(pos, "}");
+
+	return pos - dst;
+}
+#endif
+
+/*
+ * @brief	Completa el comando AT+NSOST alrededor de la carga escrita en buf tras el hueco
+ * 			de la cabecera: la codifica en hexadecimal y pega delante socket y longitud
+ * @param	buf: buffer de trabajo
+ * 			payload: longitud de la carga
+ * 			len: longitud del comando
+ * @retval	Comienzo del comando dentro de buf
+ */
+static uint8_t* frameCommand(uint8_t *buf, uint16_t payload, uint16_t *len)
+{
+	uint8_t *pos, *start;
+	uint8_t digits[5];
+	uint8_t n;
+
+	// Codificación hexadecimal en el sitio y fin del comando
+	telemetry_hex(buf + HEADER_RESERVED, payload);
+	pos = buf + HEADER_RESERVED + 2*payload;
+	*pos++ = '\r';
+	*pos = '\0';
+
+	// Cabecera pegada a la carga: socket, longitud y ','
+	n = telemetry_int(payload, 1, digits);
+	start = buf + HEADER_RESERVED - 1;
+	*start = ',';
+	start -= n;
+	memcpy(start, digits, n);
+	start -= sizeof(TELEMETRY_SOCKET) - 1;
+	memcpy(start, TELEMETRY_SOCKET, sizeof(TELEMETRY_SOCKET) - 1);
+
+	*len = pos - start;
+	return start;
+}
+
+/*
+ * @brief	Toma los valores de la ventana de medida escalados a enteros
+ * @param	coche: coche caracterizado
+ * 			timestamp: instante de la medida (ms)
+ * 			sample: ventana
+ * @retval	Nada
+ */
+static void takeSample(car *coche, uint32_t timestamp, telemetrySample_t *sample)
+{
+	sample->time = timestamp;
+	sample->lat = scaleSigned(coche->lastLat, 1e6);
+	sample->lon = scaleSigned(coche->lastLong, 1e6);
+	sample->emission[CO_EMISSION] = scaleUnsigned(emissionValue(coche, CO_EMISSION), 1e9);
+	sample->emission[NOX_EMISSION] = scaleUnsigned(emissionValue(coche, NOX_EMISSION), 1e9);
+	sample->emission[PM_EMISSION] = scaleUnsigned(emissionValue(coche, PM_EMISSION), 1e9);
+}
+
+/*
+ * @brief	Escribe una ventana completa: instante, posición y emisiones
+ * @param	dst: destino (SAMPLE_SIZE bytes)
+ * 			sample: ventana
+ * @retval	Posición siguiente a la ventana escrita
+ */
+static uint8_t* putSample(uint8_t *dst, const telemetrySample_t *sample)
+{
+	dst = putBE(dst, sample->time, 4);
+	dst = putBE(dst, (uint32_t) sample->lat, 4);
+	dst = putBE(dst, (uint32_t) sample->lon, 4);
+	dst = putBE(dst, sample->emission[CO_EMISSION], 4);
+	dst = putBE(dst, sample->emission[NOX_EMISSION], 4);
+	return putBE(dst, sample->emission[PM_EMISSION], 4);
+}
+
+#if TELEMETRY_BATCH
+/*
+ * @brief	Escribe el lote en curso tras el hueco de la cabecera, prepara su comando y
+ * 			deja el lote vacío
+ * @param	buf: buffer de trabajo
+ * 			len: longitud del comando
+ * @retval	Comienzo del comando dentro de buf
+ */
+static uint8_t* buildBatch(uint8_t *buf, uint16_t *len)
+{
+	uint8_t *pos = buf + HEADER_RESERVED;
+	uint8_t i;
+
+	*pos++ = TELEMETRY_BATCH_VERSION;
+	pos = putBE(pos, TELEMETRY_DEVICE_ID, 6);
+	pos = putBE(pos, TELEMETRY_VIN_INDEX, 2);
+	*pos++ = batch.count;
+	pos = putSample(pos, &batch.sample[0]);
+	for (i = 1; i < batch.count; i++) {
+		pos = putDelta(pos, &batch.sample[i], &batch.sample[0]);
+	}
+
+	batch.count = 0;
+	return frameCommand(buf, pos - (buf + HEADER_RESERVED), len);
+}
+
+/*
+ * @brief	Bytes que ocupa una ventana codificada como diferencia con la primera del lote
+ * @param	sample: ventana
+ * 			first: primera ventana del lote
+ * @retval	Bytes de la ventana codificada
+ */
+static uint8_t deltaSize(const telemetrySample_t *sample, const telemetrySample_t *first)
+{
+	uint8_t i, size;
+
+	size = varintSize(sample->time - first->time);
+	size += varintSize(zigzag((uint32_t) sample->lat - (uint32_t) first->lat));
+	size += varintSize(zigzag((uint32_t) sample->lon - (uint32_t) first->lon));
+	for (i = 0; i < NUM_EMISSIONS; i++) {
+		size += varintSize(zigzag(sample->emission[i] - first->emission[i]));
+	}
+	return size;
+}
+
+/*
+ * @brief	Escribe una ventana como diferencia con la primera del lote
+ * @param	dst: destino
+ * 			sample: ventana
+ * 			first: primera ventana del lote
+ * @retval	Posición siguiente a la ventana escrita
+ */
+static uint8_t* putDelta(uint8_t *dst, const telemetrySample_t *sample, const telemetrySample_t *first)
+{
+	uint8_t i;
+
+	dst = putVarint(dst, sample->time - first->time);
+	dst = putVarint(dst, zigzag((uint32_t) sample->lat - (uint32_t) first->lat));
+	dst = putVarint(dst, zigzag((uint32_t) sample->lon - (uint32_t) first->lon));
+	for (i = 0; i < NUM_EMISSIONS; i++) {
+		dst = putVarint(dst, zigzag(sample->emission[i] - first->emission[i]));
+	}
+	return dst;
+}
+
+/*
+ * @brief	Bytes que ocupa un entero codificado en varint
+ * @param	value: entero
+ * @retval	Bytes del entero codificado (1 a 5)
+ */
+static uint8_t varintSize(uint32_t value)
+{
+	uint8_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+/*
+ * @brief	Escribe un entero en varint: 7 bits por byte, empezando por los menos
+ * 			significativos, con el bit alto a 1 en todos los bytes menos el último
+ * @param	dst: destino
+ * 			value: entero
+ * @retval	Posición siguiente al entero escrito
+ */
+static uint8_t* putVarint(uint8_t *dst, uint32_t value)
+{
+	while (value >= 0x80) {
+		*dst++ = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	*dst++ = value;
+	return dst;
+}
+
+/*
+ * @brief	Codificación zigzag de una diferencia de 32 bits con signo, para que las
+ * 			diferencias pequeñas de cualquier signo ocupen pocos bytes en varint
+ * @param	delta: diferencia (complemento a 2)
+ * @retval	Diferencia codificada: 0, -1, 1, -2... -> 0, 1, 2, 3...
+ */
+static uint32_t zigzag(uint32_t delta)
+{
+	return (delta << 1) ^ ((delta & 0x80000000) ? 0xFFFFFFFF : 0);
+}
+#endif
+
+/*
+ * @brief	Escribe un entero en big endian
+ * @param	dst: destino
+ * 			value: valor a escribir
+ * 			bytes: bytes menos significativos de value que se escriben
+ * @retval	Posición siguiente al valor escrito
+ */
+static uint8_t* putBE(uint8_t *dst, uint64_t value, uint8_t bytes)
+{
+	while (bytes--) {
+		*dst++ = value >> (8*bytes);
+	}
+	return dst;
+}
+
+/*
+ * @brief	Escala un valor positivo a entero de 32 bits, redondeando y saturando
+ * @param	value: valor
+ * 			scale: factor de escala
+ * @retval	Valor escalado
+ */
+static uint32_t scaleUnsigned(float value, float scale)
+{
+	value *= scale;
+	if (!(value > 0))
+		return 0;
+	if (value >= 4294967295.0f)
+		return UINT32_MAX;
+	return (uint32_t) (value + 0.5f);
+}
+
+/*
+ * @brief	Escala un valor con signo a entero de 32 bits, redondeando y saturando
+ * @param	value: valor
+ * 			scale: factor de escala
+ * @retval	Valor escalado
+ */
+static int32_t scaleSigned(float value, float scale)
+{
+	value *= scale;
+	if (value != value)
+		return 0;
+	if (value >= 2147483647.0f)
+		return INT32_MAX;
+	if (value <= -2147483648.0f)
+		return INT32_MIN;
+	return (int32_t) ((value < 0) ? value - 0.5f : value + 0.5f);
+}
+
+/*
+ * @brief	Copia un texto fijo
+ * @param	dst: destino (sin terminar en '\0')
+ * 			text: texto a copiar
+ * @retval	Posición siguiente al texto copiado
+ */
+static uint8_t* putText(uint8_t *dst, const char *text)
+{
+	while (*text) {
+		*dst++ = *text++;
+	}
+	return dst;
+}
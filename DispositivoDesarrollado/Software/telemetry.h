@@ -0,0 +1,58 @@
+/*
+ * telemetry.h
+ *
+ *  Serialización de los mensajes de telemetría enviados por NB-IoT y USB
+ *      Author: miguelvp
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include "shareData.h"
+
+// Servidor al que se envían los datagramas por NB-IoT
+#define TELEMETRY_SOCKET	"AT+NSOST=0,35.226.227.97,8888,"
+
+// Tamaño del buffer del comando AT+NSOST: cabecera, carga en hexadecimal y retorno de carro
+#define TELEMETRY_NB_SIZE	336
+
+// Identificadores del dispositivo y del vehículo. El VIN se envía como índice de la tabla
+// de vehículos registrados en el servidor (nodo decodeRecord de Servidor/flowchart.json)
+#define TELEMETRY_DEVICE_ID		111012345678ULL
+#define TELEMETRY_VIN_INDEX		0
+
+// Registro binario, big endian:
+//	versión (1) | id (6) | índice VIN (2) | instante en ms (4) | latitud y longitud en
+//	microgrados (4+4, con signo) | CO, NOx y PM de la ventana en ng (4+4+4)
+#define TELEMETRY_VERSION		0x01
+#define TELEMETRY_RECORD_SIZE	33
+
+// Lote de ventanas:
+//	versión (1) | id (6) | índice VIN (2) | ventanas (1) | primera ventana completa, como en
+//	el registro (24) | resto de ventanas como diferencias con la primera: instante, latitud,
+//	longitud, CO, NOx y PM en varint (7 bits por byte, zigzag los que pueden ser negativos)
+#define TELEMETRY_BATCH_VERSION	0x02
+#define TELEMETRY_BATCH_MAX		16		// Ventanas por lote
+#define TELEMETRY_BATCH_BYTES	128		// Presupuesto de la carga (bytes antes de codificar)
+#define TELEMETRY_BATCH_LATENCY	60000	// Retraso máximo de la primera ventana (ms)
+
+#if TELEMETRY_BATCH && !TELEMETRY_BINARY
+#error "TELEMETRY_BATCH solo está disponible con TELEMETRY_BINARY"
+#endif
+
+#if 2*TELEMETRY_BATCH_BYTES + 40 > TELEMETRY_NB_SIZE
+#error "TELEMETRY_NB_SIZE no admite un lote de TELEMETRY_BATCH_BYTES"
+#endif
+
+uint8_t* telemetry_nbCommand(car *coche, uint32_t timestamp, uint8_t *buf, uint16_t size, uint16_t *len);
+uint8_t telemetry_record(car *coche, uint32_t timestamp, uint8_t *dst);
+uint8_t* telemetry_batchPush(car *coche, uint32_t timestamp, uint8_t *buf, uint16_t size, uint16_t *len);
+uint8_t telemetry_batchExpired(uint32_t now);
+uint8_t* telemetry_batchFlush(uint8_t *buf, uint16_t size, uint16_t *len);
+uint16_t telemetry_usb(car *coche, uint8_t *buf, uint16_t size);
+
+uint8_t telemetry_exp(float value, uint8_t decimals, uint8_t *dst);
+uint8_t telemetry_int(int32_t value, uint8_t width, uint8_t *dst);
+void telemetry_hex(uint8_t *buf, uint16_t len);
+
+#endif /* TELEMETRY_H_ */
@@ -6,6 +6,7 @@
  */
 
 #include "usb_fsm.h"
+#include "monitor.h"
 #include "FreeRTOS.h"
 #include "usbd_cdc_if.h"
 #include "stm32l4xx_hal_uart.h"
@@ -22,7 +23,12 @@ USBD_HandleTypeDef hUsbDeviceFS;
 // Dato recibido nuevo
 static uint8_t new;
 
-// Funciones de comprobacin
+// Bloque por transmitir (pendiente de reintento) y bloque en transmisión de cada salida.
+// El de transmisión no se libera hasta que el periférico termina de enviarlo
+static txBlock_t *usbBlock = NULL, *usbSending = NULL;
+static txBlock_t *nbBlock = NULL, *nbSending = NULL;
+
+// Funciones de comprobación
 static uint8_t firstStep (fsm_t *this);
 static uint8_t sendData (fsm_t *this);
 static uint8_t allSent (fsm_t *this);
@@ -30,8 +36,9 @@ static uint8_t checkUSB (fsm_t *this);
 static uint8_t checkUART1 (fsm_t *this);
 static uint8_t checkUART2 (fsm_t *this);
 static uint8_t checkUART3 (fsm_t *this);
+static uint8_t txFinished (fsm_t *this);
 
-// Funciones de transicin
+// Funciones de transición
 static void setup (fsm_t *this);
 static void sendUSB (fsm_t *this);
 static void flush (fsm_t *this);
@@ -39,8 +46,10 @@ static void update (fsm_t *this);
 static void dataUART1 (fsm_t *this);
 static void dataUART2 (fsm_t *this);
 static void dataUART3 (fsm_t *this);
+static void releaseTX (fsm_t *this);
+static void releaseSent (void);
 
-// Estados de la mquina
+// Estados de la máquina
 static enum USBstates {
 	PREV,
 	IDLE,
@@ -55,15 +64,16 @@ static fsm_trans_t USB_tt[] = {
 	{IDLE,		checkUART1,		IDLE, 		dataUART1},
 	{IDLE,		checkUART2,		IDLE, 		dataUART2},
 	{IDLE,		checkUART3,		IDLE, 		dataUART3},
+	{IDLE,		txFinished,		IDLE,		releaseTX},
 	{TX_USB,	allSent,		IDLE,		flush},
 	{TX_USB,	firstStep,		TX_USB,		sendUSB},
 	{-1, NULL, -1, NULL}
 };
 
 /*
- * @brief 	Inicializacin de la mquina de estados
- * @param 	flags: puntero a la variable compartida de la sealizacin por flags
- * @retval 	Mquina de estados
+ * @brief 	Inicialización de la máquina de estados
+ * @param 	flags: puntero a la variable compartida de la señalización por flags
+ * @retval 	Máquina de estados
  */
 fsm_t* init_usb(pilePointers_t *data)
 {
@@ -78,8 +88,8 @@ static uint8_t firstStep (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay datos a enviar
- * @param	this: mquina de estados a evaluar
+ * @brief	Comprobación de si hay datos a enviar
+ * @param	this: máquina de estados a evaluar
  * @retval	!0 -> Hay datos a enviar
  * 			 0 -> No hay datos a enviar
  */
@@ -89,8 +99,8 @@ static uint8_t sendData (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si se han enviado todos los datos
- * @param	this: mquina de estados a evaluar
+ * @brief	Comprobación de si se han enviado todos los datos
+ * @param	this: máquina de estados a evaluar
  * @retval	!0 -> Se han enviado todos los datos
  * 			 0 -> No se han enviado todos los datos
  */
@@ -100,8 +110,8 @@ static uint8_t allSent (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay datos nuevos recibidos por USB
- * @param	this: mquina de estados a evaluar
+ * @brief	Comprobación de si hay datos nuevos recibidos por USB
+ * @param	this: máquina de estados a evaluar
  * @retval	!0 -> Hay datos nuevos
  * 			 0 -> No hay datos nuevos
  */
@@ -111,8 +121,8 @@ static uint8_t checkUSB (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay datos nuevos recibidos por la UART1
- * @param	this: mquina de estados a evaluar
+ * @brief	Comprobación de si hay datos nuevos recibidos por la UART1
+ * @param	this: máquina de estados a evaluar
  * @retval	!0 -> Hay datos nuevos
  * 			 0 -> No hay datos nuevos
  */
@@ -122,8 +132,8 @@ static uint8_t checkUART1 (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay datos nuevos recibidos por la UART2
- * @param	this: mquina de estados a evaluar
+ * @brief	Comprobación de si hay datos nuevos recibidos por la UART2
+ * @param	this: máquina de estados a evaluar
  * @retval	!0 -> Hay datos nuevos
  * 			 0 -> No hay datos nuevos
  */
@@ -133,8 +143,8 @@ static uint8_t checkUART2 (fsm_t *this)
 }
 
 /*
- * @brief	Comprobacin de si hay datos nuevos recibidos por la UART3
- * @param	this: mquina de estados a evaluar
+ * @brief	Comprobación de si hay datos nuevos recibidos por la UART3
+ * @param	this: máquina de estados a evaluar
  * @retval	!0 -> Hay datos nuevos
  * 			 0 -> No hay datos nuevos
  */
@@ -144,9 +154,21 @@ static uint8_t checkUART3 (fsm_t *this)
 }
 
 /*
- * @brief	Configuracin de las DMA para asignarlas a los buffer creados previamente
+ * @brief	Comprobación de si ha terminado la transmisión de algún bloque que sigue reservado
+ * @param	this: máquina de estados a evaluar
+ * @retval	!0 -> Hay bloques transmitidos por liberar
+ * 			 0 -> Nada que liberar
+ */
+static uint8_t txFinished (fsm_t *this)
+{
+	return (usbSending != NULL && ((USBD_CDC_HandleTypeDef*)(hUsbDeviceFS.pClassData))->TxState == 0)
+			|| (nbSending != NULL && huart3.gState != HAL_UART_STATE_BUSY_TX && huart3.gState != HAL_UART_STATE_BUSY_RX);
+}
+
+/*
+ * @brief	Configuración de las DMA para asignarlas a los buffer creados previamente
  * 			para cada una de las UART
- * @param	this: mquina de estados a evaluar
+ * @param	this: máquina de estados a evaluar
  * @retval	Nada
  */
 static void setup (fsm_t *this)
@@ -157,28 +179,25 @@ static void setup (fsm_t *this)
 }
 
 /*
- * @brief	Enva datos por USB y para el mdulo NB-IoT que haya en el buffer de transmisin
- * @param	this: mquina de estados de la accin
+ * @brief	Envía datos por USB y para el módulo NB-IoT que haya en el buffer de transmisión
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void sendUSB (fsm_t *this)
 {
-	uint8_t *data, result;
 	uint16_t *flags;
 
 	flags = ((pilePointers_t*)this->data)->flags;
+	releaseSent();
 
 	if (((USBD_CDC_HandleTypeDef*)(hUsbDeviceFS.pClassData))->TxState == 0) {
-
 		// Recuperamos los datos a transmitir
 		lockTX();
-		if (getTX(&data, 10) == osEventMail) {
-			result = CDC_Transmit_FS(data, strlen((char*) data));
-
-			if (result != USBD_OK) {
-				putTX(data, strlen((char*) data));
+		if (usbBlock != NULL || getTX(&usbBlock)) {
+			if (CDC_Transmit_FS(usbBlock->data, usbBlock->len) == USBD_OK) {
+				usbSending = usbBlock;
+				usbBlock = NULL;
 			}
-			vPortFree(data);
 		} else {
 			*flags = *flags & ~TX_DATA;
 		}
@@ -186,13 +205,11 @@ static void sendUSB (fsm_t *this)
 		unlockTX();
 	}
 	if (huart3.gState != HAL_UART_STATE_BUSY_TX && huart3.gState != HAL_UART_STATE_BUSY_RX) {
-		if (getNB(&data, 10) == osEventMail) {
-			result = HAL_UART_Transmit_IT(&huart3, data, strlen((char*) data));
-
-			if (result == HAL_ERROR) {
-				putNB(data, strlen((char*) data));
+		if (nbBlock != NULL || getNB(&nbBlock)) {
+			if (HAL_UART_Transmit_IT(&huart3, nbBlock->data, nbBlock->len) == HAL_OK) {
+				nbSending = nbBlock;
+				nbBlock = NULL;
 			}
-			vPortFree(data);
 		} else {
 			*flags = *flags & ~TX_DATA;
 		}
@@ -201,8 +218,8 @@ static void sendUSB (fsm_t *this)
 }
 
 /*
- * @brief	Vuelta del envo de informacin
- * @param	this: mquina de estados a evaluar
+ * @brief	Vuelta del envío de información
+ * @param	this: máquina de estados a evaluar
  * @retval	Nada
  */
 static void flush (fsm_t *this)
@@ -212,8 +229,8 @@ static void flush (fsm_t *this)
 }
 
 /*
- * @brief	Actualiza el estado de la seal de datos en el buffer de recepcin
- * @param	this: mquina de estados de la accin
+ * @brief	Actualiza el estado de la señal de datos en el buffer de recepción
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void update (fsm_t *this)
@@ -226,39 +243,55 @@ static void update (fsm_t *this)
 
 /*
  * @brief	Actualiza el buffer circular asociado a la UART1
- * @param	this: mquina de estados de la accin
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void dataUART1 (fsm_t *this)
 {
 	uint16_t *flags;
-	uint16_t tail;
+	uint16_t tail, end, limit;
+	uint8_t *buffer = ((pilePointers_t*)this->data)->pileUART1->buffer;
 
 	osMutexWait(((pilePointers_t*)this->data)->pileLock, 0);
 	tail = ((pilePointers_t*)this->data)->pileUART1->tail;
-	do {
-		if (((pilePointers_t*)this->data)->pileUART1->buffer[tail] == '\r') {
-				flags = ((pilePointers_t*)this->data)->flags;
-				*flags = *flags | RESPOND_STN;
-				((pilePointers_t*)this->data)->pileUART1->head = (tail+1) % BUFFER_UART1;
-			osMutexRelease(((pilePointers_t*)this->data)->pileLock);
-			return;
-		}
-		if (((pilePointers_t*)this->data)->pileUART1->buffer[tail] == '>') {
+	end = (BUFFER_UART1 - (huart1.hdmarx)->Instance->CNDTR) % BUFFER_UART1;
+
+	// Modo monitor: las tramas se decodifican según llegan y se consumen del buffer
+	if (monitor_active()) {
+		if (monitor_parse(buffer, BUFFER_UART1, &tail, end)) {
 			flags = ((pilePointers_t*)this->data)->flags;
 			*flags = *flags | NEW_DATA_STN;
-			((pilePointers_t*)this->data)->pileUART1->head = (tail+1) % BUFFER_UART1;
-			osMutexRelease(((pilePointers_t*)this->data)->pileLock);
-			return;
 		}
-		tail = (tail+1) % BUFFER_UART1;
-	} while ((BUFFER_UART1 - tail) != ((huart1.hdmarx)->Instance->CNDTR));
+		((pilePointers_t*)this->data)->pileUART1->tail = tail;
+		((pilePointers_t*)this->data)->pileUART1->head = tail;
+		osMutexRelease(((pilePointers_t*)this->data)->pileLock);
+		return;
+	}
+
+	// Se busca en el sitio el fin de línea o el prompt, recorriendo hasta la posición de la
+	// DMA en dos tramos contiguos si ha dado la vuelta
+	limit = (end > tail) ? end : BUFFER_UART1;
+	while (1) {
+		for (; tail < limit; tail++) {
+			if (buffer[tail] == '\r' || buffer[tail] == '>') {
+				flags = ((pilePointers_t*)this->data)->flags;
+				*flags = *flags | ((buffer[tail] == '\r') ? RESPOND_STN : NEW_DATA_STN);
+				((pilePointers_t*)this->data)->pileUART1->head = (tail+1) % BUFFER_UART1;
+				osMutexRelease(((pilePointers_t*)this->data)->pileLock);
+				return;
+			}
+		}
+		if (limit == end)
+			break;
+		tail = 0;
+		limit = end;
+	}
 	osMutexRelease(((pilePointers_t*)this->data)->pileLock);
 }
 
 /*
  * @brief	Actualiza el buffer circular asociado a la UART2
- * @param	this: mquina de estados de la accin
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void dataUART2 (fsm_t *this)
@@ -277,11 +310,11 @@ static void dataUART2 (fsm_t *this)
 			if (charVal == '$') {
 				flagCheck = 1;
 
-			// Comprobacin de si el valor es vlido o no o si ha llegado al checksum
+			// Comprobación de si el valor es válido o no o si ha llegado al checksum
 			} else if (flagCheck && (charVal == 'V' || charVal == '*')) {
 				flagCheck = 0;
 
-			// Anlisis de los datos de posicin recibidos
+			// Análisis de los datos de posición recibidos
 			} else if (flagCheck && (charVal == 'E' || charVal == 'W')) {
 				flagCheck = 0;
 				if (pos >= 23) {
@@ -317,7 +350,7 @@ static void dataUART2 (fsm_t *this)
 
 /*
  * @brief	Actualiza el buffer circular asociado a la UART3
- * @param	this: mquina de estados de la accin
+ * @param	this: máquina de estados de la acción
  * @retval	Nada
  */
 static void dataUART3 (fsm_t *this)
@@ -411,7 +444,35 @@ static void dataUART3 (fsm_t *this)
 }
 
 /*
- * @brief	Handler de la recepcin de datos por USB
+ * @brief	Devuelve a su pool los bloques cuya transmisión ha terminado, sin esperar al
+ * 			siguiente envío, para que la ocupación de las pilas sea la real
+ * @param	this: máquina de estados de la acción
+ * @retval	Nada
+ */
+static void releaseTX (fsm_t *this)
+{
+	releaseSent();
+}
+
+/*
+ * @brief	Libera el bloque en transmisión de cada salida si el periférico ya lo ha enviado
+ * @param	Nada
+ * @retval	Nada
+ */
+static void releaseSent (void)
+{
+	if (usbSending != NULL && ((USBD_CDC_HandleTypeDef*)(hUsbDeviceFS.pClassData))->TxState == 0) {
+		freeTX(usbSending);
+		usbSending = NULL;
+	}
+	if (nbSending != NULL && huart3.gState != HAL_UART_STATE_BUSY_TX && huart3.gState != HAL_UART_STATE_BUSY_RX) {
+		freeNB(nbSending);
+		nbSending = NULL;
+	}
+}
+
+/*
+ * @brief	Handler de la recepción de datos por USB
  * @param	Buf: buffer donde se encuentran los datos recibidos
  * @param	len: cantidad de datos recibidos
  * @retval	Nada
@@ -419,9 +480,7 @@ static void dataUART3 (fsm_t *this)
 void newData (uint8_t* Buf, uint32_t len)
 {
 	uint8_t i;
-	lockRX();
 	putRX(Buf, len);
-	unlockRX();
 	for (i = 0; i < len; i++)
 		if (Buf[i] == '\r')
 			new = 1;
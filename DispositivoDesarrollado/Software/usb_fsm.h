@@ -11,8 +11,10 @@
 #include "fsm.h"
 #include "shareData.h"
 
-// Tamaos de los buffer circulares
-#define BUFFER_UART1	64
+// Tamaños de los buffer circulares. El de la UART1 cubre la respuesta más larga del STN
+// (VIN o varios PIDs: tres tramas de ~30 caracteres y el prompt) con margen para que a
+// la tasa negociada (hasta 2 Mbps) lleguen varias entre dos lecturas de la tarea USB
+#define BUFFER_UART1	256
 #define BUFFER_UART2	64
 #define BUFFER_UART3	128
 
@@ -0,0 +1,340 @@
+/*
+ * bench_decode.c
+ *
+ *  Medida de la decodificación de las respuestas del servicio 01 de micro_fsm.c: la tabla
+ *  hexValue de decodeNumber frente a la conversión con comparaciones que sustituyó y frente a
+ *  sscanf, primero número a número y después trama a trama (decodeBatch con la tabla de
+ *  descriptores pidDecoders frente a los case escritos a mano de translateOBD). Antes de medir
+ *  se comprueba que todas las versiones dan el mismo resultado
+ *      Author: miguelvp
+ */
+
+// Se incluye la fuente para llegar a sus funciones y tablas estáticas
+#include "micro_fsm.c"
+#include "check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Pasadas por todos los casos en cada medida
+#define BENCH_PASSES	200000
+
+#define NUM_NUMBERS		60
+#define NUM_FRAMES		64
+#define MAX_FRAME		32
+
+// Decodificación de un número de una respuesta
+typedef uint32_t (*numberDecoder)(uint8_t *data, uint8_t bytes);
+
+// Trama de prueba con la instrucción que la pidió
+typedef struct benchFrame {
+	command cmd;
+	uint8_t len;
+	uint8_t text[MAX_FRAME];
+} benchFrame;
+
+static volatile uint32_t sink;
+
+static uint32_t branchNumber(uint8_t *data, uint8_t bytes);
+static uint32_t scanfNumber(uint8_t *data, uint8_t bytes);
+static void benchNumbers(void);
+static void handTranslate(car *coche, benchFrame *frame, numberDecoder decode);
+static uint8_t initCar(car *coche);
+static uint8_t sameCar(car *a, car *b);
+static void benchFrames(void);
+static double now(void);
+
+int main(void)
+{
+	uint16_t flags = 0;
+
+	// storePID acaba en updateEmissions, que puede enviar el mensaje por el USB
+	REQUIRE(shareData_init(&flags), "shareData_init");
+
+	srand(1);
+	benchNumbers();
+	benchFrames();
+
+	printf("%s\n", failures ? "FALLO" : "OK");
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Conversión anterior de decodeNumber, con comparaciones por carácter
+ * @param	data: string a convertir
+ * 			bytes: número de bytes contenidos en el string
+ * @retval	Número equivalente al string pasado
+ */
+static uint32_t branchNumber(uint8_t *data, uint8_t bytes)
+{
+	uint32_t dev = 0;
+	uint8_t i;
+
+	for (i = 0; i < bytes*NEXT_NUMBER; i += NEXT_NUMBER) {
+		if (data[i] >= ASCII_LETTER_THRESHOLD) {
+			dev = dev << 4;
+			dev = dev + ((data[i] - ASCII_LETTER_THRESHOLD)+10);
+		} else if (data[i] >= ASCII_NUMBER_THRESHOLD) {
+			dev = dev << 4;
+			dev = dev + (data[i] - ASCII_NUMBER_THRESHOLD);
+		}
+		if (data[i+1] >= ASCII_LETTER_THRESHOLD) {
+			dev = dev << 4;
+			dev = dev + ((data[i+1] - ASCII_LETTER_THRESHOLD)+10);
+		} else if (data[i+1] >= ASCII_NUMBER_THRESHOLD) {
+			dev = dev << 4;
+			dev = dev + (data[i+1] - ASCII_NUMBER_THRESHOLD);
+		}
+	}
+
+	return dev;
+}
+
+/*
+ * @brief	Conversión con sscanf, byte a byte
+ * @param	data: string a convertir
+ * 			bytes: número de bytes contenidos en el string
+ * @retval	Número equivalente al string pasado
+ */
+static uint32_t scanfNumber(uint8_t *data, uint8_t bytes)
+{
+	uint32_t dev = 0;
+	unsigned int byte;
+
+	for (; bytes; bytes--, data += NEXT_NUMBER) {
+		if (sscanf((char*) data, "%2x", &byte) != 1)
+			return 0;
+		dev = (dev << 8) | byte;
+	}
+
+	return dev;
+}
+
+/*
+ * @brief	Comprueba y mide las tres conversiones sobre números de 1, 2 y 4 bytes con el
+ * 			formato de las respuestas del STN ("0B B8 ")
+ * @param	Nada
+ * @retval	Nada
+ */
+static void benchNumbers(void)
+{
+	static const uint8_t sizes[] = {1, 2, 4};
+	static uint8_t text[NUM_NUMBERS][4*NEXT_NUMBER + 1];
+	uint8_t bytes[NUM_NUMBERS];
+	double start, lutTime, branchTime, scanfTime;
+	uint32_t p, lut, acc = 0;
+	uint8_t i, k;
+
+	for (i = 0; i < NUM_NUMBERS; i++) {
+		bytes[i] = sizes[i % sizeof(sizes)];
+		for (k = 0; k < bytes[i]; k++) {
+			sprintf((char*) &text[i][k*NEXT_NUMBER], "%02X ", rand() & 0xFF);
+		}
+	}
+
+	for (i = 0; i < NUM_NUMBERS; i++) {
+		lut = decodeNumber(text[i], bytes[i]);
+		CHECK(lut == branchNumber(text[i], bytes[i]) && lut == scanfNumber(text[i], bytes[i]),
+				"\"%s\": tabla %u, comparaciones %u, sscanf %u", text[i], lut,
+				branchNumber(text[i], bytes[i]), scanfNumber(text[i], bytes[i]));
+	}
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < NUM_NUMBERS; i++) {
+			acc += decodeNumber(text[i], bytes[i]);
+		}
+	}
+	lutTime = now() - start;
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < NUM_NUMBERS; i++) {
+			acc += branchNumber(text[i], bytes[i]);
+		}
+	}
+	branchTime = now() - start;
+
+	// sscanf es mucho más lento: se mide con menos pasadas
+	start = now();
+	for (p = 0; p < BENCH_PASSES/20; p++) {
+		for (i = 0; i < NUM_NUMBERS; i++) {
+			acc += scanfNumber(text[i], bytes[i]);
+		}
+	}
+	scanfTime = (now() - start)*20;
+	sink = acc;
+
+	printf("números %3u de 1/2/4 bytes: hexValue %6.1f ns, comparaciones %6.1f ns (x%.1f), sscanf %6.1f ns (x%.1f)\n",
+			NUM_NUMBERS, lutTime*1e9 / ((double) BENCH_PASSES*NUM_NUMBERS),
+			branchTime*1e9 / ((double) BENCH_PASSES*NUM_NUMBERS), branchTime / lutTime,
+			scanfTime*1e9 / ((double) BENCH_PASSES*NUM_NUMBERS), scanfTime / lutTime);
+}
+
+/*
+ * @brief	Decodificación anterior de translateOBD: un case por instrucción con su corrección,
+ * 			y el número de bytes tomado de la cabecera de la trama. Se guarda igual que storePID
+ * 			para que sólo cambie la decodificación
+ * @param	coche: datos del vehículo
+ * 			frame: trama de respuesta
+ * 			decode: conversión de los números
+ * @retval	Nada
+ */
+static void handTranslate(car *coche, benchFrame *frame, numberDecoder decode)
+{
+	uint8_t *data = frame->text;
+	uint8_t bytes;
+
+	if (data[0] != '7' || data[1] != 'E')
+		return;
+	bytes = data[NUM_BYTES] - ASCII_NUMBER_THRESHOLD - LEN_HEADER_OBD;
+
+	switch (frame->cmd) {
+	case STN_GET_RPM:
+		scheduler_received(ENGINE_RPM);
+		window_put(&(coche->rpm), decode(&(data[PAYLOAD]), bytes) / CORRECCION_RPM);
+		break;
+	case STN_GET_SPEED:
+		scheduler_received(VEHICLE_SPEED);
+		window_put(&(coche->speed), decode(&(data[PAYLOAD]), bytes));
+#if TEST
+		updateEmissions(coche);
+#endif
+		break;
+	case STN_GET_AIR_TEMPERATURE:
+		scheduler_received(AMBIENT_AIR_TEMP);
+		window_put(&(coche->air), (int16_t) decode(&(data[PAYLOAD]), bytes) + CORRECCION_AIR);
+		break;
+	case STN_GET_FUEL:
+		scheduler_received(FUEL_TYPE);
+		coche->fuel = decode(&(data[PAYLOAD]), bytes);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * @brief	Inicializa los datos de un vehículo de prueba como en freertos.c
+ * @param	coche: datos del vehículo
+ * @retval	1 -> Correcto
+ * 			0 -> Sin memoria para las ventanas
+ */
+static uint8_t initCar(car *coche)
+{
+	memset(coche, 0, sizeof(car));
+	initParams(coche);
+	return window_init(&(coche->speed), SPEED_WINDOW) && window_init(&(coche->rpm), RPM_WINDOW)
+			&& window_init(&(coche->air), AIR_WINDOW);
+}
+
+/*
+ * @brief	Compara los últimos valores guardados de dos vehículos
+ * @param	a: datos del primer vehículo
+ * 			b: datos del segundo vehículo
+ * @retval	1 -> Iguales
+ * 			0 -> Distintos
+ */
+static uint8_t sameCar(car *a, car *b)
+{
+	return window_last(&(a->speed)) == window_last(&(b->speed)) && window_last(&(a->rpm)) == window_last(&(b->rpm))
+			&& window_last(&(a->air)) == window_last(&(b->air)) && a->fuel == b->fuel;
+}
+
+/*
+ * @brief	Comprueba y mide la decodificación de tramas de un PID (velocidad, rpm, temperatura
+ * 			del aire y combustible) con decodeBatch y con los case escritos a mano
+ * @param	Nada
+ * @retval	Nada
+ */
+static void benchFrames(void)
+{
+	static benchFrame frames[NUM_FRAMES];
+	static car table, hand;
+	double start, tableTime, branchTime, scanfTime;
+	uint32_t p;
+	uint8_t i;
+
+	if (!initCar(&table) || !initCar(&hand)) {
+		printf("FALLO: sin memoria para las ventanas\n");
+		failures++;
+		return;
+	}
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		switch (i % 4) {
+		case 0:
+			frames[i].cmd = STN_GET_SPEED;
+			sprintf((char*) frames[i].text, "7E8 03 41 %02X %02X \r", VEHICLE_SPEED, rand() & 0xFF);
+			break;
+		case 1:
+			frames[i].cmd = STN_GET_RPM;
+			sprintf((char*) frames[i].text, "7E8 04 41 %02X %02X %02X \r", ENGINE_RPM, rand() & 0x3F, rand() & 0xFF);
+			break;
+		case 2:
+			frames[i].cmd = STN_GET_AIR_TEMPERATURE;
+			sprintf((char*) frames[i].text, "7E8 03 41 %02X %02X \r", AMBIENT_AIR_TEMP, rand() & 0xFF);
+			break;
+		default:
+			frames[i].cmd = STN_GET_FUEL;
+			sprintf((char*) frames[i].text, "7E8 03 41 %02X %02X \r", FUEL_TYPE, 1 + rand() % 8);
+			break;
+		}
+		frames[i].len = strlen((char*) frames[i].text);
+	}
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		decodeBatch(&table, frames[i].text, frames[i].len);
+		handTranslate(&hand, &frames[i], branchNumber);
+		if (!sameCar(&table, &hand)) {
+			printf("FALLO: \"%.*s\": tabla %d/%d/%d/%u, case %d/%d/%d/%u\n", frames[i].len - 1, frames[i].text,
+					window_last(&table.speed), window_last(&table.rpm), window_last(&table.air), table.fuel,
+					window_last(&hand.speed), window_last(&hand.rpm), window_last(&hand.air), hand.fuel);
+			failures++;
+		}
+		handTranslate(&hand, &frames[i], scanfNumber);
+		CHECK(sameCar(&table, &hand), "\"%.*s\": sscanf distinto de la tabla", frames[i].len - 1, frames[i].text);
+	}
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < NUM_FRAMES; i++) {
+			decodeBatch(&table, frames[i].text, frames[i].len);
+		}
+	}
+	tableTime = now() - start;
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < NUM_FRAMES; i++) {
+			handTranslate(&hand, &frames[i], branchNumber);
+		}
+	}
+	branchTime = now() - start;
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES/20; p++) {
+		for (i = 0; i < NUM_FRAMES; i++) {
+			handTranslate(&hand, &frames[i], scanfNumber);
+		}
+	}
+	scanfTime = (now() - start)*20;
+	sink = window_last(&table.speed) + window_last(&hand.speed);
+
+	printf("tramas  %3u de un PID:      decodeBatch %6.1f ns, case+comparaciones %6.1f ns (x%.1f), case+sscanf %6.1f ns (x%.1f)\n",
+			NUM_FRAMES, tableTime*1e9 / ((double) BENCH_PASSES*NUM_FRAMES),
+			branchTime*1e9 / ((double) BENCH_PASSES*NUM_FRAMES), branchTime / tableTime,
+			scanfTime*1e9 / ((double) BENCH_PASSES*NUM_FRAMES), scanfTime / tableTime);
+}
+
+/*
+ * @brief	Instante actual
+ * @param	Nada
+ * @retval	Segundos desde un origen arbitrario
+ */
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
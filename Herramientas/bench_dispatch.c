@@ -0,0 +1,308 @@
+/*
+ * bench_dispatch.c
+ *
+ *  Medida de la identificación de las instrucciones de atcom.c (hash perfecto de
+ *  parseCommand frente a la búsqueda lineal con str_cmp que sustituyó) y de las cabeceras de
+ *  los mensajes del USB de shareData.c (tabla mssgHeader frente a los switch encadenados).
+ *  Antes de medir se comprueba que las dos versiones dan el mismo resultado
+ *      Author: miguelvp
+ */
+
+// Se incluyen las fuentes para llegar a sus funciones y tablas estáticas
+#include "atcom.c"
+#include "shareData.c"
+#include "check.h"
+#include <stdio.h>
+#include <time.h>
+
+// Pasadas por todas las instrucciones en cada medida
+#define BENCH_PASSES	100000
+
+#define MAX_MSSG		24
+#define MAX_CASES		128
+
+// Instrucciones de prueba de un módulo
+typedef struct benchSet {
+	const char *name;
+	command first, last;
+	uint8_t num;
+	uint8_t mssg[MAX_CASES][MAX_MSSG];
+} benchSet;
+
+static volatile uint32_t sink;
+
+static void buildSet(benchSet *set, const char *name, command first, command last);
+static command linearScan(uint8_t *mssg, command first, command last, uint32_t *params);
+static uint8_t str_cmp(uint8_t *str1, const uint8_t *str2);
+static void benchCommands(benchSet *set);
+static uint16_t chainedType(uint16_t offset);
+static void benchHeaders(void);
+static double now(void);
+
+int main(void)
+{
+	static benchSet stn, nb, gnss;
+	uint16_t flags = 0;
+
+	REQUIRE(shareData_init(&flags), "shareData_init");
+
+	buildSet(&stn, "stn", STN_REPEAT, STN_USER_OBD);
+	buildSet(&nb, "nb", NB_CONNECT, NB_SOCKET_CREATION);
+	buildSet(&gnss, "gnss", GNSS_RESTART, GNSS_BAUD_RATE);
+	benchCommands(&stn);
+	benchCommands(&nb);
+	benchCommands(&gnss);
+	benchHeaders();
+
+	printf("%s\n", failures ? "FALLO" : "OK");
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Prepara las instrucciones de prueba de un módulo: cada instrucción de inst[] del
+ * 			rango sola y con un parámetro, y palabras que no son instrucciones
+ * @param	set: instrucciones de prueba
+ * 			name: nombre del módulo
+ * 			first: primera instrucción del módulo
+ * 			last: última instrucción del módulo
+ * @retval	Nada
+ */
+static void buildSet(benchSet *set, const char *name, command first, command last)
+{
+	static const char *misses[] = {"foo", "rp", "speedx", "s1", "gnss", "", "connectt", "baud115200"};
+	uint8_t i, len;
+	command c;
+
+	set->name = name;
+	set->first = first;
+	set->last = last;
+	set->num = 0;
+	for (c = first; c <= last; c++) {
+		for (len = 0; inst[c][len] != '\r'; len++);
+		sprintf((char*) set->mssg[set->num++], "%.*s\r", len, inst[c]);
+		sprintf((char*) set->mssg[set->num++], "%.*s 115200\r", len, inst[c]);
+	}
+	for (i = 0; i < sizeof(misses)/sizeof(misses[0]); i++) {
+		sprintf((char*) set->mssg[set->num++], "%s\r", misses[i]);
+	}
+}
+
+/*
+ * @brief	Identificación anterior de la instrucción: comparación con cada una de inst[] y
+ * 			decodificación del parámetro decimal tras ella (decodeParam)
+ * @param	mssg: comienzo de la instrucción, tras la cabecera del módulo
+ * 			first: primera instrucción aceptada
+ * 			last: última instrucción aceptada
+ * 			params: parámetro de la instrucción
+ * @retval	Instrucción encontrada (NO_CMD si no hay ninguna)
+ */
+static command linearScan(uint8_t *mssg, command first, command last, uint32_t *params)
+{
+	command c;
+	uint8_t i;
+
+	*params = 0;
+	for (c = first; c <= last; c++) {
+		if (str_cmp(mssg, inst[c]))
+			break;
+	}
+	if (c > last)
+		return NO_CMD;
+
+	for (i = 0; inst[c][i] != '\r'; i++);
+	if (mssg[i] == ' ') {
+		for (i++; mssg[i] >= ASCII_NUMBER_THRESHOLD && mssg[i] <= '9'; i++) {
+			*params = *params*10 + (mssg[i] - ASCII_NUMBER_THRESHOLD);
+		}
+	}
+	return c;
+}
+
+/*
+ * @brief	Comparación de dos strings para ver si el primero es contenido en el segundo,
+ * 			tal como estaba en atcom.c
+ * @param	str1: string a comparar 1
+ * 			str2: string a comparar 2
+ * @retval	1 -> Contenido
+ * 			0 -> No contenido
+ */
+static uint8_t str_cmp(uint8_t *str1, const uint8_t *str2)
+{
+	uint8_t i;
+	for (i = 0; i < 20; i++) {
+		if (str2[i] == '\r' && (str1[i] == '\r' || str1[i] == ' '))
+			return 1;
+		else if (str1[i] != str2[i])
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * @brief	Comprueba y mide las dos identificaciones de las instrucciones de un módulo
+ * @param	set: instrucciones de prueba
+ * @retval	Nada
+ */
+static void benchCommands(benchSet *set)
+{
+	comando cmd;
+	command ref;
+	double start, hashTime, scanTime;
+	uint32_t p, params, acc = 0;
+	uint8_t i;
+
+	for (i = 0; i < set->num; i++) {
+		parseCommand(set->mssg[i], set->first, set->last, &cmd);
+		ref = linearScan(set->mssg[i], set->first, set->last, &params);
+		CHECK(cmd.type == ref && cmd.params == params, "%s \"%.*s\": parseCommand %u (%u), búsqueda lineal %u (%u)",
+				set->name, (int) strcspn((char*) set->mssg[i], "\r"), set->mssg[i], cmd.type, cmd.params, ref, params);
+	}
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < set->num; i++) {
+			parseCommand(set->mssg[i], set->first, set->last, &cmd);
+			acc += cmd.type + cmd.params;
+		}
+	}
+	hashTime = now() - start;
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < set->num; i++) {
+			acc += linearScan(set->mssg[i], set->first, set->last, &params) + params;
+		}
+	}
+	scanTime = now() - start;
+	sink = acc;
+
+	printf("%-4s %3u instrucciones: parseCommand %6.1f ns, búsqueda lineal %6.1f ns (x%.1f)\n",
+			set->name, set->num, hashTime*1e9 / ((double) BENCH_PASSES*set->num),
+			scanTime*1e9 / ((double) BENCH_PASSES*set->num), scanTime / hashTime);
+}
+
+/*
+ * @brief	Tipo de mensaje según la cabecera con los switch encadenados que había en
+ * 			typeNextMssgRX (más la cabecera "mon", añadida después), leyendo del buffer de
+ * 			recepción como mssgType
+ * @param	offset: posición del mensaje en usbReceive
+ * @retval	Tipo de mensaje
+ * 			0 -> No coincide con ninguna cabecera
+ */
+static uint16_t chainedType(uint16_t offset)
+{
+	uint8_t lastByte;
+	uint16_t type;
+
+#define NEXT_BYTE()		(lastByte = usbReceive->buffer[offset++ & usbReceive->mask])
+	NEXT_BYTE();
+	if (lastByte == 's')
+		type = STN_MSSG;
+	else if (lastByte == 'g')
+		type = GNSS_MSSG;
+	else if (lastByte == 'n')
+		type = NB_MSSG;
+	else if (lastByte == 't')
+		type = TEST_MSSG;
+	else if (lastByte == 'd')
+		type = TX_DATA;
+	else if (lastByte == 'e')
+		type = SETUP_MSSG;
+	else if (lastByte == 'm')
+		type = MONITOR_MSSG;
+	else
+		type = 0;
+
+	NEXT_BYTE();
+	switch (type) {
+	case STN_MSSG:		if (lastByte != 't') type = 0; break;
+	case GNSS_MSSG:		if (lastByte != 'n') type = 0; break;
+	case NB_MSSG:		if (lastByte != 'b') type = 0; break;
+	case TEST_MSSG:		if (lastByte != 'e') type = 0; break;
+	case TX_DATA:		if (lastByte != 'a') type = 0; break;
+	case SETUP_MSSG:	if (lastByte != 'u') type = 0; break;
+	case MONITOR_MSSG:	if (lastByte != 'o') type = 0; break;
+	}
+
+	NEXT_BYTE();
+	switch (type) {
+	case STN_MSSG:		if (lastByte != 'n') type = 0; break;
+	case GNSS_MSSG:		if (lastByte != 's') type = 0; break;
+	case TEST_MSSG:		if (lastByte != 's') type = 0; break;
+	case TX_DATA:		if (lastByte != 't') type = 0; break;
+	case SETUP_MSSG:	if (lastByte != 'r') type = 0; break;
+	case MONITOR_MSSG:	if (lastByte != 'n') type = 0; break;
+	}
+
+	NEXT_BYTE();
+	switch (type) {
+	case GNSS_MSSG:		if (lastByte != 's') type = 0; break;
+	case TEST_MSSG:		if (lastByte != 't') type = 0; break;
+	case TX_DATA:		if (lastByte != 'a') type = 0; break;
+	case SETUP_MSSG:	if (lastByte != 'o') type = 0; break;
+	}
+#undef NEXT_BYTE
+	return type;
+}
+
+/*
+ * @brief	Comprueba y mide las dos identificaciones de las cabeceras de los mensajes del USB
+ * @param	Nada
+ * @retval	Nada
+ */
+static void benchHeaders(void)
+{
+	static const char *mssgs[] = {
+			"stn speed", "gnss rate 100", "nb connect", "test speed", "data", "euro6 1",
+			"mon on", "xyz", "st", "gnome", "datum", "nb"
+	};
+	const uint8_t num = sizeof(mssgs)/sizeof(mssgs[0]);
+	uint16_t offset[sizeof(mssgs)/sizeof(mssgs[0])], len[sizeof(mssgs)/sizeof(mssgs[0])];
+	double start, tableTime, chainTime;
+	uint32_t p, acc = 0;
+	uint16_t pos = 0;
+	uint8_t i;
+
+	// Los mensajes se dejan en el buffer de recepción, como los deja putRX
+	for (i = 0; i < num; i++) {
+		offset[i] = pos;
+		len[i] = strlen(mssgs[i]) + 1;
+		memcpy(&usbReceive->buffer[pos], mssgs[i], len[i]);
+		pos += len[i];
+		CHECK(mssgType(offset[i], len[i]) == chainedType(offset[i]), "cabecera \"%s\": mssgType %u, switch %u",
+				mssgs[i], mssgType(offset[i], len[i]), chainedType(offset[i]));
+	}
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < num; i++) {
+			acc += mssgType(offset[i], len[i]);
+		}
+	}
+	tableTime = now() - start;
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < num; i++) {
+			acc += chainedType(offset[i]);
+		}
+	}
+	chainTime = now() - start;
+	sink = acc;
+
+	printf("cabeceras %3u mensajes:     mssgType %6.1f ns, switch encadenados %6.1f ns (x%.1f)\n",
+			num, tableTime*1e9 / ((double) BENCH_PASSES*num), chainTime*1e9 / ((double) BENCH_PASSES*num),
+			chainTime / tableTime);
+}
+
+/*
+ * @brief	Instante actual
+ * @param	Nada
+ * @retval	Segundos desde un origen arbitrario
+ */
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
@@ -0,0 +1,349 @@
+/*
+ * bench_spsc.c
+ *
+ *  Medida del buffer de recepción del USB de shareData.c frente al que sustituyó: el buffer de
+ *  un productor y un consumidor (spsc_buf, índices libres con máscara y copia por regiones)
+ *  frente a circular_buf_put/get byte a byte con módulo. Primero el buffer solo y después
+ *  putRX/getRX completos, los anteriores con el mutex que los protegía. Antes de medir se
+ *  comprueba que los datos salen iguales que entraron
+ *      Author: miguelvp
+ */
+
+#include "shareData.h"
+#include "check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Pasadas por todos los mensajes en cada medida
+#define BENCH_PASSES	100000
+
+// Tamaños de los buffer: RX_SIZE de shareData.c y el anterior, que no era potencia de 2
+#define SPSC_SIZE		64
+#define OLD_RX_SIZE		48
+
+#define MAX_MSSG		32
+
+static const char *mssgs[] = {
+		"stn speed\r", "gnss rate 1000\r", "nb connect\r", "test speed 120\r",
+		"mon on all\r", "euro6 2 1 1\r", "stn user 01 0D 0C\r", "data\r"
+};
+#define NUM_MSSGS		(sizeof(mssgs)/sizeof(mssgs[0]))
+
+static volatile uint32_t sink;
+
+static uint8_t circular_buf_put(circular_buf_t *cbuf, uint8_t data);
+static uint8_t circular_buf_get(circular_buf_t *cbuf, uint8_t *data);
+static uint8_t circular_buf_empty(circular_buf_t cbuf);
+static uint8_t oldPutRX(circular_buf_t *cbuf, uint8_t *data, uint16_t len);
+static uint8_t oldGetRX(circular_buf_t *cbuf, uint8_t *data, uint16_t len);
+static uint8_t spscPut(spsc_buf_t *sbuf, uint8_t *data, uint16_t len);
+static uint8_t spscGet(spsc_buf_t *sbuf, uint8_t *data, uint16_t len);
+static void benchRings(void);
+static void benchRX(void);
+static double now(void);
+
+int main(void)
+{
+	uint16_t flags = 0;
+
+	REQUIRE(shareData_init(&flags), "shareData_init");
+
+	benchRings();
+	benchRX();
+
+	printf("%s\n", failures ? "FALLO" : "OK");
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Añade datos al buffer circular, tal como estaba en shareData.c
+ * @param	cbuf: buffer circular
+ * @param	data: datos a añadir
+ * @retval	1 -> Datos añadidos correctamente
+ * 			0 -> Error al añadir los datos
+ */
+static uint8_t circular_buf_put(circular_buf_t *cbuf, uint8_t data)
+{
+	int r = 0;
+
+	if (cbuf) {
+		cbuf->buffer[cbuf->head] = data;
+		cbuf->head = (cbuf->head + 1) % cbuf->size;
+
+		if (cbuf->head == cbuf->tail) {
+			cbuf->tail = (cbuf->tail + 1) % cbuf->size;
+			cbuf->full = 1;
+		}
+
+		r = 1;
+	}
+
+	return r;
+}
+
+/*
+ * @brief	Extrae datos del buffer circular, tal como estaba en shareData.c
+ * @param	cbuf: buffer circular
+ * @param	data: puntero a los datos extraídos
+ * @retval	1 -> Datos extraídos correctamente
+ * 			0 -> Error al extraer los datos
+ */
+static uint8_t circular_buf_get(circular_buf_t *cbuf, uint8_t *data)
+{
+	int r = 0;
+
+	if (cbuf && data && !circular_buf_empty(*cbuf)) {
+		*data = cbuf->buffer[cbuf->tail];
+		cbuf->tail = (cbuf->tail + 1) % cbuf->size;
+
+		r = 1;
+	}
+
+	return r;
+}
+
+/*
+ * @brief	Comprobación de si el buffer circular está vacío, tal como estaba en shareData.c
+ * @param	cbuf: buffer circular
+ * @retval	1 -> El buffer está vacío
+ * 			0 -> El buffer no está vacío
+ */
+static uint8_t circular_buf_empty(circular_buf_t cbuf)
+{
+	return (cbuf.head == cbuf.tail) && !cbuf.full;
+}
+
+/*
+ * @brief	putRX anterior: byte a byte, con el '\0' tras el '\r' y vuelta atrás si falla
+ * @param	cbuf: buffer circular
+ * 			data: datos a guardar
+ * 			len: cantidad de datos
+ * @retval	1 -> Datos añadidos correctamente
+ * 			0 -> Datos no añadidos
+ */
+static uint8_t oldPutRX(circular_buf_t *cbuf, uint8_t *data, uint16_t len)
+{
+	uint16_t i, hInit;
+	hInit = cbuf->head;
+	for (i = 0; i < len; i++) {
+		if (!circular_buf_put(cbuf, data[i])) {
+			cbuf->head = hInit;
+			return 0;
+		}
+	}
+	if (data[len-1] == '\r') {
+		if (!circular_buf_put(cbuf, '\0')) {
+			cbuf->head = hInit;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * @brief	getRX anterior: byte a byte y vuelta atrás si falta alguno
+ * @param	cbuf: buffer circular
+ * 			data: destino de los datos
+ * 			len: número de datos a recoger
+ * @retval	1 -> Datos extraídos correctamente
+ * 			0 -> Datos no extraídos
+ */
+static uint8_t oldGetRX(circular_buf_t *cbuf, uint8_t *data, uint16_t len)
+{
+	uint16_t i, tInit;
+	tInit = cbuf->tail;
+	for (i = 0; i < len; i++) {
+		if (!circular_buf_get(cbuf, &data[i])) {
+			cbuf->tail = tInit;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * @brief	Escritura en un spsc_buf como la hace putRX, sin el índice de mensajes
+ * @param	sbuf: buffer circular
+ * 			data: datos a guardar
+ * 			len: cantidad de datos
+ * @retval	1 -> Datos añadidos correctamente
+ * 			0 -> No caben enteros
+ */
+static uint8_t spscPut(spsc_buf_t *sbuf, uint8_t *data, uint16_t len)
+{
+	buf_span_t span;
+
+	if (spsc_buf_writeSpan(sbuf, &span) < len)
+		return 0;
+	span_fill(&span, 0, data, len);
+	__atomic_store_n(&sbuf->head, (uint16_t) (sbuf->head + len), __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * @brief	Lectura de un spsc_buf como la hace getRX, sin el índice de mensajes
+ * @param	sbuf: buffer circular
+ * 			data: destino de los datos
+ * 			len: número de datos a recoger
+ * @retval	1 -> Datos extraídos correctamente
+ * 			0 -> No hay suficientes
+ */
+static uint8_t spscGet(spsc_buf_t *sbuf, uint8_t *data, uint16_t len)
+{
+	buf_span_t span;
+
+	if (spsc_buf_readSpan(sbuf, &span) < len)
+		return 0;
+	span_copy(&span, 0, data, len);
+	__atomic_store_n(&sbuf->tail, (uint16_t) (sbuf->tail + len), __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * @brief	Comprueba y mide los dos buffer solos: cada mensaje se escribe y se lee entero, y
+ * 			los índices van dando la vuelta
+ * @param	Nada
+ * @retval	Nada
+ */
+static void benchRings(void)
+{
+	static uint8_t oldData[OLD_RX_SIZE];
+	circular_buf_t old = {oldData, 0, 0, OLD_RX_SIZE, 0};
+	spsc_buf_t *spsc;
+	uint8_t out[MAX_MSSG];
+	uint16_t len[NUM_MSSGS];
+	double start, spscTime, oldTime;
+	uint32_t p, bytes = 0, acc = 0;
+	uint8_t i;
+
+	if (!spsc_buf_init(&spsc, SPSC_SIZE)) {
+		printf("FALLO: spsc_buf_init\n");
+		failures++;
+		return;
+	}
+
+	for (i = 0; i < NUM_MSSGS; i++) {
+		len[i] = strlen(mssgs[i]);
+		bytes += len[i];
+		// Varias vueltas por mensaje para pasar por el final de los dos buffer
+		for (p = 0; p < SPSC_SIZE; p++) {
+			memset(out, 0, sizeof(out));
+			if (!spscPut(spsc, (uint8_t*) mssgs[i], len[i]) || !spscGet(spsc, out, len[i]) || memcmp(out, mssgs[i], len[i])) {
+				printf("FALLO: spsc_buf, \"%.*s\"\n", len[i] - 1, mssgs[i]);
+				failures++;
+				break;
+			}
+			memset(out, 0, sizeof(out));
+			if (!oldPutRX(&old, (uint8_t*) mssgs[i], len[i]) || !oldGetRX(&old, out, len[i] + 1)
+					|| memcmp(out, mssgs[i], len[i]) || out[len[i]] != '\0') {
+				printf("FALLO: circular_buf, \"%.*s\"\n", len[i] - 1, mssgs[i]);
+				failures++;
+				break;
+			}
+		}
+	}
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < NUM_MSSGS; i++) {
+			spscPut(spsc, (uint8_t*) mssgs[i], len[i] + 1);
+			spscGet(spsc, out, len[i] + 1);
+			acc += out[0];
+		}
+	}
+	spscTime = now() - start;
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < NUM_MSSGS; i++) {
+			oldPutRX(&old, (uint8_t*) mssgs[i], len[i]);
+			oldGetRX(&old, out, len[i] + 1);
+			acc += out[0];
+		}
+	}
+	oldTime = now() - start;
+	sink = acc;
+
+	printf("buffer  %2u mensajes (%u bytes): spsc_buf %6.1f ns, circular_buf_put/get %6.1f ns (x%.1f) por mensaje\n",
+			(unsigned) NUM_MSSGS, bytes, spscTime*1e9 / ((double) BENCH_PASSES*NUM_MSSGS),
+			oldTime*1e9 / ((double) BENCH_PASSES*NUM_MSSGS), oldTime / spscTime);
+}
+
+/*
+ * @brief	Comprueba y mide putRX/getRX completos (con el índice de mensajes y su tipo)
+ * 			frente a los anteriores, cada uno entre osMutexWait y osMutexRelease como lo
+ * 			llamaban el callback del USB y la tarea principal
+ * @param	Nada
+ * @retval	Nada
+ */
+static void benchRX(void)
+{
+	static uint8_t oldData[OLD_RX_SIZE];
+	circular_buf_t old = {oldData, 0, 0, OLD_RX_SIZE, 0};
+	osMutexDef(receivePile);
+	osMutexId mutex;
+	uint8_t out[MAX_MSSG];
+	uint16_t len[NUM_MSSGS];
+	double start, newTime, oldTime;
+	uint32_t p, acc = 0;
+	uint8_t i;
+
+	if ((mutex = osMutexCreate(osMutex(receivePile))) == NULL) {
+		printf("FALLO: osMutexCreate\n");
+		failures++;
+		return;
+	}
+
+	for (i = 0; i < NUM_MSSGS; i++) {
+		len[i] = strlen(mssgs[i]);
+		memset(out, 0, sizeof(out));
+		if (!putRX((uint8_t*) mssgs[i], len[i]) || lenFirstMssgRX() != len[i] + 1 || !getRX(out, len[i] + 1)
+				|| memcmp(out, mssgs[i], len[i] + 1)) {
+			printf("FALLO: putRX/getRX, \"%.*s\"\n", len[i] - 1, mssgs[i]);
+			failures++;
+		}
+	}
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < NUM_MSSGS; i++) {
+			putRX((uint8_t*) mssgs[i], len[i]);
+			getRX(out, lenFirstMssgRX());
+			acc += out[0];
+		}
+	}
+	newTime = now() - start;
+
+	start = now();
+	for (p = 0; p < BENCH_PASSES; p++) {
+		for (i = 0; i < NUM_MSSGS; i++) {
+			osMutexWait(mutex, osWaitForever);
+			oldPutRX(&old, (uint8_t*) mssgs[i], len[i]);
+			osMutexRelease(mutex);
+			osMutexWait(mutex, osWaitForever);
+			oldGetRX(&old, out, len[i] + 1);
+			osMutexRelease(mutex);
+			acc += out[0];
+		}
+	}
+	oldTime = now() - start;
+	sink = acc;
+
+	printf("putRX/getRX %2u mensajes:      spsc_buf %6.1f ns, circular_buf y mutex  %6.1f ns (x%.1f) por mensaje\n",
+			(unsigned) NUM_MSSGS, newTime*1e9 / ((double) BENCH_PASSES*NUM_MSSGS),
+			oldTime*1e9 / ((double) BENCH_PASSES*NUM_MSSGS), oldTime / newTime);
+}
+
+/*
+ * @brief	Instante actual
+ * @param	Nada
+ * @retval	Segundos desde un origen arbitrario
+ */
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
@@ -0,0 +1,361 @@
+/*
+ * fleet.c
+ *
+ *  Reprocesado en el PC de las trazas de velocidad de una flota con el mismo cálculo de
+ *  COPERT que el dispositivo (copert.c)
+ *      Author: miguelvp
+ */
+
+#include "fleet.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FLEET_X86		1
+#else
+#define FLEET_X86		0
+#endif
+
+// Los kernels vectoriales reproducen la ruta de calcEmissions en coma flotante sin
+// interpolación. Con COPERT_FIXED_POINT o EF_INTERPOLATION sólo queda calcEmissionsTrace
+#define FLEET_SIMD		(FLEET_X86 && !COPERT_FIXED_POINT && !EF_INTERPOLATION)
+
+// Conversión de horas a milisegundos, como en copert.c
+#define HOUR_TO_MS		(60*60*1000)
+
+// Muestras de un bloque de la traza
+#define FLEET_BLOCK		1024
+
+// Bloque de una traza: el promedio, el factor de emisión y la distancia de cada muestra se
+// calculan en vectores y las emisiones se suman después en el orden de la traza, con las
+// mismas operaciones en coma flotante que calcEmissionsTrace, para que el resultado sea
+// idéntico bit a bit
+typedef struct traceBlock {
+	float sum[FLEET_BLOCK];		// Suma de la ventana en cada muestra
+	float count[FLEET_BLOCK];	// Muestras de la ventana en cada muestra
+	float contrib[NUM_EMISSIONS][FLEET_BLOCK];	// Emisiones de cada muestra
+} traceBlock;
+
+// Trabajo repartido entre los hilos de fleet_run
+typedef struct fleetJob {
+	fleetVehicle *fleet;
+	uint32_t num;
+	fleetKernel kernel;
+	uint32_t next;		// Siguiente vehículo sin calcular (atómico)
+	uint32_t valid;		// Vehículos calculados (atómico)
+} fleetJob;
+
+static const char *kernelNames[NUM_FLEET_KERNELS] = {"auto", "scalar", "sse", "avx2"};
+
+static void* worker(void *arg);
+#if FLEET_SIMD
+static void windowBlock(const uint8_t *speed, uint32_t pos, uint32_t num, uint16_t window, int32_t *sum, traceBlock *blk);
+static void contribScalar(const efRow *ef, float time, uint32_t first, uint32_t num, traceBlock *blk);
+static void contribSSE(const efRow *ef, float time, uint32_t num, traceBlock *blk);
+static void contribAVX2(const efRow *ef, float time, uint32_t num, traceBlock *blk);
+static void accumulateBlock(const traceBlock *blk, uint32_t num, emissionAcc *emission);
+#endif
+
+/*
+ * @brief	Resuelve la implementación a usar según las que admite el procesador
+ * @param	kernel: implementación pedida
+ * @retval	Implementación disponible: la pedida o, si no es posible, la mejor inferior
+ */
+fleetKernel fleet_kernel(fleetKernel kernel)
+{
+#if FLEET_SIMD
+	uint8_t avx2;
+
+	__builtin_cpu_init();
+	avx2 = __builtin_cpu_supports("avx2") != 0;
+	if (kernel == FLEET_AUTO)
+		return avx2 ? FLEET_AVX2 : FLEET_SSE;
+	if (kernel == FLEET_AVX2 && !avx2)
+		return FLEET_SSE;
+	return kernel;
+#else
+	return FLEET_SCALAR;
+#endif
+}
+
+/*
+ * @brief	Nombre de una implementación
+ * @param	kernel: implementación
+ * @retval	Nombre (auto, scalar, sse o avx2)
+ */
+const char* fleet_kernelName(fleetKernel kernel)
+{
+	return (kernel < NUM_FLEET_KERNELS) ? kernelNames[kernel] : "?";
+}
+
+/*
+ * @brief	Acumula las emisiones de una traza grabada. El resultado es idéntico bit a bit al
+ * 			de calcEmissionsTrace con cualquiera de las implementaciones
+ * @param	param: parámetros de las sustancias contaminantes (ver copertParams)
+ * 			speed: velocidades de la traza, una por periodo de muestreo
+ * 			samples: número de muestras de la traza
+ * 			window: longitud de la ventana de promediado
+ * 			time: periodo de muestreo (ms)
+ * 			emission: acumuladores de las emisiones (no se reinician)
+ * 			kernel: implementación a usar
+ * @retval	Nada
+ */
+void fleet_trace(const emissionParams *param, const uint8_t *speed, uint32_t samples, uint16_t window, float time, emissionAcc *emission, fleetKernel kernel)
+{
+#if FLEET_SIMD
+	traceBlock blk;
+	uint32_t pos, num;
+	int32_t sum = 0;
+#endif
+
+	kernel = fleet_kernel(kernel);
+	if (kernel == FLEET_SCALAR || window == 0) {
+		calcEmissionsTrace(param, speed, samples, window, time, emission);
+		return;
+	}
+
+#if FLEET_SIMD
+	for (pos = 0; pos < samples; pos += num) {
+		num = (samples - pos < FLEET_BLOCK) ? samples - pos : FLEET_BLOCK;
+		windowBlock(speed, pos, num, window, &sum, &blk);
+		if (kernel == FLEET_AVX2)
+			contribAVX2(param->ef, time, num, &blk);
+		else
+			contribSSE(param->ef, time, num, &blk);
+		accumulateBlock(&blk, num, emission);
+	}
+#endif
+}
+
+/*
+ * @brief	Calcula las emisiones de todos los vehículos de la flota repartiéndolos entre un
+ * 			pool de hilos: cada hilo toma el siguiente vehículo pendiente hasta acabar
+ * @param	fleet: vehículos de la flota
+ * 			num: número de vehículos
+ * 			threads: número de hilos (0 -> uno por procesador)
+ * 			kernel: implementación a usar
+ * @retval	Número de vehículos calculados (los demás tienen valid a 0)
+ */
+uint32_t fleet_run(fleetVehicle *fleet, uint32_t num, uint16_t threads, fleetKernel kernel)
+{
+	pthread_t thread[FLEET_MAX_THREADS];
+	fleetJob job;
+	uint16_t i, started;
+	long cpus;
+
+	if (threads == 0)
+		threads = ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0) ? cpus : 1;
+	if (threads > FLEET_MAX_THREADS)
+		threads = FLEET_MAX_THREADS;
+	if (threads > num)
+		threads = num ? num : 1;
+
+	job.fleet = fleet;
+	job.num = num;
+	job.kernel = fleet_kernel(kernel);
+	job.next = 0;
+	job.valid = 0;
+
+	// El hilo que llama también trabaja
+	for (started = 0; started < threads - 1; started++) {
+		if (pthread_create(&thread[started], NULL, worker, &job) != 0)
+			break;
+	}
+	worker(&job);
+	for (i = 0; i < started; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	return job.valid;
+}
+
+/*
+ * @brief	Hilo del pool: calcula vehículos hasta que no queda ninguno. La tabla de factores
+ * 			de emisión es del hilo y sólo se recalcula al cambiar la clase del vehículo
+ * @param	arg: trabajo compartido (fleetJob)
+ * @retval	NULL
+ */
+static void* worker(void *arg)
+{
+	fleetJob *job = (fleetJob*) arg;
+	fleetVehicle *v, *last = NULL;
+	efRow table[EF_TABLE_SIZE];
+	emissionParams param;
+	uint32_t i;
+	uint8_t k, valid = 0;
+
+	param.ef = table;
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->num) {
+		v = &job->fleet[i];
+		if (last == NULL || last->fuel != v->fuel || last->euro != v->euro || last->segment != v->segment)
+			valid = copertParams(&param, v->fuel, v->euro, v->segment);
+		last = v;
+
+		memset(v->emission, 0, sizeof(v->emission));
+		memset(v->value, 0, sizeof(v->value));
+		v->valid = valid;
+		if (!valid)
+			continue;
+
+		fleet_trace(&param, v->speed, v->samples, v->window, v->period, v->emission, job->kernel);
+		for (k = 0; k < NUM_EMISSIONS; k++) {
+#if COPERT_FIXED_POINT
+			v->value[k] = (float) v->emission[k] / param.scale[k] / HOUR_TO_MS;
+#else
+			v->value[k] = v->emission[k];
+#endif
+		}
+		__atomic_fetch_add(&job->valid, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+#if FLEET_SIMD
+/*
+ * @brief	Suma y número de muestras de la ventana en cada muestra del bloque, con las mismas
+ * 			operaciones enteras que calcEmissionsTrace
+ * @param	speed: velocidades de la traza
+ * 			pos: primera muestra del bloque
+ * 			num: muestras del bloque
+ * 			window: longitud de la ventana de promediado
+ * 			sum: suma de la ventana, se actualiza de un bloque al siguiente
+ * 			blk: bloque
+ * @retval	Nada
+ */
+static void windowBlock(const uint8_t *speed, uint32_t pos, uint32_t num, uint16_t window, int32_t *sum, traceBlock *blk)
+{
+	int32_t s = *sum;
+	uint32_t i = 0;
+
+	// Ventana llenándose al comienzo de la traza
+	for (; i < num && pos < window; i++, pos++) {
+		s += speed[pos];
+		blk->sum[i] = s;
+		blk->count[i] = pos + 1;
+	}
+	for (; i < num; i++, pos++) {
+		s += speed[pos] - speed[pos - window];
+		blk->sum[i] = s;
+		blk->count[i] = window;
+	}
+	*sum = s;
+}
+
+/*
+ * @brief	Emisiones de las muestras del bloque, de una en una (restos de los vectores)
+ * @param	ef: tabla de factores de emisión
+ * 			time: periodo de muestreo (ms)
+ * 			first: primera muestra a calcular
+ * 			num: muestras del bloque
+ * 			blk: bloque
+ * @retval	Nada
+ */
+static void contribScalar(const efRow *ef, float time, uint32_t first, uint32_t num, traceBlock *blk)
+{
+	float av_speed, distance;
+	uint32_t i;
+	uint8_t k, index;
+
+	for (i = first; i < num; i++) {
+		av_speed = blk->sum[i] / blk->count[i];
+		distance = av_speed*time/HOUR_TO_MS;
+		index = av_speed;
+		for (k = 0; k < NUM_EMISSIONS; k++) {
+			blk->contrib[k][i] = ef[index][k]*distance;
+		}
+	}
+}
+
+/*
+ * @brief	Emisiones de las muestras del bloque, de 4 en 4 (SSE2)
+ * @param	ef: tabla de factores de emisión
+ * 			time: periodo de muestreo (ms)
+ * 			num: muestras del bloque
+ * 			blk: bloque
+ * @retval	Nada
+ */
+static void contribSSE(const efRow *ef, float time, uint32_t num, traceBlock *blk)
+{
+	const __m128 vTime = _mm_set1_ps(time);
+	const __m128 vHour = _mm_set1_ps((float) HOUR_TO_MS);
+	__m128 avSpeed, distance;
+	int32_t index[4];
+	uint32_t i;
+	uint8_t k;
+
+	for (i = 0; i + 4 <= num; i += 4) {
+		avSpeed = _mm_div_ps(_mm_loadu_ps(&blk->sum[i]), _mm_loadu_ps(&blk->count[i]));
+		distance = _mm_div_ps(_mm_mul_ps(avSpeed, vTime), vHour);
+		_mm_storeu_si128((__m128i*) index, _mm_cvttps_epi32(avSpeed));
+		for (k = 0; k < NUM_EMISSIONS; k++) {
+			_mm_storeu_ps(&blk->contrib[k][i], _mm_mul_ps(distance,
+					_mm_set_ps(ef[index[3]][k], ef[index[2]][k], ef[index[1]][k], ef[index[0]][k])));
+		}
+	}
+	contribScalar(ef, time, i, num, blk);
+}
+
+/*
+ * @brief	Emisiones de las muestras del bloque, de 8 en 8 (AVX2, factores leídos con gather)
+ * @param	ef: tabla de factores de emisión
+ * 			time: periodo de muestreo (ms)
+ * 			num: muestras del bloque
+ * 			blk: bloque
+ * @retval	Nada
+ */
+__attribute__((target("avx2")))
+static void contribAVX2(const efRow *ef, float time, uint32_t num, traceBlock *blk)
+{
+	const __m256 vTime = _mm256_set1_ps(time);
+	const __m256 vHour = _mm256_set1_ps((float) HOUR_TO_MS);
+	const __m256i vRow = _mm256_set1_epi32(NUM_EMISSIONS);
+	__m256 avSpeed, distance;
+	__m256i offset;
+	uint32_t i;
+	uint8_t k;
+
+	for (i = 0; i + 8 <= num; i += 8) {
+		avSpeed = _mm256_div_ps(_mm256_loadu_ps(&blk->sum[i]), _mm256_loadu_ps(&blk->count[i]));
+		distance = _mm256_div_ps(_mm256_mul_ps(avSpeed, vTime), vHour);
+		offset = _mm256_mullo_epi32(_mm256_cvttps_epi32(avSpeed), vRow);
+		for (k = 0; k < NUM_EMISSIONS; k++) {
+			_mm256_storeu_ps(&blk->contrib[k][i], _mm256_mul_ps(distance,
+					_mm256_i32gather_ps(&ef[0][k], offset, sizeof(float))));
+		}
+	}
+	// Sin restos de AVX en los registros antes de volver al código SSE
+	_mm256_zeroupper();
+	contribScalar(ef, time, i, num, blk);
+}
+
+/*
+ * @brief	Suma las emisiones de las muestras del bloque en el orden de la traza
+ * @param	blk: bloque
+ * 			num: muestras del bloque
+ * 			emission: acumuladores de las emisiones
+ * @retval	Nada
+ */
+static void accumulateBlock(const traceBlock *blk, uint32_t num, emissionAcc *emission)
+{
+	float acc[4] = {0};
+	__m128 vAcc;
+	uint32_t i;
+	uint8_t k;
+
+	// Una suma vectorial por muestra, con una sustancia en cada componente: cada componente
+	// es la misma suma en coma flotante que en calcEmissionsTrace
+	_Static_assert(NUM_EMISSIONS == 3, "accumulateBlock suma CO, NOx y PM en un __m128");
+	for (k = 0; k < NUM_EMISSIONS; k++) {
+		acc[k] = emission[k];
+	}
+	vAcc = _mm_loadu_ps(acc);
+	for (i = 0; i < num; i++) {
+		vAcc = _mm_add_ps(vAcc, _mm_set_ps(0, blk->contrib[2][i], blk->contrib[1][i], blk->contrib[0][i]));
+	}
+	_mm_storeu_ps(acc, vAcc);
+	for (k = 0; k < NUM_EMISSIONS; k++) {
+		emission[k] = acc[k];
+	}
+}
+#endif
@@ -0,0 +1,48 @@
+/*
+ * fleet.h
+ *
+ *  Reprocesado en el PC de las trazas de velocidad de una flota con el mismo cálculo de
+ *  COPERT que el dispositivo (copert.c)
+ *      Author: miguelvp
+ */
+
+#ifndef FLEET_H_
+#define FLEET_H_
+
+#include <stdint.h>
+#include "copert.h"
+
+// Máximo de hilos de fleet_run
+#define FLEET_MAX_THREADS	64
+
+// Implementación del cálculo de una traza
+typedef enum fleetKernel {
+	FLEET_AUTO,			// La más rápida disponible en el procesador
+	FLEET_SCALAR,		// calcEmissionsTrace de copert.c, muestra a muestra
+	FLEET_SSE,			// 4 muestras por instrucción (SSE2)
+	FLEET_AVX2,			// 8 muestras por instrucción (AVX2)
+	NUM_FLEET_KERNELS
+} fleetKernel;
+
+// Vehículo de la flota: clase COPERT, traza de velocidades y emisiones calculadas
+typedef struct fleetVehicle {
+	uint32_t		id;
+	fuelType		fuel;
+	uint8_t			euro;
+	engineSegment	segment;
+	uint16_t		window;		// Muestras de la ventana de promediado
+	float			period;		// Periodo de muestreo (ms)
+	const uint8_t	*speed;		// Velocidades (km/h), una por periodo
+	uint32_t		samples;
+
+	uint8_t			valid;		// 0 -> Clase no encontrada en el registro
+	emissionAcc		emission[NUM_EMISSIONS];	// Acumuladores, como en car
+	float			value[NUM_EMISSIONS];		// Emisiones (g)
+} fleetVehicle;
+
+fleetKernel fleet_kernel(fleetKernel kernel);
+const char* fleet_kernelName(fleetKernel kernel);
+void fleet_trace(const emissionParams *param, const uint8_t *speed, uint32_t samples, uint16_t window, float time, emissionAcc *emission, fleetKernel kernel);
+uint32_t fleet_run(fleetVehicle *fleet, uint32_t num, uint16_t threads, fleetKernel kernel);
+
+#endif /* FLEET_H_ */
@@ -0,0 +1,282 @@
+/*
+ * fleet_main.c
+ *
+ *  Reprocesado de las trazas de velocidad de la flota desde la línea de comandos
+ *      Author: miguelvp
+ */
+
+#include "fleet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Longitud máxima de una línea del manifiesto
+#define LINE_SIZE		512
+
+static const char usage[] =
+		"uso: fleet [-j hilos] [-k auto|scalar|sse|avx2] [-c] manifiesto.csv\n"
+		"     fleet -b vehiculos muestras [-j hilos]\n"
+		"\n"
+		"Manifiesto: una línea por vehículo \"id,combustible,norma,segmento,ventana,periodo,traza\"\n"
+		"  combustible, segmento: valores de fuelType y engineSegment (copert.h)\n"
+		"  norma: código en hexadecimal de copert.h (10, 30, 61...)\n"
+		"  ventana: muestras de la ventana de promediado\n"
+		"  periodo: periodo de muestreo (ms)\n"
+		"  traza: fichero con una velocidad (km/h) por byte, relativo al manifiesto\n"
+		"Salida: \"id,muestras,co,nox,pm\" con las emisiones en gramos\n"
+		"  -c: comprueba cada vehículo contra calcEmissionsTrace, bit a bit\n"
+		"  -b: mide las muestras por segundo de cada implementación con trazas sintéticas\n";
+
+static uint32_t loadManifest(const char *name, fleetVehicle **fleet);
+static uint8_t* loadTrace(const char *manifest, const char *name, uint32_t *samples);
+static uint32_t checkFleet(const fleetVehicle *fleet, uint32_t num);
+static int benchmark(uint32_t vehicles, uint32_t samples, uint16_t threads);
+static double now(void);
+
+int main(int argc, char **argv)
+{
+	fleetVehicle *fleet;
+	fleetKernel kernel = FLEET_AUTO;
+	uint16_t threads = 0;
+	uint32_t num, i, errors;
+	uint8_t check = 0;
+	int arg;
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "-j") && arg + 1 < argc) {
+			threads = atoi(argv[++arg]);
+		} else if (!strcmp(argv[arg], "-k") && arg + 1 < argc) {
+			arg++;
+			for (kernel = FLEET_AUTO; kernel < NUM_FLEET_KERNELS && strcmp(argv[arg], fleet_kernelName(kernel)); kernel++);
+			if (kernel == NUM_FLEET_KERNELS) {
+				fputs(usage, stderr);
+				return 2;
+			}
+		} else if (!strcmp(argv[arg], "-c")) {
+			check = 1;
+		} else if (!strcmp(argv[arg], "-b") && arg + 2 < argc) {
+			num = atoi(argv[arg+1]);
+			i = atoi(argv[arg+2]);
+			for (arg += 3; arg + 1 < argc && !strcmp(argv[arg], "-j"); arg += 2) {
+				threads = atoi(argv[arg+1]);
+			}
+			return benchmark(num, i, threads);
+		} else {
+			fputs(usage, stderr);
+			return 2;
+		}
+	}
+	if (arg != argc - 1) {
+		fputs(usage, stderr);
+		return 2;
+	}
+
+	if ((num = loadManifest(argv[arg], &fleet)) == 0)
+		return 1;
+	if (fleet_run(fleet, num, threads, kernel) != num)
+		fprintf(stderr, "Hay vehículos con una clase que no está en el registro COPERT\n");
+
+	for (i = 0; i < num; i++) {
+		if (fleet[i].valid)
+			printf("%u,%u,%.9g,%.9g,%.9g\n", fleet[i].id, fleet[i].samples,
+					fleet[i].value[CO_EMISSION], fleet[i].value[NOX_EMISSION], fleet[i].value[PM_EMISSION]);
+		else
+			printf("%u,%u,,,\n", fleet[i].id, fleet[i].samples);
+	}
+
+	if (check) {
+		errors = checkFleet(fleet, num);
+		fprintf(stderr, "Comprobación con calcEmissionsTrace (%s): %u de %u vehículos distintos\n",
+				fleet_kernelName(fleet_kernel(kernel)), errors, num);
+		return errors ? 1 : 0;
+	}
+	return 0;
+}
+
+/*
+ * @brief	Lee el manifiesto de la flota y sus trazas
+ * @param	name: fichero del manifiesto
+ * 			fleet: vehículos leídos
+ * @retval	Número de vehículos (0 -> error)
+ */
+static uint32_t loadManifest(const char *name, fleetVehicle **fleet)
+{
+	char line[LINE_SIZE], trace[LINE_SIZE];
+	unsigned int id, fuel, euro, segment, window;
+	uint32_t num = 0, size = 0, n = 0;
+	fleetVehicle *v;
+	float period;
+	FILE *f;
+
+	if ((f = fopen(name, "r")) == NULL) {
+		perror(name);
+		return 0;
+	}
+
+	*fleet = NULL;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		n++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%u,%u,%x,%u,%u,%f,%511[^\r\n]", &id, &fuel, &euro, &segment, &window, &period, trace) != 7) {
+			fprintf(stderr, "%s:%u: línea no válida\n", name, n);
+			continue;
+		}
+		if (num == size) {
+			size = size ? 2*size : 64;
+			*fleet = realloc(*fleet, size*sizeof(fleetVehicle));
+		}
+		v = &(*fleet)[num];
+		v->id = id;
+		v->fuel = fuel;
+		v->euro = euro;
+		v->segment = segment;
+		v->window = window;
+		v->period = period;
+		if ((v->speed = loadTrace(name, trace, &v->samples)) != NULL)
+			num++;
+	}
+	fclose(f);
+	return num;
+}
+
+/*
+ * @brief	Lee la traza de velocidades de un vehículo
+ * @param	manifest: fichero del manifiesto
+ * 			name: fichero de la traza, relativo al directorio del manifiesto
+ * 			samples: número de muestras leídas
+ * @retval	Velocidades o NULL si no se ha podido leer
+ */
+static uint8_t* loadTrace(const char *manifest, const char *name, uint32_t *samples)
+{
+	char path[2*LINE_SIZE];
+	const char *dir;
+	uint8_t *speed;
+	long size;
+	FILE *f;
+
+	dir = strrchr(manifest, '/');
+	if (name[0] != '/' && dir != NULL)
+		snprintf(path, sizeof(path), "%.*s/%s", (int) (dir - manifest), manifest, name);
+	else
+		snprintf(path, sizeof(path), "%s", name);
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		perror(path);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	speed = malloc(size ? size : 1);
+	*samples = fread(speed, 1, size, f);
+	fclose(f);
+	return speed;
+}
+
+/*
+ * @brief	Repite el cálculo de cada vehículo con calcEmissionsTrace y lo compara bit a bit
+ * @param	fleet: vehículos ya calculados
+ * 			num: número de vehículos
+ * @retval	Número de vehículos con un resultado distinto
+ */
+static uint32_t checkFleet(const fleetVehicle *fleet, uint32_t num)
+{
+	efRow table[EF_TABLE_SIZE];
+	emissionParams param;
+	emissionAcc emission[NUM_EMISSIONS];
+	uint32_t i, errors = 0;
+
+	param.ef = table;
+	for (i = 0; i < num; i++) {
+		if (!fleet[i].valid)
+			continue;
+		copertParams(&param, fleet[i].fuel, fleet[i].euro, fleet[i].segment);
+		memset(emission, 0, sizeof(emission));
+		calcEmissionsTrace(&param, fleet[i].speed, fleet[i].samples, fleet[i].window, fleet[i].period, emission);
+		if (memcmp(emission, fleet[i].emission, sizeof(emission))) {
+			fprintf(stderr, "Vehículo %u: resultado distinto de calcEmissionsTrace\n", fleet[i].id);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+/*
+ * @brief	Mide la velocidad de cada implementación sobre una flota sintética: recorridos con
+ * 			aceleraciones, velocidad de crucero y paradas, con las clases del registro
+ * @param	vehicles: número de vehículos
+ * 			samples: muestras de cada vehículo
+ * 			threads: número de hilos (0 -> uno por procesador)
+ * @retval	0 -> Todas las implementaciones coinciden con la escalar
+ * 			1 -> Alguna difiere
+ */
+static int benchmark(uint32_t vehicles, uint32_t samples, uint16_t threads)
+{
+	static const uint8_t classes[][3] = {
+			{GAS, EURO_3, SEGMENT_MEDIUM}, {DSL, EURO_6_2016, SEGMENT_SMALL}
+	};
+	fleetVehicle *fleet, *ref;
+	fleetKernel kernel;
+	uint8_t *speed;
+	uint32_t i, j, errors = 0;
+	int32_t v;
+	double start, elapsed;
+
+	fleet = calloc(vehicles, sizeof(fleetVehicle));
+	ref = calloc(vehicles, sizeof(fleetVehicle));
+	srand(1);
+	for (i = 0; i < vehicles; i++) {
+		speed = malloc(samples ? samples : 1);
+		for (j = 0, v = 0; j < samples; j++) {
+			v += rand() % 7 - 3;
+			if (rand() % 2000 == 0)
+				v = 0;
+			v = (v < 0) ? 0 : (v > 140) ? 140 : v;
+			speed[j] = v;
+		}
+		fleet[i].id = i;
+		fleet[i].fuel = classes[i % 2][0];
+		fleet[i].euro = classes[i % 2][1];
+		fleet[i].segment = classes[i % 2][2];
+		fleet[i].window = (i % 3 == 0) ? 1 : 10;
+		fleet[i].period = 1000;
+		fleet[i].speed = speed;
+		fleet[i].samples = samples;
+	}
+
+	for (kernel = FLEET_SCALAR; kernel < NUM_FLEET_KERNELS; kernel++) {
+		if (fleet_kernel(kernel) != kernel)
+			continue;
+		start = now();
+		fleet_run(fleet, vehicles, threads, kernel);
+		elapsed = now() - start;
+		printf("%-6s %10.1f Mmuestras/s\n", fleet_kernelName(kernel),
+				(double) vehicles * samples / elapsed / 1e6);
+
+		if (kernel == FLEET_SCALAR) {
+			memcpy(ref, fleet, vehicles*sizeof(fleetVehicle));
+			continue;
+		}
+		for (i = 0; i < vehicles; i++) {
+			if (memcmp(ref[i].emission, fleet[i].emission, sizeof(fleet[i].emission)))
+				errors++;
+		}
+	}
+	if (errors)
+		printf("%u resultados distintos de la implementación escalar\n", errors);
+	return errors ? 1 : 0;
+}
+
+/*
+ * @brief	Instante actual
+ * @param	Nada
+ * @retval	Segundos desde un origen arbitrario
+ */
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
@@ -0,0 +1,24 @@
+/*
+ * FreeRTOS.h
+ *
+ *  Sustituto de FreeRTOS para compilar en el PC el código del dispositivo. Las secciones
+ *  críticas se implementan con un mutex global (host.c)
+ *      Author: miguelvp
+ */
+
+#ifndef FREERTOS_H_
+#define FREERTOS_H_
+
+#include <stddef.h>
+
+#define pdMS_TO_TICKS(ms)		(ms)
+
+void* pvPortMalloc(size_t size);
+void vPortFree(void *pv);
+
+void vPortEnterCritical(void);
+void vPortExitCritical(void);
+#define taskENTER_CRITICAL()	vPortEnterCritical()
+#define taskEXIT_CRITICAL()		vPortExitCritical()
+
+#endif /* FREERTOS_H_ */
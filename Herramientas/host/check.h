@@ -0,0 +1,24 @@
+/*
+ * check.h
+ *
+ *  Comprobaciones comunes de las pruebas y medidas de las herramientas: cada fallo se
+ *  imprime con el prefijo "FALLO: " y se cuenta en failures, que decide el resultado
+ *      Author: miguelvp
+ */
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Fallos de la prueba (cada programa es una única unidad de compilación)
+static uint32_t failures;
+
+// Cuenta un fallo si no se cumple la condición
+#define CHECK(cond, ...)	do { if (!(cond)) { printf("FALLO: " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+// Termina la prueba si no se cumple una condición sin la que no puede seguir
+#define REQUIRE(cond, ...)	do { if (!(cond)) { printf("FALLO: " __VA_ARGS__); printf("\n"); return 1; } } while (0)
+
+#endif /* CHECK_H_ */
@@ -0,0 +1,76 @@
+/*
+ * cmsis_os.h
+ *
+ *  Sustituto de la capa CMSIS-OS para compilar en el PC el código del dispositivo. Sólo
+ *  declara lo que usa el firmware; la implementación, sobre pthreads, está en host.c
+ *      Author: miguelvp
+ */
+
+#ifndef CMSIS_OS_H_
+#define CMSIS_OS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "FreeRTOS.h"
+
+#define osWaitForever		0xFFFFFFFF
+
+typedef enum {
+	osOK = 0,
+	osEventSignal = 0x08,
+	osEventMessage = 0x10,
+	osEventMail = 0x20,
+	osEventTimeout = 0x40,
+	osErrorParameter = 0x80,
+	osErrorResource = 0x81,
+	osErrorOS = 0xFF
+} osStatus;
+
+typedef struct hostMutex *osMutexId;
+typedef struct hostMailQ *osMailQId;
+typedef void *osThreadId;
+
+typedef struct osMutexDef_t {
+	uint32_t dummy;
+} osMutexDef_t;
+
+typedef struct osMailQDef_t {
+	uint32_t queue_sz;		// Bloques de la cola
+	uint32_t item_sz;		// Tamaño de cada bloque
+} osMailQDef_t;
+
+typedef struct osEvent {
+	osStatus status;
+	union {
+		uint32_t v;
+		void *p;
+		int32_t signals;
+	} value;
+	union {
+		osMailQId mail_id;
+	} def;
+} osEvent;
+
+#define osMutexDef(name)				const osMutexDef_t os_mutex_def_##name = {0}
+#define osMutex(name)					&os_mutex_def_##name
+#define osMailQDef(name, queue_sz, type)	const osMailQDef_t os_mailQ_def_##name = {(queue_sz), sizeof(type)}
+#define osMailQ(name)					&os_mailQ_def_##name
+
+osMutexId osMutexCreate(const osMutexDef_t *mutex_def);
+osStatus osMutexWait(osMutexId mutex_id, uint32_t millisec);
+osStatus osMutexRelease(osMutexId mutex_id);
+osStatus osMutexDelete(osMutexId mutex_id);
+
+// Usos incorrectos de los mutex (tomar uno propio o liberar uno ajeno), para las pruebas
+extern uint32_t hostMutexErrors;
+
+osMailQId osMailCreate(const osMailQDef_t *queue_def, osThreadId thread_id);
+void* osMailAlloc(osMailQId queue_id, uint32_t millisec);
+osStatus osMailPut(osMailQId queue_id, void *mail);
+osEvent osMailGet(osMailQId queue_id, uint32_t millisec);
+osStatus osMailFree(osMailQId queue_id, void *mail);
+
+uint32_t osKernelSysTick(void);
+osStatus osDelay(uint32_t millisec);
+
+#endif /* CMSIS_OS_H_ */
@@ -0,0 +1,37 @@
+/*
+ * fsm.h
+ *
+ *  Sustituto de la librería de máquinas de estados del dispositivo, con la misma interfaz
+ *  (implementación en host.c)
+ *      Author: miguelvp
+ */
+
+#ifndef FSM_H_
+#define FSM_H_
+
+#include <stdint.h>
+
+typedef struct fsm_t fsm_t;
+
+typedef uint8_t (*fsm_input_func_t) (fsm_t*);
+typedef void (*fsm_output_func_t) (fsm_t*);
+
+typedef struct fsm_trans_t {
+	int orig_state;
+	fsm_input_func_t in;
+	int dest_state;
+	fsm_output_func_t out;
+} fsm_trans_t;
+
+struct fsm_t {
+	int current_state;
+	fsm_trans_t *tt;
+	void *data;
+};
+
+fsm_t* fsm_new(fsm_trans_t *tt, void *data);
+void fsm_init(fsm_t *this, fsm_trans_t *tt, void *data);
+void fsm_destroy(fsm_t *this);
+void fsm_fire(fsm_t *this);
+
+#endif /* FSM_H_ */
@@ -0,0 +1,385 @@
+/*
+ * host.c
+ *
+ *  Implementación en el PC de los servicios de FreeRTOS, CMSIS-OS, la HAL y la librería de
+ *  máquinas de estados que usa el código del dispositivo. El sistema operativo se apoya en
+ *  pthreads para poder probar el código con varios hilos; los periféricos no hacen nada
+ *      Author: miguelvp
+ */
+
+#define _GNU_SOURCE
+#include "cmsis_os.h"
+#include "stm32l4xx_hal.h"
+#include "lptim.h"
+#include "usbd_cdc_if.h"
+#include "fsm.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Frecuencia del bus APB2 del dispositivo
+#define HOST_PCLK2		80000000
+
+struct hostMutex {
+	pthread_mutex_t lock;
+};
+
+// Cola de correo: bloques de tamaño fijo, los libres en una pila y los enviados en orden
+struct hostMailQ {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	uint32_t size;
+	uint8_t *blocks;
+	void **freeList;
+	uint32_t numFree;
+	void **fifo;
+	uint32_t head, count;
+};
+
+LPTIM_HandleTypeDef hlptim2;
+uint32_t hostFlashFaults;
+uint32_t hostMutexErrors;
+
+static pthread_mutex_t critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static void deadline(struct timespec *t, uint32_t millisec);
+static void flashWritable(uintptr_t addr, size_t len);
+
+void* pvPortMalloc(size_t size)
+{
+	return malloc(size);
+}
+
+void vPortFree(void *pv)
+{
+	free(pv);
+}
+
+void vPortEnterCritical(void)
+{
+	pthread_mutex_lock(&critical);
+}
+
+void vPortExitCritical(void)
+{
+	pthread_mutex_unlock(&critical);
+}
+
+osMutexId osMutexCreate(const osMutexDef_t *mutex_def)
+{
+	osMutexId mutex = malloc(sizeof(struct hostMutex));
+	pthread_mutexattr_t attr;
+
+	// No recursivo, como en FreeRTOS: volver a tomarlo o liberarlo sin tenerlo es un error
+	if (mutex != NULL) {
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+		pthread_mutex_init(&mutex->lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+	return mutex;
+}
+
+osStatus osMutexWait(osMutexId mutex_id, uint32_t millisec)
+{
+	struct timespec t;
+	int err;
+
+	if (mutex_id == NULL)
+		return osErrorParameter;
+	if (millisec == osWaitForever)
+		err = pthread_mutex_lock(&mutex_id->lock);
+	else if (millisec == 0)
+		err = pthread_mutex_trylock(&mutex_id->lock);
+	else {
+		deadline(&t, millisec);
+		err = pthread_mutex_timedlock(&mutex_id->lock, &t);
+	}
+	// En el dispositivo el hilo que ya lo tiene se queda esperando hasta el timeout
+	if (err == EDEADLK)
+		hostMutexErrors++;
+	if (err)
+		return (millisec == osWaitForever) ? osErrorOS : osErrorResource;
+	return osOK;
+}
+
+osStatus osMutexRelease(osMutexId mutex_id)
+{
+	if (mutex_id == NULL)
+		return osErrorParameter;
+	if (pthread_mutex_unlock(&mutex_id->lock)) {
+		hostMutexErrors++;
+		return osErrorResource;
+	}
+	return osOK;
+}
+
+osStatus osMutexDelete(osMutexId mutex_id)
+{
+	if (mutex_id == NULL)
+		return osErrorParameter;
+	pthread_mutex_destroy(&mutex_id->lock);
+	free(mutex_id);
+	return osOK;
+}
+
+osMailQId osMailCreate(const osMailQDef_t *queue_def, osThreadId thread_id)
+{
+	osMailQId q;
+	uint32_t i;
+
+	if ((q = calloc(1, sizeof(struct hostMailQ))) == NULL)
+		return NULL;
+	q->size = queue_def->queue_sz;
+	q->blocks = malloc(q->size * queue_def->item_sz);
+	q->freeList = malloc(q->size * sizeof(void*));
+	q->fifo = malloc(q->size * sizeof(void*));
+	if (q->blocks == NULL || q->freeList == NULL || q->fifo == NULL)
+		return NULL;
+	for (i = 0; i < q->size; i++) {
+		q->freeList[i] = &q->blocks[(q->size - 1 - i) * queue_def->item_sz];
+	}
+	q->numFree = q->size;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->changed, NULL);
+	return q;
+}
+
+void* osMailAlloc(osMailQId queue_id, uint32_t millisec)
+{
+	struct timespec t;
+	void *mail = NULL;
+
+	deadline(&t, millisec);
+	pthread_mutex_lock(&queue_id->lock);
+	while (queue_id->numFree == 0 && millisec != 0) {
+		if (millisec == osWaitForever)
+			pthread_cond_wait(&queue_id->changed, &queue_id->lock);
+		else if (pthread_cond_timedwait(&queue_id->changed, &queue_id->lock, &t) == ETIMEDOUT)
+			break;
+	}
+	if (queue_id->numFree)
+		mail = queue_id->freeList[--queue_id->numFree];
+	pthread_mutex_unlock(&queue_id->lock);
+	return mail;
+}
+
+osStatus osMailPut(osMailQId queue_id, void *mail)
+{
+	if (mail == NULL)
+		return osErrorParameter;
+	pthread_mutex_lock(&queue_id->lock);
+	queue_id->fifo[(queue_id->head + queue_id->count++) % queue_id->size] = mail;
+	pthread_cond_broadcast(&queue_id->changed);
+	pthread_mutex_unlock(&queue_id->lock);
+	return osOK;
+}
+
+osEvent osMailGet(osMailQId queue_id, uint32_t millisec)
+{
+	struct timespec t;
+	osEvent evt;
+
+	evt.status = osEventTimeout;
+	evt.value.p = NULL;
+	evt.def.mail_id = queue_id;
+	deadline(&t, millisec);
+	pthread_mutex_lock(&queue_id->lock);
+	while (queue_id->count == 0 && millisec != 0) {
+		if (millisec == osWaitForever)
+			pthread_cond_wait(&queue_id->changed, &queue_id->lock);
+		else if (pthread_cond_timedwait(&queue_id->changed, &queue_id->lock, &t) == ETIMEDOUT)
+			break;
+	}
+	if (queue_id->count) {
+		evt.status = osEventMail;
+		evt.value.p = queue_id->fifo[queue_id->head];
+		queue_id->head = (queue_id->head + 1) % queue_id->size;
+		queue_id->count--;
+	} else if (millisec == 0) {
+		evt.status = osOK;
+	}
+	pthread_mutex_unlock(&queue_id->lock);
+	return evt;
+}
+
+osStatus osMailFree(osMailQId queue_id, void *mail)
+{
+	if (mail == NULL)
+		return osErrorParameter;
+	pthread_mutex_lock(&queue_id->lock);
+	queue_id->freeList[queue_id->numFree++] = mail;
+	pthread_cond_broadcast(&queue_id->changed);
+	pthread_mutex_unlock(&queue_id->lock);
+	return osOK;
+}
+
+uint32_t osKernelSysTick(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000 + t.tv_nsec/1000000;
+}
+
+osStatus osDelay(uint32_t millisec)
+{
+	struct timespec t = {millisec / 1000, (millisec % 1000) * 1000000};
+	nanosleep(&t, NULL);
+	return osEventTimeout;
+}
+
+void HAL_GPIO_WritePin(void *port, uint16_t pin, GPIO_PinState state)
+{
+}
+
+void HAL_GPIO_TogglePin(void *port, uint16_t pin)
+{
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+	return HOST_PCLK2;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t address, uint64_t data)
+{
+	volatile uint64_t *dw = (volatile uint64_t*) (uintptr_t) address;
+
+	if (hostFlashFaults) {
+		hostFlashFaults--;
+		return HAL_ERROR;
+	}
+
+	// Como en el STM32L4, sólo se puede programar una doble palabra borrada
+	flashWritable(address, sizeof(uint64_t));
+	if (*dw != 0xFFFFFFFFFFFFFFFF)
+		return HAL_ERROR;
+	*dw = data;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *erase, uint32_t *pageError)
+{
+	uintptr_t addr = FLASH_BASE + (uintptr_t) erase->Page * FLASH_PAGE_SIZE;
+
+	flashWritable(addr, erase->NbPages * FLASH_PAGE_SIZE);
+	memset((void*) addr, 0xFF, erase->NbPages * FLASH_PAGE_SIZE);
+	*pageError = 0xFFFFFFFF;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_LPTIM_OnePulse_Start_IT(LPTIM_HandleTypeDef *hlptim, uint32_t period, uint32_t pulse)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_LPTIM_OnePulse_Stop_IT(LPTIM_HandleTypeDef *hlptim)
+{
+	return HAL_OK;
+}
+
+uint8_t CDC_Transmit_FS(uint8_t *buf, uint16_t len)
+{
+	return USBD_OK;
+}
+
+fsm_t* fsm_new(fsm_trans_t *tt, void *data)
+{
+	fsm_t *this = malloc(sizeof(fsm_t));
+	if (this != NULL)
+		fsm_init(this, tt, data);
+	return this;
+}
+
+void fsm_init(fsm_t *this, fsm_trans_t *tt, void *data)
+{
+	this->tt = tt;
+	this->current_state = tt[0].orig_state;
+	this->data = data;
+}
+
+void fsm_destroy(fsm_t *this)
+{
+	free(this);
+}
+
+void fsm_fire(fsm_t *this)
+{
+	fsm_trans_t *t;
+
+	for (t = this->tt; t->orig_state >= 0; ++t) {
+		if ((this->current_state == t->orig_state) && t->in(this)) {
+			this->current_state = t->dest_state;
+			if (t->out)
+				t->out(this);
+			break;
+		}
+	}
+}
+
+/*
+ * @brief	Permite escribir en la "flash", que en el PC es una constante del programa
+ * @param	addr: comienzo de la zona
+ * 			len: bytes de la zona
+ * @retval	Nada
+ */
+static void flashWritable(uintptr_t addr, size_t len)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = addr & ~(page - 1);
+
+	mprotect((void*) start, (addr + len - start + page - 1) & ~(page - 1), PROT_READ | PROT_WRITE);
+}
+
+/*
+ * @brief	Instante absoluto tras una espera, para las esperas con límite de pthreads
+ * @param	t: instante calculado
+ * 			millisec: espera (ms)
+ * @retval	Nada
+ */
+static void deadline(struct timespec *t, uint32_t millisec)
+{
+	clock_gettime(CLOCK_REALTIME, t);
+	if (millisec == osWaitForever)
+		return;
+	t->tv_sec += millisec / 1000;
+	t->tv_nsec += (millisec % 1000) * 1000000;
+	if (t->tv_nsec >= 1000000000) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000;
+	}
+}
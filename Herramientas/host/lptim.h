@@ -0,0 +1,15 @@
+/*
+ * lptim.h
+ *
+ *  Sustituto de lptim.h del proyecto de CubeMX
+ *      Author: miguelvp
+ */
+
+#ifndef LPTIM_H_
+#define LPTIM_H_
+
+#include "stm32l4xx_hal.h"
+
+extern LPTIM_HandleTypeDef hlptim2;
+
+#endif /* LPTIM_H_ */
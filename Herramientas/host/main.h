@@ -0,0 +1,20 @@
+/*
+ * main.h
+ *
+ *  Sustituto de main.h del proyecto de CubeMX: pines de la placa
+ *      Author: miguelvp
+ */
+
+#ifndef MAIN_H_
+#define MAIN_H_
+
+#include "stm32l4xx_hal.h"
+
+#define STN_RST_Pin				0x0001
+#define STN_RST_GPIO_Port		NULL
+#define USER_LED_1_Pin			0x0002
+#define USER_LED_1_GPIO_Port	NULL
+#define USER_LED_2_Pin			0x0004
+#define USER_LED_2_GPIO_Port	NULL
+
+#endif /* MAIN_H_ */
@@ -0,0 +1,17 @@
+/*
+ * printf.h
+ *
+ *  Sustituto de la librería printf del dispositivo: en el PC se usa la de C
+ *      Author: miguelvp
+ */
+
+#ifndef PRINTF_H_
+#define PRINTF_H_
+
+#include <stdio.h>
+
+#define printf_		printf
+#define sprintf_	sprintf
+#define snprintf_	snprintf
+
+#endif /* PRINTF_H_ */
@@ -0,0 +1,103 @@
+/*
+ * stm32l4xx_hal.h
+ *
+ *  Sustituto de la HAL de STM32L4 para compilar en el PC el código del dispositivo. Los
+ *  periféricos no hacen nada: las funciones de host.c devuelven HAL_OK
+ *      Author: miguelvp
+ */
+
+#ifndef STM32L4XX_HAL_H_
+#define STM32L4XX_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct {
+	volatile uint32_t CNDTR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+	DMA_Channel_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+typedef struct {
+	volatile uint32_t CR1, CR2, CR3, BRR;
+} USART_TypeDef;
+
+typedef struct {
+	uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef enum {
+	HAL_UART_STATE_RESET = 0x00,
+	HAL_UART_STATE_READY = 0x20,
+	HAL_UART_STATE_BUSY_TX = 0x21,
+	HAL_UART_STATE_BUSY_RX = 0x22
+} HAL_UART_StateTypeDef;
+
+typedef struct {
+	USART_TypeDef *Instance;
+	UART_InitTypeDef Init;
+	DMA_HandleTypeDef *hdmatx;
+	DMA_HandleTypeDef *hdmarx;
+	HAL_UART_StateTypeDef gState;
+} UART_HandleTypeDef;
+
+typedef struct {
+	uint32_t dummy;
+} LPTIM_HandleTypeDef;
+
+// Flash: en el PC la página se programa en memoria (host.c), con la dirección de 32 bits del
+// dispositivo, por lo que los programas que la usan se enlazan sin PIE
+#define FLASH_BASE					0x00000000UL
+#define FLASH_BANK_SIZE				0x80000000UL
+#define FLASH_PAGE_SIZE				0x800
+#define FLASH_BANK_1				1
+#define FLASH_TYPEERASE_PAGES		0
+#define FLASH_TYPEPROGRAM_DOUBLEWORD	0
+#define FLASH_FLAG_ALL_ERRORS		0xFFFF
+#define __HAL_FLASH_CLEAR_FLAG(f)	((void) (f))
+
+typedef struct {
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Page;
+	uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+// Número de las siguientes programaciones de la flash que fallan, para las pruebas
+extern uint32_t hostFlashFaults;
+
+#define __HAL_UART_ENABLE(h)		((h)->Instance->CR1 |= 1u)
+#define __HAL_UART_DISABLE(h)		((h)->Instance->CR1 &= ~1u)
+
+void HAL_GPIO_WritePin(void *port, uint16_t pin, GPIO_PinState state);
+void HAL_GPIO_TogglePin(void *port, uint16_t pin);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart);
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t address, uint64_t data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *erase, uint32_t *pageError);
+
+HAL_StatusTypeDef HAL_LPTIM_OnePulse_Start_IT(LPTIM_HandleTypeDef *hlptim, uint32_t period, uint32_t pulse);
+HAL_StatusTypeDef HAL_LPTIM_OnePulse_Stop_IT(LPTIM_HandleTypeDef *hlptim);
+
+#endif /* STM32L4XX_HAL_H_ */
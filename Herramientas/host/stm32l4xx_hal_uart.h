@@ -0,0 +1,13 @@
+/*
+ * stm32l4xx_hal_uart.h
+ *
+ *  Sustituto de la HAL de las UART (todo está en stm32l4xx_hal.h)
+ *      Author: miguelvp
+ */
+
+#ifndef STM32L4XX_HAL_UART_H_
+#define STM32L4XX_HAL_UART_H_
+
+#include "stm32l4xx_hal.h"
+
+#endif /* STM32L4XX_HAL_UART_H_ */
@@ -0,0 +1,13 @@
+/*
+ * task.h
+ *
+ *  Sustituto de task.h de FreeRTOS para compilar en el PC el código del dispositivo
+ *      Author: miguelvp
+ */
+
+#ifndef TASK_H_
+#define TASK_H_
+
+#include "FreeRTOS.h"
+
+#endif /* TASK_H_ */
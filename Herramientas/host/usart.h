@@ -0,0 +1,13 @@
+/*
+ * usart.h
+ *
+ *  Sustituto de usart.h del proyecto de CubeMX
+ *      Author: miguelvp
+ */
+
+#ifndef USART_H_
+#define USART_H_
+
+#include "stm32l4xx_hal.h"
+
+#endif /* USART_H_ */
@@ -0,0 +1,26 @@
+/*
+ * usbd_cdc_if.h
+ *
+ *  Sustituto de la interfaz CDC del USB: lo enviado se descarta (host.c)
+ *      Author: miguelvp
+ */
+
+#ifndef USBD_CDC_IF_H_
+#define USBD_CDC_IF_H_
+
+#include "stm32l4xx_hal.h"
+
+#define USBD_OK		0
+#define USBD_BUSY	1
+
+typedef struct {
+	void *pClassData;
+} USBD_HandleTypeDef;
+
+typedef struct {
+	volatile uint32_t TxState;
+} USBD_CDC_HandleTypeDef;
+
+uint8_t CDC_Transmit_FS(uint8_t *buf, uint16_t len);
+
+#endif /* USBD_CDC_IF_H_ */
@@ -0,0 +1,96 @@
+/*
+ * test_commands.c
+ *
+ *  Prueba de las órdenes de configuración recibidas por USB y procesadas por read() de
+ *  micro_fsm.c: longitud de las ventanas de muestras ("win")
+ *      Author: miguelvp
+ */
+
+// Se incluye la fuente para llegar a read()
+#include "micro_fsm.c"
+#include "check.h"
+#include <stdio.h>
+
+static uint16_t sendCommand(fsm_t *fsm, const char *text, uint8_t *out, uint16_t max);
+static uint8_t sameSizes(car *coche, uint16_t speed, uint16_t rpm, uint16_t air);
+
+int main(void)
+{
+	static car coche;
+	static uint8_t out[4*TX_BLOCK_SIZE];
+	pilePointers_t communication = {0};
+	fsm_t fsm = {0};
+	uint16_t flags = 0, len, i;
+
+	REQUIRE(shareData_init(&flags), "shareData_init");
+	communication.flags = &flags;
+	coche.communication = &communication;
+	fsm.data = &coche;
+	CHECK(window_init(&(coche.speed), SPEED_WINDOW) && window_init(&(coche.rpm), RPM_WINDOW)
+			&& window_init(&(coche.air), AIR_WINDOW), "ventanas iniciales");
+
+	// Nuevas longitudes: se descartan las muestras anteriores y la suma sólo recoge las de la nueva ventana
+	window_put(&(coche.speed), 200);
+	len = sendCommand(&fsm, "win 4 2 3\r", out, sizeof(out));
+	CHECK(len == 0, "respuesta a una orden válida: %.*s", len, out);
+	CHECK(sameSizes(&coche, 4, 2, 3), "longitudes %u %u %u", coche.speed.size, coche.rpm.size, coche.air.size);
+	CHECK(window_count(&(coche.speed)) == 0, "%u muestras tras el cambio", window_count(&(coche.speed)));
+	for (i = 1; i <= 6; i++) {
+		window_put(&(coche.speed), 10*i);
+	}
+	CHECK(coche.speed.sum == 30 + 40 + 50 + 60 && window_count(&(coche.speed)) == 4,
+			"suma %ld de %u muestras", (long) coche.speed.sum, window_count(&(coche.speed)));
+
+	// Longitudes no válidas: se rechaza la orden y no se cambia nada
+	len = sendCommand(&fsm, "win 0 2 3\r", out, sizeof(out));
+	CHECK(len && !memcmp(out, "Ventana no valida\r", len), "respuesta a una longitud nula: %.*s", len, out);
+	len = sendCommand(&fsm, "win 5 2\r", out, sizeof(out));
+	CHECK(len && !memcmp(out, "Ventana no valida\r", len), "respuesta a una orden incompleta: %.*s", len, out);
+	len = sendCommand(&fsm, "win 5 70000 1\r", out, sizeof(out));
+	CHECK(len && !memcmp(out, "Ventana no valida\r", len), "respuesta a una longitud de 17 bits: %.*s", len, out);
+	CHECK(sameSizes(&coche, 4, 2, 3), "longitudes %u %u %u tras las órdenes rechazadas",
+			coche.speed.size, coche.rpm.size, coche.air.size);
+	CHECK(window_count(&(coche.speed)) == 4, "muestras descartadas por una orden rechazada");
+
+	printf("%s: órdenes de configuración\n", failures ? "FALLO" : "OK");
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Entrega una orden por el buffer de recepción, la procesa con read() y recoge la
+ * 			respuesta de la pila de USB
+ * @param	fsm: máquina de estados del micro
+ * 			text: orden terminada en '\r'
+ * 			out: respuesta
+ * 			max: tamaño de out
+ * @retval	Longitud de la respuesta
+ */
+static uint16_t sendCommand(fsm_t *fsm, const char *text, uint8_t *out, uint16_t max)
+{
+	txBlock_t *block;
+	uint16_t len = 0;
+
+	CHECK(putRX((uint8_t*) text, strlen(text)), "orden %s no recibida", text);
+	read(fsm);
+	while (getTX(&block)) {
+		if (len + block->len <= max)
+			memcpy(&out[len], block->data, block->len);
+		len += block->len;
+		freeTX(block);
+	}
+	return len;
+}
+
+/*
+ * @brief	Comprueba la longitud de las ventanas de muestras
+ * @param	coche: datos del vehículo
+ * 			speed: longitud esperada de la ventana de velocidad
+ * 			rpm: longitud esperada de la ventana de rpm
+ * 			air: longitud esperada de la ventana de temperatura del aire
+ * @retval	1 -> Coinciden todas
+ * 			0 -> Alguna es distinta
+ */
+static uint8_t sameSizes(car *coche, uint16_t speed, uint16_t rpm, uint16_t air)
+{
+	return coche->speed.size == speed && coche->rpm.size == rpm && coche->air.size == air;
+}
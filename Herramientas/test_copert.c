@@ -0,0 +1,283 @@
+/*
+ * test_copert.c
+ *
+ *  Prueba de la tabla de factores de emisión de copert.c contra la fórmula de COPERT en
+ *  doble precisión. Se compila dos veces, en coma flotante (test_copert) y en coma fija
+ *  (test_copert_fixed, COPERT_FIXED_POINT=1), y mide además el coste por muestra
+ *      Author: miguelvp
+ */
+
+#include "copert.h"
+#include "check.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES()	__rdtsc()
+#else
+#define CYCLES()	0
+#endif
+
+// Como en copert.c
+#define HOUR_TO_MS		(60*60*1000)
+#define MIN_SPEED		5
+#define MAX_SPEED		130
+
+// Barrido de 0 a 255 km/h y vuelta, con una muestra por segundo
+#define TRACE_SAMPLES	200000
+#define TRACE_WINDOW	10
+#define TRACE_PERIOD	1000
+
+// Error relativo máximo de las emisiones de la traza completa respecto a la referencia en
+// doble precisión. En coma flotante domina el redondeo de los acumuladores de 24 bits de
+// mantisa a lo largo de la traza; en coma fija, el de calculateEF en float, que sigue
+// evaluando la fórmula al construir la tabla
+#if COPERT_FIXED_POINT
+#define TRACE_TOLERANCE		1e-4
+#else
+#define TRACE_TOLERANCE		1e-3
+#endif
+
+// Repeticiones de la traza en la medida de tiempo
+#define BENCH_REPEAT	20
+
+static float formulaEF(const copertEntry *entry, uint8_t speed);
+static double referenceEF(const copertEntry *entry, uint8_t speed);
+static void checkClass(fuelType fuel, uint8_t euro, engineSegment segment, const uint8_t *trace);
+static void checkMissing(fuelType fuel, uint8_t euro, engineSegment segment);
+static void checkOverspeed(fuelType fuel, uint8_t euro, engineSegment segment);
+static void benchmark(const uint8_t *trace);
+
+int main(void)
+{
+	static const uint8_t classes[][3] = {
+			{GAS, EURO_3, SEGMENT_MEDIUM}, {DSL, EURO_6_2016, SEGMENT_SMALL}
+	};
+	// Sin curva de COPERT: otra normativa, otro segmento u otro combustible de la misma familia
+	static const uint8_t missing[][3] = {
+			{GAS, EURO_1, SEGMENT_MEDIUM}, {DSL, EURO_4, SEGMENT_SMALL}, {GAS, EURO_3, SEGMENT_SMALL},
+			{LPG, EURO_3, SEGMENT_MEDIUM}, {HYB_DSL, EURO_6_2016, SEGMENT_SMALL}, {ELEC, EURO_6D, SEGMENT_SMALL}
+	};
+	static uint8_t trace[TRACE_SAMPLES];
+	uint32_t i, c;
+
+	for (i = 0; i < TRACE_SAMPLES; i++) {
+		trace[i] = (i / 256) % 2 ? 255 - i % 256 : i % 256;
+	}
+
+	for (c = 0; c < sizeof(classes)/sizeof(classes[0]); c++) {
+		checkClass(classes[c][0], classes[c][1], classes[c][2], trace);
+	}
+	for (i = 0; i < sizeof(missing)/sizeof(missing[0]); i++) {
+		checkMissing(missing[i][0], missing[i][1], missing[i][2]);
+	}
+	checkOverspeed(GAS, EURO_3, SEGMENT_MEDIUM);
+	benchmark(trace);
+
+	printf("%s: %s, %u clases\n", failures ? "FALLO" : "OK",
+			COPERT_FIXED_POINT ? "coma fija" : "coma flotante", c);
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Fórmula de COPERT con las mismas operaciones en float que calculateEF de copert.c
+ * @param	entry: coeficientes del registro
+ * 			speed: velocidad media del vehículo
+ * @retval	Factor de emisión (g/km)
+ */
+static float formulaEF(const copertEntry *entry, uint8_t speed)
+{
+	float ef;
+	if (speed < MIN_SPEED)
+		return 0;
+	if (speed > MAX_SPEED)
+		speed = MAX_SPEED;
+	ef = (entry->a*speed*speed+entry->b*speed+entry->c+entry->d/speed)/(entry->e*speed*speed+entry->f*speed+1)*entry->reductionFactor;
+	return (ef > 0)? ef : 0;
+}
+
+/*
+ * @brief	Fórmula de COPERT en doble precisión, con los mismos límites que calculateEF
+ * @param	entry: coeficientes del registro
+ * 			speed: velocidad media del vehículo
+ * @retval	Factor de emisión (g/km)
+ */
+static double referenceEF(const copertEntry *entry, uint8_t speed)
+{
+	double v = (speed > MAX_SPEED)? MAX_SPEED : speed, ef;
+
+	if (speed < MIN_SPEED)
+		return 0;
+	ef = (entry->a*v*v + entry->b*v + entry->c + entry->d/v)/(entry->e*v*v + entry->f*v + 1)*entry->reductionFactor;
+	return (ef > 0)? ef : 0;
+}
+
+/*
+ * @brief	Comprueba la tabla de una clase contra la fórmula en float (idéntica en coma
+ * 			flotante, a menos de un paso de la escala en coma fija) y las emisiones de la
+ * 			traza de barrido contra la referencia en doble precisión
+ * @param	fuel: combustible del vehículo
+ * 			euro: normativa a la que está adherida el motor
+ * 			segment: segmento de cilindrada del motor
+ * 			trace: traza de barrido (TRACE_SAMPLES muestras)
+ * @retval	Nada
+ */
+static void checkClass(fuelType fuel, uint8_t euro, engineSegment segment, const uint8_t *trace)
+{
+	static car vehicle;
+	const copertEntry *entry;
+	double ref[NUM_EMISSIONS], err, table, av_speed;
+	int32_t sum = 0;
+	uint32_t i;
+	uint16_t speed, count = 0;
+	uint8_t k;
+
+	initParams(&vehicle);
+	if (!setParamsTable(&vehicle, fuel, euro, segment)) {
+		printf("FALLO: clase %u/%02x/%u no encontrada en el registro\n", fuel, euro, segment);
+		failures++;
+		return;
+	}
+
+	for (k = 0; k < NUM_EMISSIONS; k++) {
+		entry = copertLookup(fuel, euro, segment, k);
+		for (speed = 0; speed < EF_TABLE_SIZE; speed++) {
+			if (vehicle.params.ef[speed][k] < 0) {
+				printf("FALLO: clase %u/%02x/%u, sustancia %u, %u km/h: factor negativo en la tabla\n",
+						fuel, euro, segment, k, speed);
+				failures++;
+				break;
+			}
+#if COPERT_FIXED_POINT
+			// Redondeo a la escala de la sustancia: como mucho un paso (1/scale)
+			table = (double) vehicle.params.ef[speed][k] / vehicle.params.scale[k];
+			err = fabs(table - formulaEF(entry, speed)) * vehicle.params.scale[k];
+			if (err > 1) {
+#else
+			table = vehicle.params.ef[speed][k];
+			err = fabs(table - formulaEF(entry, speed));
+			if (err != 0) {
+#endif
+				printf("FALLO: clase %u/%02x/%u, sustancia %u, %u km/h: tabla %.9g, fórmula %.9g\n",
+						fuel, euro, segment, k, speed, table, (double) formulaEF(entry, speed));
+				failures++;
+				break;
+			}
+		}
+	}
+
+	// Misma ventana que calcEmissionsTrace, con la media y la distancia en doble precisión
+	memset(ref, 0, sizeof(ref));
+	for (i = 0; i < TRACE_SAMPLES; i++) {
+		sum += trace[i];
+		if (count < TRACE_WINDOW)
+			count++;
+		else
+			sum -= trace[i - TRACE_WINDOW];
+		av_speed = (double) sum / count;
+		for (k = 0; k < NUM_EMISSIONS; k++) {
+			ref[k] += referenceEF(copertLookup(fuel, euro, segment, k), (uint8_t) av_speed)*av_speed*TRACE_PERIOD/HOUR_TO_MS;
+		}
+	}
+
+	calcEmissionsTrace(&vehicle.params, trace, TRACE_SAMPLES, TRACE_WINDOW, TRACE_PERIOD, vehicle.emission);
+	for (k = 0; k < NUM_EMISSIONS; k++) {
+		err = (ref[k] != 0) ? fabs(emissionValue(&vehicle, k) - ref[k]) / fabs(ref[k]) : fabs(emissionValue(&vehicle, k));
+		printf("clase %u/%02x/%u, sustancia %u: %.9g g, error relativo %.2g\n",
+				fuel, euro, segment, k, ref[k], err);
+		CHECK(err <= TRACE_TOLERANCE, "error relativo mayor que %g", TRACE_TOLERANCE);
+	}
+}
+
+/*
+ * @brief	Comprueba que una clase sin curva de COPERT no se encuentra y no modifica los
+ * 			parámetros ya establecidos
+ * @param	fuel: combustible del vehículo
+ * 			euro: normativa a la que está adherida el motor
+ * 			segment: segmento de cilindrada del motor
+ * @retval	Nada
+ */
+static void checkMissing(fuelType fuel, uint8_t euro, engineSegment segment)
+{
+	static car vehicle;
+	emissionParams before;
+	uint8_t k;
+
+	initParams(&vehicle);
+	setParamsTable(&vehicle, GAS, EURO_3, SEGMENT_MEDIUM);
+	before = vehicle.params;
+	for (k = 0; k < NUM_EMISSIONS; k++) {
+		CHECK(copertLookup(fuel, euro, segment, k) == NULL, "clase %u/%02x/%u, sustancia %u: encontrada sin curva de COPERT",
+				fuel, euro, segment, k);
+	}
+	CHECK(!setParamsTable(&vehicle, fuel, euro, segment) && !memcmp(&before, &vehicle.params, sizeof(before)),
+			"clase %u/%02x/%u establecida sin curva de COPERT", fuel, euro, segment);
+}
+
+/*
+ * @brief	Comprueba que una velocidad media por encima de la tabla usa el factor de la última
+ * 			fila (sin salirse de la tabla) y la distancia realmente recorrida
+ * @param	fuel: combustible del vehículo
+ * 			euro: normativa a la que está adherida el motor
+ * 			segment: segmento de cilindrada del motor
+ * @retval	Nada
+ */
+static void checkOverspeed(fuelType fuel, uint8_t euro, engineSegment segment)
+{
+	static car vehicle;
+	float top[NUM_EMISSIONS], err;
+	uint16_t speed = 655;
+	uint8_t k;
+
+	initParams(&vehicle);
+	setParamsTable(&vehicle, fuel, euro, segment);
+	vehicle.speed.count = TRACE_WINDOW;
+
+	vehicle.speed.sum = (EF_TABLE_SIZE-1) * TRACE_WINDOW;
+	resetEmissions(&vehicle);
+	calcEmissions(&vehicle, TRACE_PERIOD);
+	for (k = 0; k < NUM_EMISSIONS; k++) {
+		top[k] = emissionValue(&vehicle, k);
+	}
+
+	vehicle.speed.sum = speed * TRACE_WINDOW;
+	resetEmissions(&vehicle);
+	calcEmissions(&vehicle, TRACE_PERIOD);
+	for (k = 0; k < NUM_EMISSIONS; k++) {
+		err = fabs(emissionValue(&vehicle, k) - top[k] * speed / (EF_TABLE_SIZE-1));
+		CHECK(err <= 1e-3 * fabs(top[k]), "clase %u/%02x/%u, sustancia %u, %u km/h: %.9g g, se esperaban %.9g g",
+				fuel, euro, segment, k, speed, emissionValue(&vehicle, k), top[k] * speed / (EF_TABLE_SIZE-1));
+	}
+}
+
+/*
+ * @brief	Mide el coste por muestra de calcEmissionsTrace (ventana, tabla y acumulación)
+ * @param	trace: traza de barrido (TRACE_SAMPLES muestras)
+ * @retval	Nada
+ */
+static void benchmark(const uint8_t *trace)
+{
+	static car vehicle;
+	struct timespec start, end;
+	uint64_t cycles;
+	double ns;
+	uint8_t r;
+
+	initParams(&vehicle);
+	setParamsTable(&vehicle, DSL, EURO_6_2016, SEGMENT_SMALL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cycles = CYCLES();
+	for (r = 0; r < BENCH_REPEAT; r++) {
+		calcEmissionsTrace(&vehicle.params, trace, TRACE_SAMPLES, TRACE_WINDOW, TRACE_PERIOD, vehicle.emission);
+	}
+	cycles = CYCLES() - cycles;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = ((end.tv_sec - start.tv_sec)*1e9 + (end.tv_nsec - start.tv_nsec)) / ((double) BENCH_REPEAT*TRACE_SAMPLES);
+	printf("calcEmissionsTrace (%s): %.2f ns/muestra, %.1f ciclos/muestra\n",
+			COPERT_FIXED_POINT ? "coma fija" : "coma flotante", ns,
+			(double) cycles / ((double) BENCH_REPEAT*TRACE_SAMPLES));
+}
@@ -0,0 +1,166 @@
+/*
+ * test_fleet.c
+ *
+ *  Prueba del reprocesado de la flota: cada implementación de fleet_trace y fleet_run debe
+ *  dar el mismo resultado, bit a bit, que calcEmissionsTrace de copert.c
+ *      Author: miguelvp
+ */
+
+#include "fleet.h"
+#include "check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SAMPLES		5000
+
+static void fillTrace(uint8_t *speed, uint32_t samples, uint8_t shape);
+static void checkTrace(const emissionParams *param, const uint8_t *speed, uint32_t samples, uint16_t window, float time);
+static void checkRun(void);
+
+int main(void)
+{
+	static const uint32_t samples[] = {0, 1, 7, 1023, 1024, 1025, MAX_SAMPLES};
+	static const uint16_t windows[] = {1, 2, 10, 60, 300};
+	static const float periods[] = {100, 1000, 2000.5f};
+	static uint8_t speed[MAX_SAMPLES];
+	efRow table[EF_TABLE_SIZE];
+	emissionParams param;
+	uint8_t shape, s, w, p;
+	uint32_t cases = 0;
+
+	param.ef = table;
+	if (!copertParams(&param, DSL, EURO_6_2016, SEGMENT_SMALL)) {
+		printf("FALLO: clase de prueba no encontrada en el registro\n");
+		return 1;
+	}
+
+	for (shape = 0; shape < 4; shape++) {
+		fillTrace(speed, MAX_SAMPLES, shape);
+		for (s = 0; s < sizeof(samples)/sizeof(samples[0]); s++) {
+			for (w = 0; w < sizeof(windows)/sizeof(windows[0]); w++) {
+				for (p = 0; p < sizeof(periods)/sizeof(periods[0]); p++) {
+					checkTrace(&param, speed, samples[s], windows[w], periods[p]);
+					cases++;
+				}
+			}
+		}
+	}
+	checkRun();
+
+	printf("%s: %u trazas, implementación más rápida %s\n", failures ? "FALLO" : "OK", cases,
+			fleet_kernelName(fleet_kernel(FLEET_AUTO)));
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Genera una traza de prueba
+ * @param	speed: velocidades
+ * 			samples: número de muestras
+ * 			shape: 0 -> aleatoria, 1 -> alrededor de la velocidad mínima, 2 -> velocidad
+ * 			máxima constante, 3 -> recorrido con aceleraciones y paradas
+ * @retval	Nada
+ */
+static void fillTrace(uint8_t *speed, uint32_t samples, uint8_t shape)
+{
+	uint32_t i;
+	int32_t v = 0;
+
+	srand(shape);
+	for (i = 0; i < samples; i++) {
+		switch (shape) {
+		case 0:
+			speed[i] = rand() % 256;
+			break;
+		case 1:
+			speed[i] = 3 + rand() % 4;
+			break;
+		case 2:
+			speed[i] = 255;
+			break;
+		default:
+			v += rand() % 9 - 4;
+			if (rand() % 500 == 0)
+				v = 0;
+			v = (v < 0) ? 0 : (v > 180) ? 180 : v;
+			speed[i] = v;
+			break;
+		}
+	}
+}
+
+/*
+ * @brief	Compara cada implementación disponible con calcEmissionsTrace para una traza
+ * @param	param: parámetros de las sustancias contaminantes
+ * 			speed: velocidades de la traza
+ * 			samples: número de muestras
+ * 			window: longitud de la ventana de promediado
+ * 			time: periodo de muestreo (ms)
+ * @retval	Nada
+ */
+static void checkTrace(const emissionParams *param, const uint8_t *speed, uint32_t samples, uint16_t window, float time)
+{
+	emissionAcc ref[NUM_EMISSIONS], emission[NUM_EMISSIONS];
+	fleetKernel kernel;
+
+	memset(ref, 0, sizeof(ref));
+	calcEmissionsTrace(param, speed, samples, window, time, ref);
+
+	for (kernel = FLEET_SCALAR; kernel < NUM_FLEET_KERNELS; kernel++) {
+		if (fleet_kernel(kernel) != kernel)
+			continue;
+		memset(emission, 0, sizeof(emission));
+		fleet_trace(param, speed, samples, window, time, emission, kernel);
+		CHECK(!memcmp(ref, emission, sizeof(ref)), "%s, %u muestras, ventana %u, periodo %g: %.9g %.9g %.9g != %.9g %.9g %.9g",
+				fleet_kernelName(kernel), samples, window, time,
+				(double) emission[0], (double) emission[1], (double) emission[2],
+				(double) ref[0], (double) ref[1], (double) ref[2]);
+	}
+}
+
+/*
+ * @brief	Calcula una flota con varios hilos y clases mezcladas (incluidas dos que no están en
+ * 			el registro) y compara cada vehículo con calcEmissionsTrace
+ * @param	Nada
+ * @retval	Nada
+ */
+static void checkRun(void)
+{
+	static const uint8_t classes[][3] = {
+			{GAS, EURO_3, SEGMENT_MEDIUM}, {DSL, EURO_6_2016, SEGMENT_SMALL},
+			{CNG, EURO_5, SEGMENT_ANY}, {ELEC, EURO_6D, SEGMENT_SMALL}
+	};
+	static uint8_t speed[MAX_SAMPLES];
+	fleetVehicle fleet[40];
+	efRow table[EF_TABLE_SIZE];
+	emissionParams param;
+	emissionAcc ref[NUM_EMISSIONS];
+	uint32_t i, valid;
+
+	fillTrace(speed, MAX_SAMPLES, 3);
+	memset(fleet, 0, sizeof(fleet));
+	for (i = 0; i < 40; i++) {
+		fleet[i].id = i;
+		fleet[i].fuel = classes[i % 4][0];
+		fleet[i].euro = classes[i % 4][1];
+		fleet[i].segment = classes[i % 4][2];
+		fleet[i].window = 1 + i % 12;
+		fleet[i].period = 500 + 100*i;
+		fleet[i].speed = &speed[i*37];
+		fleet[i].samples = MAX_SAMPLES - i*37 - i*50;
+	}
+
+	valid = fleet_run(fleet, 40, 4, FLEET_AUTO);
+	CHECK(valid == 20, "fleet_run ha calculado %u vehículos de 20", valid);
+
+	param.ef = table;
+	for (i = 0; i < 40; i++) {
+		if (!copertParams(&param, fleet[i].fuel, fleet[i].euro, fleet[i].segment)) {
+			CHECK(!fleet[i].valid, "vehículo %u calculado sin clase en el registro", i);
+			continue;
+		}
+		memset(ref, 0, sizeof(ref));
+		calcEmissionsTrace(&param, fleet[i].speed, fleet[i].samples, fleet[i].window, fleet[i].period, ref);
+		CHECK(fleet[i].valid && !memcmp(ref, fleet[i].emission, sizeof(ref)), "vehículo %u distinto de calcEmissionsTrace", i);
+	}
+}
@@ -0,0 +1,120 @@
+/*
+ * test_pidcache.c
+ *
+ *  Prueba de la caché en flash de los PIDs soportados de pidcache.c sobre la flash emulada de
+ *  host.c: entradas escritas a medias por un corte, fallos de programación y página llena
+ *      Author: miguelvp
+ */
+
+// Se incluye la fuente para llegar a la página de la caché
+#include "pidcache.c"
+#include "check.h"
+#include <stdio.h>
+
+static void makeVin(uint8_t *vin, uint16_t n);
+static void makePids(uint32_t *service1, uint16_t n);
+static void expect(const char *what, uint16_t n, uint8_t present);
+
+int main(void)
+{
+	uint32_t service1[PID_RANGES];
+	uint8_t vin[VIN_LENGTH];
+	uint64_t word = 0x0123456789ABCDEF;
+	uint32_t addr;
+	uint16_t n;
+	uint8_t i;
+
+	// Guardado y búsqueda
+	makeVin(vin, 1);
+	makePids(service1, 1);
+	CHECK(pidcache_store(vin, service1, 1), "guardado de la entrada 1");
+	expect("tras guardar", 1, 1);
+	expect("tras guardar", 2, 0);
+
+	// Corte durante la escritura de la siguiente entrada: todo escrito menos la marca
+	addr = (uint32_t) (uintptr_t) CACHE_ENTRY(1);
+	for (i = 1; i < sizeof(pidCacheEntry_t) / sizeof(uint64_t); i++) {
+		HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr + i*sizeof(uint64_t), word);
+	}
+	makeVin(vin, 2);
+	makePids(service1, 2);
+	CHECK(pidcache_store(vin, service1, 2), "guardado tras una entrada escrita a medias");
+	expect("tras la entrada a medias", 1, 1);
+	expect("tras la entrada a medias", 2, 1);
+
+	// Fallo al programar: se borra la página y se reintenta una vez
+	hostFlashFaults = 1;
+	makeVin(vin, 3);
+	makePids(service1, 3);
+	CHECK(pidcache_store(vin, service1, 3), "guardado con un fallo de programación");
+	expect("tras el reintento", 3, 1);
+	expect("tras el borrado de la página", 1, 0);
+
+	// Si también falla el reintento, no se guarda, pero la caché sigue siendo utilizable
+	hostFlashFaults = 2;
+	makeVin(vin, 4);
+	makePids(service1, 4);
+	CHECK(!pidcache_store(vin, service1, 4), "guardado con dos fallos de programación");
+	expect("tras dos fallos", 4, 0);
+	CHECK(pidcache_store(vin, service1, 4), "guardado tras dos fallos");
+	expect("tras dos fallos", 4, 1);
+
+	// Página llena: se borra y se empieza de nuevo
+	for (n = 100; n < 100 + PID_CACHE_ENTRIES + 1; n++) {
+		makeVin(vin, n);
+		makePids(service1, n);
+		CHECK(pidcache_store(vin, service1, n), "guardado de la entrada %u", n);
+	}
+	expect("con la página llena", 100 + PID_CACHE_ENTRIES, 1);
+	expect("con la página llena", 100, 0);
+
+	printf("%s: %u entradas por página\n", failures ? "FALLO" : "OK", (unsigned) PID_CACHE_ENTRIES);
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	VIN de prueba
+ * @param	vin: número de bastidor (VIN_LENGTH caracteres)
+ * 			n: número del vehículo
+ * @retval	Nada
+ */
+static void makeVin(uint8_t *vin, uint16_t n)
+{
+	char text[VIN_LENGTH + 1];
+	snprintf(text, sizeof(text), "WVWZZZ1JZXW%06u", n);
+	memcpy(vin, text, VIN_LENGTH);
+}
+
+/*
+ * @brief	PIDs soportados de prueba
+ * @param	service1: bitmaps del servicio 01
+ * 			n: número del vehículo
+ * @retval	Nada
+ */
+static void makePids(uint32_t *service1, uint16_t n)
+{
+	uint8_t j;
+	for (j = 0; j < PID_RANGES; j++) {
+		service1[j] = 0xBE1FA813 ^ (n * 0x9E3779B9) ^ j;
+	}
+}
+
+/*
+ * @brief	Comprueba si un vehículo está en la caché y, si está, que sus PIDs son los suyos
+ * @param	what: descripción del paso de la prueba
+ * 			n: número del vehículo
+ * 			present: 1 si debe estar
+ * @retval	Nada
+ */
+static void expect(const char *what, uint16_t n, uint8_t present)
+{
+	uint32_t service1[PID_RANGES], ref[PID_RANGES], service9 = 0;
+	uint8_t vin[VIN_LENGTH], found;
+
+	makeVin(vin, n);
+	makePids(ref, n);
+	found = pidcache_load(vin, service1, &service9);
+	CHECK(found == present, "%s: vehículo %u %s", what, n, present ? "no encontrado" : "encontrado");
+	if (found && present)
+		CHECK(!memcmp(service1, ref, sizeof(ref)) && service9 == n, "%s: PIDs del vehículo %u distintos", what, n);
+}
@@ -0,0 +1,78 @@
+/*
+ * test_scheduler.c
+ *
+ *  Prueba del descubrimiento de los PIDs soportados de scheduler.c: cada fase debe avanzar
+ *  tanto si el vehículo responde como si contesta NO DATA o no contesta, y el resultado se
+ *  guarda en la caché de pidcache.c (sobre la flash emulada de host.c). Todos los PIDs
+ *  planificados deben tener un campo de destino en los datos del vehículo
+ *      Author: miguelvp
+ */
+
+#include "scheduler.h"
+#include "pidcache.h"
+#include "pids.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(void)
+{
+	static const uint8_t vin[VIN_LENGTH + 1] = "WVWZZZ1JZXW000001";
+	static const pidDecoder_t decoders[PID_DECODERS_SIZE] = PID_DECODERS;
+	const pidSchedule_t *sched;
+	uint32_t service1[PID_RANGES], service9;
+	uint8_t pids[4], num, i;
+
+	// Cada PID planificado se guarda en algún campo: si no, se gastaría bus en descartarlo
+	sched = scheduler_table(&num);
+	for (i = 0; i < num; i++) {
+		CHECK(sched[i].pid < PID_DECODERS_SIZE && decoders[sched[i].pid].field != FIELD_NONE,
+				"PID %02X planificado sin campo de destino", sched[i].pid);
+	}
+
+	// NO DATA en todas las fases: se termina sin PIDs conocidos (se suponen todos) y sin
+	// guardar nada en la caché
+	scheduler_init(0);
+	CHECK(scheduler_discovery() == STN_GET_VIN, "primera fase %u", scheduler_discovery());
+	scheduler_unanswered(STN_GET_VIN);
+	CHECK(scheduler_discovery() == STN_PIDS_1_1, "tras el VIN sin respuesta: %u", scheduler_discovery());
+	scheduler_unanswered(STN_PIDS_1_1);
+	CHECK(scheduler_discovery() == STN_PIDS_9, "tras 0100 sin respuesta: %u", scheduler_discovery());
+	scheduler_unanswered(STN_PIDS_9);
+	CHECK(scheduler_discovery() == NO_CMD, "tras 0900 sin respuesta: %u", scheduler_discovery());
+	CHECK(scheduler_isSupported(ENGINE_RPM), "sin PIDs conocidos deben suponerse todos");
+	CHECK(scheduler_next(0, pids, sizeof(pids)) > 0, "sin PIDs planificados tras el descubrimiento");
+
+	// Respuestas: 0100 indica que hay más rangos y 0120 contesta NO DATA. Un prompt de una
+	// petición que ya no es la de la fase en curso no la hace avanzar
+	scheduler_init(0);
+	scheduler_vin(vin);
+	CHECK(scheduler_discovery() == STN_PIDS_1_1, "tras el VIN: %u", scheduler_discovery());
+	scheduler_supported(STN_PIDS_1_1, 0x18180001);
+	scheduler_unanswered(STN_PIDS_1_1);
+	CHECK(scheduler_discovery() == STN_PIDS_1_2, "tras 0100: %u", scheduler_discovery());
+	scheduler_unanswered(STN_PIDS_1_2);
+	CHECK(scheduler_discovery() == STN_PIDS_9, "tras 0120 sin respuesta: %u", scheduler_discovery());
+	scheduler_supported(STN_PIDS_9, 0x54000000);
+	CHECK(scheduler_discovery() == NO_CMD, "tras 0900: %u", scheduler_discovery());
+	CHECK(scheduler_isSupported(ENGINE_RPM) && scheduler_isSupported(VEHICLE_SPEED), "rpm y velocidad soportadas");
+	CHECK(!scheduler_isSupported(AMBIENT_AIR_TEMP), "temperatura del aire no soportada");
+
+	CHECK(pidcache_load(vin, service1, &service9), "vehículo no guardado en la caché");
+	CHECK(service1[0] == 0x18180001 && service1[1] == 0 && service9 == 0x54000000, "PIDs guardados distintos");
+
+	// El mismo vehículo se recupera de la caché sin volver a preguntar
+	scheduler_init(0);
+	scheduler_vin(vin);
+	CHECK(scheduler_discovery() == NO_CMD, "vehículo de la caché: %u", scheduler_discovery());
+
+	// Sin respuesta alguna (el STN se reinicia) también se avanza
+	scheduler_init(0);
+	scheduler_timeout();
+	scheduler_timeout();
+	scheduler_timeout();
+	CHECK(scheduler_discovery() == NO_CMD, "tras tres reinicios: %u", scheduler_discovery());
+
+	printf("%s: descubrimiento de PIDs\n", failures ? "FALLO" : "OK");
+	return failures ? 1 : 0;
+}
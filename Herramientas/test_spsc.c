@@ -0,0 +1,159 @@
+/*
+ * test_spsc.c
+ *
+ *  Prueba del buffer de recepción del USB de shareData.c con un hilo productor (el callback
+ *  del USB, putRX) y un hilo consumidor (la tarea principal, lenFirstMssgRX, typeNextMssgRX y
+ *  getRX) a la vez. Los mensajes llegan en trozos de longitud variable, los índices de 16 bits
+ *  dan muchas vueltas y cada mensaje se comprueba byte a byte al leerlo
+ *      Author: miguelvp
+ */
+
+#include "shareData.h"
+#include "check.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Mensajes de la prueba: unos 3 MB por el buffer de 64 bytes
+#define STRESS_MSSGS	200000
+#define MAX_TEXT		32
+
+// Tiempo sin avanzar tras el que se da la prueba por bloqueada (ms)
+#define STALL_TIMEOUT	2000
+
+// Cabecera de un mensaje de prueba y el tipo que le corresponde
+typedef struct stressHeader {
+	const char *text;
+	uint16_t type;
+} stressHeader;
+
+// Se incluye una cabecera desconocida: typeNextMssgRX descarta el mensaje
+static const stressHeader headers[] = {
+		{"stn speed", STN_MSSG}, {"gnss rate", GNSS_MSSG}, {"nb connect", NB_MSSG},
+		{"test speed", TEST_MSSG}, {"mon on", MONITOR_MSSG}, {"euro6 2", SETUP_MSSG},
+		{"xyz", 0}
+};
+#define NUM_HEADERS		(sizeof(headers)/sizeof(headers[0]))
+
+static volatile uint8_t stop;
+
+static uint8_t buildMssg(uint32_t n, char *text);
+static void* producer(void *arg);
+static void* consumer(void *arg);
+
+int main(void)
+{
+	pthread_t prod, cons;
+	uint16_t flags = 0;
+	uint32_t received = 0;
+
+	REQUIRE(shareData_init(&flags), "shareData_init");
+
+	pthread_create(&cons, NULL, consumer, &received);
+	pthread_create(&prod, NULL, producer, NULL);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	CHECK(received == STRESS_MSSGS, "%u de %u mensajes", received, STRESS_MSSGS);
+	CHECK(!notReadRX() && !lenFirstMssgRX(), "quedan %u bytes en el buffer de recepción", notReadRX());
+
+	printf("%s: %u mensajes entre dos hilos\n", failures ? "FALLO" : "OK", received);
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Texto de un mensaje de prueba: cabecera, número de mensaje y relleno variable
+ * @param	n: número del mensaje
+ * 			text: texto del mensaje, terminado en '\r'
+ * @retval	Índice de la cabecera en headers
+ */
+static uint8_t buildMssg(uint32_t n, char *text)
+{
+	uint8_t h = n % NUM_HEADERS;
+	sprintf(text, "%s %u %.*s\r", headers[h].text, n, (int) (n % 11), "abcdefghijk");
+	return h;
+}
+
+/*
+ * @brief	Productor: entrega cada mensaje en uno a tres trozos con putRX, reintentando
+ * 			mientras no quepan
+ * @param	arg: sin uso
+ * @retval	NULL
+ */
+static void* producer(void *arg)
+{
+	char text[MAX_TEXT];
+	uint32_t n, start;
+	uint16_t len, pos, chunk;
+
+	srand(1);
+	for (n = 0; n < STRESS_MSSGS && !stop; n++) {
+		buildMssg(n, text);
+		len = strlen(text);
+		for (pos = 0; pos < len && !stop; pos += chunk) {
+			chunk = (rand() % 3 == 0 || len - pos < 2) ? len - pos : 1 + rand() % (len - pos - 1);
+			start = osKernelSysTick();
+			while (!putRX((uint8_t*) &text[pos], chunk)) {
+				if (osKernelSysTick() - start > STALL_TIMEOUT) {
+					printf("FALLO: putRX bloqueado en el mensaje %u\n", n);
+					failures++;
+					stop = 1;
+					break;
+				}
+				sched_yield();
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * @brief	Consumidor: lee los mensajes como la tarea principal y los compara con los
+ * 			esperados. Los de cabecera desconocida los descarta typeNextMssgRX
+ * @param	arg: contador de mensajes comprobados
+ * @retval	NULL
+ */
+static void* consumer(void *arg)
+{
+	uint32_t *received = (uint32_t*) arg;
+	char text[MAX_TEXT];
+	uint8_t data[MAX_TEXT + 1] = {0};
+	uint32_t start = osKernelSysTick();
+	uint16_t len, type;
+	uint8_t h;
+
+	while (*received < STRESS_MSSGS && !stop) {
+		if (!(len = lenFirstMssgRX())) {
+			if (osKernelSysTick() - start > STALL_TIMEOUT) {
+				printf("FALLO: sin mensajes tras el %u\n", *received);
+				failures++;
+				stop = 1;
+			}
+			sched_yield();
+			continue;
+		}
+		start = osKernelSysTick();
+
+		h = buildMssg(*received, text);
+		type = typeNextMssgRX();
+		if (type != headers[h].type) {
+			printf("FALLO: mensaje %u: tipo %u, esperado %u\n", *received, type, headers[h].type);
+			failures++;
+			stop = 1;
+			break;
+		}
+		if (type) {
+			if (len != strlen(text) + 1 || len > sizeof(data) || !getRX(data, len)
+					|| memcmp(data, text, len - 1) || data[len - 1] != '\0') {
+				printf("FALLO: mensaje %u: \"%.*s\", esperado \"%s\"\n", *received, len - 1, data, text);
+				failures++;
+				stop = 1;
+				break;
+			}
+		}
+		(*received)++;
+	}
+	return NULL;
+}
@@ -0,0 +1,134 @@
+/*
+ * test_telemetry.c
+ *
+ *  Prueba de los lotes de telemetría de telemetry.c y shareData.c: un lote abierto se envía al
+ *  superar TELEMETRY_BATCH_LATENCY aunque no lleguen más ventanas, y al parar la adquisición
+ *  se envía con las ventanas que tenga. La parada llega como la orden "test" a read() de
+ *  micro_fsm.c, que ya tiene tomado el mutex de las pilas de transmisión
+ *      Author: miguelvp
+ */
+
+// Se incluye la fuente para llegar a read()
+#include "micro_fsm.c"
+#include "telemetry.h"
+#include "check.h"
+#include <stdio.h>
+
+static uint8_t batchWindows(const uint8_t *cmd, uint16_t len);
+static uint8_t drainNB(uint8_t *out, uint16_t max);
+static void toggleTest(fsm_t *fsm);
+
+int main(void)
+{
+	static car coche;
+	static uint8_t buf[TELEMETRY_NB_SIZE], out[TELEMETRY_NB_SIZE];
+	pilePointers_t communication = {0};
+	fsm_t fsm = {0};
+	uint16_t flags = 0, len;
+	uint32_t t0 = 1000;
+	uint8_t *cmd, windows;
+
+	REQUIRE(shareData_init(&flags), "shareData_init");
+	coche.lastLat = 40.4168;
+	coche.lastLong = -3.7038;
+	communication.flags = &flags;
+	coche.communication = &communication;
+	fsm.data = &coche;
+
+	// Dos ventanas: el lote sigue abierto hasta que vence la latencia de la primera
+	CHECK(telemetry_batchPush(&coche, t0, buf, sizeof(buf), &len) == NULL, "lote cerrado con 1 ventana");
+	CHECK(telemetry_batchPush(&coche, t0 + 1000, buf, sizeof(buf), &len) == NULL, "lote cerrado con 2 ventanas");
+	CHECK(!telemetry_batchExpired(t0 + TELEMETRY_BATCH_LATENCY - 1), "lote vencido antes de tiempo");
+	CHECK(telemetry_batchExpired(t0 + TELEMETRY_BATCH_LATENCY), "lote no vencido tras TELEMETRY_BATCH_LATENCY");
+
+	cmd = telemetry_batchFlush(buf, sizeof(buf), &len);
+	CHECK(cmd != NULL && batchWindows(cmd, len) == 2, "lote vencido con %u ventanas", cmd ? batchWindows(cmd, len) : 0);
+	CHECK(!telemetry_batchExpired(t0 + 2*TELEMETRY_BATCH_LATENCY), "lote vacío vencido");
+	CHECK(telemetry_batchFlush(buf, sizeof(buf), &len) == NULL, "lote vacío enviado");
+
+	// Adquisición con "test": una ventana no basta para cerrar el lote
+	toggleTest(&fsm);
+	CHECK(flags & TEST_MSSG, "adquisición no activada");
+	lockTX();
+	CHECK(sendMssg(&coche), "ventana no encolada");
+	unlockTX();
+	CHECK(drainNB(out, sizeof(out)) == 0, "lote enviado con 1 ventana");
+	CHECK(!expiredMssg(), "lote recién abierto vencido");
+
+	// Fin de la adquisición: la ventana que queda se encola por NB-IoT sin volver a tomar el
+	// mutex que read() ya tiene
+	toggleTest(&fsm);
+	CHECK(!(flags & TEST_MSSG), "adquisición no desactivada");
+	windows = drainNB(out, sizeof(out));
+	CHECK(windows == 1, "lote al parar con %u ventanas", windows);
+	CHECK(hostMutexErrors == 0, "%lu usos incorrectos del mutex de transmisión", (unsigned long) hostMutexErrors);
+	CHECK(lockTX() && unlockTX(), "mutex de transmisión no liberado");
+
+	// Sin lote pendiente no se envía nada
+	toggleTest(&fsm);
+	toggleTest(&fsm);
+	CHECK(drainNB(out, sizeof(out)) == 0, "lote enviado dos veces");
+
+	printf("%s: lotes de hasta %u ventanas y %u ms\n", failures ? "FALLO" : "OK",
+			TELEMETRY_BATCH_MAX, TELEMETRY_BATCH_LATENCY);
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Número de ventanas del lote que envía un comando AT+NSOST
+ * @param	cmd: comando (socket, longitud, carga en hexadecimal y \r)
+ * 			len: longitud del comando
+ * @retval	Ventanas del lote (0 si el comando no es válido)
+ */
+static uint8_t batchWindows(const uint8_t *cmd, uint16_t len)
+{
+	const uint16_t socket = sizeof(TELEMETRY_SOCKET) - 1;
+	const uint8_t *payload;
+	unsigned windows;
+
+	// La carga va tras la longitud; las ventanas, tras la versión (1), el id (6) y el índice
+	// del VIN (2)
+	if (len <= socket || memcmp(cmd, TELEMETRY_SOCKET, socket)
+			|| (payload = memchr(cmd + socket, ',', len - socket)) == NULL
+			|| payload + 1 + 2*10 > cmd + len
+			|| sscanf((const char*) payload + 1 + 2*9, "%2x", &windows) != 1)
+		return 0;
+	return windows;
+}
+
+/*
+ * @brief	Transmite la pila de NB-IoT y devuelve las ventanas del último lote
+ * @param	out: datos transmitidos
+ * 			max: tamaño de out
+ * @retval	Ventanas del lote transmitido (0 si no había nada)
+ */
+static uint8_t drainNB(uint8_t *out, uint16_t max)
+{
+	txBlock_t *block;
+	uint16_t len = 0;
+
+	while (getNB(&block)) {
+		if (len + block->len <= max)
+			memcpy(&out[len], block->data, block->len);
+		len += block->len;
+		freeNB(block);
+	}
+	return len ? batchWindows(out, len) : 0;
+}
+
+/*
+ * @brief	Entrega la orden "test" por el buffer de recepción, la procesa con read() y
+ * 			descarta lo que haya dejado en la pila de USB
+ * @param	fsm: máquina de estados del micro
+ * @retval	Nada
+ */
+static void toggleTest(fsm_t *fsm)
+{
+	txBlock_t *block;
+
+	CHECK(putRX((uint8_t*) "test\r", 5), "orden test no recibida");
+	read(fsm);
+	while (getTX(&block)) {
+		freeTX(block);
+	}
+}
@@ -0,0 +1,107 @@
+/*
+ * test_txpile.c
+ *
+ *  Prueba de las pilas de transmisión por bloques de shareData.c (putTX, getTX y freeTX): un
+ *  mensaje que no cabe entero en el pool se descarta entero, sin dejar bloques encolados ni
+ *  reservados, y la ocupación vuelve a cero al liberar lo transmitido
+ *      Author: miguelvp
+ */
+
+#include "shareData.h"
+#include "check.h"
+#include <stdio.h>
+#include <string.h>
+
+// Bloques del pool de USB (TX_USB_NUM_MSSG de shareData.c)
+#define POOL_BLOCKS		10
+
+static void makeMssg(uint8_t *mssg, uint16_t len, uint8_t seed);
+static uint16_t drain(uint8_t *out, uint16_t max);
+
+int main(void)
+{
+	static uint8_t mssg[POOL_BLOCKS*TX_BLOCK_SIZE + 2], other[2*TX_BLOCK_SIZE + 1], out[sizeof(mssg)];
+	txStats_t usb, nb;
+	uint16_t flags = 0, len;
+
+	REQUIRE(shareData_init(&flags), "shareData_init");
+
+	// Un mensaje que ocupa todo el pool
+	makeMssg(mssg, POOL_BLOCKS*TX_BLOCK_SIZE, 'a');
+	CHECK(putTX(mssg, sizeof(mssg)), "mensaje de %u bloques", POOL_BLOCKS);
+	statsTX(&usb, &nb);
+	CHECK(usb.used == POOL_BLOCKS && usb.highWater == POOL_BLOCKS, "ocupación %u, máximo %u", usb.used, usb.highWater);
+
+	// Sin bloques libres se descarta el siguiente
+	makeMssg(other, TX_BLOCK_SIZE + 1, 'A');
+	CHECK(!putTX(other, sizeof(other)), "mensaje encolado con el pool lleno");
+	statsTX(&usb, &nb);
+	CHECK(usb.used == POOL_BLOCKS && usb.failures == 1, "ocupación %u, descartes %lu", usb.used, (unsigned long) usb.failures);
+
+	len = drain(out, sizeof(out));
+	CHECK(len == POOL_BLOCKS*TX_BLOCK_SIZE && !memcmp(out, mssg, len), "transmitidos %u bytes", len);
+	statsTX(&usb, &nb);
+	CHECK(usb.used == 0, "ocupación %u tras liberar", usb.used);
+
+	// Quedan bloques, pero no para todo el mensaje: no se encola su principio y los bloques
+	// reservados vuelven al pool
+	makeMssg(mssg, (POOL_BLOCKS - 1)*TX_BLOCK_SIZE, 'b');
+	CHECK(putTX(mssg, sizeof(mssg)), "mensaje de %u bloques", POOL_BLOCKS - 1);
+	CHECK(!putTX(other, sizeof(other)), "mensaje de 2 bloques encolado con 1 libre");
+	statsTX(&usb, &nb);
+	CHECK(usb.used == POOL_BLOCKS - 1 && usb.highWater == POOL_BLOCKS, "ocupación %u, máximo %u", usb.used, usb.highWater);
+
+	len = drain(out, sizeof(out));
+	CHECK(len == (POOL_BLOCKS - 1)*TX_BLOCK_SIZE && !memcmp(out, mssg, len), "transmitidos %u bytes, se esperaban %u",
+			len, (POOL_BLOCKS - 1)*TX_BLOCK_SIZE);
+
+	CHECK(putTX(other, sizeof(other)), "mensaje de 2 bloques con el pool vacío");
+	len = drain(out, sizeof(out));
+	CHECK(len == TX_BLOCK_SIZE + 1 && !memcmp(out, other, len), "transmitidos %u bytes", len);
+
+	// Un mensaje mayor que el pool nunca cabe
+	makeMssg(mssg, sizeof(mssg) - 1, 'c');
+	CHECK(!putTX(mssg, sizeof(mssg)), "mensaje mayor que el pool");
+
+	statsTX(&usb, &nb);
+	CHECK(usb.used == 0, "ocupación %u al terminar", usb.used);
+
+	printf("%s: pila de USB de %u bloques\n", failures ? "FALLO" : "OK", POOL_BLOCKS);
+	return failures ? 1 : 0;
+}
+
+/*
+ * @brief	Mensaje de prueba terminado en \0
+ * @param	mssg: mensaje
+ * 			len: longitud sin el \0
+ * 			seed: primer carácter
+ * @retval	Nada
+ */
+static void makeMssg(uint8_t *mssg, uint16_t len, uint8_t seed)
+{
+	uint16_t i;
+	for (i = 0; i < len; i++) {
+		mssg[i] = seed + i % 26;
+	}
+	mssg[len] = '\0';
+}
+
+/*
+ * @brief	Transmite la pila: toma los bloques en orden, los copia y los libera
+ * @param	out: datos transmitidos
+ * 			max: tamaño de out
+ * @retval	Número de bytes transmitidos
+ */
+static uint16_t drain(uint8_t *out, uint16_t max)
+{
+	txBlock_t *block;
+	uint16_t len = 0;
+
+	while (getTX(&block)) {
+		if (len + block->len <= max)
+			memcpy(&out[len], block->data, block->len);
+		len += block->len;
+		freeTX(block);
+	}
+	return len;
+}